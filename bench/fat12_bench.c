@@ -0,0 +1,185 @@
+#include "fat12_utils.h"
+#include "fat12_mkimg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+// End-to-end benchmark over a fixed set of generated images: free cluster count, directory walk and whole tool runs.
+// Every result is printed as one "case<TAB>metric<TAB>value<TAB>unit" line so runs can be diffed.
+
+typedef struct {
+        const char* name;
+        fat12_mkimg_spec spec;
+} bench_case;
+
+static const bench_case BENCH_CASES[] = {
+        { "flat-16", { .num_files = 16, .max_file_size = 4096, .label = "BENCH", .label_placement = FAT12_LABEL_BOTH, .seed = 1 } },
+        { "tree-200", { .num_files = 200, .depth = 2, .dirs_per_level = 3, .max_file_size = 4096, .label = "BENCH", .label_placement = FAT12_LABEL_ROOT, .seed = 2 } },
+        { "frag-200", { .num_files = 200, .depth = 2, .dirs_per_level = 3, .max_file_size = 8192, .fragmentation = 80, .seed = 3 } },
+        { "lfn-del-400", { .num_files = 400, .depth = 3, .dirs_per_level = 2, .max_file_size = 2048, .long_names = 1, .num_deleted = 40, .seed = 4 } }
+};
+#define BENCH_NUM_CASES (sizeof(BENCH_CASES) / sizeof(BENCH_CASES[0]))
+
+// Function to get a monotonic timestamp in nanoseconds
+static uint64_t now_ns (void) {
+
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+
+}
+
+// Function to generate the image of a case and write it to path
+static int write_image (const bench_case* bench, const char* path) {
+
+        char* image;
+        size_t image_size;
+        if (fat12_mkimg(&bench->spec, &image, &image_size) != FAT12_OK) {
+                fprintf(stderr, "%s: %s\n", bench->name, fat12_last_error());
+                return 1;
+        }
+        FILE* file = fopen(path, "wb");
+        int failed = file == NULL || fwrite(image, 1, image_size, file) != image_size;
+        if (file != NULL && fclose(file) != 0) {
+                failed = 1;
+        }
+        if (failed) {
+                perror(path);
+        }
+        free(image);
+        return failed;
+
+}
+
+// Function to time opening a volume and counting its free clusters, returning nanoseconds per cluster
+static double time_free_count (const char* path, int iterations) {
+
+        uint64_t elapsed = 0;
+        uint32_t num_clusters = 0;
+        for (int i = 0; i < iterations; i++) {
+                fat12_volume* volume;
+                uint32_t free_size;
+                uint64_t start = now_ns();
+                if (fat12_volume_open(path, &volume) != FAT12_OK || fat12_get_free_size(volume, &free_size) != FAT12_OK) {
+                        fprintf(stderr, "%s: %s\n", path, fat12_last_error());
+                        exit(EXIT_FAILURE);
+                }
+                elapsed += now_ns() - start;
+                const fat12_geometry* geometry;
+                if (fat12_volume_geometry(volume, &geometry) == FAT12_OK) {
+                        num_clusters = geometry->end_cluster - 2;
+                }
+                fat12_volume_close(volume);
+        }
+        return (double)elapsed / ((double)iterations * num_clusters);
+
+}
+
+// Function to time walking every directory entry of an already open volume, returning nanoseconds per entry
+static double time_walk (const char* path, int iterations, long* num_entries) {
+
+        fat12_volume* volume;
+        if (fat12_volume_open(path, &volume) != FAT12_OK) {
+                fprintf(stderr, "%s: %s\n", path, fat12_last_error());
+                exit(EXIT_FAILURE);
+        }
+
+        long entries = 0;
+        uint64_t start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+                fat12_dir_walker walker;
+                fat12_dir_item item;
+                if (fat12_dir_walker_init(&walker, volume) != FAT12_OK) {
+                        fprintf(stderr, "%s: %s\n", path, fat12_last_error());
+                        exit(EXIT_FAILURE);
+                }
+                entries = 0;
+                while (fat12_dir_walker_next(&walker, &item) > 0) {
+                        entries++;
+                }
+                fat12_dir_walker_free(&walker);
+        }
+        uint64_t elapsed = now_ns() - start;
+        fat12_volume_close(volume);
+
+        *num_entries = entries;
+        return entries > 0 ? (double)elapsed / ((double)iterations * entries) : 0.0;
+
+}
+
+// Function to time full runs of a tool binary on one image, with its output discarded, returning images per second
+static double time_tool (const char* tool, const char* path, int iterations) {
+
+        uint64_t start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+                pid_t pid = fork();
+                if (pid < 0) {
+                        perror("fork");
+                        exit(EXIT_FAILURE);
+                }
+                if (pid == 0) {
+                        int null_fd = open("/dev/null", O_WRONLY);
+                        if (null_fd >= 0) {
+                                dup2(null_fd, STDOUT_FILENO);
+                        }
+                        execl(tool, tool, path, (char*)NULL);
+                        _exit(127);
+                }
+                int status;
+                if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                        fprintf(stderr, "%s %s failed\n", tool, path);
+                        exit(EXIT_FAILURE);
+                }
+        }
+        return (double)iterations * 1e9 / (double)(now_ns() - start);
+
+}
+
+int main (int argc, char* argv[]) {
+
+        if (argc < 2 || argc > 4) {
+                fprintf(stderr, "Usage: %s <workdir> [tooldir] [iterations]\n", argv[0]);
+                exit(2);
+        }
+        const char* workdir = argv[1];
+        const char* tooldir = argc > 2 ? argv[2] : NULL;
+        int iterations = argc > 3 ? atoi(argv[3]) : 200;
+        if (iterations <= 0) {
+                fprintf(stderr, "Usage: %s <workdir> [tooldir] [iterations]\n", argv[0]);
+                exit(2);
+        }
+
+        for (size_t i = 0; i < BENCH_NUM_CASES; i++) {
+                const bench_case* bench = &BENCH_CASES[i];
+                char path[4096];
+                snprintf(path, sizeof(path), "%s/%s.IMA", workdir, bench->name);
+                if (write_image(bench, path) != 0) {
+                        return 1;
+                }
+
+                long num_entries;
+                double free_ns = time_free_count(path, iterations);
+                double walk_ns = time_walk(path, iterations * 10, &num_entries);
+                fprintf(stdout, "%s\tentries\t%ld\tcount\n", bench->name, num_entries);
+                fprintf(stdout, "%s\tfree_count\t%.3f\tns/cluster\n", bench->name, free_ns);
+                fprintf(stdout, "%s\tdir_walk\t%.3f\tns/entry\n", bench->name, walk_ns);
+
+                // Whole tool runs, when the tools were built alongside
+                if (tooldir != NULL) {
+                        static const char* const tools[] = { "diskinfo", "disklist" };
+                        for (size_t t = 0; t < sizeof(tools) / sizeof(tools[0]); t++) {
+                                char tool[4096];
+                                snprintf(tool, sizeof(tool), "%s/%s", tooldir, tools[t]);
+                                fprintf(stdout, "%s\t%s\t%.1f\timages/s\n", bench->name, tools[t], time_tool(tool, path, iterations));
+                        }
+                }
+        }
+
+        return 0;
+
+}
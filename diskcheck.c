@@ -0,0 +1,93 @@
+#include "fat12_utils.h"
+#include "fat12_check.h"
+#include "fat12_batch.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of images checked so far that had problems, updated by every batch worker
+static size_t num_inconsistent = 0;
+
+// Function to print the usage message and exit
+static void usage (const char* program) {
+
+	fprintf(stderr, "Usage: %s [--stats[=json]] <disk.IMA>\n       %s [--stats[=json]] [--prefetch[=pread]] --batch <listfile|dir>\n", program, program);
+	exit(2);
+
+}
+
+// Function to check the disk image at the provided path, counting it if it is inconsistent
+static fat12_status check_image (const char* path, FILE* out) {
+
+	fat12_volume* volume;
+	fat12_status status = fat12_volume_open(path, &volume);
+	if (status != FAT12_OK) {
+		return status;
+	}
+	size_t num_problems = 0;
+	status = fat12_check_volume(volume, out, &num_problems);
+	fat12_volume_close(volume);
+	if (status == FAT12_OK && num_problems > 0) {
+		__atomic_fetch_add(&num_inconsistent, 1, __ATOMIC_RELAXED);
+	}
+	return status;
+
+}
+
+int main (int argc, char* argv[]) {
+
+	// Options come before the image
+	int stats = 0;
+	int stats_json = 0;
+	fat12_prefetch_mode prefetch = FAT12_PREFETCH_OFF;
+	int arg = 1;
+	for (; arg < argc; arg++) {
+		int parsed = fat12_prefetch_parse_option(argv[arg], &prefetch);
+		if (parsed == 0 && (parsed = fat12_stats_parse_option(argv[arg], &stats_json)) > 0) {
+			stats = 1;
+		}
+		if (parsed == 0) {
+			break;
+		}
+		if (parsed < 0) {
+			usage(argv[0]);
+		}
+	}
+	if (arg >= argc || (strcmp(argv[arg], "--batch") == 0 && arg + 1 >= argc)) {
+		usage(argv[0]);
+	}
+	if (stats && fat12_stats_enable(1) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(EXIT_FAILURE);
+	}
+	fat12_batch_use_prefetch(prefetch);
+
+	int exit_status = 0;
+	if (strcmp(argv[arg], "--batch") == 0) {
+
+		// Check the images of the batch in parallel, reporting them in order
+		exit_status = fat12_batch_main(argv[arg + 1], check_image);
+
+	} else if (check_image(argv[arg], stdout) != FAT12_OK) {
+
+		// Checking the provided disk image failed
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit_status = EXIT_FAILURE;
+
+	}
+	if (num_inconsistent > 0) {
+		exit_status = EXIT_FAILURE;
+	}
+
+	// Counters go to standard error so the report itself is unchanged
+	if (stats) {
+		uint64_t phase_start = fat12_stats_phase_begin();
+		fflush(stdout);
+		fat12_stats_phase_end(FAT12_PHASE_OUTPUT, phase_start);
+		fat12_stats_print(stderr, stats_json);
+	}
+
+	return exit_status;
+
+}
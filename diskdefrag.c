@@ -0,0 +1,120 @@
+#include "fat12_utils.h"
+#include "fat12_defrag.h"
+#include "fat12_batch.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Function to print the usage message and exit
+static void usage (const char* program) {
+
+	fprintf(stderr, "Usage: %s [--stats[=json]] <disk.IMA>\n       %s [--stats[=json]] [--prefetch[=pread]] --batch <listfile|dir>\n       %s [--stats[=json]] --rewrite <disk.IMA> <new.IMA>\n", program, program, program);
+	exit(2);
+
+}
+
+// Function to report the fragmentation of the disk image at the provided path
+static fat12_status report_image (const char* path, FILE* out) {
+
+	fat12_volume* volume;
+	fat12_status status = fat12_volume_open(path, &volume);
+	if (status != FAT12_OK) {
+		return status;
+	}
+	status = fat12_defrag_report(volume, out, NULL);
+	fat12_volume_close(volume);
+	return status;
+
+}
+
+// Function to write a compacted copy of the disk image at source_path to dest_path
+static fat12_status rewrite_image (const char* source_path, const char* dest_path) {
+
+	// Writing the copy over its own source would destroy the clusters still to be read
+	struct stat source_stat;
+	struct stat dest_stat;
+	if (stat(source_path, &source_stat) == 0 && stat(dest_path, &dest_stat) == 0
+		&& source_stat.st_dev == dest_stat.st_dev && source_stat.st_ino == dest_stat.st_ino) {
+		fprintf(stderr, "%s and %s are the same file\n", source_path, dest_path);
+		return FAT12_ERR_INVALID;
+	}
+
+	fat12_volume* volume;
+	fat12_defrag_summary summary;
+	fat12_status status = fat12_volume_open(source_path, &volume);
+	if (status == FAT12_OK) {
+		status = fat12_defrag_rewrite(volume, dest_path, &summary);
+		fat12_volume_close(volume);
+	}
+	if (status != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		return status;
+	}
+	size_t num_chains = summary.num_files + summary.num_directories;
+	fprintf(stdout, "Wrote %s: %zu files and directories in %zu extents, down from %llu\n", dest_path, num_chains, num_chains, (unsigned long long)summary.num_extents);
+	return FAT12_OK;
+
+}
+
+int main (int argc, char* argv[]) {
+
+	// Options come before the image
+	int stats = 0;
+	int stats_json = 0;
+	fat12_prefetch_mode prefetch = FAT12_PREFETCH_OFF;
+	int arg = 1;
+	for (; arg < argc; arg++) {
+		int parsed = fat12_prefetch_parse_option(argv[arg], &prefetch);
+		if (parsed == 0 && (parsed = fat12_stats_parse_option(argv[arg], &stats_json)) > 0) {
+			stats = 1;
+		}
+		if (parsed == 0) {
+			break;
+		}
+		if (parsed < 0) {
+			usage(argv[0]);
+		}
+	}
+	if (arg >= argc || (strcmp(argv[arg], "--batch") == 0 && arg + 2 != argc)
+		|| (strcmp(argv[arg], "--rewrite") == 0 && arg + 3 != argc)) {
+		usage(argv[0]);
+	}
+	if (stats && fat12_stats_enable(1) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(EXIT_FAILURE);
+	}
+	fat12_batch_use_prefetch(prefetch);
+
+	int exit_status = 0;
+	if (strcmp(argv[arg], "--batch") == 0) {
+
+		// Analyze the images of the batch in parallel, reporting them in order
+		exit_status = fat12_batch_main(argv[arg + 1], report_image);
+
+	} else if (strcmp(argv[arg], "--rewrite") == 0) {
+
+		if (rewrite_image(argv[arg + 1], argv[arg + 2]) != FAT12_OK) {
+			exit_status = EXIT_FAILURE;
+		}
+
+	} else if (report_image(argv[arg], stdout) != FAT12_OK) {
+
+		// Analyzing the provided disk image failed
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit_status = EXIT_FAILURE;
+
+	}
+
+	// Counters go to standard error so the report itself is unchanged
+	if (stats) {
+		uint64_t phase_start = fat12_stats_phase_begin();
+		fflush(stdout);
+		fat12_stats_phase_end(FAT12_PHASE_OUTPUT, phase_start);
+		fat12_stats_print(stderr, stats_json);
+	}
+
+	return exit_status;
+
+}
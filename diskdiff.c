@@ -0,0 +1,68 @@
+#include "fat12_utils.h"
+#include "fat12_diff.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Function to print the usage message and exit
+static void usage (const char* program) {
+
+	fprintf(stderr, "Usage: %s [--stats[=json]] <old.IMA> <new.IMA>\n", program);
+	exit(2);
+
+}
+
+int main (int argc, char* argv[]) {
+
+	// Options come before the images
+	int stats = 0;
+	int stats_json = 0;
+	int arg = 1;
+	for (; arg < argc; arg++) {
+		int parsed = fat12_stats_parse_option(argv[arg], &stats_json);
+		if (parsed == 0) {
+			break;
+		}
+		if (parsed < 0) {
+			usage(argv[0]);
+		}
+		stats = 1;
+	}
+	if (argc - arg != 2) {
+		usage(argv[0]);
+	}
+	if (stats && fat12_stats_enable(1) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(2);
+	}
+
+	// Like diff: 0 when the images hold the same files, 1 when they differ, 2 when they could not be compared
+	fat12_volume* old_volume;
+	fat12_volume* new_volume;
+	size_t num_changes = 0;
+	fat12_status status = fat12_volume_open(argv[arg], &old_volume);
+	if (status == FAT12_OK) {
+		status = fat12_volume_open(argv[arg + 1], &new_volume);
+		if (status == FAT12_OK) {
+			status = fat12_diff_volumes(old_volume, new_volume, stdout, &num_changes);
+			fat12_volume_close(new_volume);
+		}
+		fat12_volume_close(old_volume);
+	}
+	if (status != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(2);
+	}
+
+	// Counters go to standard error so the report itself is unchanged
+	if (stats) {
+		uint64_t phase_start = fat12_stats_phase_begin();
+		fflush(stdout);
+		fat12_stats_phase_end(FAT12_PHASE_OUTPUT, phase_start);
+		fat12_stats_print(stderr, stats_json);
+	}
+
+	return num_changes > 0 ? 1 : 0;
+
+}
@@ -0,0 +1,120 @@
+#include "fat12_utils.h"
+#include "fat12_extract.h"
+#include "fat12_path.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Function to print the usage message and exit
+static void usage (const char* program) {
+
+	fprintf(stderr, "Usage: %s [--stats[=json]] <disk.IMA> <path> [dest|-]\n       %s [--stats[=json]] --tree <disk.IMA> <dir|/> <destdir>\n", program, program);
+	exit(2);
+
+}
+
+// Function to copy the file at path in the volume to dest, or to standard output if dest is "-", reporting any failure on standard error
+static fat12_status get_file (fat12_volume* volume, const char* path, const char* dest) {
+
+	const char* entry;
+	fat12_status status = fat12_find_entry(volume, path, &entry);
+	if (status != FAT12_OK) {
+		fprintf(stderr, "%s\n", status == FAT12_ERR_NOT_FOUND ? "File not found." : fat12_last_error());
+		return status;
+	}
+	if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] & ATTRIBUTE_SUBDIRECTORY_BIT_MASK) {
+		fprintf(stderr, "%s is a directory, use --tree\n", path);
+		return FAT12_ERR_INVALID;
+	}
+
+	// Default to the file's own name in the current directory
+	char name[FAT12_NAME_BUFFER_SIZE];
+	if (dest == NULL) {
+		fat12_entry_path_name(entry, name);
+		if (strchr(name, '/') != NULL || !fat12_path_is_safe(name)) {
+			fprintf(stderr, "Unsafe file name in image: %s\n", name);
+			return FAT12_ERR_INVALID;
+		}
+		dest = name;
+	}
+
+	int fd = strcmp(dest, "-") == 0 ? STDOUT_FILENO : open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(dest);
+		return FAT12_ERR_IO;
+	}
+	status = fat12_extract_file(volume, entry, fd);
+	if (fd != STDOUT_FILENO && close(fd) != 0 && status == FAT12_OK) {
+		perror(dest);
+		return FAT12_ERR_IO;
+	}
+	if (status != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+	}
+	return status;
+
+}
+
+int main (int argc, char* argv[]) {
+
+	// Options come before the image
+	int stats = 0;
+	int stats_json = 0;
+	int tree = 0;
+	int arg = 1;
+	for (; arg < argc; arg++) {
+		int parsed = fat12_stats_parse_option(argv[arg], &stats_json);
+		if (parsed < 0) {
+			usage(argv[0]);
+		}
+		if (parsed > 0) {
+			stats = 1;
+		} else if (strcmp(argv[arg], "--tree") == 0) {
+			tree = 1;
+		} else {
+			break;
+		}
+	}
+	if (argc - arg < 2 || argc - arg > 3 || (tree && argc - arg != 3)) {
+		usage(argv[0]);
+	}
+	if (stats && fat12_stats_enable(1) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(EXIT_FAILURE);
+	}
+
+	fat12_volume* volume;
+	if (fat12_volume_open(argv[arg], &volume) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(EXIT_FAILURE);
+	}
+
+	fat12_status status;
+	if (tree) {
+
+		// Unpack the directory (or the whole image) in on-disk order
+		size_t num_files;
+		status = fat12_extract_tree(volume, argv[arg + 1], argv[arg + 2], &num_files);
+		if (status != FAT12_OK) {
+			fprintf(stderr, "%s\n", fat12_last_error());
+		} else {
+			fprintf(stderr, "%zu files extracted to %s\n", num_files, argv[arg + 2]);
+		}
+
+	} else {
+
+		status = get_file(volume, argv[arg + 1], argc - arg == 3 ? argv[arg + 2] : NULL);
+
+	}
+	fat12_volume_close(volume);
+
+	if (stats) {
+		fat12_stats_print(stderr, stats_json);
+	}
+
+	return status == FAT12_OK ? 0 : EXIT_FAILURE;
+
+}
@@ -1,171 +1,217 @@
 #include "fat12_utils.h"
+#include "fat12_report.h"
+#include "fat12_batch.h"
+#include "fat12_stats.h"
+#include "fat12_index.h"
+#include "fat12_stream.h"
+#include "fat12_daemon.h"
+#include "fat12_path.h"
+#include "fat12_checksum.h"
+#include "fat12_output.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdint.h>
-#include <inttypes.h>
-#include <ctype.h>
 
-// Function to trim trailing spaces from a string
-void trim_trailing_spaces(char* str) {
-	int length = strlen(str);
-	while (length > 0 && isspace((unsigned char)str[length - 1])) {
-		str[length - 1] = '\0';
-		length--;
-	}
-}
+// Function to print the usage message and exit
+static void usage (const char* program) {
 
-// Function to format the creation date and time of a directory entry in the provided disk image
-char* format_creation_datetime(FILE* file, char* creation_date, char* creation_time){	
+	fprintf(stderr, "Usage: %s [--stats[=json]] [--format=human|jsonl|csv|binary] [--index=<dir>|--via-daemon[=<socket>]|--checksum[=crc32c|sha256]|--stream] <disk.IMA|->\n       %s [--stats[=json]] [--format=human|jsonl|csv|binary] [--index=<dir>|--via-daemon[=<socket>]|--checksum[=crc32c|sha256]] [--prefetch[=pread]] --batch <listfile|dir>\n       %s [--stats[=json]] --find|--stat <disk.IMA> <path|->...\n", program, program, program);
+	exit(2);
 
-	// Deserialize data
-	uint16_t date = (unsigned char)creation_date[0] | (unsigned char)creation_date[1] << 8;
-	uint16_t time = (unsigned char)creation_time[0] | (unsigned char)creation_time[1] << 8;
+}
+
+// Function to print what --find or --stat reports for the entry at path, as the directory walk spelled the path
+static void print_entry (const char* path, const char* entry, int stat_mode) {
+
+	fat12_dirent dirent;
+	char creation_datetime[FAT12_DATETIME_BUFFER_SIZE];
+	fat12_dirent_decode(entry, &dirent);
+	fat12_format_datetime(dirent.creation_date, dirent.creation_time, creation_datetime);
+	int is_directory = (dirent.attributes & ATTRIBUTE_SUBDIRECTORY_BIT_MASK) != 0;
+	if (!stat_mode) {
+		fprintf(stdout, "%c %-10u %s %s\n", is_directory ? 'D' : 'F', dirent.file_size, path, creation_datetime);
+		return;
+	}
 
-	// Allocate memory for string
-        char* formatted_datetime = (char*)calloc(17, sizeof(char));
-        if (formatted_datetime == NULL) {
-                perror("Memory allocation failed");
-                fclose(file);
-                exit(EXIT_FAILURE);
-        }
+	char write_datetime[FAT12_DATETIME_BUFFER_SIZE];
+	fat12_format_datetime(dirent.write_date, dirent.write_time, write_datetime);
+	fprintf(stdout, "%-12s %s\n", "Path:", path);
+	fprintf(stdout, "%-12s %s\n", "Type:", is_directory ? "Directory" : "File");
+	fprintf(stdout, "%-12s %u\n", "Size:", dirent.file_size);
+	fprintf(stdout, "%-12s %u\n", "Cluster:", dirent.first_logical_cluster);
+	fprintf(stdout, "%-12s 0x%02X\n", "Attributes:", dirent.attributes);
+	fprintf(stdout, "%-12s %s\n", "Created:", creation_datetime);
+	fprintf(stdout, "%-12s %s\n\n", "Modified:", write_datetime);
 
-	// Extract the date and time from raw data
-	int year, month, day, hour, minute;
-	year = ((date & 0xFE00) >> 9) + 1980; // Year is stored in the high seven bits as a value since 1980
-	month = (date & 0x1E0) >> 5; // Month is stored in the middle four bits
-	day = (date & 0x1F); // Day is stored in the low five bits
-	hour = (time & 0xF800) >> 11; // Hour is stored in the high five bits
-	minute = (time & 0x7E0) >> 5; // Minute is stored in the middle six bits
+}
 
-	// Format the date and time into human-readable string
-	snprintf(formatted_datetime, 17, "%04d-%02d-%02d %02d:%02d", year, month, day, hour, minute);
+// Function to look up one path in the path index, reporting a missing one on standard error, returning 1 if it was found
+static int lookup_path (const fat12_path_index* index, const char* path, int stat_mode) {
 
-	return formatted_datetime; // Caller is responsible for freeing this memory
+	const char* entry;
+	const char* found_path;
+	if (fat12_path_index_lookup(index, path, &entry, &found_path) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		return 0;
+	}
+	print_entry(found_path, entry, stat_mode);
+	return 1;
 
 }
 
-// Function to print all files, organized by directory, in the provided disk image
-void print_files (FILE* file, long int dir_start_byte, int dir_length_sectors) {
-
-        // Seek to position of directory
-        if (fseek(file, dir_start_byte, SEEK_SET) != 0) { // Move file pointer dir_start_byte number of bytes relative to start of file
-                perror("Error seeking to directory");
-                fclose(file);
-                exit(EXIT_FAILURE);
-        }
-
-        // Allocate memory for binary data
-        size_t entry_size_bytes = SECTOR_SIZE_BYTES / SECTOR_SIZE_ENTRIES;
-        char* entry = calloc(entry_size_bytes, sizeof(char));
-        if (entry == NULL) {
-                perror("Memory allocation failed");
-                fclose(file);
-                exit(EXIT_FAILURE);
-        }
-
-	// Read all entries in directory
-        for (int sector_offset = 0; sector_offset < dir_length_sectors; sector_offset++) { // Traverse all sectors of directory
-                for (int i = 0; i < SECTOR_SIZE_ENTRIES; i++) { // Traverse all entries of sector
-
-                        // Read the entry
-                        if (fread(entry, 1, 32, file) != 32) {
-                                perror("Error reading entry");
-                                fclose(file);
-                                exit(EXIT_FAILURE);
-                        }
-
-                        // Skip the entry if first logical cluster is 0 or 1
-                        uint16_t first_logical_cluster = get_first_logical_cluster(entry);
-                        if (first_logical_cluster == 0 || first_logical_cluster == 1) {
-                                continue;
-                        }
-
-                        // Skip the entry if attribute is 0x0F (indicating entry is part of a long file name)
-                        if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] == 0x0F) {
-                                continue;
-                        }
-
-                        // Skip the entry if first byte is 0xE5 (indicating entry is free)
-                        if (entry[0] == 0xE5) {
-                                continue;
-                        }
-
-                        // Skip the entry if volume label bit of attribute is set
-                        if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] & ATTRIBUTE_VOLUME_LABEL_BIT_MASK) {
-                                continue;
-                        }
-
-                        // If the entry is a subdirectory, print it, traverse it, then proceed to next entry
-                        if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] & ATTRIBUTE_SUBDIRECTORY_BIT_MASK) {
-				char* filename = read_directory_entry_data(file, entry, FILENAME_START_BYTE, FILENAME_LENGTH_BYTES);
-				fprintf(stdout, "%s\n--------------------------------------------------\n", filename);
-				free(filename);
-                                long int subdir_start_byte = (33 + first_logical_cluster - 2) * SECTOR_SIZE_BYTES;
-                                uint32_t subdir_file_size = get_file_size(entry);
-                                int subdir_length_sectors = (subdir_file_size + SECTOR_SIZE_BYTES - 1) / SECTOR_SIZE_BYTES;
-                                print_files(file, subdir_start_byte, subdir_length_sectors);
-                                continue;
-                        }
-
-                        // Print the entry as a regular file
-			char* file_size_data = read_directory_entry_data(file, entry, FILE_SIZE_START_BYTE, FILE_SIZE_LENGTH_BYTES);
-			uint32_t file_size = 
-				(unsigned char)file_size_data[0] | 
-				(unsigned char)file_size_data[1] << 8 | 
-				(unsigned char)file_size_data[2] << 16 | 
-				(unsigned char)file_size_data[3] << 24;
-			free(file_size_data);
-			char* filename = read_directory_entry_data(file, entry, FILENAME_START_BYTE, FILENAME_LENGTH_BYTES);
-			char* extension = read_directory_entry_data(file, entry, EXTENSION_START_BYTE, EXTENSION_LENGTH_BYTES);
-			trim_trailing_spaces(filename);
-			trim_trailing_spaces(extension);
-			char* filename_extension = (char*)calloc(FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES + 2, sizeof(char)); // +2 for the dot and null terminator
-			if (filename_extension == NULL) {
-				perror("Memory allocation failed");
-                		fclose(file);
-                		exit(EXIT_FAILURE);
+// Function to answer --find or --stat for every path given, or read one per line from standard input for "-", returning the exit status
+static int lookup_paths (const char* image, char** paths, int num_paths, int stat_mode) {
+
+	// One walk builds the index; each lookup after it costs constant time
+	fat12_volume* volume;
+	const fat12_path_index* index;
+	if (fat12_volume_open(image, &volume) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		return EXIT_FAILURE;
+	}
+	if (fat12_volume_path_index(volume, &index) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		fat12_volume_close(volume);
+		return EXIT_FAILURE;
+	}
+
+	int all_found = 1;
+	for (int i = 0; i < num_paths; i++) {
+		if (strcmp(paths[i], "-") != 0) {
+			all_found &= lookup_path(index, paths[i], stat_mode);
+			continue;
+		}
+		char* line = NULL;
+		size_t line_capacity = 0;
+		ssize_t length;
+		while ((length = getline(&line, &line_capacity, stdin)) >= 0) {
+			while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+				line[--length] = '\0';
+			}
+			if (length > 0) {
+				all_found &= lookup_path(index, line, stat_mode);
 			}
-			snprintf(filename_extension, FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES + 2, "%s.%s", filename, extension);
-			free(extension);
-                        free(filename);
-			char* creation_date_data = read_directory_entry_data(file, entry, FILE_CREATE_DATE_START_BYTE, FILE_CREATE_DATE_LENGTH_BYTES);
-			char* creation_time_data = read_directory_entry_data(file, entry, FILE_CREATE_TIME_START_BYTE, FILE_CREATE_TIME_LENGTH_BYTES);
-			char* creation_datetime = format_creation_datetime(file, creation_date_data, creation_time_data);
-			free(creation_date_data);
-			free(creation_time_data);
-			fprintf(stdout, "F %-10u %-*s %s\n", file_size, FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES + 1, filename_extension, creation_datetime); // +1 for the dot
-			free(creation_datetime);
-			free(filename_extension);
-
-                }
-        }
-
-        free(entry);
+		}
+		free(line);
+	}
+
+	fat12_volume_close(volume);
+	return all_found ? 0 : EXIT_FAILURE;
 
 }
 
 int main (int argc, char* argv[]) {
 
-        if (argc < 2) {
-                fprintf(stderr, "Usage: %s <disk.IMA>\n", argv[0]);
-                exit(2);
-        }
-
-        // Open provided file
-        FILE* file = fopen(argv[1], "r");
-        if (file == NULL) {
-                perror("Error opening file");
-                exit(EXIT_FAILURE);
-        }
-
-	// Print all the files
-	long int root_dir_start_byte = ROOT_DIR_START_SECTOR * SECTOR_SIZE_BYTES;
-        int root_dir_length_sectors = ROOT_DIR_END_SECTOR - ROOT_DIR_START_SECTOR + 1;
-	fprintf(stdout, "Root\n--------------------------------------------------\n");
-        print_files(file, root_dir_start_byte, root_dir_length_sectors);
-
-	fclose(file);
-	return 0;
+	// Options come before the image
+	int stats = 0;
+	int stats_json = 0;
+	const char* index_dir = NULL;
+	const char* daemon_socket = NULL;
+	fat12_output_format format = FAT12_OUTPUT_HUMAN;
+	fat12_prefetch_mode prefetch = FAT12_PREFETCH_OFF;
+	int stream = 0;
+	fat12_checksum_kind checksum = FAT12_CHECKSUM_NONE;
+	int arg = 1;
+	for (; arg < argc; arg++) {
+		int parsed = fat12_index_parse_option(argv[arg], &index_dir);
+		if (parsed == 0) {
+			parsed = fat12_daemon_parse_option(argv[arg], &daemon_socket);
+		}
+		if (parsed == 0) {
+			parsed = fat12_output_parse_option(argv[arg], &format);
+		}
+		if (parsed == 0) {
+			parsed = fat12_checksum_parse_option(argv[arg], &checksum);
+		}
+		if (parsed == 0) {
+			parsed = fat12_prefetch_parse_option(argv[arg], &prefetch);
+		}
+		if (parsed == 0) {
+			parsed = fat12_stream_parse_option(argv[arg], &stream);
+		}
+		if (parsed == 0 && (parsed = fat12_stats_parse_option(argv[arg], &stats_json)) > 0) {
+			stats = 1;
+		}
+		if (parsed == 0) {
+			break;
+		}
+		if (parsed < 0) {
+			usage(argv[0]);
+		}
+	}
+	if (arg >= argc || (strcmp(argv[arg], "--batch") == 0 && arg + 1 >= argc)
+		|| ((strcmp(argv[arg], "--find") == 0 || strcmp(argv[arg], "--stat") == 0) && arg + 2 >= argc)) {
+		usage(argv[0]);
+	}
+
+	// Checksums need the file contents, which neither index files nor the daemon keep
+	if (checksum != FAT12_CHECKSUM_NONE && (index_dir != NULL || daemon_socket != NULL)) {
+		usage(argv[0]);
+	}
+
+	// A stream is one image read once, and only its metadata is kept; "-" streams standard input
+	if (strcmp(argv[arg], "-") == 0) {
+		stream = 1;
+	}
+	if (stream && (index_dir != NULL || daemon_socket != NULL || checksum != FAT12_CHECKSUM_NONE || prefetch != FAT12_PREFETCH_OFF
+		|| strcmp(argv[arg], "--batch") == 0 || strcmp(argv[arg], "--find") == 0 || strcmp(argv[arg], "--stat") == 0)) {
+		usage(argv[0]);
+	}
+
+	// The daemon only renders the human format, and path lookups print it too
+	if (format != FAT12_OUTPUT_HUMAN && (daemon_socket != NULL || strcmp(argv[arg], "--find") == 0 || strcmp(argv[arg], "--stat") == 0)) {
+		usage(argv[0]);
+	}
+	if (stats && fat12_stats_enable(1) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(EXIT_FAILURE);
+	}
+	fat12_batch_use_prefetch(prefetch);
+	if (stream) {
+		fat12_report_use_stream(1);
+	}
+	if (index_dir != NULL) {
+		fat12_report_use_index(index_dir);
+	}
+	if (daemon_socket != NULL) {
+		fat12_report_use_daemon(daemon_socket);
+	}
+	if (format != FAT12_OUTPUT_HUMAN) {
+		fat12_report_use_format(format);
+		fat12_batch_use_headers(0); // Every record names its image instead
+		fat12_output_begin(stdout, format, FAT12_RECORD_FILE);
+	}
+	if (checksum != FAT12_CHECKSUM_NONE) {
+		fat12_report_use_checksum(checksum);
+	}
+
+	int exit_status = 0;
+	if (strcmp(argv[arg], "--find") == 0 || strcmp(argv[arg], "--stat") == 0) {
+
+		// Look up paths in the image instead of listing it
+		exit_status = lookup_paths(argv[arg + 1], argv + arg + 2, argc - arg - 2, strcmp(argv[arg], "--stat") == 0);
+
+	} else if (strcmp(argv[arg], "--batch") == 0) {
+
+		// List every image of the batch, skipping the ones that fail
+		exit_status = fat12_batch_main(argv[arg + 1], fat12_report_files);
+
+	} else if (fat12_report_files(argv[arg], stdout) != FAT12_OK) {
+
+		// Print all the files of the provided disk image failed
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit_status = EXIT_FAILURE;
+
+	}
+
+	// Counters go to standard error so the report itself is unchanged
+	if (stats) {
+		uint64_t phase_start = fat12_stats_phase_begin();
+		fflush(stdout);
+		fat12_stats_phase_end(FAT12_PHASE_OUTPUT, phase_start);
+		fat12_stats_print(stderr, stats_json);
+	}
+
+	return exit_status;
 
 }
@@ -0,0 +1,112 @@
+#include "fat12_utils.h"
+#include "fat12_write.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Function to print the usage message and exit
+static void usage (const char* program) {
+
+	fprintf(stderr, "Usage: %s [--stats[=json]] <disk.IMA> [--dir <dir>] <file>...\n", program);
+	exit(2);
+
+}
+
+// Function to add one host file to the image under its own name, reporting any failure on standard error
+static fat12_status put_file (fat12_writer* writer, const char* dir, const char* path) {
+
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror(path);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return FAT12_ERR_IO;
+	}
+	if (!S_ISREG(st.st_mode) || st.st_size > UINT32_MAX) {
+		fprintf(stderr, "%s: not a regular file of at most 4 GB\n", path);
+		close(fd);
+		return FAT12_ERR_INVALID;
+	}
+
+	const char* name = strrchr(path, '/');
+	name = name != NULL ? name + 1 : path;
+	fat12_status status = fat12_put_file(writer, dir, name, fd, (uint32_t)st.st_size, st.st_mtime);
+	if (status != FAT12_OK) {
+		fprintf(stderr, "%s: %s\n", path, fat12_last_error());
+	}
+	close(fd);
+	return status;
+
+}
+
+int main (int argc, char* argv[]) {
+
+	// Options come before the image
+	int stats = 0;
+	int stats_json = 0;
+	int arg = 1;
+	for (; arg < argc; arg++) {
+		int parsed = fat12_stats_parse_option(argv[arg], &stats_json);
+		if (parsed == 0) {
+			break;
+		}
+		if (parsed < 0) {
+			usage(argv[0]);
+		}
+		stats = 1;
+	}
+	if (arg >= argc) {
+		usage(argv[0]);
+	}
+	const char* image = argv[arg++];
+	const char* dir = "";
+	if (arg + 1 < argc && strcmp(argv[arg], "--dir") == 0) {
+		dir = argv[arg + 1];
+		arg += 2;
+	}
+	if (arg >= argc) {
+		usage(argv[0]);
+	}
+	if (stats && fat12_stats_enable(1) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(EXIT_FAILURE);
+	}
+
+	fat12_volume* volume;
+	fat12_writer* writer;
+	if (fat12_volume_open_writable(image, &volume) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(EXIT_FAILURE);
+	}
+	if (fat12_writer_begin(volume, &writer) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		fat12_volume_close(volume);
+		exit(EXIT_FAILURE);
+	}
+
+	// Add every file, then write the FAT copies once for all of them, and only after them the new entries
+	int failed = 0;
+	for (; arg < argc; arg++) {
+		failed |= put_file(writer, dir, argv[arg]) != FAT12_OK;
+	}
+	if (fat12_writer_commit(writer) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		failed = 1;
+	}
+	fat12_writer_free(writer);
+	fat12_volume_close(volume);
+
+	if (stats) {
+		fat12_stats_print(stderr, stats_json);
+	}
+
+	return failed ? EXIT_FAILURE : 0;
+
+}
@@ -0,0 +1,119 @@
+#include "fat12_utils.h"
+#include "fat12_undelete.h"
+#include "fat12_batch.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Function to print the usage message and exit
+static void usage (const char* program) {
+
+	fprintf(stderr, "Usage: %s [--stats[=json]] <disk.IMA>\n       %s [--stats[=json]] [--prefetch[=pread]] --batch <listfile|dir>\n       %s [--stats[=json]] [--min-score=N] --extract <disk.IMA> <destdir>\n", program, program, program);
+	exit(2);
+
+}
+
+// Function to list the deleted files of the disk image at the provided path
+static fat12_status report_image (const char* path, FILE* out) {
+
+	fat12_volume* volume;
+	fat12_status status = fat12_volume_open(path, &volume);
+	if (status != FAT12_OK) {
+		return status;
+	}
+	status = fat12_undelete_list(volume, out, NULL);
+	fat12_volume_close(volume);
+	return status;
+
+}
+
+// Function to extract the likely recoverable deleted files of the disk image at image_path into dest_dir
+static fat12_status extract_image (const char* image_path, const char* dest_dir, int min_score) {
+
+	fat12_volume* volume;
+	size_t num_files = 0;
+	fat12_status status = fat12_volume_open(image_path, &volume);
+	if (status == FAT12_OK) {
+		status = fat12_undelete_extract(volume, dest_dir, min_score, &num_files);
+		fat12_volume_close(volume);
+	}
+	if (status != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		return status;
+	}
+	fprintf(stdout, "Recovered %zu file%s into %s\n", num_files, num_files == 1 ? "" : "s", dest_dir);
+	return FAT12_OK;
+
+}
+
+int main (int argc, char* argv[]) {
+
+	// Options come before the image
+	int stats = 0;
+	int stats_json = 0;
+	int min_score = FAT12_UNDELETE_LIKELY_SCORE;
+	fat12_prefetch_mode prefetch = FAT12_PREFETCH_OFF;
+	int arg = 1;
+	for (; arg < argc; arg++) {
+		if (strncmp(argv[arg], "--min-score=", 12) == 0) {
+			char* end;
+			long value = strtol(argv[arg] + 12, &end, 10);
+			if (end == argv[arg] + 12 || *end != '\0' || value < 0 || value > 100) {
+				usage(argv[0]);
+			}
+			min_score = (int)value;
+			continue;
+		}
+		int parsed = fat12_prefetch_parse_option(argv[arg], &prefetch);
+		if (parsed == 0 && (parsed = fat12_stats_parse_option(argv[arg], &stats_json)) > 0) {
+			stats = 1;
+		}
+		if (parsed == 0) {
+			break;
+		}
+		if (parsed < 0) {
+			usage(argv[0]);
+		}
+	}
+	if (arg >= argc || (strcmp(argv[arg], "--batch") == 0 && arg + 2 != argc)
+		|| (strcmp(argv[arg], "--extract") == 0 && arg + 3 != argc)) {
+		usage(argv[0]);
+	}
+	if (stats && fat12_stats_enable(1) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(EXIT_FAILURE);
+	}
+	fat12_batch_use_prefetch(prefetch);
+
+	int exit_status = 0;
+	if (strcmp(argv[arg], "--batch") == 0) {
+
+		// Scan the images of the batch in parallel, reporting them in order
+		exit_status = fat12_batch_main(argv[arg + 1], report_image);
+
+	} else if (strcmp(argv[arg], "--extract") == 0) {
+
+		if (extract_image(argv[arg + 1], argv[arg + 2], min_score) != FAT12_OK) {
+			exit_status = EXIT_FAILURE;
+		}
+
+	} else if (report_image(argv[arg], stdout) != FAT12_OK) {
+
+		// Scanning the provided disk image failed
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit_status = EXIT_FAILURE;
+
+	}
+
+	// Counters go to standard error so the list itself is unchanged
+	if (stats) {
+		uint64_t phase_start = fat12_stats_phase_begin();
+		fflush(stdout);
+		fat12_stats_phase_end(FAT12_PHASE_OUTPUT, phase_start);
+		fat12_stats_print(stderr, stats_json);
+	}
+
+	return exit_status;
+
+}
@@ -0,0 +1,540 @@
+#include "fat12_batch.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Range of task indices [head, tail) owned by one worker; the owner takes from the head, thieves from the tail
+typedef struct {
+        pthread_mutex_t lock;
+        size_t head;
+        size_t tail;
+} fat12_pool_deque;
+
+typedef struct fat12_pool {
+        fat12_pool_deque* deques;
+        int num_workers;
+        fat12_pool_task task;
+        void* context;
+} fat12_pool;
+
+typedef struct {
+        fat12_pool* pool;
+        int worker;
+} fat12_pool_worker;
+
+// Function to take the next index from the worker's own deque, returning 0 if it is empty
+static int fat12_pool_pop (fat12_pool_deque* deque, size_t* index) {
+
+        int found = 0;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->head < deque->tail) {
+                *index = deque->head++;
+                found = 1;
+        }
+        pthread_mutex_unlock(&deque->lock);
+        return found;
+
+}
+
+// Function to steal the last index of another worker's deque, returning 0 if every deque is empty
+static int fat12_pool_steal (fat12_pool* pool, int worker, size_t* index) {
+
+        for (int i = 1; i < pool->num_workers; i++) {
+                fat12_pool_deque* victim = &pool->deques[(worker + i) % pool->num_workers];
+                int found = 0;
+                pthread_mutex_lock(&victim->lock);
+                if (victim->head < victim->tail) {
+                        *index = --victim->tail;
+                        found = 1;
+                }
+                pthread_mutex_unlock(&victim->lock);
+                if (found) {
+                        return 1;
+                }
+        }
+        return 0;
+
+}
+
+// Set while the thread is running pool tasks, so a pool started from a task stays on that task's thread
+static __thread int fat12_pool_in_task = 0;
+
+// Function run by each pool thread until no work is left anywhere
+static void* fat12_pool_work (void* argument) {
+
+        fat12_pool_worker* self = argument;
+        fat12_pool* pool = self->pool;
+        size_t index;
+        int in_task = fat12_pool_in_task;
+        fat12_pool_in_task = 1;
+
+        // Tasks never spawn tasks onto this pool, so once every deque is empty the pool is drained
+        while (fat12_pool_pop(&pool->deques[self->worker], &index) || fat12_pool_steal(pool, self->worker, &index)) {
+                pool->task(index, self->worker, pool->context);
+        }
+        fat12_pool_in_task = in_task;
+        return NULL;
+
+}
+
+// Function to get the number of workers to use for count tasks, one per online core, or just one from inside a pool task, whose pool already has the cores busy
+int fat12_pool_num_workers (size_t count) {
+
+        if (fat12_pool_in_task) {
+                return 1;
+        }
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cores < 1) {
+                cores = 1;
+        }
+        if ((size_t)cores > count) {
+                cores = count > 0 ? (long)count : 1;
+        }
+        return (int)cores;
+
+}
+
+/*
+ * Runs task for every index in [0, count) on a work-stealing pool of num_workers threads.
+ * Each worker starts with a contiguous slice of the indices and works through it in order,
+ * stealing from the far end of other slices once its own is empty. Returns once every task has finished.
+ *
+ * @param count The number of tasks.
+ * @param num_workers The number of threads to run them on.
+ * @param task The task to run for each index.
+ * @param context Passed through to every task.
+ * @return FAT12_OK, or FAT12_ERR_NOMEM if the pool could not be set up.
+ */
+fat12_status fat12_pool_run (size_t count, int num_workers, fat12_pool_task task, void* context) {
+
+        if (count == 0) {
+                return FAT12_OK;
+        }
+        if (num_workers < 1) {
+                num_workers = 1;
+        }
+
+        fat12_pool pool = { NULL, num_workers, task, context };
+        pool.deques = calloc(num_workers, sizeof(fat12_pool_deque));
+        fat12_pool_worker* workers = calloc(num_workers, sizeof(fat12_pool_worker));
+        pthread_t* threads = calloc(num_workers, sizeof(pthread_t));
+        if (pool.deques == NULL || workers == NULL || threads == NULL) {
+                fat12_status status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                free(threads);
+                free(workers);
+                free(pool.deques);
+                return status;
+        }
+
+        // Split the indices into one contiguous slice per worker
+        for (int w = 0; w < num_workers; w++) {
+                pthread_mutex_init(&pool.deques[w].lock, NULL);
+                pool.deques[w].head = count * w / num_workers;
+                pool.deques[w].tail = count * (w + 1) / num_workers;
+                workers[w].pool = &pool;
+                workers[w].worker = w;
+        }
+
+        // Start the workers; if a thread cannot be started, the ones already running steal its slice. A single worker runs on the calling thread
+        int started = 0;
+        for (int w = 0; num_workers > 1 && w < num_workers; w++) {
+                if (pthread_create(&threads[w], NULL, fat12_pool_work, &workers[w]) != 0) {
+                        break;
+                }
+                started++;
+        }
+        if (started == 0) {
+                fat12_pool_work(&workers[0]); // Run everything on the calling thread instead
+        }
+        for (int w = 0; w < started; w++) {
+                pthread_join(threads[w], NULL);
+        }
+
+        for (int w = 0; w < num_workers; w++) {
+                pthread_mutex_destroy(&pool.deques[w].lock);
+        }
+        free(threads);
+        free(workers);
+        free(pool.deques);
+        return FAT12_OK;
+
+}
+
+// Function to compare two paths for sorting
+static int fat12_batch_compare_paths (const void* a, const void* b) {
+
+        return strcmp(*(char* const*)a, *(char* const*)b);
+
+}
+
+// Function to append a copy of path to the growable list of paths
+static fat12_status fat12_batch_add_path (char*** paths, size_t* count, size_t* capacity, const char* path) {
+
+        if (*count == *capacity) {
+                size_t grown_capacity = *capacity > 0 ? *capacity * 2 : 64;
+                char** grown = realloc(*paths, grown_capacity * sizeof(char*));
+                if (grown == NULL) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                *paths = grown;
+                *capacity = grown_capacity;
+        }
+        (*paths)[*count] = strdup(path);
+        if ((*paths)[*count] == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        (*count)++;
+        return FAT12_OK;
+
+}
+
+/*
+ * Collects the image paths of a batch. If source is a directory, every regular file in it is used,
+ * sorted by name; otherwise source is a list file ("-" for standard input) with one path per line.
+ * The caller is responsible for releasing the paths with fat12_batch_free_paths.
+ *
+ * @param source The directory or list file.
+ * @param paths Set to the collected paths.
+ * @param count Set to the number of collected paths.
+ * @return FAT12_OK, or the reason the paths could not be collected.
+ */
+fat12_status fat12_batch_collect_paths (const char* source, char*** paths, size_t* count) {
+
+        size_t capacity = 0;
+        *paths = NULL;
+        *count = 0;
+
+        struct stat st;
+        if (stat(source, &st) == 0 && S_ISDIR(st.st_mode)) {
+
+                DIR* dir = opendir(source);
+                if (dir == NULL) {
+                        return fat12_error(FAT12_ERR_IO, "Error opening directory: %s", strerror(errno));
+                }
+                // Trailing slashes are dropped so "batch/" names its images batch/X, not batch//X
+                int source_length = (int) strlen(source);
+                while (source_length > 0 && source[source_length - 1] == '/') {
+                        source_length--;
+                }
+                struct dirent* dirent;
+                while ((dirent = readdir(dir)) != NULL) {
+                        if (dirent->d_name[0] == '.') {
+                                continue;
+                        }
+                        size_t length = source_length + strlen(dirent->d_name) + 2;
+                        char* path = malloc(length);
+                        if (path == NULL) {
+                                fat12_status status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                                closedir(dir);
+                                fat12_batch_free_paths(*paths, *count);
+                                return status;
+                        }
+                        snprintf(path, length, "%.*s/%s", source_length, source, dirent->d_name);
+                        fat12_status status = FAT12_OK;
+                        if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+                                status = fat12_batch_add_path(paths, count, &capacity, path);
+                        }
+                        free(path);
+                        if (status != FAT12_OK) {
+                                closedir(dir);
+                                fat12_batch_free_paths(*paths, *count);
+                                return status;
+                        }
+                }
+                closedir(dir);
+
+                // Directory order is arbitrary, so sort to keep the output deterministic
+                qsort(*paths, *count, sizeof(char*), fat12_batch_compare_paths);
+                return FAT12_OK;
+
+        }
+
+        FILE* list = strcmp(source, "-") == 0 ? stdin : fopen(source, "r");
+        if (list == NULL) {
+                return fat12_error(FAT12_ERR_IO, "Error opening batch list: %s", strerror(errno));
+        }
+        char* line = NULL;
+        size_t line_capacity = 0;
+        ssize_t length;
+        fat12_status status = FAT12_OK;
+        while (status == FAT12_OK && (length = getline(&line, &line_capacity, list)) >= 0) {
+                while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+                        line[--length] = '\0';
+                }
+                if (length > 0) {
+                        status = fat12_batch_add_path(paths, count, &capacity, line);
+                }
+        }
+        free(line);
+        if (list != stdin) {
+                fclose(list);
+        }
+        if (status != FAT12_OK) {
+                fat12_batch_free_paths(*paths, *count);
+        }
+        return status;
+
+}
+
+// Function to release paths collected with fat12_batch_collect_paths
+void fat12_batch_free_paths (char** paths, size_t count) {
+
+        for (size_t i = 0; i < count; i++) {
+                free(paths[i]);
+        }
+        free(paths);
+
+}
+
+// Result of one image, handed from the worker that produced it to the thread that prints in order
+typedef struct {
+        char* output;
+        size_t length;
+        fat12_status status;
+        int done;
+        char error[256];
+} fat12_batch_result;
+
+// Output stream reused by one worker for every image it reports
+typedef struct {
+        FILE* stream;
+        char* buffer;
+        size_t size;
+} fat12_batch_buffer;
+
+typedef struct {
+        char** paths;
+        fat12_batch_report report;
+        fat12_batch_result* results;
+        fat12_batch_buffer* buffers;
+        fat12_prefetch* prefetch; // Reading the metadata of the images ahead of the workers, or NULL
+        pthread_mutex_t lock;
+        pthread_cond_t ready;
+} fat12_batch;
+
+// Function to report one image into the worker's own buffer and publish the result
+static void fat12_batch_task (size_t index, int worker, void* context) {
+
+        fat12_batch* batch = context;
+        fat12_batch_buffer* buffer = &batch->buffers[worker];
+        fat12_batch_result* result = &batch->results[index];
+        char* output = NULL;
+        size_t length = 0;
+        fat12_status status;
+
+        if (buffer->stream == NULL) {
+                buffer->stream = open_memstream(&buffer->buffer, &buffer->size);
+        }
+        if (buffer->stream == NULL) {
+                status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        } else {
+                rewind(buffer->stream);
+                if (batch->prefetch != NULL) {
+                        fat12_prefetch_wait(batch->prefetch, index);
+                }
+                status = batch->report(batch->paths[index], buffer->stream);
+                fflush(buffer->stream);
+                length = (size_t)ftello(buffer->stream);
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                output = malloc(length + 1);
+                if (output == NULL) {
+                        status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                } else {
+                        memcpy(output, buffer->buffer, length);
+                }
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        result->output = output;
+        result->length = length;
+        result->status = status;
+        if (status != FAT12_OK) {
+                snprintf(result->error, sizeof(result->error), "%s", fat12_last_error());
+        }
+        result->done = 1;
+        pthread_cond_broadcast(&batch->ready);
+        pthread_mutex_unlock(&batch->lock);
+
+}
+
+typedef struct {
+        fat12_batch* batch;
+        size_t count;
+        int num_workers;
+} fat12_batch_pool_args;
+
+// Function to run the pool on its own thread so the caller can print results as they complete
+static void* fat12_batch_pool_thread (void* argument) {
+
+        fat12_batch_pool_args* args = argument;
+        if (fat12_pool_run(args->count, args->num_workers, fat12_batch_task, args->batch) != FAT12_OK) {
+                pthread_mutex_lock(&args->batch->lock);
+                for (size_t i = 0; i < args->count; i++) {
+                        if (!args->batch->results[i].done) {
+                                args->batch->results[i].status = FAT12_ERR_NOMEM;
+                                snprintf(args->batch->results[i].error, sizeof(args->batch->results[i].error), "%s", fat12_last_error());
+                                args->batch->results[i].done = 1;
+                        }
+                }
+                pthread_cond_broadcast(&args->batch->ready);
+                pthread_mutex_unlock(&args->batch->lock);
+        }
+        return NULL;
+
+}
+
+// Whether each report is printed under a "==> path <==" header, off for formats whose records name their image
+static int fat12_batch_headers = 1;
+
+// Function to turn the "==> path <==" headers between the reports of a batch on or off
+void fat12_batch_use_headers (int headers) {
+
+        fat12_batch_headers = headers;
+
+}
+
+// How the metadata of a batch's images is read ahead, off unless a tool asks for it
+static fat12_prefetch_mode fat12_batch_prefetch = FAT12_PREFETCH_OFF;
+
+// Function to choose how the metadata of a batch's images is read ahead of the workers
+void fat12_batch_use_prefetch (fat12_prefetch_mode mode) {
+
+        fat12_batch_prefetch = mode;
+
+}
+
+// Function to start reading ahead in the order the pool's workers will take the images: the first of each worker's slice, then the second of each, and so on
+static fat12_prefetch* fat12_batch_start_prefetch (char** paths, size_t count, int num_workers) {
+
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        size_t* order = malloc(count * sizeof(size_t));
+        if (order == NULL) {
+                return NULL;
+        }
+        size_t placed = 0;
+        for (size_t position = 0; placed < count; position++) {
+                for (int w = 0; w < num_workers; w++) {
+                        size_t index = count * w / num_workers + position;
+                        if (index < count * (w + 1) / num_workers) {
+                                order[placed++] = index;
+                        }
+                }
+        }
+
+        // Without read-ahead the batch still runs, just as it would without the option
+        fat12_prefetch* prefetch = NULL;
+        if (fat12_prefetch_start(paths, order, count, fat12_batch_prefetch, &prefetch) != FAT12_OK) {
+                prefetch = NULL;
+        }
+        free(order);
+        return prefetch;
+
+}
+
+/*
+ * Reports every image of a batch across a work-stealing pool sized to the machine's cores.
+ * With read-ahead on, each worker first waits for the metadata of its image to be in the page cache.
+ * Reports are written to out in the order of paths, each under a "==> path <==" header unless headers are off, as soon as
+ * every earlier image is done. An image whose report fails is described on err and skipped.
+ *
+ * @param paths The image paths.
+ * @param count The number of images.
+ * @param report The report to produce for each image.
+ * @param out Where reports are written.
+ * @param err Where failures are described.
+ * @return The number of images that failed.
+ */
+size_t fat12_batch_run (char** paths, size_t count, fat12_batch_report report, FILE* out, FILE* err) {
+
+        fat12_batch batch;
+        int num_workers = fat12_pool_num_workers(count);
+        batch.paths = paths;
+        batch.report = report;
+        batch.results = calloc(count > 0 ? count : 1, sizeof(fat12_batch_result));
+        batch.buffers = calloc(num_workers, sizeof(fat12_batch_buffer));
+        if (batch.results == NULL || batch.buffers == NULL) {
+                fprintf(err, "Memory allocation failed: %s\n", strerror(errno));
+                free(batch.buffers);
+                free(batch.results);
+                return count;
+        }
+        pthread_mutex_init(&batch.lock, NULL);
+        pthread_cond_init(&batch.ready, NULL);
+        batch.prefetch = fat12_batch_prefetch != FAT12_PREFETCH_OFF && count > 0 ? fat12_batch_start_prefetch(paths, count, num_workers) : NULL;
+
+        fat12_batch_pool_args args = { &batch, count, num_workers };
+        pthread_t pool_thread;
+        int threaded = pthread_create(&pool_thread, NULL, fat12_batch_pool_thread, &args) == 0;
+        if (!threaded) {
+                fat12_batch_pool_thread(&args);
+        }
+
+        // Print results in input order, waiting for each one as needed
+        size_t failures = 0;
+        int printed = 0;
+        for (size_t i = 0; i < count; i++) {
+                fat12_batch_result* result = &batch.results[i];
+                pthread_mutex_lock(&batch.lock);
+                while (!result->done) {
+                        pthread_cond_wait(&batch.ready, &batch.lock);
+                }
+                pthread_mutex_unlock(&batch.lock);
+
+                if (result->status != FAT12_OK) {
+                        fprintf(err, "%s: %s\n", paths[i], result->error);
+                        failures++;
+                } else {
+                        uint64_t phase_start = fat12_stats_phase_begin();
+                        if (fat12_batch_headers) {
+                                fprintf(out, "%s==> %s <==\n", printed ? "\n" : "", paths[i]);
+                        }
+                        fwrite(result->output, 1, result->length, out);
+                        fat12_stats_phase_end(FAT12_PHASE_OUTPUT, phase_start);
+                        printed = 1;
+                }
+                free(result->output);
+                result->output = NULL;
+        }
+        fflush(out);
+
+        if (threaded) {
+                pthread_join(pool_thread, NULL);
+        }
+        fat12_prefetch_free(batch.prefetch);
+        for (int w = 0; w < num_workers; w++) {
+                if (batch.buffers[w].stream != NULL) {
+                        fclose(batch.buffers[w].stream);
+                }
+                free(batch.buffers[w].buffer);
+        }
+        pthread_cond_destroy(&batch.ready);
+        pthread_mutex_destroy(&batch.lock);
+        free(batch.buffers);
+        free(batch.results);
+        return failures;
+
+}
+
+// Function to run batch mode for a tool's main, returning its exit status
+int fat12_batch_main (const char* source, fat12_batch_report report) {
+
+        char** paths;
+        size_t count;
+        if (fat12_batch_collect_paths(source, &paths, &count) != FAT12_OK) {
+                fprintf(stderr, "%s: %s\n", source, fat12_last_error());
+                return EXIT_FAILURE;
+        }
+
+        size_t failures = fat12_batch_run(paths, count, report, stdout, stderr);
+        fat12_batch_free_paths(paths, count);
+        return failures > 0 ? EXIT_FAILURE : 0;
+
+}
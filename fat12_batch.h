@@ -0,0 +1,25 @@
+#ifndef FAT12_BATCH_H
+#define FAT12_BATCH_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "fat12_utils.h"
+#include "fat12_prefetch.h"
+
+// Task run by the thread pool for one index, on the given worker
+typedef void (*fat12_pool_task) (size_t index, int worker, void* context);
+
+// Report produced for one image in batch mode, written to out
+typedef fat12_status (*fat12_batch_report) (const char* path, FILE* out);
+
+int fat12_pool_num_workers (size_t count);
+fat12_status fat12_pool_run (size_t count, int num_workers, fat12_pool_task task, void* context);
+
+fat12_status fat12_batch_collect_paths (const char* source, char*** paths, size_t* count);
+void fat12_batch_free_paths (char** paths, size_t count);
+void fat12_batch_use_headers (int headers);
+void fat12_batch_use_prefetch (fat12_prefetch_mode mode);
+size_t fat12_batch_run (char** paths, size_t count, fat12_batch_report report, FILE* out, FILE* err);
+int fat12_batch_main (const char* source, fat12_batch_report report);
+
+#endif
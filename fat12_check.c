@@ -0,0 +1,244 @@
+#include "fat12_check.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_fat.h"
+#include "fat12_path.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+
+// State of one consistency check
+typedef struct {
+        const fat12_geometry* geometry;
+        const fat12_fat* fat;
+        uint32_t end_cluster; // One past the last cluster both the data region and the FAT cover
+        uint64_t* owned; // One bit per cluster claimed by a chain so far
+        uint64_t* current; // One bit per cluster of the chain being followed
+        uint16_t* chain; // The clusters of that chain, so its bits can be cleared afterwards
+        FILE* out;
+        size_t num_problems;
+} fat12_check;
+
+// Function to test one bit of a cluster bitset
+static inline int fat12_check_bit (const uint64_t* bitset, uint32_t cluster) {
+
+        return (int)(bitset[cluster / 64] >> (cluster % 64)) & 1;
+
+}
+
+// Function to print one problem and count it
+__attribute__((format(printf, 2, 3)))
+static void fat12_check_report (fat12_check* check, const char* format, ...) {
+
+        va_list args;
+        va_start(args, format);
+        vfprintf(check->out, format, args);
+        va_end(args);
+        fputc('\n', check->out);
+        check->num_problems++;
+
+}
+
+// Function to compare every FAT copy after the first with the first
+static fat12_status fat12_check_fat_copies (fat12_check* check, fat12_volume* volume) {
+
+        const fat12_geometry* geometry = check->geometry;
+        size_t fat_length_bytes = (size_t)geometry->sectors_per_fat * geometry->bytes_per_sector;
+        const unsigned char* first = (const unsigned char*)fat12_volume_bytes(volume, geometry->fat_start_byte, fat_length_bytes);
+        if (first == NULL) {
+                return fat12_error(FAT12_ERR_RANGE, "Error reading FAT copies: image too small");
+        }
+        for (uint32_t copy = 1; copy < geometry->num_fats; copy++) {
+                const unsigned char* other = (const unsigned char*)fat12_volume_bytes(volume, geometry->fat_start_byte + copy * fat_length_bytes, fat_length_bytes);
+                if (other == NULL) {
+                        return fat12_error(FAT12_ERR_RANGE, "Error reading FAT copies: image too small");
+                }
+                uint32_t first_cluster = 0;
+                uint32_t num_different = fat12_fat_compare(first, other, fat_length_bytes, check->fat->num_entries, &first_cluster);
+                if (num_different > 0) {
+                        fat12_check_report(check, "FAT copy %u differs from copy 1 in %u entr%s, first at cluster %u", copy + 1, num_different, num_different == 1 ? "y" : "ies", first_cluster);
+                }
+        }
+        return FAT12_OK;
+
+}
+
+/*
+ * Follows the cluster chain of one file or directory, claiming its clusters in the ownership bitset
+ * and reporting where it leaves the volume, loops, runs into a cluster another chain owns, or ends without
+ * a proper end-of-chain marker. For a file, the chain length is also checked against the size in the entry.
+ */
+static void fat12_check_chain (fat12_check* check, const char* path, const char* entry, int is_directory) {
+
+        uint32_t cluster_size_bytes = check->geometry->cluster_size_bytes;
+        uint32_t size = get_file_size(entry);
+        uint32_t cluster = get_first_logical_cluster(entry);
+        if (cluster == 0) {
+                if (!is_directory && size > 0) {
+                        fat12_check_report(check, "%s: no clusters for %u bytes", path, size);
+                }
+                return;
+        }
+
+        uint32_t length = 0;
+        int broken = 1;
+        for (;;) {
+                if (cluster < 2 || cluster >= check->end_cluster) {
+                        fat12_check_report(check, "%s: chain points to invalid cluster %u", path, cluster);
+                        break;
+                }
+                if (fat12_check_bit(check->current, cluster)) {
+                        fat12_check_report(check, "%s: chain loops back to cluster %u", path, cluster);
+                        break;
+                }
+                if (fat12_check_bit(check->owned, cluster)) {
+                        fat12_check_report(check, "%s: cluster %u is cross-linked with another chain", path, cluster);
+                        break;
+                }
+                check->owned[cluster / 64] |= (uint64_t)1 << (cluster % 64);
+                check->current[cluster / 64] |= (uint64_t)1 << (cluster % 64);
+                check->chain[length++] = (uint16_t)cluster;
+
+                uint16_t next = check->fat->entries[cluster];
+                if (next >= FAT_ENTRY_END_OF_CHAIN_MIN) {
+                        broken = 0;
+                        break;
+                }
+                if (next == FAT_ENTRY_FREE) {
+                        fat12_check_report(check, "%s: cluster %u is in the chain but marked free", path, cluster);
+                        break;
+                }
+                if (next >= 0xFF0) {
+                        fat12_check_report(check, "%s: bad end marker 0x%03X at cluster %u", path, next, cluster);
+                        break;
+                }
+                cluster = next;
+        }
+        for (uint32_t i = 0; i < length; i++) {
+                check->current[check->chain[i] / 64] = 0;
+        }
+
+        uint32_t expected = (uint32_t)(((uint64_t)size + cluster_size_bytes - 1) / cluster_size_bytes);
+        if (!broken && !is_directory && length != expected) {
+                fat12_check_report(check, "%s: %u cluster%s for %u bytes, expected %u", path, length, length == 1 ? "" : "s", size, expected);
+        }
+
+}
+
+// Function to report allocated clusters no chain owns, one line per lost chain
+static void fat12_check_lost (fat12_check* check) {
+
+        size_t num_words = (check->end_cluster + 63) / 64;
+        uint64_t* lost = check->current; // Every chain is done with it, and it is all zero again
+        uint64_t* pointed = (uint64_t*)(void*)check->chain;
+        const uint16_t* entries = check->fat->entries;
+
+        // Lost: allocated in the FAT (neither free nor marked bad) but never reached from a directory entry
+        for (uint32_t cluster = 2; cluster < check->end_cluster; cluster++) {
+                uint16_t value = entries[cluster];
+                uint64_t allocated = value != FAT_ENTRY_FREE && value != FAT_ENTRY_BAD;
+                lost[cluster / 64] |= (allocated & ~(check->owned[cluster / 64] >> (cluster % 64))) << (cluster % 64);
+        }
+
+        // A lost chain starts at a lost cluster no other lost cluster points to
+        memset(pointed, 0, num_words * sizeof(uint64_t));
+        for (size_t w = 0; w < num_words; w++) {
+                for (uint64_t bits = lost[w]; bits != 0; bits &= bits - 1) {
+                        uint32_t next = entries[w * 64 + (uint32_t)__builtin_ctzll(bits)];
+                        if (next >= 2 && next < check->end_cluster && fat12_check_bit(lost, next)) {
+                                pointed[next / 64] |= (uint64_t)1 << (next % 64);
+                        }
+                }
+        }
+
+        // Follow each chain from its start, clearing clusters as they are counted; whatever is left over forms loops
+        for (int pass = 0; pass < 2; pass++) {
+                for (size_t w = 0; w < num_words; w++) {
+                        uint64_t starts = pass == 0 ? lost[w] & ~pointed[w] : lost[w];
+                        for (; starts != 0; starts &= starts - 1) {
+                                uint32_t start = (uint32_t)(w * 64 + __builtin_ctzll(starts));
+                                if (!fat12_check_bit(lost, start)) {
+                                        continue;
+                                }
+                                uint32_t length = 0;
+                                for (uint32_t cluster = start; cluster >= 2 && cluster < check->end_cluster && fat12_check_bit(lost, cluster); cluster = entries[cluster]) {
+                                        lost[cluster / 64] &= ~((uint64_t)1 << (cluster % 64));
+                                        length++;
+                                }
+                                fat12_check_report(check, "Lost chain at cluster %u: %u cluster%s%s", start, length, length == 1 ? "" : "s", pass == 0 ? "" : ", looped");
+                        }
+                }
+        }
+
+}
+
+/*
+ * Checks the consistency of a volume and prints one line per problem found, then a summary line.
+ * Every FAT copy is compared with the first. Every file and directory chain is followed through the first FAT,
+ * building a bitset of the clusters owned so far, which exposes cross-links and loops as they are met;
+ * chains that end badly or disagree with the file size are reported too. Allocated clusters left without
+ * an owner at the end are reported as lost chains.
+ *
+ * @param volume The volume.
+ * @param out Where problems are printed.
+ * @param num_problems Set to the number of problems found.
+ * @return FAT12_OK if the check ran, whatever it found, or the reason it could not.
+ */
+fat12_status fat12_check_volume (fat12_volume* volume, FILE* out, size_t* num_problems) {
+
+        fat12_check check;
+        memset(&check, 0, sizeof(check));
+        check.out = out;
+        fat12_status status = fat12_volume_geometry(volume, &check.geometry);
+        if (status == FAT12_OK) {
+                status = fat12_volume_fat(volume, &check.fat);
+        }
+        if (status != FAT12_OK) {
+                return status;
+        }
+        check.end_cluster = check.geometry->end_cluster < check.fat->num_entries ? check.geometry->end_cluster : check.fat->num_entries;
+
+        // The chain scratch doubles as a bitset when looking for lost chains, so it is sized for both
+        size_t num_words = (check.end_cluster + 63) / 64;
+        size_t chain_bytes = check.end_cluster * sizeof(uint16_t) > num_words * sizeof(uint64_t) ? check.end_cluster * sizeof(uint16_t) : num_words * sizeof(uint64_t);
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 3);
+        check.owned = calloc(num_words, sizeof(uint64_t));
+        check.current = calloc(num_words, sizeof(uint64_t));
+        check.chain = malloc(chain_bytes);
+        if (check.owned == NULL || check.current == NULL || check.chain == NULL) {
+                status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+
+        if (status == FAT12_OK) {
+                status = fat12_check_fat_copies(&check, volume);
+        }
+        if (status == FAT12_OK) {
+                fat12_path_walker walker;
+                fat12_dir_item item;
+                int result = fat12_path_walker_init(&walker, volume);
+                while (result == FAT12_OK && (result = fat12_path_walker_next(&walker, &item)) == 1) {
+                        fat12_check_chain(&check, walker.path, item.entry, item.is_directory);
+                        result = FAT12_OK;
+                }
+                fat12_path_walker_free(&walker);
+                status = result < 0 ? (fat12_status)result : FAT12_OK;
+        }
+        if (status == FAT12_OK) {
+                fat12_check_lost(&check);
+                if (check.num_problems > 0) {
+                        fprintf(out, "%zu problem%s found\n", check.num_problems, check.num_problems == 1 ? "" : "s");
+                } else {
+                        fprintf(out, "No problems found\n");
+                }
+                *num_problems = check.num_problems;
+        }
+
+        free(check.chain);
+        free(check.current);
+        free(check.owned);
+        return status;
+
+}
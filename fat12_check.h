@@ -0,0 +1,10 @@
+#ifndef FAT12_CHECK_H
+#define FAT12_CHECK_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "fat12_utils.h"
+
+fat12_status fat12_check_volume (fat12_volume* volume, FILE* out, size_t* num_problems);
+
+#endif
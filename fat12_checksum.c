@@ -0,0 +1,443 @@
+#include "fat12_checksum.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_extract.h"
+#include "fat12_batch.h"
+#include "fat12_fat.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define FAT12_CHECKSUM_X86 1
+#endif
+
+// Castagnoli polynomial, bit-reversed
+#define CRC32C_POLYNOMIAL 0x82F63B78u
+
+// Images with at least this many bytes of files are hashed on several cores; below it, starting threads costs more than it saves
+#define CHECKSUM_PARALLEL_MIN_BYTES (1u << 20)
+
+// Slicing-by-8 tables: table[0] is the classic byte table, table[k] advances a byte k more positions
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_table_once = PTHREAD_ONCE_INIT;
+
+// Function to fill the slicing-by-8 tables, once per process
+static void fat12_crc32c_init_table (void) {
+
+        for (uint32_t byte = 0; byte < 256; byte++) {
+                uint32_t crc = byte;
+                for (int bit = 0; bit < 8; bit++) {
+                        crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+                }
+                crc32c_table[0][byte] = crc;
+        }
+        for (uint32_t byte = 0; byte < 256; byte++) {
+                for (int k = 1; k < 8; k++) {
+                        uint32_t previous = crc32c_table[k - 1][byte];
+                        crc32c_table[k][byte] = (previous >> 8) ^ crc32c_table[0][previous & 0xFF];
+                }
+        }
+
+}
+
+/*
+ * Updates a raw CRC-32C register with slicing-by-8, eight bytes per step through eight table lookups.
+ * This is the reference implementation the SSE4.2 kernel is checked against.
+ */
+static uint32_t fat12_crc32c_scalar (uint32_t crc, const unsigned char* data, size_t length) {
+
+        pthread_once(&crc32c_table_once, fat12_crc32c_init_table);
+        for (; length >= 8; data += 8, length -= 8) {
+                uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+                uint32_t high = (uint32_t)data[4] | (uint32_t)data[5] << 8 | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+                crc = crc32c_table[7][low & 0xFF] ^ crc32c_table[6][(low >> 8) & 0xFF] ^ crc32c_table[5][(low >> 16) & 0xFF] ^ crc32c_table[4][low >> 24]
+                        ^ crc32c_table[3][high & 0xFF] ^ crc32c_table[2][(high >> 8) & 0xFF] ^ crc32c_table[1][(high >> 16) & 0xFF] ^ crc32c_table[0][high >> 24];
+        }
+        for (; length > 0; data++, length--) {
+                crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data) & 0xFF];
+        }
+        return crc;
+
+}
+
+#ifdef FAT12_CHECKSUM_X86
+
+// Function to update a raw CRC-32C register with the SSE4.2 crc32 instruction, eight bytes at a time
+__attribute__((target("sse4.2")))
+static uint32_t fat12_crc32c_sse42 (uint32_t crc, const unsigned char* data, size_t length) {
+
+#ifdef __x86_64__
+        uint64_t crc64 = crc;
+        for (; length >= 8; data += 8, length -= 8) {
+                uint64_t word;
+                memcpy(&word, data, sizeof(word));
+                crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = (uint32_t)crc64;
+#endif
+        for (; length > 0; data++, length--) {
+                crc = _mm_crc32_u8(crc, *data);
+        }
+        return crc;
+
+}
+
+// Whether the CPU has the SHA extensions: -1 until checked, since cpuid can trap to the hypervisor and is too slow to repeat per block
+static int sha_extensions = -1;
+
+// Function to check for the SHA extensions, which older compilers cannot name to __builtin_cpu_supports
+static int fat12_cpu_has_sha (void) {
+
+        int supported = __atomic_load_n(&sha_extensions, __ATOMIC_RELAXED);
+        if (supported < 0) {
+                unsigned int eax, ebx, ecx, edx;
+                supported = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && ((ebx >> 29) & 1) && __builtin_cpu_supports("sse4.1");
+                __atomic_store_n(&sha_extensions, supported, __ATOMIC_RELAXED);
+        }
+        return supported;
+
+}
+
+#endif
+
+// Function to continue a CRC-32C over more data, starting from 0 for the first call, with the widest kernel the CPU supports
+uint32_t fat12_crc32c (uint32_t crc, const void* data, size_t length) {
+
+#ifdef FAT12_CHECKSUM_X86
+        if (__builtin_cpu_supports("sse4.2")) {
+                return ~fat12_crc32c_sse42(~crc, data, length);
+        }
+#endif
+        return ~fat12_crc32c_scalar(~crc, data, length);
+
+}
+
+// SHA-256 round constants
+static const uint32_t SHA256_K[64] = {
+        0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+        0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+        0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+        0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+        0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+        0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+        0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+        0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+// Function to rotate a 32-bit word right
+static inline uint32_t fat12_rotr32 (uint32_t x, int n) {
+
+        return (x >> n) | (x << (32 - n));
+
+}
+
+/*
+ * Runs the SHA-256 compression function over whole 64-byte blocks, straight from the FIPS 180-4 description.
+ * This is the reference implementation the SHA-NI kernel is checked against.
+ */
+static void fat12_sha256_blocks_scalar (uint32_t state[8], const unsigned char* data, size_t num_blocks) {
+
+        for (; num_blocks > 0; data += 64, num_blocks--) {
+                uint32_t w[64];
+                for (int t = 0; t < 16; t++) {
+                        w[t] = (uint32_t)data[t * 4] << 24 | (uint32_t)data[t * 4 + 1] << 16 | (uint32_t)data[t * 4 + 2] << 8 | data[t * 4 + 3];
+                }
+                for (int t = 16; t < 64; t++) {
+                        uint32_t s0 = fat12_rotr32(w[t - 15], 7) ^ fat12_rotr32(w[t - 15], 18) ^ (w[t - 15] >> 3);
+                        uint32_t s1 = fat12_rotr32(w[t - 2], 17) ^ fat12_rotr32(w[t - 2], 19) ^ (w[t - 2] >> 10);
+                        w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+                }
+
+                uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+                uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+                for (int t = 0; t < 64; t++) {
+                        uint32_t t1 = h + (fat12_rotr32(e, 6) ^ fat12_rotr32(e, 11) ^ fat12_rotr32(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[t] + w[t];
+                        uint32_t t2 = (fat12_rotr32(a, 2) ^ fat12_rotr32(a, 13) ^ fat12_rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                        h = g;
+                        g = f;
+                        f = e;
+                        e = d + t1;
+                        d = c;
+                        c = b;
+                        b = a;
+                        a = t1 + t2;
+                }
+                state[0] += a;
+                state[1] += b;
+                state[2] += c;
+                state[3] += d;
+                state[4] += e;
+                state[5] += f;
+                state[6] += g;
+                state[7] += h;
+        }
+
+}
+
+#ifdef FAT12_CHECKSUM_X86
+
+/*
+ * Runs the SHA-256 compression function over whole 64-byte blocks with the SHA extensions.
+ * The instructions keep the state as the register pairs ABEF and CDGH, and each sha256rnds2 does two rounds,
+ * so every four message words take two of them; sha256msg1 and sha256msg2 extend the schedule four words at a time.
+ */
+__attribute__((target("sha,sse4.1")))
+static void fat12_sha256_blocks_shani (uint32_t state[8], const unsigned char* data, size_t num_blocks) {
+
+        const __m128i byte_swap = _mm_set_epi64x(0x0C0D0E0F08090A0Bll, 0x0405060700010203ll);
+        __m128i dcba = _mm_loadu_si128((const __m128i*)&state[0]);
+        __m128i hgfe = _mm_loadu_si128((const __m128i*)&state[4]);
+        __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+        __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+        __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+        __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+
+        for (; num_blocks > 0; data += 64, num_blocks--) {
+                __m128i abef_start = abef;
+                __m128i cdgh_start = cdgh;
+                __m128i w[4]; // Schedule words 4i..4i+3 in w[i % 4], so the last four groups are always at hand
+                for (int i = 0; i < 16; i++) {
+                        __m128i words;
+                        if (i < 4) {
+                                words = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i * 16)), byte_swap);
+                        } else {
+                                words = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                                words = _mm_add_epi32(words, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                                words = _mm_sha256msg2_epu32(words, w[(i + 3) & 3]);
+                        }
+                        w[i & 3] = words;
+                        __m128i rounds = _mm_add_epi32(words, _mm_loadu_si128((const __m128i*)&SHA256_K[i * 4]));
+                        cdgh = _mm_sha256rnds2_epu32(cdgh, abef, rounds);
+                        abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(rounds, 0x0E));
+                }
+                abef = _mm_add_epi32(abef, abef_start);
+                cdgh = _mm_add_epi32(cdgh, cdgh_start);
+        }
+
+        __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+        __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+        _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(feba, dchg, 0xF0));
+        _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+
+}
+
+#endif
+
+// Function to run the SHA-256 compression function over whole blocks with the fastest kernel the CPU supports
+static void fat12_sha256_blocks (uint32_t state[8], const unsigned char* data, size_t num_blocks) {
+
+#ifdef FAT12_CHECKSUM_X86
+        if (fat12_cpu_has_sha()) {
+                fat12_sha256_blocks_shani(state, data, num_blocks);
+                return;
+        }
+#endif
+        fat12_sha256_blocks_scalar(state, data, num_blocks);
+
+}
+
+// Function to start a SHA-256 hash
+void fat12_sha256_init (fat12_sha256* sha) {
+
+        static const uint32_t initial_state[8] = {
+                0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+        };
+        memcpy(sha->state, initial_state, sizeof(initial_state));
+        sha->length = 0;
+
+}
+
+// Function to feed more data to a SHA-256 hash; whole blocks are hashed straight from data without being copied
+void fat12_sha256_update (fat12_sha256* sha, const void* data, size_t length) {
+
+        const unsigned char* bytes = data;
+        size_t buffered = sha->length % 64;
+        sha->length += length;
+        if (buffered > 0) {
+                size_t needed = 64 - buffered;
+                if (length < needed) {
+                        memcpy(sha->block + buffered, bytes, length);
+                        return;
+                }
+                memcpy(sha->block + buffered, bytes, needed);
+                fat12_sha256_blocks(sha->state, sha->block, 1);
+                bytes += needed;
+                length -= needed;
+        }
+        fat12_sha256_blocks(sha->state, bytes, length / 64);
+        memcpy(sha->block, bytes + length / 64 * 64, length % 64);
+
+}
+
+// Function to finish a SHA-256 hash, padding the last block with the message length in bits
+void fat12_sha256_final (fat12_sha256* sha, unsigned char digest[32]) {
+
+        uint64_t length_bits = sha->length * 8;
+        size_t buffered = sha->length % 64;
+        sha->block[buffered++] = 0x80;
+        if (buffered > 56) {
+                memset(sha->block + buffered, 0, 64 - buffered);
+                fat12_sha256_blocks(sha->state, sha->block, 1);
+                buffered = 0;
+        }
+        memset(sha->block + buffered, 0, 56 - buffered);
+        for (int i = 0; i < 8; i++) {
+                sha->block[56 + i] = (unsigned char)(length_bits >> (56 - i * 8));
+        }
+        fat12_sha256_blocks(sha->state, sha->block, 1);
+        for (int i = 0; i < 8; i++) {
+                digest[i * 4] = (unsigned char)(sha->state[i] >> 24);
+                digest[i * 4 + 1] = (unsigned char)(sha->state[i] >> 16);
+                digest[i * 4 + 2] = (unsigned char)(sha->state[i] >> 8);
+                digest[i * 4 + 3] = (unsigned char)sha->state[i];
+        }
+
+}
+
+// Function to get the name of the kernel a checksum dispatches to on this CPU
+const char* fat12_checksum_kernel (fat12_checksum_kind kind) {
+
+#ifdef FAT12_CHECKSUM_X86
+        if (kind == FAT12_CHECKSUM_CRC32C && __builtin_cpu_supports("sse4.2")) {
+                return "sse4.2";
+        }
+        if (kind == FAT12_CHECKSUM_SHA256 && fat12_cpu_has_sha()) {
+                return "sha-ni";
+        }
+#endif
+        return "scalar";
+
+}
+
+/*
+ * Computes the checksum of one file, streaming its cluster chain straight from the image into the hash
+ * one run of consecutive clusters at a time, without copying it out first.
+ *
+ * @param volume The volume.
+ * @param entry The raw directory entry of the file.
+ * @param kind The checksum to compute.
+ * @param checksum Set to the checksum in lower-case hex; FAT12_CHECKSUM_BUFFER_SIZE bytes long.
+ * @return FAT12_OK, or the reason the chain could not be followed.
+ */
+fat12_status fat12_file_checksum (fat12_volume* volume, const char* entry, fat12_checksum_kind kind, char* checksum) {
+
+        fat12_extent* extents;
+        size_t num_extents;
+        fat12_status status = fat12_file_extents(volume, entry, &extents, &num_extents);
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        uint32_t crc = 0;
+        fat12_sha256 sha;
+        fat12_sha256_init(&sha);
+        for (size_t i = 0; i < num_extents; i++) {
+                const char* data = fat12_volume_bytes(volume, extents[i].start_byte, extents[i].length_bytes);
+                if (kind == FAT12_CHECKSUM_CRC32C) {
+                        crc = fat12_crc32c(crc, data, extents[i].length_bytes);
+                } else {
+                        fat12_sha256_update(&sha, data, extents[i].length_bytes);
+                }
+        }
+        free(extents);
+
+        if (kind == FAT12_CHECKSUM_CRC32C) {
+                snprintf(checksum, FAT12_CHECKSUM_BUFFER_SIZE, "%08x", crc);
+        } else {
+                unsigned char digest[32];
+                fat12_sha256_final(&sha, digest);
+                for (int i = 0; i < 32; i++) {
+                        snprintf(checksum + i * 2, 3, "%02x", digest[i]);
+                }
+        }
+        return FAT12_OK;
+
+}
+
+// Files being checksummed by the pool, and the first failure among them
+typedef struct {
+        fat12_volume* volume;
+        const char* const* entries;
+        fat12_checksum_kind kind;
+        char (*checksums)[FAT12_CHECKSUM_BUFFER_SIZE];
+        int failed;
+        fat12_status status;
+        char error[256];
+} fat12_checksum_batch;
+
+// Function to checksum one file on a pool worker, keeping the description of the first failure for the caller's thread
+static void fat12_checksum_task (size_t index, int worker, void* context) {
+
+        (void)worker;
+        fat12_checksum_batch* batch = context;
+        if (__atomic_load_n(&batch->failed, __ATOMIC_ACQUIRE)) {
+                return;
+        }
+        fat12_status status = fat12_file_checksum(batch->volume, batch->entries[index], batch->kind, batch->checksums[index]);
+        int expected = 0;
+        if (status != FAT12_OK && __atomic_compare_exchange_n(&batch->failed, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                batch->status = status;
+                snprintf(batch->error, sizeof(batch->error), "%s", fat12_last_error());
+        }
+
+}
+
+/*
+ * Computes the checksums of several files of one volume. Once the files add up to enough bytes,
+ * they are spread over the work-stealing pool, one file per task; from inside a batch worker the pool
+ * stays on the calling thread, since the batch already keeps every core busy with other images.
+ *
+ * @param volume The volume.
+ * @param entries The raw directory entries of the files.
+ * @param num_entries The number of files.
+ * @param kind The checksum to compute.
+ * @param checksums Set to the checksum of each file, in the order of entries.
+ * @return FAT12_OK, or the reason one of the files could not be read.
+ */
+fat12_status fat12_checksum_files (fat12_volume* volume, const char* const* entries, size_t num_entries, fat12_checksum_kind kind, char (*checksums)[FAT12_CHECKSUM_BUFFER_SIZE]) {
+
+        // Decode the FAT before any worker starts, so they only ever read it
+        const fat12_fat* fat;
+        fat12_status status = fat12_volume_fat(volume, &fat);
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        uint64_t total_bytes = 0;
+        for (size_t i = 0; i < num_entries; i++) {
+                total_bytes += get_file_size(entries[i]);
+        }
+        int num_workers = total_bytes >= CHECKSUM_PARALLEL_MIN_BYTES ? fat12_pool_num_workers(num_entries) : 1;
+
+        fat12_checksum_batch batch = { volume, entries, kind, checksums, 0, FAT12_OK, "" };
+        status = fat12_pool_run(num_entries, num_workers, fat12_checksum_task, &batch);
+        if (status == FAT12_OK && batch.failed) {
+                status = fat12_error(batch.status, "%s", batch.error);
+        }
+        return status;
+
+}
+
+// Function to check whether a command-line argument is --checksum[=crc32c|sha256], returning 1 if so (CRC-32C by default), -1 if it names an unknown checksum, or 0 otherwise
+int fat12_checksum_parse_option (const char* arg, fat12_checksum_kind* kind) {
+
+        if (strcmp(arg, "--checksum") == 0 || strcmp(arg, "--checksum=crc32c") == 0) {
+                *kind = FAT12_CHECKSUM_CRC32C;
+                return 1;
+        }
+        if (strcmp(arg, "--checksum=sha256") == 0) {
+                *kind = FAT12_CHECKSUM_SHA256;
+                return 1;
+        }
+        if (strncmp(arg, "--checksum=", 11) == 0) {
+                return -1;
+        }
+        return 0;
+
+}
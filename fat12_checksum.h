@@ -0,0 +1,35 @@
+#ifndef FAT12_CHECKSUM_H
+#define FAT12_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fat12_utils.h"
+
+// Checksums disklist --checksum can add to each file
+typedef enum {
+        FAT12_CHECKSUM_NONE = 0,
+        FAT12_CHECKSUM_CRC32C, // Castagnoli CRC-32, as 8 hex digits
+        FAT12_CHECKSUM_SHA256 // As 64 hex digits
+} fat12_checksum_kind;
+
+// Longest checksum in hex, a SHA-256 digest, plus a null terminator
+#define FAT12_CHECKSUM_BUFFER_SIZE 65
+
+// Running SHA-256 state, fed with fat12_sha256_update
+typedef struct {
+        uint32_t state[8];
+        uint64_t length; // Bytes hashed so far
+        unsigned char block[64]; // Bytes of an incomplete block, waiting for the rest of it
+} fat12_sha256;
+
+uint32_t fat12_crc32c (uint32_t crc, const void* data, size_t length);
+void fat12_sha256_init (fat12_sha256* sha);
+void fat12_sha256_update (fat12_sha256* sha, const void* data, size_t length);
+void fat12_sha256_final (fat12_sha256* sha, unsigned char digest[32]);
+const char* fat12_checksum_kernel (fat12_checksum_kind kind);
+
+fat12_status fat12_file_checksum (fat12_volume* volume, const char* entry, fat12_checksum_kind kind, char* checksum);
+fat12_status fat12_checksum_files (fat12_volume* volume, const char* const* entries, size_t num_entries, fat12_checksum_kind kind, char (*checksums)[FAT12_CHECKSUM_BUFFER_SIZE]);
+int fat12_checksum_parse_option (const char* arg, fat12_checksum_kind* kind);
+
+#endif
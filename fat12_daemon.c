@@ -0,0 +1,781 @@
+#define _GNU_SOURCE // accept4, struct ucred
+#include "fat12_daemon.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_report.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+
+// Protocol: a request is one line, "<I|L> <absolute image path>\n". The response is a "<status> <output length> <message length>\n"
+// header followed by the output, which is the whole report when status is FAT12_OK and whatever was printed before the failure
+// otherwise, then the error message, empty on success.
+// A connection can carry any number of requests, answered in order.
+
+// Longest request line: the type, a space, the path and the newline
+#define FAT12_DAEMON_REQUEST_MAX (PATH_MAX + 3)
+
+// Reports kept per image, by request type
+enum {
+        FAT12_DAEMON_REPORT_INFO,
+        FAT12_DAEMON_REPORT_LIST,
+        FAT12_DAEMON_NUM_REPORTS
+};
+
+// Image kept resident: the open volume with its decoded FAT, and each report rendered so far
+typedef struct fat12_daemon_entry {
+        char* path;
+        struct stat st; // Identity of the image file when it was opened
+        int watch; // inotify watch on the image, or -1
+        fat12_volume* volume;
+        char* reports[FAT12_DAEMON_NUM_REPORTS];
+        size_t report_lengths[FAT12_DAEMON_NUM_REPORTS];
+        size_t bytes; // Charged against fat12_daemon_limits.max_bytes
+        struct fat12_daemon_entry* prev;
+        struct fat12_daemon_entry* next;
+} fat12_daemon_entry;
+
+// Resident images, in a list from most to least recently used; a few hundred images keep a linear lookup cheap
+typedef struct {
+        fat12_daemon_entry* head;
+        fat12_daemon_entry* tail;
+        size_t num_images;
+        size_t bytes;
+        int inotify_fd; // -1 when inotify is unavailable, leaving the per-request stat as the only check
+        fat12_daemon_limits limits;
+} fat12_daemon_cache;
+
+// Connection of one client, with the part of a request line read so far and the part of its responses not sent yet
+typedef struct {
+        int fd; // Non-blocking, so a client that stops reading cannot stall the others
+        size_t length;
+        char buffer[FAT12_DAEMON_REQUEST_MAX];
+        char* pending; // Response bytes the socket did not take yet; no more requests are read until they are sent
+        size_t pending_sent;
+        size_t pending_length;
+        size_t pending_capacity;
+} fat12_daemon_client;
+
+static volatile sig_atomic_t fat12_daemon_stopping = 0;
+
+// Function to send a whole buffer over a socket, retrying short writes; a peer that hung up is an error, not a SIGPIPE
+static int fat12_daemon_write_all (int fd, const char* data, size_t length) {
+
+        while (length > 0) {
+                ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+                if (written < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (written <= 0) {
+                        return -1;
+                }
+                data += written;
+                length -= (size_t)written;
+        }
+        return 0;
+
+}
+
+// Function to fill in the address of a Unix socket
+static fat12_status fat12_daemon_address (const char* socket_path, struct sockaddr_un* address) {
+
+        memset(address, 0, sizeof(*address));
+        address->sun_family = AF_UNIX;
+        if (strlen(socket_path) >= sizeof(address->sun_path)) {
+                return fat12_error(FAT12_ERR_INVALID, "Socket path too long: %s", socket_path);
+        }
+        strcpy(address->sun_path, socket_path);
+        return FAT12_OK;
+
+}
+
+/*
+ * Returns the socket fat12d listens on and --via-daemon connects to when no other is given:
+ * $XDG_RUNTIME_DIR/fat12d.sock, or /tmp/fat12d-<uid>/fat12d.sock when there is no runtime directory.
+ * Either way the directory belongs to the user alone, so no one else can put a socket where clients look.
+ *
+ * @return The path, in a buffer that stays valid for the life of the process.
+ */
+const char* fat12_daemon_default_socket (void) {
+
+        static char socket_path[PATH_MAX];
+        const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+        if (runtime_dir != NULL && runtime_dir[0] == '/') {
+                snprintf(socket_path, sizeof(socket_path), "%s/fat12d.sock", runtime_dir);
+        } else {
+                snprintf(socket_path, sizeof(socket_path), "/tmp/fat12d-%u/fat12d.sock", (unsigned)getuid());
+        }
+        return socket_path;
+
+}
+
+// Function to connect to whatever listens on a Unix socket, without checking who it is
+static fat12_status fat12_daemon_dial (const char* socket_path, int* fd) {
+
+        struct sockaddr_un address;
+        fat12_status status = fat12_daemon_address(socket_path, &address);
+        if (status != FAT12_OK) {
+                return status;
+        }
+        int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connection < 0) {
+                return fat12_error(FAT12_ERR_IO, "Error creating socket: %s", strerror(errno));
+        }
+        if (connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0) {
+                status = fat12_error(FAT12_ERR_IO, "Error connecting to fat12d at %s: %s", socket_path, strerror(errno));
+                close(connection);
+                return status;
+        }
+        *fd = connection;
+        return FAT12_OK;
+
+}
+
+// Function to read the user id of the process at the other end of a Unix socket, returning -1 if the kernel does not say
+static int fat12_daemon_peer_uid (int fd, uid_t* uid) {
+
+        struct ucred credentials;
+        socklen_t length = sizeof(credentials);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0 || length != sizeof(credentials)) {
+                return -1;
+        }
+        *uid = credentials.uid;
+        return 0;
+
+}
+
+// Function to connect to a running fat12d, refusing one that runs as another user, since its answers would be printed as ours
+fat12_status fat12_daemon_connect (const char* socket_path, int* fd) {
+
+        int connection;
+        fat12_status status = fat12_daemon_dial(socket_path, &connection);
+        if (status != FAT12_OK) {
+                return status;
+        }
+        uid_t uid;
+        if (fat12_daemon_peer_uid(connection, &uid) != 0) {
+                status = fat12_error(FAT12_ERR_IO, "Error checking fat12d at %s: %s", socket_path, strerror(errno));
+                close(connection);
+                return status;
+        }
+        if (uid != geteuid()) {
+                close(connection);
+                return fat12_error(FAT12_ERR_INVALID, "fat12d at %s runs as uid %u, not as this user", socket_path, (unsigned)uid);
+        }
+        *fd = connection;
+        return FAT12_OK;
+
+}
+
+/*
+ * Asks fat12d for a report on an image and writes it to out, exactly as the standalone tool would print it.
+ * A failure on the daemon's side is returned with the daemon's status and message, so callers handle it like a local one.
+ *
+ * @param fd A connection from fat12_daemon_connect.
+ * @param request The report wanted.
+ * @param image_path The disk image, resolved to an absolute path before it is sent.
+ * @param out Where to write the report.
+ * @return FAT12_OK, the daemon's failure, or FAT12_ERR_IO if the connection failed.
+ */
+fat12_status fat12_daemon_query (int fd, fat12_daemon_request request, const char* image_path, FILE* out) {
+
+        char resolved[PATH_MAX];
+        const char* path = realpath(image_path, resolved) != NULL ? resolved : image_path;
+        char line[FAT12_DAEMON_REQUEST_MAX + 1];
+        int line_length = snprintf(line, sizeof(line), "%c %s\n", (char)request, path);
+        if (line_length < 0 || (size_t)line_length >= sizeof(line) - 1 || strchr(path, '\n') != NULL) {
+                return fat12_error(FAT12_ERR_INVALID, "Invalid image path: %s", image_path);
+        }
+        if (fat12_daemon_write_all(fd, line, (size_t)line_length) != 0) {
+                return fat12_error(FAT12_ERR_IO, "Error sending request to fat12d: %s", strerror(errno));
+        }
+
+        // The header is short, so the first read normally holds it and the start of the report
+        char buffer[65536];
+        size_t filled = 0;
+        char* newline = NULL;
+        while (newline == NULL) {
+                ssize_t bytes_read = read(fd, buffer + filled, sizeof(buffer) - 1 - filled);
+                if (bytes_read < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (bytes_read <= 0) {
+                        return fat12_error(FAT12_ERR_IO, "Error reading response from fat12d: %s", bytes_read < 0 ? strerror(errno) : "connection closed");
+                }
+                filled += (size_t)bytes_read;
+                buffer[filled] = '\0';
+                newline = strchr(buffer, '\n');
+                if (newline == NULL && filled >= 64) {
+                        return fat12_error(FAT12_ERR_IO, "Invalid response from fat12d");
+                }
+        }
+        int status;
+        size_t output_remaining;
+        size_t message_remaining;
+        if (sscanf(buffer, "%d %zu %zu", &status, &output_remaining, &message_remaining) != 3) {
+                return fat12_error(FAT12_ERR_IO, "Invalid response from fat12d");
+        }
+
+        // Stream the output through, then collect the error message that follows it on failure
+        char message[512];
+        size_t message_length = 0;
+        char* data = newline + 1;
+        size_t length = filled - (size_t)(data - buffer);
+        for (;;) {
+                size_t output_part = length < output_remaining ? length : output_remaining;
+                fwrite(data, 1, output_part, out);
+                output_remaining -= output_part;
+                size_t message_part = length - output_part < message_remaining ? length - output_part : message_remaining;
+                size_t copied = message_part < sizeof(message) - 1 - message_length ? message_part : sizeof(message) - 1 - message_length;
+                memcpy(message + message_length, data + output_part, copied);
+                message_length += copied;
+                message_remaining -= message_part;
+                if (output_remaining == 0 && message_remaining == 0) {
+                        break;
+                }
+                ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+                if (bytes_read < 0 && errno == EINTR) {
+                        length = 0;
+                        continue;
+                }
+                if (bytes_read <= 0) {
+                        return fat12_error(FAT12_ERR_IO, "Error reading response from fat12d: %s", bytes_read < 0 ? strerror(errno) : "connection closed");
+                }
+                data = buffer;
+                length = (size_t)bytes_read;
+        }
+
+        if (status != FAT12_OK) {
+                message[message_length] = '\0';
+                return fat12_error((fat12_status)status, "%s", message);
+        }
+        return FAT12_OK;
+
+}
+
+// Function to unlink an entry from the recency list
+static void fat12_daemon_unlink (fat12_daemon_cache* cache, fat12_daemon_entry* entry) {
+
+        if (entry->prev != NULL) {
+                entry->prev->next = entry->next;
+        } else {
+                cache->head = entry->next;
+        }
+        if (entry->next != NULL) {
+                entry->next->prev = entry->prev;
+        } else {
+                cache->tail = entry->prev;
+        }
+        entry->prev = NULL;
+        entry->next = NULL;
+
+}
+
+// Function to put an entry at the most recently used end of the list
+static void fat12_daemon_push_front (fat12_daemon_cache* cache, fat12_daemon_entry* entry) {
+
+        entry->next = cache->head;
+        if (cache->head != NULL) {
+                cache->head->prev = entry;
+        } else {
+                cache->tail = entry;
+        }
+        cache->head = entry;
+
+}
+
+// Function to drop an image from the cache, releasing its volume, reports and, when no other entry shares it, its watch
+static void fat12_daemon_evict (fat12_daemon_cache* cache, fat12_daemon_entry* entry) {
+
+        fat12_daemon_unlink(cache, entry);
+        cache->num_images--;
+        cache->bytes -= entry->bytes;
+
+        int shared = 0;
+        for (fat12_daemon_entry* other = cache->head; other != NULL && entry->watch >= 0; other = other->next) {
+                shared |= other->watch == entry->watch;
+        }
+        if (entry->watch >= 0 && !shared) {
+                inotify_rm_watch(cache->inotify_fd, entry->watch);
+        }
+
+        for (int i = 0; i < FAT12_DAEMON_NUM_REPORTS; i++) {
+                free(entry->reports[i]);
+        }
+        fat12_volume_close(entry->volume);
+        free(entry->path);
+        free(entry);
+
+}
+
+// Function to drop least recently used images until the cache is within its limits, always keeping keep
+static void fat12_daemon_trim (fat12_daemon_cache* cache, fat12_daemon_entry* keep) {
+
+        while ((cache->num_images > cache->limits.max_images || cache->bytes > cache->limits.max_bytes) && cache->tail != NULL && cache->tail != keep) {
+                fat12_daemon_evict(cache, cache->tail);
+        }
+
+}
+
+// Function to check whether the image file still has the identity it had when it was cached
+static int fat12_daemon_unchanged (const struct stat* cached, const struct stat* current) {
+
+        return cached->st_dev == current->st_dev && cached->st_ino == current->st_ino && cached->st_size == current->st_size
+                && cached->st_mtim.tv_sec == current->st_mtim.tv_sec && cached->st_mtim.tv_nsec == current->st_mtim.tv_nsec
+                && cached->st_ctim.tv_sec == current->st_ctim.tv_sec && cached->st_ctim.tv_nsec == current->st_ctim.tv_nsec;
+
+}
+
+// Function to find the resident image at path, dropping a stale one and opening the image on a miss
+static fat12_status fat12_daemon_lookup (fat12_daemon_cache* cache, const char* path, fat12_daemon_entry** found) {
+
+        fat12_daemon_entry* entry = cache->head;
+        while (entry != NULL && strcmp(entry->path, path) != 0) {
+                entry = entry->next;
+        }
+
+        // The stat catches changes inotify cannot see, such as on network file systems
+        struct stat st;
+        int stat_failed = stat(path, &st) != 0;
+        if (entry != NULL && (stat_failed || !fat12_daemon_unchanged(&entry->st, &st))) {
+                fat12_daemon_evict(cache, entry);
+                entry = NULL;
+        }
+        if (stat_failed) {
+                return fat12_error(FAT12_ERR_IO, "Error opening file: %s", strerror(errno));
+        }
+        if (entry != NULL) {
+                fat12_daemon_unlink(cache, entry);
+                fat12_daemon_push_front(cache, entry);
+                *found = entry;
+                return FAT12_OK;
+        }
+
+        entry = calloc(1, sizeof(fat12_daemon_entry));
+        char* copy = strdup(path);
+        if (entry == NULL || copy == NULL) {
+                free(copy);
+                free(entry);
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        fat12_status status = fat12_volume_open(path, &entry->volume);
+        if (status != FAT12_OK) {
+                free(copy);
+                free(entry);
+                return status;
+        }
+        entry->path = copy;
+        entry->st = st;
+        entry->bytes = (size_t)st.st_size;
+        entry->watch = cache->inotify_fd >= 0 ? inotify_add_watch(cache->inotify_fd, path, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF) : -1;
+
+        fat12_daemon_push_front(cache, entry);
+        cache->num_images++;
+        cache->bytes += entry->bytes;
+        fat12_daemon_trim(cache, entry);
+        *found = entry;
+        return FAT12_OK;
+
+}
+
+// Function to drop every image an inotify event arrived for
+static void fat12_daemon_drain_events (fat12_daemon_cache* cache) {
+
+        char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t length;
+        while ((length = read(cache->inotify_fd, buffer, sizeof(buffer))) > 0) {
+                for (char* at = buffer; at < buffer + length; ) {
+                        const struct inotify_event* event = (const struct inotify_event*)at;
+                        fat12_daemon_entry* entry = cache->head;
+                        while (entry != NULL) {
+                                fat12_daemon_entry* next = entry->next;
+                                if (entry->watch == event->wd) {
+                                        fat12_daemon_evict(cache, entry);
+                                }
+                                entry = next;
+                        }
+                        at += sizeof(struct inotify_event) + event->len;
+                }
+        }
+
+}
+
+// Function to render a report of a resident image with the same fat12_print_* functions the tools use, once.
+// On failure the caller gets whatever was printed before it, to pass on like the standalone tool would, and frees it.
+static fat12_status fat12_daemon_render (fat12_daemon_cache* cache, fat12_daemon_entry* entry, int report, char** partial, size_t* partial_length) {
+
+        if (entry->reports[report] != NULL) {
+                return FAT12_OK;
+        }
+        char* data = NULL;
+        size_t length = 0;
+        FILE* stream = open_memstream(&data, &length);
+        if (stream == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        fat12_status status = report == FAT12_DAEMON_REPORT_INFO ? fat12_print_info(entry->volume, stream) : fat12_print_files(entry->volume, stream);
+        if (fclose(stream) != 0 && status == FAT12_OK) {
+                status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        if (status != FAT12_OK) {
+                *partial = data;
+                *partial_length = length;
+                return status;
+        }
+
+        entry->reports[report] = data;
+        entry->report_lengths[report] = length;
+        entry->bytes += length;
+        cache->bytes += length;
+        fat12_daemon_trim(cache, entry);
+        return FAT12_OK;
+
+}
+
+// Function to queue response bytes a client's socket did not take, returning -1 if there is no memory for them
+static int fat12_daemon_queue (fat12_daemon_client* client, const char* data, size_t length) {
+
+        if (client->pending_sent > 0) {
+                client->pending_length -= client->pending_sent;
+                memmove(client->pending, client->pending + client->pending_sent, client->pending_length);
+                client->pending_sent = 0;
+        }
+        if (client->pending_length + length > client->pending_capacity) {
+                size_t capacity = client->pending_capacity * 2 > client->pending_length + length ? client->pending_capacity * 2 : client->pending_length + length;
+                char* grown = realloc(client->pending, capacity);
+                if (grown == NULL) {
+                        return -1;
+                }
+                client->pending = grown;
+                client->pending_capacity = capacity;
+        }
+        memcpy(client->pending + client->pending_length, data, length);
+        client->pending_length += length;
+        return 0;
+
+}
+
+// Function to send as much of a client's queued response as its socket takes, returning -1 once the client is gone
+static int fat12_daemon_flush (fat12_daemon_client* client) {
+
+        while (client->pending_sent < client->pending_length) {
+                ssize_t written = send(client->fd, client->pending + client->pending_sent, client->pending_length - client->pending_sent, MSG_NOSIGNAL);
+                if (written < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        return 0;
+                }
+                if (written <= 0) {
+                        return -1;
+                }
+                client->pending_sent += (size_t)written;
+        }
+        client->pending_sent = 0;
+        client->pending_length = 0;
+        return 0;
+
+}
+
+// Function to answer one request line, queuing what the socket does not take at once; returns -1 if the client can no longer be written to
+static int fat12_daemon_answer (fat12_daemon_cache* cache, fat12_daemon_client* client, const char* line) {
+
+        fat12_daemon_entry* entry = NULL;
+        char* partial = NULL;
+        size_t partial_length = 0;
+        fat12_status status;
+        int report = line[0] == FAT12_DAEMON_INFO ? FAT12_DAEMON_REPORT_INFO : FAT12_DAEMON_REPORT_LIST;
+        if ((line[0] != FAT12_DAEMON_INFO && line[0] != FAT12_DAEMON_LIST) || line[1] != ' ' || line[2] == '\0') {
+                status = fat12_error(FAT12_ERR_INVALID, "Invalid request");
+        } else {
+                status = fat12_daemon_lookup(cache, line + 2, &entry);
+                if (status == FAT12_OK) {
+                        status = fat12_daemon_render(cache, entry, report, &partial, &partial_length);
+                }
+        }
+
+        const char* output = status == FAT12_OK ? entry->reports[report] : partial;
+        size_t output_length = status == FAT12_OK ? entry->report_lengths[report] : partial_length;
+        const char* message = status == FAT12_OK ? "" : fat12_last_error();
+        char header[64];
+        int header_length = snprintf(header, sizeof(header), "%d %zu %zu\n", (int)status, output_length, strlen(message));
+
+        // One system call for the whole response in the common case, unless earlier responses are still queued ahead of it
+        struct iovec parts[3] = { { header, (size_t)header_length }, { (void*)output, output_length }, { (void*)message, strlen(message) } };
+        size_t skip = 0;
+        int result = 0;
+        if (client->pending_length == 0) {
+                struct msghdr response;
+                memset(&response, 0, sizeof(response));
+                response.msg_iov = parts;
+                response.msg_iovlen = 3;
+                ssize_t written;
+                do {
+                        written = sendmsg(client->fd, &response, MSG_NOSIGNAL);
+                } while (written < 0 && errno == EINTR);
+                if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                        result = -1;
+                }
+                skip = written < 0 ? 0 : (size_t)written;
+        }
+        for (int i = 0; i < 3 && result == 0; i++) {
+                if (skip >= parts[i].iov_len) {
+                        skip -= parts[i].iov_len;
+                        continue;
+                }
+                result = fat12_daemon_queue(client, (const char*)parts[i].iov_base + skip, parts[i].iov_len - skip);
+                skip = 0;
+        }
+        free(partial);
+        return result;
+
+}
+
+// Function to read what a client sent and answer every complete request line in it, returning -1 once the client is gone
+static int fat12_daemon_serve_client (fat12_daemon_cache* cache, fat12_daemon_client* client) {
+
+        ssize_t bytes_read = read(client->fd, client->buffer + client->length, sizeof(client->buffer) - client->length);
+        if (bytes_read < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return 0;
+        }
+        if (bytes_read <= 0) {
+                return -1;
+        }
+        client->length += (size_t)bytes_read;
+
+        char* start = client->buffer;
+        char* newline;
+        while ((newline = memchr(start, '\n', client->length - (size_t)(start - client->buffer))) != NULL) {
+                *newline = '\0';
+                if (fat12_daemon_answer(cache, client, start) != 0) {
+                        return -1;
+                }
+                start = newline + 1;
+        }
+        client->length -= (size_t)(start - client->buffer);
+        memmove(client->buffer, start, client->length);
+
+        // A full buffer without a newline is not a request this daemon can answer
+        return client->length == sizeof(client->buffer) ? -1 : 0;
+
+}
+
+// Function to create the per-user directory of the default socket, or check that an existing one is private to the user
+static fat12_status fat12_daemon_private_dir (const char* socket_path) {
+
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s", socket_path);
+        char* slash = strrchr(dir, '/');
+        if (slash == NULL || slash == dir) {
+                return FAT12_OK;
+        }
+        *slash = '\0';
+        if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+                return fat12_error(FAT12_ERR_IO, "Error creating %s: %s", dir, strerror(errno));
+        }
+        struct stat st;
+        if (lstat(dir, &st) != 0) {
+                return fat12_error(FAT12_ERR_IO, "Error opening %s: %s", dir, strerror(errno));
+        }
+        if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077) != 0) {
+                return fat12_error(FAT12_ERR_INVALID, "%s is not a directory private to this user", dir);
+        }
+        return FAT12_OK;
+
+}
+
+// Function to bind the listening socket, replacing a stale socket file but never a live daemon
+static fat12_status fat12_daemon_listen (const char* socket_path, int* fd) {
+
+        struct sockaddr_un address;
+        fat12_status status = fat12_daemon_address(socket_path, &address);
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        // The fallback default sits in /tmp, where only a directory of our own keeps others from taking the name first
+        char fallback[PATH_MAX];
+        snprintf(fallback, sizeof(fallback), "/tmp/fat12d-%u/fat12d.sock", (unsigned)getuid());
+        if (strcmp(socket_path, fallback) == 0) {
+                status = fat12_daemon_private_dir(socket_path);
+                if (status != FAT12_OK) {
+                        return status;
+                }
+        }
+
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0) {
+                return fat12_error(FAT12_ERR_IO, "Error creating socket: %s", strerror(errno));
+        }
+        int bound = bind(listener, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if (!bound && errno == EADDRINUSE) {
+                int live;
+                if (fat12_daemon_dial(socket_path, &live) == FAT12_OK) {
+                        close(live);
+                        close(listener);
+                        return fat12_error(FAT12_ERR_INVALID, "fat12d is already listening on %s", socket_path);
+                }
+                unlink(socket_path);
+                bound = bind(listener, (struct sockaddr*)&address, sizeof(address)) == 0;
+        }
+
+        // Nothing can connect before listen, so restricting the socket file here leaves no window open to other users
+        if (!bound || chmod(socket_path, 0600) != 0 || listen(listener, 64) != 0) {
+                status = fat12_error(FAT12_ERR_IO, "Error listening on %s: %s", socket_path, strerror(errno));
+                close(listener);
+                return status;
+        }
+        *fd = listener;
+        return FAT12_OK;
+
+}
+
+/*
+ * Runs fat12d: answers report requests on a Unix socket from images kept resident, until fat12_daemon_stop is called.
+ * Requests are served one at a time from a single poll loop; a resident image answers from its rendered report
+ * without touching the image again. Client sockets never block: what a client does not read yet is queued for it,
+ * and its further requests wait until it has caught up, while the other clients are served. An image is dropped as soon as inotify reports a change to it, and a stat
+ * before every answer catches the changes inotify misses.
+ *
+ * @param socket_path Where to listen. The socket is made readable and writable by its owner only, and the
+ *        connections of other users are closed unanswered.
+ * @param limits How many images, and how many bytes of them, to keep resident.
+ * @return FAT12_OK once stopped, or the reason the daemon could not start.
+ */
+fat12_status fat12_daemon_serve (const char* socket_path, const fat12_daemon_limits* limits) {
+
+        int listener = -1;
+        fat12_status status = fat12_daemon_listen(socket_path, &listener);
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        fat12_daemon_cache cache = { NULL, NULL, 0, 0, inotify_init1(IN_NONBLOCK | IN_CLOEXEC), *limits };
+        fat12_daemon_client* clients = NULL;
+        struct pollfd* fds = NULL;
+        size_t num_clients = 0;
+        size_t capacity = 0;
+
+        while (!fat12_daemon_stopping) {
+
+                // The listener and the inotify descriptor come first, then one slot per client
+                if (num_clients + 2 > capacity) {
+                        size_t grown_capacity = capacity > 0 ? capacity * 2 : 16;
+                        fat12_daemon_client* grown_clients = realloc(clients, grown_capacity * sizeof(fat12_daemon_client));
+                        if (grown_clients != NULL) {
+                                clients = grown_clients;
+                        }
+                        struct pollfd* grown_fds = realloc(fds, grown_capacity * sizeof(struct pollfd));
+                        if (grown_fds != NULL) {
+                                fds = grown_fds;
+                        }
+                        if (grown_clients == NULL || grown_fds == NULL) {
+                                status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                                break;
+                        }
+                        capacity = grown_capacity;
+                }
+                fds[0] = (struct pollfd){ listener, POLLIN, 0 };
+                fds[1] = (struct pollfd){ cache.inotify_fd, POLLIN, 0 };
+                for (size_t i = 0; i < num_clients; i++) {
+                        fds[i + 2] = (struct pollfd){ clients[i].fd, clients[i].pending_length > 0 ? POLLOUT : POLLIN, 0 };
+                }
+                if (poll(fds, num_clients + 2, -1) < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        status = fat12_error(FAT12_ERR_IO, "Error waiting for requests: %s", strerror(errno));
+                        break;
+                }
+
+                // Invalidate before answering, so no request sees an image changed before it arrived
+                if (fds[1].revents & POLLIN) {
+                        fat12_daemon_drain_events(&cache);
+                }
+                size_t kept = 0;
+                for (size_t i = 0; i < num_clients; i++) {
+                        short revents = fds[i + 2].revents;
+                        int gone;
+                        if (clients[i].pending_length > 0) {
+                                gone = revents != 0 && fat12_daemon_flush(&clients[i]) != 0;
+                        } else {
+                                gone = (revents & (POLLIN | POLLHUP | POLLERR)) && fat12_daemon_serve_client(&cache, &clients[i]) != 0;
+                        }
+                        if (gone) {
+                                close(clients[i].fd);
+                                free(clients[i].pending);
+                                continue;
+                        }
+                        clients[kept++] = clients[i];
+                }
+                num_clients = kept;
+                if (fds[0].revents & POLLIN) {
+                        // Only our own user and root are served; the socket's mode should already keep everyone else out
+                        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                        uid_t uid;
+                        if (fd >= 0 && (fat12_daemon_peer_uid(fd, &uid) != 0 || (uid != geteuid() && uid != 0))) {
+                                close(fd);
+                                fd = -1;
+                        }
+                        if (fd >= 0) {
+                                clients[num_clients].fd = fd;
+                                clients[num_clients].length = 0;
+                                clients[num_clients].pending = NULL;
+                                clients[num_clients].pending_sent = 0;
+                                clients[num_clients].pending_length = 0;
+                                clients[num_clients].pending_capacity = 0;
+                                num_clients++;
+                        }
+                }
+
+        }
+
+        for (size_t i = 0; i < num_clients; i++) {
+                close(clients[i].fd);
+                free(clients[i].pending);
+        }
+        while (cache.head != NULL) {
+                fat12_daemon_evict(&cache, cache.head);
+        }
+        if (cache.inotify_fd >= 0) {
+                close(cache.inotify_fd);
+        }
+        free(fds);
+        free(clients);
+        close(listener);
+        unlink(socket_path);
+        return status;
+
+}
+
+// Function to make fat12_daemon_serve return; safe to call from a signal handler
+void fat12_daemon_stop (void) {
+
+        fat12_daemon_stopping = 1;
+
+}
+
+// Function to check whether a command-line argument is --via-daemon[=<socket>], returning 1 if so (with socket_path set), -1 if the socket is empty, or 0 otherwise
+int fat12_daemon_parse_option (const char* arg, const char** socket_path) {
+
+        if (strcmp(arg, "--via-daemon") == 0) {
+                *socket_path = fat12_daemon_default_socket();
+                return 1;
+        }
+        if (strncmp(arg, "--via-daemon=", 13) == 0) {
+                *socket_path = arg + 13;
+                return arg[13] != '\0' ? 1 : -1;
+        }
+        return 0;
+
+}
@@ -0,0 +1,27 @@
+#ifndef FAT12_DAEMON_H
+#define FAT12_DAEMON_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "fat12_utils.h"
+
+// Reports a client can ask fat12d for, sent as the first byte of a request line
+typedef enum {
+        FAT12_DAEMON_INFO = 'I', // What diskinfo prints
+        FAT12_DAEMON_LIST = 'L' // What disklist prints
+} fat12_daemon_request;
+
+// Bounds on what fat12d keeps resident; the least recently used images are dropped first
+typedef struct {
+        size_t max_images;
+        size_t max_bytes; // Mapped images plus rendered reports
+} fat12_daemon_limits;
+
+const char* fat12_daemon_default_socket (void);
+fat12_status fat12_daemon_connect (const char* socket_path, int* fd);
+fat12_status fat12_daemon_query (int fd, fat12_daemon_request request, const char* image_path, FILE* out);
+fat12_status fat12_daemon_serve (const char* socket_path, const fat12_daemon_limits* limits);
+void fat12_daemon_stop (void);
+int fat12_daemon_parse_option (const char* arg, const char** socket_path);
+
+#endif
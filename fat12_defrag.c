@@ -0,0 +1,460 @@
+#include "fat12_defrag.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_fat.h"
+#include "fat12_path.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Bytes of destination clusters gathered before each write
+#define DEFRAG_WRITE_BUFFER_BYTES 65536
+
+// State of one fragmentation analysis, and the layout of the compacted image built along the way
+typedef struct {
+        const fat12_geometry* geometry;
+        const fat12_fat* fat;
+        uint32_t end_cluster; // One past the last cluster both the data region and the FAT cover
+        uint64_t* owned; // One bit per source cluster claimed by a chain so far
+        uint16_t* order; // Source cluster of each destination cluster, from cluster 2 on, chain after chain
+        uint32_t num_ordered;
+        uint16_t* remap; // Destination cluster of each source cluster in a chain, 0 for every other cluster
+        uint64_t* last; // One bit per destination cluster that ends its chain
+        uint64_t* directory; // One bit per destination cluster that holds a directory
+        FILE* out; // Where each chain is reported, or NULL
+        size_t num_problems;
+        char problem[FAT12_PATH_MAX + 128]; // The first chain that cannot be moved, and why
+        fat12_defrag_summary summary;
+} fat12_defrag;
+
+// Function to test one bit of a cluster bitset
+static inline int fat12_defrag_bit (const uint64_t* bitset, uint32_t cluster) {
+
+        return (int)(bitset[cluster / 64] >> (cluster % 64)) & 1;
+
+}
+
+// Function to set one bit of a cluster bitset
+static inline void fat12_defrag_set (uint64_t* bitset, uint32_t cluster) {
+
+        bitset[cluster / 64] |= (uint64_t)1 << (cluster % 64);
+
+}
+
+// Function to remember why a chain cannot be moved, keeping only the first reason
+__attribute__((format(printf, 2, 3)))
+static void fat12_defrag_problem (fat12_defrag* defrag, const char* format, ...) {
+
+        if (defrag->num_problems++ == 0) {
+                va_list args;
+                va_start(args, format);
+                vsnprintf(defrag->problem, sizeof(defrag->problem), format, args);
+                va_end(args);
+        }
+
+}
+
+/*
+ * Follows the cluster chain of one file or directory, counting its extents, and appends its clusters
+ * to the destination order so that it will occupy one run. Chains that leave the volume, loop, cross
+ * another chain, end badly or disagree with the file size are counted as far as they go and remembered
+ * as problems, since they cannot be moved safely.
+ */
+static void fat12_defrag_chain (fat12_defrag* defrag, const char* path, const char* entry, int is_directory) {
+
+        uint32_t size = get_file_size(entry);
+        uint32_t cluster = get_first_logical_cluster(entry);
+        if (cluster == 0) {
+                if (!is_directory && size > 0) {
+                        fat12_defrag_problem(defrag, "%s: no clusters for %u bytes", path, size);
+                }
+                return;
+        }
+
+        uint32_t first_ordered = defrag->num_ordered;
+        uint32_t length = 0;
+        uint32_t extents = 0;
+        uint32_t previous = 0;
+        int broken = 1;
+        for (;;) {
+                if (cluster < 2 || cluster >= defrag->end_cluster) {
+                        fat12_defrag_problem(defrag, "%s: chain points to invalid cluster %u", path, cluster);
+                        break;
+                }
+                if (fat12_defrag_bit(defrag->owned, cluster)) {
+                        fat12_defrag_problem(defrag, "%s: cluster %u is cross-linked or loops", path, cluster);
+                        break;
+                }
+                fat12_defrag_set(defrag->owned, cluster);
+                defrag->remap[cluster] = (uint16_t)(2 + defrag->num_ordered);
+                defrag->order[defrag->num_ordered++] = (uint16_t)cluster;
+                extents += length == 0 || cluster != previous + 1;
+                length++;
+                previous = cluster;
+
+                uint16_t next = defrag->fat->entries[cluster];
+                if (next >= FAT_ENTRY_END_OF_CHAIN_MIN) {
+                        broken = 0;
+                        break;
+                }
+                if (next == FAT_ENTRY_FREE || next >= 0xFF0) {
+                        fat12_defrag_problem(defrag, "%s: chain ends with 0x%03X at cluster %u", path, next, cluster);
+                        break;
+                }
+                cluster = next;
+        }
+        uint32_t cluster_size_bytes = defrag->geometry->cluster_size_bytes;
+        uint32_t expected = (uint32_t)(((uint64_t)size + cluster_size_bytes - 1) / cluster_size_bytes);
+        if (!broken && !is_directory && length != expected) {
+                fat12_defrag_problem(defrag, "%s: %u cluster%s for %u bytes, expected %u", path, length, length == 1 ? "" : "s", size, expected);
+        }
+        if (length == 0) {
+                return;
+        }
+
+        // The chain's destination clusters run from first_ordered on; mark where it ends and what it holds
+        fat12_defrag_set(defrag->last, 2 + defrag->num_ordered - 1);
+        if (is_directory) {
+                for (uint32_t i = first_ordered; i < defrag->num_ordered; i++) {
+                        fat12_defrag_set(defrag->directory, 2 + i);
+                }
+        }
+
+        fat12_defrag_summary* summary = &defrag->summary;
+        if (is_directory) {
+                summary->num_directories++;
+        } else {
+                summary->num_files++;
+        }
+        summary->num_fragmented += extents > 1;
+        summary->num_clusters += length;
+        summary->num_extents += extents;
+        if (defrag->out != NULL) {
+                fprintf(defrag->out, "%-8u %-9u %-8.1f %s%s\n", extents, length, (double)length / extents, path, is_directory ? "/" : "");
+        }
+
+}
+
+// Function to count the free clusters of the volume and the runs they form
+static void fat12_defrag_free_space (fat12_defrag* defrag) {
+
+        int in_run = 0;
+        for (uint32_t cluster = 2; cluster < defrag->end_cluster; cluster++) {
+                int is_free = defrag->fat->entries[cluster] == FAT_ENTRY_FREE;
+                defrag->summary.num_free_clusters += is_free;
+                defrag->summary.num_free_runs += is_free && !in_run;
+                in_run = is_free;
+        }
+
+}
+
+// Function to release what an analysis allocated
+static void fat12_defrag_free (fat12_defrag* defrag) {
+
+        free(defrag->owned);
+        free(defrag->order);
+        free(defrag->remap);
+        free(defrag->last);
+        free(defrag->directory);
+
+}
+
+/*
+ * Walks every file and subdirectory of the volume, following each chain once, and lays the chains out
+ * one after another from cluster 2, in walk order, so that each directory is followed by its contents.
+ *
+ * @param defrag The analysis, released with fat12_defrag_free whatever the result.
+ * @param volume The volume.
+ * @param out Where a line per chain is printed, or NULL.
+ * @return FAT12_OK if the walk completed, whatever problems it found, or the reason it could not.
+ */
+static fat12_status fat12_defrag_analyze (fat12_defrag* defrag, fat12_volume* volume, FILE* out) {
+
+        memset(defrag, 0, sizeof(*defrag));
+        defrag->out = out;
+        fat12_status status = fat12_volume_geometry(volume, &defrag->geometry);
+        if (status == FAT12_OK) {
+                status = fat12_volume_fat(volume, &defrag->fat);
+        }
+        if (status != FAT12_OK) {
+                return status;
+        }
+        defrag->end_cluster = defrag->geometry->end_cluster < defrag->fat->num_entries ? defrag->geometry->end_cluster : defrag->fat->num_entries;
+
+        size_t num_words = defrag->end_cluster / 64 + 1;
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 5);
+        defrag->owned = calloc(num_words, sizeof(uint64_t));
+        defrag->last = calloc(num_words, sizeof(uint64_t));
+        defrag->directory = calloc(num_words, sizeof(uint64_t));
+        defrag->order = malloc(defrag->end_cluster * sizeof(uint16_t));
+        defrag->remap = calloc(defrag->end_cluster, sizeof(uint16_t));
+        if (defrag->owned == NULL || defrag->last == NULL || defrag->directory == NULL || defrag->order == NULL || defrag->remap == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+
+        fat12_path_walker walker;
+        fat12_dir_item item;
+        int result = fat12_path_walker_init(&walker, volume);
+        while (result == FAT12_OK && (result = fat12_path_walker_next(&walker, &item)) == 1) {
+                fat12_defrag_chain(defrag, walker.path, item.entry, item.is_directory);
+                result = FAT12_OK;
+        }
+        fat12_path_walker_free(&walker);
+        if (result < 0) {
+                return (fat12_status)result;
+        }
+        fat12_defrag_free_space(defrag);
+        return FAT12_OK;
+
+}
+
+// Function to print the image-wide figures of an analysis
+static void fat12_defrag_print_summary (FILE* out, const fat12_defrag_summary* summary) {
+
+        size_t num_chains = summary->num_files + summary->num_directories;
+        fprintf(out, "%-12s %zu\n", "Files:", summary->num_files);
+        fprintf(out, "%-12s %zu\n", "Directories:", summary->num_directories);
+        fprintf(out, "%-12s %zu (%.1f%%)\n", "Fragmented:", summary->num_fragmented, num_chains > 0 ? 100.0 * summary->num_fragmented / num_chains : 0.0);
+        fprintf(out, "%-12s %llu\n", "Extents:", (unsigned long long)summary->num_extents);
+        fprintf(out, "%-12s %llu\n", "Clusters:", (unsigned long long)summary->num_clusters);
+        fprintf(out, "%-12s %.1f clusters\n", "Average run:", summary->num_extents > 0 ? (double)summary->num_clusters / summary->num_extents : 0.0);
+        fprintf(out, "%-12s %u clusters in %u run%s\n", "Free space:", summary->num_free_clusters, summary->num_free_runs, summary->num_free_runs == 1 ? "" : "s");
+
+}
+
+/*
+ * Reports the fragmentation of a volume from its FAT chains: one line per file and subdirectory with its
+ * extent count, cluster count, average run length and path, then the same figures for the whole image.
+ *
+ * @param volume The volume.
+ * @param out Where the report is printed.
+ * @param summary Set to the image-wide figures (may be NULL).
+ * @return FAT12_OK, or the reason the directory tree could not be walked.
+ */
+fat12_status fat12_defrag_report (fat12_volume* volume, FILE* out, fat12_defrag_summary* summary) {
+
+        fat12_defrag defrag;
+        fprintf(out, "%-8s %-9s %-8s %s\n", "Extents", "Clusters", "Avg run", "Path");
+        fat12_status status = fat12_defrag_analyze(&defrag, volume, out);
+        if (status == FAT12_OK) {
+                fputc('\n', out);
+                fat12_defrag_print_summary(out, &defrag.summary);
+                if (defrag.num_problems > 0) {
+                        fprintf(out, "%-12s %zu, first: %s\n", "Problems:", defrag.num_problems, defrag.problem);
+                }
+                if (summary != NULL) {
+                        *summary = defrag.summary;
+                }
+        }
+        fat12_defrag_free(&defrag);
+        return status;
+
+}
+
+// Function to point the entries of one stretch of a directory at the new places of their chains, returning 1 once its end-of-directory marker is reached
+static int fat12_defrag_patch (const fat12_defrag* defrag, char* entries, size_t length_bytes) {
+
+        for (size_t offset = 0; offset + DIR_ENTRY_SIZE_BYTES <= length_bytes; offset += DIR_ENTRY_SIZE_BYTES) {
+                char* entry = entries + offset;
+                if (entry[0] == 0x00) {
+                        return 1;
+                }
+                if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] == ATTRIBUTE_LONG_FILE_NAME) {
+                        continue;
+                }
+
+                // Deleted entries lose their clusters, whose old contents do not survive the move; "." and ".." are remapped like the rest
+                uint16_t cluster = get_first_logical_cluster(entry);
+                if ((unsigned char)entry[0] == 0xE5) {
+                        cluster = 0;
+                } else if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] & ATTRIBUTE_VOLUME_LABEL_BIT_MASK) {
+                        continue;
+                } else if (cluster >= 2) {
+                        cluster = cluster < defrag->end_cluster ? defrag->remap[cluster] : 0;
+                }
+                entry[FIRST_LOGICAL_CLUSTER_BYTE1] = (char)(cluster & 0xFF);
+                entry[FIRST_LOGICAL_CLUSTER_BYTE2] = (char)(cluster >> 8);
+        }
+        return 0;
+
+}
+
+// Function to write all of data to fd
+static fat12_status fat12_defrag_write (int fd, const char* data, size_t length, const char* dest_path) {
+
+        while (length > 0) {
+                ssize_t written = write(fd, data, length);
+                if (written < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (written <= 0) {
+                        return fat12_error(FAT12_ERR_IO, "Error writing %s: %s", dest_path, strerror(errno));
+                }
+                data += written;
+                length -= (size_t)written;
+        }
+        return FAT12_OK;
+
+}
+
+/*
+ * Builds everything before the data region of the compacted image: the source's boot sector and reserved
+ * sectors, every FAT copy rewritten for the new layout, and the root directory with its entries remapped.
+ * Clusters marked bad are not carried over, since the data they guarded has moved.
+ */
+static fat12_status fat12_defrag_metadata (const fat12_defrag* defrag, fat12_volume* volume, char** metadata) {
+
+        const fat12_geometry* geometry = defrag->geometry;
+        const char* source = fat12_volume_bytes(volume, 0, geometry->data_start_byte);
+        if (source == NULL) {
+                return fat12_error(FAT12_ERR_RANGE, "Error reading metadata: image too small");
+        }
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        char* built = malloc(geometry->data_start_byte);
+        if (built == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        memcpy(built, source, geometry->data_start_byte);
+
+        // Each chain is one run, so every cluster points at the next one until the last
+        size_t fat_length_bytes = (size_t)geometry->sectors_per_fat * geometry->bytes_per_sector;
+        unsigned char* fat = (unsigned char*)built + geometry->fat_start_byte;
+        for (uint32_t cluster = 2; cluster < defrag->fat->num_entries; cluster++) {
+                uint16_t value = FAT_ENTRY_FREE;
+                if (cluster < 2 + defrag->num_ordered) {
+                        value = fat12_defrag_bit(defrag->last, cluster) ? 0xFFF : (uint16_t)(cluster + 1);
+                }
+                fat12_fat_pack_entry(fat, cluster, value);
+        }
+        for (uint32_t copy = 1; copy < geometry->num_fats; copy++) {
+                memcpy(fat + copy * fat_length_bytes, fat, fat_length_bytes);
+        }
+
+        fat12_defrag_patch(defrag, built + geometry->root_start_byte, (size_t)geometry->root_entries * DIR_ENTRY_SIZE_BYTES);
+        *metadata = built;
+        return FAT12_OK;
+
+}
+
+// Function to write the data region of the compacted image in destination order, then whatever the source holds past it
+static fat12_status fat12_defrag_stream (const fat12_defrag* defrag, fat12_volume* volume, int fd, const char* dest_path) {
+
+        const fat12_geometry* geometry = defrag->geometry;
+        uint32_t cluster_size_bytes = geometry->cluster_size_bytes;
+        size_t capacity = cluster_size_bytes < DEFRAG_WRITE_BUFFER_BYTES ? DEFRAG_WRITE_BUFFER_BYTES / cluster_size_bytes * cluster_size_bytes : cluster_size_bytes;
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        char* buffer = malloc(capacity);
+        if (buffer == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+
+        // Used clusters first, each read from wherever it was and written where it now goes
+        fat12_status status = FAT12_OK;
+        size_t size = 0;
+        int directory_ended = 0;
+        for (uint32_t i = 0; i < defrag->num_ordered && status == FAT12_OK; i++) {
+                uint32_t destination = 2 + i;
+                const char* data = fat12_volume_bytes(volume, fat12_cluster_start_byte(geometry, defrag->order[i]), cluster_size_bytes);
+                if (data == NULL) {
+                        status = fat12_error(FAT12_ERR_RANGE, "Cluster %u lies beyond the end of the image", defrag->order[i]);
+                        break;
+                }
+                memcpy(buffer + size, data, cluster_size_bytes);
+                if (fat12_defrag_bit(defrag->directory, destination) && !directory_ended) {
+                        directory_ended = fat12_defrag_patch(defrag, buffer + size, cluster_size_bytes);
+                }
+                if (fat12_defrag_bit(defrag->last, destination)) {
+                        directory_ended = 0;
+                }
+                size += cluster_size_bytes;
+                if (size == capacity) {
+                        status = fat12_defrag_write(fd, buffer, size, dest_path);
+                        size = 0;
+                }
+        }
+        if (status == FAT12_OK && size > 0) {
+                status = fat12_defrag_write(fd, buffer, size, dest_path);
+        }
+
+        // Then free clusters as zeros, up to where the source image ends
+        size_t image_size = fat12_volume_size(volume);
+        size_t data_end_byte = fat12_cluster_start_byte(geometry, geometry->end_cluster);
+        if (data_end_byte > image_size) {
+                data_end_byte = image_size;
+        }
+        size_t position = fat12_cluster_start_byte(geometry, 2 + defrag->num_ordered);
+        memset(buffer, 0, capacity);
+        while (status == FAT12_OK && position < data_end_byte) {
+                size_t length = data_end_byte - position < capacity ? data_end_byte - position : capacity;
+                status = fat12_defrag_write(fd, buffer, length, dest_path);
+                position += length;
+        }
+
+        // Anything past the data region, such as a trailing partial sector, is copied as it is
+        if (status == FAT12_OK && position < image_size) {
+                const char* tail = fat12_volume_bytes(volume, (long int)position, image_size - position);
+                status = tail != NULL ? fat12_defrag_write(fd, tail, image_size - position, dest_path) : fat12_error(FAT12_ERR_RANGE, "Error reading image tail");
+        }
+
+        free(buffer);
+        return status;
+
+}
+
+/*
+ * Writes a compacted copy of a volume to dest_path, in which every file and subdirectory occupies one run
+ * of clusters, packed from cluster 2 in directory walk order with each directory ahead of its contents.
+ * The copy is made in one forward pass over the destination: metadata first, then each cluster in its
+ * destination order, then the free space as zeros. Every FAT copy and every first-cluster field,
+ * "." and ".." included, is updated to match. The source is not modified, and must not be dest_path.
+ *
+ * @param volume The volume to compact.
+ * @param dest_path The image to create or replace.
+ * @param summary Set to the fragmentation of the source (may be NULL).
+ * @return FAT12_OK, FAT12_ERR_INVALID if a chain is damaged (nothing is written then), or the reason the copy failed.
+ */
+fat12_status fat12_defrag_rewrite (fat12_volume* volume, const char* dest_path, fat12_defrag_summary* summary) {
+
+        fat12_defrag defrag;
+        fat12_status status = fat12_defrag_analyze(&defrag, volume, NULL);
+        if (status == FAT12_OK && defrag.num_problems > 0) {
+                status = fat12_error(FAT12_ERR_INVALID, "Cannot rewrite an inconsistent image (%s); run diskcheck", defrag.problem);
+        }
+        char* metadata = NULL;
+        if (status == FAT12_OK) {
+                status = fat12_defrag_metadata(&defrag, volume, &metadata);
+        }
+        if (status != FAT12_OK) {
+                fat12_defrag_free(&defrag);
+                return status;
+        }
+
+        int fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+                status = fat12_error(FAT12_ERR_IO, "Error creating %s: %s", dest_path, strerror(errno));
+        } else {
+                status = fat12_defrag_write(fd, metadata, defrag.geometry->data_start_byte, dest_path);
+                if (status == FAT12_OK) {
+                        status = fat12_defrag_stream(&defrag, volume, fd, dest_path);
+                }
+                if (close(fd) != 0 && status == FAT12_OK) {
+                        status = fat12_error(FAT12_ERR_IO, "Error writing %s: %s", dest_path, strerror(errno));
+                }
+                if (status != FAT12_OK) {
+                        unlink(dest_path);
+                }
+        }
+        if (status == FAT12_OK && summary != NULL) {
+                *summary = defrag.summary;
+        }
+
+        free(metadata);
+        fat12_defrag_free(&defrag);
+        return status;
+
+}
@@ -0,0 +1,23 @@
+#ifndef FAT12_DEFRAG_H
+#define FAT12_DEFRAG_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "fat12_utils.h"
+
+// Fragmentation of a volume, over the cluster chains of its files and subdirectories
+typedef struct {
+        size_t num_files; // Files with at least one cluster
+        size_t num_directories;
+        size_t num_fragmented; // Chains of more than one extent
+        uint64_t num_clusters;
+        uint64_t num_extents; // Runs of clusters that follow each other on disk
+        uint32_t num_free_clusters;
+        uint32_t num_free_runs;
+} fat12_defrag_summary;
+
+fat12_status fat12_defrag_report (fat12_volume* volume, FILE* out, fat12_defrag_summary* summary);
+fat12_status fat12_defrag_rewrite (fat12_volume* volume, const char* dest_path, fat12_defrag_summary* summary);
+
+#endif
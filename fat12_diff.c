@@ -0,0 +1,382 @@
+#include "fat12_diff.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_fat.h"
+#include "fat12_path.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// Seed of the content hashes used to pair removed files with added ones
+#define DIFF_HASH_SEED 0x4449464631324653ull
+
+// Content is hashed in sector-sized blocks; every cluster is a whole number of them, so hashes agree across layouts
+#define DIFF_BLOCK_BYTES SECTOR_SIZE_BYTES
+
+// What happened to a path between the old and the new image, as printed at the start of its line
+enum {
+        DIFF_UNCHANGED = 0,
+        DIFF_ADDED = 'A',
+        DIFF_REMOVED = 'D',
+        DIFF_MODIFIED = 'M',
+        DIFF_MOVED = 'R'
+};
+
+// One file or directory of an image being diffed
+typedef struct {
+        const char* entry; // The raw entry, pointing into the volume
+        const char* path; // Into the path arena of the tree, set once the walk is done
+        size_t path_offset;
+        int is_directory;
+        int change;
+        size_t moved_to; // For a moved item of the old tree, the index of its new item
+        int hash_state; // 0 until hashed, 1 once hash is set, -1 if the chain could not be followed
+        uint64_t hash;
+} fat12_diff_item;
+
+// Every path of one image, sorted so the two trees can be walked side by side
+typedef struct {
+        fat12_volume* volume;
+        const fat12_geometry* geometry;
+        const fat12_fat* fat;
+        uint32_t end_cluster; // One past the last cluster both the data region and the FAT cover
+        fat12_diff_item* items;
+        size_t num_items;
+        size_t items_capacity;
+        char* paths;
+        size_t paths_size;
+        size_t paths_capacity;
+} fat12_diff_tree;
+
+// Function to test one bit of a cluster bitset
+static inline int fat12_diff_bit (const uint64_t* bitset, uint32_t cluster) {
+
+        return (int)(bitset[cluster / 64] >> (cluster % 64)) & 1;
+
+}
+
+// Function to grow an array to hold at least the needed number of elements, doubling its capacity
+static fat12_status fat12_diff_reserve (void** data, size_t* capacity, size_t needed, size_t element_size) {
+
+        if (needed <= *capacity) {
+                return FAT12_OK;
+        }
+        size_t grown_capacity = *capacity > 0 ? *capacity : 256;
+        while (grown_capacity < needed) {
+                grown_capacity *= 2;
+        }
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        void* grown = realloc(*data, grown_capacity * element_size);
+        if (grown == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        *data = grown;
+        *capacity = grown_capacity;
+        return FAT12_OK;
+
+}
+
+// Function to order items by path
+static int fat12_diff_compare_items (const void* a, const void* b) {
+
+        return strcmp(((const fat12_diff_item*)a)->path, ((const fat12_diff_item*)b)->path);
+
+}
+
+// Function to walk every path of a volume into a tree, sorted by path
+static fat12_status fat12_diff_tree_load (fat12_diff_tree* tree, fat12_volume* volume) {
+
+        memset(tree, 0, sizeof(*tree));
+        tree->volume = volume;
+        fat12_status status = fat12_volume_geometry(volume, &tree->geometry);
+        if (status == FAT12_OK) {
+                status = fat12_volume_fat(volume, &tree->fat);
+        }
+        if (status != FAT12_OK) {
+                return status;
+        }
+        tree->end_cluster = tree->geometry->end_cluster < tree->fat->num_entries ? tree->geometry->end_cluster : tree->fat->num_entries;
+
+        fat12_path_walker walker;
+        fat12_dir_item item;
+        int result = fat12_path_walker_init(&walker, volume);
+        while (result == FAT12_OK && (result = fat12_path_walker_next(&walker, &item)) == 1) {
+                size_t path_size = strlen(walker.path) + 1;
+                result = fat12_diff_reserve((void**)&tree->items, &tree->items_capacity, tree->num_items + 1, sizeof(fat12_diff_item));
+                if (result == FAT12_OK) {
+                        result = fat12_diff_reserve((void**)&tree->paths, &tree->paths_capacity, tree->paths_size + path_size, 1);
+                }
+                if (result != FAT12_OK) {
+                        break;
+                }
+                fat12_diff_item* added = &tree->items[tree->num_items++];
+                memset(added, 0, sizeof(*added));
+                added->entry = item.entry;
+                added->path_offset = tree->paths_size;
+                added->is_directory = item.is_directory;
+                memcpy(tree->paths + tree->paths_size, walker.path, path_size);
+                tree->paths_size += path_size;
+        }
+        fat12_path_walker_free(&walker);
+        if (result < 0) {
+                return (fat12_status)result;
+        }
+
+        // The arena has stopped moving, so paths can be pointed at now
+        for (size_t i = 0; i < tree->num_items; i++) {
+                tree->items[i].path = tree->paths + tree->items[i].path_offset;
+        }
+        qsort(tree->items, tree->num_items, sizeof(fat12_diff_item), fat12_diff_compare_items);
+        return FAT12_OK;
+
+}
+
+// Function to release the memory held by a tree
+static void fat12_diff_tree_free (fat12_diff_tree* tree) {
+
+        free(tree->items);
+        free(tree->paths);
+
+}
+
+/*
+ * Marks every cluster that differs between two images of the same layout: allocated in either image,
+ * and with a different FAT entry or different contents. Clusters free in both are skipped without being read,
+ * so this is at most one sequential pass over the data of each image.
+ */
+static fat12_status fat12_diff_changed_clusters (fat12_diff_tree* old_tree, fat12_diff_tree* new_tree, uint64_t** changed) {
+
+        uint32_t end_cluster = old_tree->end_cluster < new_tree->end_cluster ? old_tree->end_cluster : new_tree->end_cluster;
+        uint32_t cluster_size_bytes = old_tree->geometry->cluster_size_bytes;
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        *changed = calloc((old_tree->end_cluster + 63) / 64, sizeof(uint64_t)); // Indexed by clusters of the old chains
+        if (*changed == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+
+        const uint16_t* old_entries = old_tree->fat->entries;
+        const uint16_t* new_entries = new_tree->fat->entries;
+        for (uint32_t cluster = 2; cluster < end_cluster; cluster++) {
+                if (old_entries[cluster] == FAT_ENTRY_FREE && new_entries[cluster] == FAT_ENTRY_FREE) {
+                        continue;
+                }
+                int different = old_entries[cluster] != new_entries[cluster];
+                if (!different) {
+                        uint32_t start_byte = fat12_cluster_start_byte(old_tree->geometry, cluster);
+                        const char* old_data = fat12_volume_bytes(old_tree->volume, start_byte, cluster_size_bytes);
+                        const char* new_data = fat12_volume_bytes(new_tree->volume, start_byte, cluster_size_bytes);
+                        different = old_data == NULL || new_data == NULL || memcmp(old_data, new_data, cluster_size_bytes) != 0;
+                }
+                if (different) {
+                        (*changed)[cluster / 64] |= (uint64_t)1 << (cluster % 64);
+                }
+        }
+
+        // Clusters past the end of the smaller image have nothing to match
+        for (uint32_t cluster = end_cluster; cluster < old_tree->end_cluster; cluster++) {
+                (*changed)[cluster / 64] |= (uint64_t)1 << (cluster % 64);
+        }
+        return FAT12_OK;
+
+}
+
+// Function to check whether any cluster of a file's chain differs, following the chain for as many clusters as its size needs
+static int fat12_diff_chain_changed (const fat12_diff_tree* tree, const uint64_t* changed, const char* entry) {
+
+        uint32_t cluster_size_bytes = tree->geometry->cluster_size_bytes;
+        uint32_t num_clusters = (uint32_t)(((uint64_t)get_file_size(entry) + cluster_size_bytes - 1) / cluster_size_bytes);
+        uint32_t cluster = get_first_logical_cluster(entry);
+        for (uint32_t i = 0; i < num_clusters; i++) {
+                if (cluster < 2 || cluster >= tree->end_cluster || fat12_diff_bit(changed, cluster)) {
+                        return 1;
+                }
+                cluster = tree->fat->entries[cluster];
+        }
+        return 0;
+
+}
+
+/*
+ * Hashes the contents of a file once, cluster by cluster along its chain, and caches the result in the item.
+ * Only files whose clusters differ, or that may have moved, are ever hashed.
+ *
+ * @param tree The tree the item belongs to.
+ * @param item The file.
+ * @return 1 if item->hash holds the content hash, or 0 if the chain leaves the volume before the end of the file.
+ */
+static int fat12_diff_content_hash (fat12_diff_tree* tree, fat12_diff_item* item) {
+
+        if (item->hash_state != 0) {
+                return item->hash_state > 0;
+        }
+        item->hash_state = -1;
+
+        uint32_t cluster_size_bytes = tree->geometry->cluster_size_bytes;
+        uint32_t remaining = get_file_size(item->entry);
+        uint32_t cluster = get_first_logical_cluster(item->entry);
+        uint64_t hash = DIFF_HASH_SEED;
+        while (remaining > 0) {
+                if (cluster < 2 || cluster >= tree->end_cluster) {
+                        return 0;
+                }
+                uint32_t length = remaining < cluster_size_bytes ? remaining : cluster_size_bytes;
+                const char* data = fat12_volume_bytes(tree->volume, fat12_cluster_start_byte(tree->geometry, cluster), length);
+                if (data == NULL) {
+                        return 0;
+                }
+                for (uint32_t offset = 0; offset < length; offset += DIFF_BLOCK_BYTES) {
+                        hash = fat12_hash64(hash, data + offset, length - offset < DIFF_BLOCK_BYTES ? length - offset : DIFF_BLOCK_BYTES);
+                }
+                remaining -= length;
+                cluster = tree->fat->entries[cluster];
+        }
+        item->hash = hash;
+        item->hash_state = 1;
+        return 1;
+
+}
+
+// Function to check whether a file present at the same path in both images changed, in its entry or its contents
+static int fat12_diff_file_changed (fat12_diff_tree* old_tree, fat12_diff_item* old_item, fat12_diff_tree* new_tree, fat12_diff_item* new_item, const uint64_t* changed) {
+
+        // Everything in the entry but the first cluster, which moves when the file is rewritten elsewhere with the same contents
+        if (memcmp(old_item->entry, new_item->entry, FIRST_LOGICAL_CLUSTER_BYTE1) != 0 || memcmp(old_item->entry + FILE_SIZE_START_BYTE, new_item->entry + FILE_SIZE_START_BYTE, FILE_SIZE_LENGTH_BYTES) != 0) {
+                return 1;
+        }
+
+        // Same chain, none of it touched: the same clusters hold the same bytes, so nothing needs hashing
+        if (changed != NULL && get_first_logical_cluster(old_item->entry) == get_first_logical_cluster(new_item->entry) && !fat12_diff_chain_changed(old_tree, changed, old_item->entry)) {
+                return 0;
+        }
+        if (!fat12_diff_content_hash(old_tree, old_item) || !fat12_diff_content_hash(new_tree, new_item)) {
+                return 1;
+        }
+        return old_item->hash != new_item->hash;
+
+}
+
+// Function to pair every removed file with an added file of the same size and contents, turning the pair into a move
+static void fat12_diff_find_moves (fat12_diff_tree* old_tree, fat12_diff_tree* new_tree) {
+
+        for (size_t i = 0; i < old_tree->num_items; i++) {
+                fat12_diff_item* old_item = &old_tree->items[i];
+                uint32_t size = get_file_size(old_item->entry);
+                if (old_item->change != DIFF_REMOVED || old_item->is_directory || size == 0) {
+                        continue; // Empty files all look alike, so they are never paired
+                }
+                for (size_t j = 0; j < new_tree->num_items; j++) {
+                        fat12_diff_item* new_item = &new_tree->items[j];
+                        if (new_item->change != DIFF_ADDED || new_item->is_directory || get_file_size(new_item->entry) != size) {
+                                continue;
+                        }
+                        if (!fat12_diff_content_hash(old_tree, old_item)) {
+                                break;
+                        }
+                        if (fat12_diff_content_hash(new_tree, new_item) && new_item->hash == old_item->hash) {
+                                old_item->change = DIFF_MOVED;
+                                old_item->moved_to = j;
+                                new_item->change = DIFF_MOVED;
+                                break;
+                        }
+                }
+        }
+
+}
+
+// Function to print the line for one changed item of either tree
+static void fat12_diff_print (FILE* out, const fat12_diff_item* item, const fat12_diff_tree* new_tree) {
+
+        if (item->change == DIFF_MOVED) {
+                fprintf(out, "R %s -> %s\n", item->path, new_tree->items[item->moved_to].path);
+        } else {
+                fprintf(out, "%c %s%s\n", item->change, item->path, item->is_directory ? "/" : "");
+        }
+
+}
+
+/*
+ * Compares two images and prints one line per path that differs, in path order:
+ * "A PATH" for a path only in the new image, "D PATH" for one only in the old image,
+ * "M PATH" for a file whose entry or contents changed, and "R OLD -> NEW" for a file that was
+ * removed in one place and added with the same contents in another. Directories end in '/'.
+ *
+ * When both images have the same layout, clusters are compared in place first: a file still on the same
+ * chain, with none of its clusters differing, is unchanged without being read. Only files that changed,
+ * were rewritten elsewhere, or may have moved are hashed. Images of different layouts are compared by hashing.
+ *
+ * @param old_volume The image before.
+ * @param new_volume The image after.
+ * @param out Where the differences are printed.
+ * @param num_changes Set to the number of lines printed.
+ * @return FAT12_OK, or the reason an image could not be read.
+ */
+fat12_status fat12_diff_volumes (fat12_volume* old_volume, fat12_volume* new_volume, FILE* out, size_t* num_changes) {
+
+        fat12_diff_tree old_tree;
+        fat12_diff_tree new_tree;
+        uint64_t* changed = NULL;
+        fat12_status status = fat12_diff_tree_load(&old_tree, old_volume);
+        if (status != FAT12_OK) {
+                fat12_diff_tree_free(&old_tree);
+                return status;
+        }
+        status = fat12_diff_tree_load(&new_tree, new_volume);
+        const fat12_geometry* old_geometry = old_tree.geometry;
+        const fat12_geometry* new_geometry = new_tree.geometry;
+        if (status == FAT12_OK && old_geometry->data_start_byte == new_geometry->data_start_byte && old_geometry->cluster_size_bytes == new_geometry->cluster_size_bytes) {
+                status = fat12_diff_changed_clusters(&old_tree, &new_tree, &changed);
+        }
+
+        // Both trees are sorted, so paths present in both meet as the two are walked side by side
+        size_t i = 0;
+        size_t j = 0;
+        while (status == FAT12_OK && (i < old_tree.num_items || j < new_tree.num_items)) {
+                int order = i >= old_tree.num_items ? 1 : j >= new_tree.num_items ? -1 : strcmp(old_tree.items[i].path, new_tree.items[j].path);
+                if (order < 0) {
+                        old_tree.items[i++].change = DIFF_REMOVED;
+                } else if (order > 0) {
+                        new_tree.items[j++].change = DIFF_ADDED;
+                } else {
+                        fat12_diff_item* old_item = &old_tree.items[i++];
+                        fat12_diff_item* new_item = &new_tree.items[j++];
+                        if (old_item->is_directory != new_item->is_directory) {
+                                old_item->change = DIFF_REMOVED;
+                                new_item->change = DIFF_ADDED;
+                        } else if (!old_item->is_directory && fat12_diff_file_changed(&old_tree, old_item, &new_tree, new_item, changed)) {
+                                old_item->change = DIFF_MODIFIED;
+                        }
+                }
+        }
+
+        // Print in path order, a move where its old path was
+        if (status == FAT12_OK) {
+                fat12_diff_find_moves(&old_tree, &new_tree);
+                size_t count = 0;
+                for (i = 0, j = 0; i < old_tree.num_items || j < new_tree.num_items;) {
+                        int order = i >= old_tree.num_items ? 1 : j >= new_tree.num_items ? -1 : strcmp(old_tree.items[i].path, new_tree.items[j].path);
+                        if (order <= 0) {
+                                const fat12_diff_item* old_item = &old_tree.items[i++];
+                                if (old_item->change != DIFF_UNCHANGED) {
+                                        fat12_diff_print(out, old_item, &new_tree);
+                                        count++;
+                                }
+                        }
+                        if (order >= 0) {
+                                const fat12_diff_item* new_item = &new_tree.items[j++];
+                                if (new_item->change == DIFF_ADDED) {
+                                        fat12_diff_print(out, new_item, &new_tree);
+                                        count++;
+                                }
+                        }
+                }
+                *num_changes = count;
+        }
+
+        free(changed);
+        fat12_diff_tree_free(&new_tree);
+        fat12_diff_tree_free(&old_tree);
+        return status;
+
+}
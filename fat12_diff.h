@@ -0,0 +1,10 @@
+#ifndef FAT12_DIFF_H
+#define FAT12_DIFF_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "fat12_utils.h"
+
+fat12_status fat12_diff_volumes (fat12_volume* old_volume, fat12_volume* new_volume, FILE* out, size_t* num_changes);
+
+#endif
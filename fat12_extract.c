@@ -0,0 +1,320 @@
+#define _GNU_SOURCE // copy_file_range
+#include "fat12_extract.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_fat.h"
+#include "fat12_path.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+// Ways of moving an extent from the image to the destination, from the cheapest down
+typedef enum {
+        FAT12_COPY_FILE_RANGE, // In-kernel copy between files, possibly sharing blocks
+        FAT12_COPY_SENDFILE, // In-kernel copy to any descriptor, pipes and sockets included
+        FAT12_COPY_WRITE // write() straight out of the mapped or buffered image
+} fat12_copy_method;
+
+/*
+ * Resolves the cluster chain of a file through the FAT into extents, merging clusters that follow
+ * each other on disk, with the last extent trimmed to the file size from the entry.
+ * The caller is responsible for freeing the extents.
+ *
+ * @param volume The volume.
+ * @param entry The raw directory entry of the file.
+ * @param extents Set to the extents, in file order (NULL for an empty file).
+ * @param num_extents Set to the number of extents.
+ * @return FAT12_OK, or FAT12_ERR_INVALID if the chain is broken or shorter than the file.
+ */
+fat12_status fat12_file_extents (fat12_volume* volume, const char* entry, fat12_extent** extents, size_t* num_extents) {
+
+        const fat12_geometry* geometry;
+        const fat12_fat* fat;
+        fat12_status status = fat12_volume_geometry(volume, &geometry);
+        if (status == FAT12_OK) {
+                status = fat12_volume_fat(volume, &fat);
+        }
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        uint32_t remaining = get_file_size(entry);
+        uint16_t cluster = get_first_logical_cluster(entry);
+        fat12_extent* list = NULL;
+        size_t count = 0;
+        size_t capacity = 0;
+
+        // A chain can have no more links than the FAT has entries, which also stops loops
+        for (uint32_t steps = 0; remaining > 0; steps++) {
+                if (cluster < 2 || cluster >= FAT_ENTRY_BAD || cluster >= fat->num_entries || steps >= fat->num_entries) {
+                        free(list);
+                        return fat12_error(FAT12_ERR_INVALID, "Broken cluster chain at cluster %u with %u bytes left", cluster, remaining);
+                }
+
+                uint32_t start_byte = fat12_cluster_start_byte(geometry, cluster);
+                uint32_t length_bytes = remaining < geometry->cluster_size_bytes ? remaining : geometry->cluster_size_bytes;
+                if ((size_t)start_byte + length_bytes > fat12_volume_size(volume)) {
+                        free(list);
+                        return fat12_error(FAT12_ERR_RANGE, "Cluster %u lies beyond the end of the image", cluster);
+                }
+
+                if (count > 0 && list[count - 1].start_byte + list[count - 1].length_bytes == start_byte) {
+                        list[count - 1].length_bytes += length_bytes;
+                } else {
+                        if (count == capacity) {
+                                capacity = capacity > 0 ? capacity * 2 : 8;
+                                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                                fat12_extent* grown = realloc(list, capacity * sizeof(fat12_extent));
+                                if (grown == NULL) {
+                                        free(list);
+                                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                                }
+                                list = grown;
+                        }
+                        list[count].start_byte = start_byte;
+                        list[count].length_bytes = length_bytes;
+                        count++;
+                }
+
+                remaining -= length_bytes;
+                cluster = fat12_fat_next(fat, cluster);
+        }
+
+        *extents = list;
+        *num_extents = count;
+        return FAT12_OK;
+
+}
+
+// Function to copy one extent of the image to fd, falling back to a cheaper-to-support method whenever the current one is refused
+static fat12_status fat12_copy_extent (fat12_volume* volume, const fat12_extent* extent, int fd, fat12_copy_method* method) {
+
+        off_t offset = extent->start_byte;
+        size_t remaining = extent->length_bytes;
+        fat12_stats_add(FAT12_STAT_BYTES_READ, remaining);
+
+        while (remaining > 0) {
+                ssize_t copied;
+                if (*method == FAT12_COPY_FILE_RANGE) {
+                        copied = copy_file_range(volume->fd, &offset, fd, NULL, remaining, 0);
+                } else if (*method == FAT12_COPY_SENDFILE) {
+                        copied = sendfile(fd, volume->fd, &offset, remaining);
+                } else {
+                        copied = write(fd, volume->data + offset, remaining);
+                        if (copied > 0) {
+                                offset += copied;
+                        }
+                }
+                fat12_stats_add(FAT12_STAT_READ_CALLS, 1);
+
+                if (copied < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (copied <= 0 && *method != FAT12_COPY_WRITE && (copied == 0 || errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)) {
+                        (*method)++; // Not supported between these descriptors, so try the next method
+                        continue;
+                }
+                if (copied <= 0) {
+                        return fat12_error(FAT12_ERR_IO, "Error writing file: %s", copied < 0 ? strerror(errno) : "no progress");
+                }
+                remaining -= (size_t)copied;
+        }
+
+        return FAT12_OK;
+
+}
+
+/*
+ * Writes the content of a file to fd, extent by extent, with copy_file_range or sendfile
+ * when the volume is backed by a file and write() from memory otherwise.
+ *
+ * @param volume The volume.
+ * @param entry The raw directory entry of the file.
+ * @param fd The destination, written at its current position.
+ * @return FAT12_OK, or the reason the file could not be extracted.
+ */
+fat12_status fat12_extract_file (fat12_volume* volume, const char* entry, int fd) {
+
+        fat12_extent* extents;
+        size_t num_extents;
+        fat12_status status = fat12_file_extents(volume, entry, &extents, &num_extents);
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        fat12_copy_method method = volume->fd >= 0 ? FAT12_COPY_FILE_RANGE : FAT12_COPY_WRITE;
+        for (size_t i = 0; i < num_extents && status == FAT12_OK; i++) {
+                status = fat12_copy_extent(volume, &extents[i], fd, &method);
+        }
+
+        free(extents);
+        return status;
+
+}
+
+// One file waiting to be extracted by fat12_extract_tree
+typedef struct {
+        const char* entry;
+        uint16_t first_cluster;
+        size_t path_offset; // Offset of the destination path in the path arena
+} fat12_extract_job;
+
+// Function to order jobs by where the file starts on disk
+static int fat12_extract_job_compare (const void* a, const void* b) {
+
+        const fat12_extract_job* job_a = a;
+        const fat12_extract_job* job_b = b;
+        return (int)job_a->first_cluster - (int)job_b->first_cluster;
+
+}
+
+// Function to append a null-terminated string to a growable arena, setting offset to where it starts
+static fat12_status fat12_arena_append (char** arena, size_t* size, size_t* capacity, const char* string, size_t* offset) {
+
+        size_t length = strlen(string) + 1;
+        if (*size + length > *capacity) {
+                size_t grown_capacity = *capacity > 0 ? *capacity * 2 : 4096;
+                while (*size + length > grown_capacity) {
+                        grown_capacity *= 2;
+                }
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                char* grown = realloc(*arena, grown_capacity);
+                if (grown == NULL) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                *arena = grown;
+                *capacity = grown_capacity;
+        }
+        memcpy(*arena + *size, string, length);
+        *offset = *size;
+        *size += length;
+        return FAT12_OK;
+
+}
+
+/*
+ * Extracts every file and subdirectory below a directory of the volume into dest_dir, recreating the tree.
+ * Directories are created while walking; files are then written in the order they start on disk,
+ * so a whole image unpacks in one forward pass over it.
+ *
+ * @param volume The volume.
+ * @param dir_path The directory to extract, such as "SUBDIR", by its long or its short path; NULL, "" or "/" extracts the whole image.
+ * @param dest_dir The directory to extract into, created if needed.
+ * @param num_files Set to the number of files extracted (may be NULL).
+ * @return FAT12_OK, or the reason the tree could not be extracted.
+ */
+fat12_status fat12_extract_tree (fat12_volume* volume, const char* dir_path, const char* dest_dir, size_t* num_files) {
+
+        if (dir_path == NULL) {
+                dir_path = "";
+        }
+        while (*dir_path == '/') {
+                dir_path++;
+        }
+        size_t dir_path_length = strlen(dir_path);
+        while (dir_path_length > 0 && dir_path[dir_path_length - 1] == '/') {
+                dir_path_length--;
+        }
+        int dir_depth = 0;
+        for (size_t i = 0; i < dir_path_length; i++) {
+                dir_depth += dir_path[i] == '/';
+        }
+        if (mkdir(dest_dir, 0755) != 0 && errno != EEXIST) {
+                return fat12_error(FAT12_ERR_IO, "Error creating directory %s: %s", dest_dir, strerror(errno));
+        }
+
+        fat12_extract_job* jobs = NULL;
+        size_t num_jobs = 0;
+        size_t jobs_capacity = 0;
+        char* arena = NULL;
+        size_t arena_size = 0;
+        size_t arena_capacity = 0;
+        int found_dir = dir_path_length == 0;
+        char dest_path[FAT12_PATH_MAX + 4096];
+
+        // Create the directories and queue the files of the subtree
+        fat12_path_walker walker;
+        fat12_dir_item item;
+        int status = fat12_path_walker_init(&walker, volume);
+        while (status == FAT12_OK && (status = fat12_path_walker_next(&walker, &item)) == 1) {
+                status = FAT12_OK;
+                if (item.is_directory && dir_path_length > 0 && (fat12_path_equal(walker.path, dir_path) || fat12_path_equal(walker.short_path, dir_path))) {
+                        found_dir = 1;
+                        continue;
+                }
+                if (!fat12_path_within(walker.path, dir_path) && !fat12_path_within(walker.short_path, dir_path)) {
+                        continue;
+                }
+
+                // Files are named by their long paths below the directory, whichever form of its path was given
+                const char* relative_path = walker.path + (dir_path_length > 0 ? walker.dir_lengths[dir_depth] : 0);
+                // A short name can hold any byte, '/' included, so a crafted entry could climb out of dest_dir
+                if (!fat12_path_is_safe(relative_path)) {
+                        status = fat12_error(FAT12_ERR_INVALID, "Unsafe path in image: %s", relative_path);
+                        continue;
+                }
+                snprintf(dest_path, sizeof(dest_path), "%s/%s", dest_dir, relative_path);
+                if (item.is_directory) {
+                        if (mkdir(dest_path, 0755) != 0 && errno != EEXIST) {
+                                status = fat12_error(FAT12_ERR_IO, "Error creating directory %s: %s", dest_path, strerror(errno));
+                        }
+                        continue;
+                }
+
+                if (num_jobs == jobs_capacity) {
+                        jobs_capacity = jobs_capacity > 0 ? jobs_capacity * 2 : 64;
+                        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                        fat12_extract_job* grown = realloc(jobs, jobs_capacity * sizeof(fat12_extract_job));
+                        if (grown == NULL) {
+                                status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                                continue;
+                        }
+                        jobs = grown;
+                }
+                fat12_extract_job* job = &jobs[num_jobs];
+                job->entry = item.entry;
+                job->first_cluster = get_first_logical_cluster(item.entry);
+                status = fat12_arena_append(&arena, &arena_size, &arena_capacity, dest_path, &job->path_offset);
+                if (status == FAT12_OK) {
+                        num_jobs++;
+                }
+        }
+        fat12_path_walker_free(&walker);
+        if (status == FAT12_OK && !found_dir) {
+                status = fat12_error(FAT12_ERR_NOT_FOUND, "Directory not found: %s", dir_path);
+        }
+
+        // Write the files in on-disk order
+        if (status == FAT12_OK) {
+                qsort(jobs, num_jobs, sizeof(fat12_extract_job), fat12_extract_job_compare);
+        }
+        for (size_t i = 0; i < num_jobs && status == FAT12_OK; i++) {
+                const char* path = arena + jobs[i].path_offset;
+                int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0) {
+                        status = fat12_error(FAT12_ERR_IO, "Error creating file %s: %s", path, strerror(errno));
+                        break;
+                }
+                status = fat12_extract_file(volume, jobs[i].entry, fd);
+                if (close(fd) != 0 && status == FAT12_OK) {
+                        status = fat12_error(FAT12_ERR_IO, "Error writing file %s: %s", path, strerror(errno));
+                }
+        }
+
+        free(arena);
+        free(jobs);
+        if (status < 0) {
+                return (fat12_status)status;
+        }
+        if (num_files != NULL) {
+                *num_files = num_jobs;
+        }
+        return FAT12_OK;
+
+}
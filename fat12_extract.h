@@ -0,0 +1,18 @@
+#ifndef FAT12_EXTRACT_H
+#define FAT12_EXTRACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fat12_utils.h"
+
+// Run of consecutive clusters of a file, as a byte range of the image
+typedef struct {
+        uint32_t start_byte;
+        uint32_t length_bytes;
+} fat12_extent;
+
+fat12_status fat12_file_extents (fat12_volume* volume, const char* entry, fat12_extent** extents, size_t* num_extents);
+fat12_status fat12_extract_file (fat12_volume* volume, const char* entry, int fd);
+fat12_status fat12_extract_tree (fat12_volume* volume, const char* dir_path, const char* dest_dir, size_t* num_files);
+
+#endif
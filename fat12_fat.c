@@ -0,0 +1,310 @@
+#include "fat12_fat.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FAT12_FAT_X86 1
+#endif
+
+const uint16_t FAT_ENTRY_FREE = 0x000;
+const uint16_t FAT_ENTRY_BAD = 0xFF7;
+const uint16_t FAT_ENTRY_END_OF_CHAIN_MIN = 0xFF8;
+
+/*
+ * Unpacks num_entries 12-bit FAT entries into 16-bit slots, one pair of entries per three bytes.
+ * Per the FAT12 layout, an even entry n is the low byte at n * 3 / 2 plus the low nibble of the byte after it,
+ * and an odd entry is the high nibble of the byte at n * 3 / 2 plus the byte after it.
+ * This is the reference implementation the vectorized kernels are checked against.
+ *
+ * @param raw The packed FAT, at least (num_entries * 3 + 1) / 2 bytes long.
+ * @param entries The destination, num_entries slots long.
+ * @param num_entries The number of entries to unpack.
+ */
+void fat12_fat_unpack_scalar (const unsigned char* raw, uint16_t* entries, size_t num_entries) {
+
+        size_t n = 0;
+        for (; n + 1 < num_entries; n += 2) {
+                const unsigned char* pair = raw + n / 2 * 3;
+                entries[n] = (uint16_t)(pair[0] | ((pair[1] & 0x0F) << 8));
+                entries[n + 1] = (uint16_t)((pair[1] >> 4) | (pair[2] << 4));
+        }
+        if (n < num_entries) {
+                const unsigned char* pair = raw + n / 2 * 3;
+                entries[n] = (uint16_t)(pair[0] | ((pair[1] & 0x0F) << 8));
+        }
+
+}
+
+#ifdef FAT12_FAT_X86
+
+// Byte pairs that hold each of the eight entries packed into twelve bytes (even entries start on a byte, odd ones on a nibble)
+#define FAT12_UNPACK_SHUFFLE 0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11
+// Even entries are shifted up by a nibble so that one right shift by 4 leaves the 12 bits of every lane
+#define FAT12_UNPACK_MULTIPLIER 16, 1, 16, 1, 16, 1, 16, 1
+
+// Function to unpack eight entries per step with SSSE3, returning the number of entries handled
+__attribute__((target("ssse3")))
+static size_t fat12_fat_unpack_ssse3 (const unsigned char* raw, uint16_t* entries, size_t num_entries, size_t raw_length_bytes) {
+
+        const __m128i shuffle = _mm_setr_epi8(FAT12_UNPACK_SHUFFLE);
+        const __m128i multiplier = _mm_setr_epi16(FAT12_UNPACK_MULTIPLIER);
+        size_t n = 0;
+
+        // Each step consumes 12 bytes but loads 16, so stop while a full load still fits
+        for (; n + 8 <= num_entries && n / 2 * 3 + 16 <= raw_length_bytes; n += 8) {
+                __m128i bytes = _mm_loadu_si128((const __m128i*)(raw + n / 2 * 3));
+                __m128i words = _mm_shuffle_epi8(bytes, shuffle);
+                words = _mm_srli_epi16(_mm_mullo_epi16(words, multiplier), 4);
+                _mm_storeu_si128((__m128i*)(entries + n), words);
+        }
+
+        return n;
+
+}
+
+// Function to unpack sixteen entries per step with AVX2, returning the number of entries handled
+__attribute__((target("avx2")))
+static size_t fat12_fat_unpack_avx2 (const unsigned char* raw, uint16_t* entries, size_t num_entries, size_t raw_length_bytes) {
+
+        const __m256i shuffle = _mm256_setr_epi8(FAT12_UNPACK_SHUFFLE, FAT12_UNPACK_SHUFFLE);
+        const __m256i multiplier = _mm256_setr_epi16(FAT12_UNPACK_MULTIPLIER, FAT12_UNPACK_MULTIPLIER);
+        size_t n = 0;
+
+        // The upper lane is loaded from 12 bytes further on, so the last load ends at offset 28
+        for (; n + 16 <= num_entries && n / 2 * 3 + 28 <= raw_length_bytes; n += 16) {
+                const unsigned char* src = raw + n / 2 * 3;
+                __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)src)),
+                                                        _mm_loadu_si128((const __m128i*)(src + 12)), 1);
+                __m256i words = _mm256_shuffle_epi8(bytes, shuffle);
+                words = _mm256_srli_epi16(_mm256_mullo_epi16(words, multiplier), 4);
+                _mm256_storeu_si256((__m256i*)(entries + n), words);
+        }
+
+        return n;
+
+}
+
+#endif
+
+/*
+ * Unpacks num_entries 12-bit FAT entries into 16-bit slots with the widest kernel the CPU supports,
+ * finishing the tail with the scalar path.
+ *
+ * @param raw The packed FAT, at least (num_entries * 3 + 1) / 2 bytes long.
+ * @param entries The destination, num_entries slots long.
+ * @param num_entries The number of entries to unpack.
+ */
+void fat12_fat_unpack (const unsigned char* raw, uint16_t* entries, size_t num_entries) {
+
+        size_t n = 0;
+
+#ifdef FAT12_FAT_X86
+        size_t raw_length_bytes = (num_entries * 3 + 1) / 2;
+        if (__builtin_cpu_supports("avx2")) {
+                n = fat12_fat_unpack_avx2(raw, entries, num_entries, raw_length_bytes);
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+                n += fat12_fat_unpack_ssse3(raw + n / 2 * 3, entries + n, num_entries - n, raw_length_bytes - n / 2 * 3);
+        }
+#endif
+
+        // Kernels always stop on an even entry, so the remaining entries start on a byte boundary
+        fat12_fat_unpack_scalar(raw + n / 2 * 3, entries + n, num_entries - n);
+
+}
+
+// Function to get the name of the kernel fat12_fat_unpack dispatches to on this CPU
+const char* fat12_fat_unpack_kernel (void) {
+
+#ifdef FAT12_FAT_X86
+        if (__builtin_cpu_supports("avx2")) {
+                return "avx2";
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+                return "ssse3";
+        }
+#endif
+        return "scalar";
+
+}
+
+/*
+ * Gets the decoded first FAT of the volume, decoding it on the first call.
+ * The result is owned by the volume and released by fat12_volume_close.
+ *
+ * @param volume The volume.
+ * @param decoded Set to the decoded FAT on success.
+ * @return FAT12_OK, or the reason the FAT could not be decoded.
+ */
+fat12_status fat12_volume_fat (fat12_volume* volume, const fat12_fat** decoded) {
+
+        if (volume->fat != NULL) {
+                *decoded = volume->fat;
+                return FAT12_OK;
+        }
+
+        // Locate the first FAT, right after the reserved sectors
+        const fat12_geometry* geometry;
+        fat12_status status = fat12_volume_geometry(volume, &geometry);
+        if (status != FAT12_OK) {
+                return status;
+        }
+        size_t fat_length_bytes = (size_t)geometry->sectors_per_fat * geometry->bytes_per_sector;
+        const unsigned char* raw = (const unsigned char*)fat12_volume_bytes(volume, geometry->fat_start_byte, fat_length_bytes);
+        if (raw == NULL) {
+                return fat12_error(FAT12_ERR_RANGE, "Error reading first FAT table: image too small");
+        }
+
+        uint64_t phase_start = fat12_stats_phase_begin();
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 2);
+        fat12_fat* fat = calloc(1, sizeof(fat12_fat));
+        if (fat != NULL) {
+                fat->num_entries = (uint32_t)(fat_length_bytes * 2 / 3);
+                fat->entries = malloc((fat->num_entries + 1) * sizeof(uint16_t));
+        }
+        if (fat == NULL || fat->entries == NULL) {
+                status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                free(fat);
+                return status;
+        }
+
+        fat12_fat_unpack(raw, fat->entries, fat->num_entries);
+        fat12_stats_phase_end(FAT12_PHASE_FAT, phase_start);
+        volume->fat = fat;
+        *decoded = fat;
+        return FAT12_OK;
+
+}
+
+// Function to release a decoded FAT
+void fat12_fat_free (fat12_fat* fat) {
+
+        if (fat == NULL) {
+                return;
+        }
+        free(fat->entries);
+        free(fat);
+
+}
+
+// Function to count the free entries in the cluster range [first_cluster, end_cluster) of the decoded FAT
+uint32_t fat12_fat_count_free (const fat12_fat* fat, uint32_t first_cluster, uint32_t end_cluster) {
+
+        if (end_cluster > fat->num_entries) {
+                end_cluster = fat->num_entries;
+        }
+
+        uint32_t free_count = 0;
+        for (uint32_t cluster = first_cluster; cluster < end_cluster; cluster++) {
+                free_count += fat->entries[cluster] == FAT_ENTRY_FREE;
+        }
+
+        return free_count;
+
+}
+
+// Function to set one bit per free entry in the cluster range [first_cluster, end_cluster) of the decoded FAT into bitmap, which must hold end_cluster bits and start zeroed
+void fat12_fat_free_bitmap (const fat12_fat* fat, uint32_t first_cluster, uint32_t end_cluster, uint64_t* bitmap) {
+
+        if (end_cluster > fat->num_entries) {
+                end_cluster = fat->num_entries;
+        }
+
+        // Same scan as fat12_fat_count_free, recording where the free entries are instead of how many
+        for (uint32_t cluster = first_cluster; cluster < end_cluster; cluster++) {
+                bitmap[cluster / 64] |= (uint64_t)(fat->entries[cluster] == FAT_ENTRY_FREE) << (cluster % 64);
+        }
+
+}
+
+// Function to store one 12-bit entry into a packed FAT, leaving the nibble it shares with its neighbour untouched
+void fat12_fat_pack_entry (unsigned char* raw, uint32_t cluster, uint16_t value) {
+
+        unsigned char* bytes = raw + cluster * 3 / 2;
+        if (cluster & 1) {
+                bytes[0] = (unsigned char)((bytes[0] & 0x0F) | ((value & 0x0F) << 4));
+                bytes[1] = (unsigned char)(value >> 4);
+        } else {
+                bytes[0] = (unsigned char)(value & 0xFF);
+                bytes[1] = (unsigned char)((bytes[1] & 0xF0) | ((value >> 8) & 0x0F));
+        }
+
+}
+
+// Function to get the cluster following the given one in its chain, or an end-of-chain value if there is none
+uint16_t fat12_fat_next (const fat12_fat* fat, uint16_t cluster) {
+
+        if (cluster >= fat->num_entries) {
+                return 0xFFF;
+        }
+        return fat->entries[cluster];
+
+}
+
+// Function to read one 12-bit entry straight from a packed FAT
+static uint16_t fat12_fat_raw_entry (const unsigned char* raw, uint32_t cluster) {
+
+        const unsigned char* bytes = raw + cluster * 3 / 2;
+        return (uint16_t)(cluster & 1 ? (bytes[0] >> 4) | (bytes[1] << 4) : bytes[0] | ((bytes[1] & 0x0F) << 8));
+
+}
+
+/*
+ * Compares two packed FAT copies, 32 bytes per step with 64-bit words, only decoding entries where a word differs.
+ * Byte b of a packed FAT holds part of entry b * 2 / 3, and also of the entry after it when b % 3 == 1.
+ *
+ * @param a The first copy.
+ * @param b The second copy.
+ * @param length_bytes The length of each copy.
+ * @param num_entries The number of entries to compare.
+ * @param first_cluster Set to the first entry that differs, if any does.
+ * @return The number of entries that differ.
+ */
+uint32_t fat12_fat_compare (const unsigned char* a, const unsigned char* b, size_t length_bytes, uint32_t num_entries, uint32_t* first_cluster) {
+
+        uint32_t num_different = 0;
+        uint32_t next_cluster = 0; // Entries below this were already compared
+        for (size_t offset = 0; offset < length_bytes; ) {
+                size_t block = length_bytes - offset < 32 ? length_bytes - offset : 32;
+                if (block == 32) {
+                        uint64_t words_a[4];
+                        uint64_t words_b[4];
+                        memcpy(words_a, a + offset, 32);
+                        memcpy(words_b, b + offset, 32);
+                        if (((words_a[0] ^ words_b[0]) | (words_a[1] ^ words_b[1]) | (words_a[2] ^ words_b[2]) | (words_a[3] ^ words_b[3])) == 0) {
+                                offset += 32;
+                                continue;
+                        }
+                }
+
+                // Decode only the entries that overlap bytes that differ
+                for (size_t byte = offset; byte < offset + block; byte++) {
+                        if (a[byte] == b[byte]) {
+                                continue;
+                        }
+                        uint32_t last = (uint32_t)(byte * 2 / 3) + (byte % 3 == 1);
+                        for (uint32_t cluster = (uint32_t)(byte * 2 / 3); cluster <= last && cluster < num_entries; cluster++) {
+                                if (cluster < next_cluster) {
+                                        continue;
+                                }
+                                next_cluster = cluster + 1;
+                                if (fat12_fat_raw_entry(a, cluster) != fat12_fat_raw_entry(b, cluster)) {
+                                        if (num_different == 0) {
+                                                *first_cluster = cluster;
+                                        }
+                                        num_different++;
+                                }
+                        }
+                }
+                offset += block;
+        }
+        return num_different;
+
+}
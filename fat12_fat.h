@@ -0,0 +1,30 @@
+#ifndef FAT12_FAT_H
+#define FAT12_FAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fat12_utils.h"
+
+extern const uint16_t FAT_ENTRY_FREE;
+extern const uint16_t FAT_ENTRY_BAD;
+extern const uint16_t FAT_ENTRY_END_OF_CHAIN_MIN;
+
+// First FAT of a volume, decoded into one 16-bit slot per 12-bit entry
+typedef struct fat12_fat {
+        uint16_t* entries;
+        uint32_t num_entries;
+} fat12_fat;
+
+void fat12_fat_unpack_scalar (const unsigned char* raw, uint16_t* entries, size_t num_entries);
+void fat12_fat_unpack (const unsigned char* raw, uint16_t* entries, size_t num_entries);
+const char* fat12_fat_unpack_kernel (void);
+
+fat12_status fat12_volume_fat (fat12_volume* volume, const fat12_fat** decoded);
+void fat12_fat_free (fat12_fat* fat);
+uint32_t fat12_fat_count_free (const fat12_fat* fat, uint32_t first_cluster, uint32_t end_cluster);
+void fat12_fat_free_bitmap (const fat12_fat* fat, uint32_t first_cluster, uint32_t end_cluster, uint64_t* bitmap);
+void fat12_fat_pack_entry (unsigned char* raw, uint32_t cluster, uint16_t value);
+uint32_t fat12_fat_compare (const unsigned char* a, const unsigned char* b, size_t length_bytes, uint32_t num_entries, uint32_t* first_cluster);
+uint16_t fat12_fat_next (const fat12_fat* fat, uint16_t cluster);
+
+#endif
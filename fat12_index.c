@@ -0,0 +1,541 @@
+#include "fat12_index.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_fat.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Layout of an index file: a fixed header, then one record per item of the directory walk, in walk order, then the long file names of the items
+enum {
+        INDEX_MAGIC_LENGTH_BYTES = 8,
+        INDEX_NUM_ITEMS_BYTE = 8,
+        INDEX_CHECKSUM_BYTE = 16, // Hash of everything from INDEX_IMAGE_SIZE_BYTE to the end of the file
+        INDEX_IMAGE_SIZE_BYTE = 24,
+        INDEX_MTIME_SEC_BYTE = 32,
+        INDEX_MTIME_NSEC_BYTE = 40,
+        INDEX_DEVICE_BYTE = 48,
+        INDEX_INODE_BYTE = 56,
+        INDEX_CONTENT_HASH_BYTE = 64,
+        INDEX_BOOT_SECTOR_BYTE = 72, // The start of the boot sector, enough for the OS name and the BPB
+        INDEX_BOOT_SECTOR_LENGTH_BYTES = 64,
+        INDEX_LABEL_BYTE = 136, // Null-terminated, as fat12_get_label returns it
+        INDEX_TOTAL_SIZE_BYTE = 148,
+        INDEX_FREE_SIZE_BYTE = 152,
+        INDEX_NUM_FILES_BYTE = 156,
+        INDEX_HEADER_SIZE_BYTES = 160,
+        INDEX_ITEM_DEPTH_BYTE = 32, // Within a record, after the raw 32-byte directory entry
+        INDEX_ITEM_FLAGS_BYTE = 34,
+        INDEX_ITEM_LONG_NAME_BYTE = 36, // One past the offset of the item's null-terminated long name among the names, or 0 for none
+        INDEX_ITEM_SIZE_BYTES = 40
+};
+
+// Magic number and format version; an index with any other is rebuilt
+static const char INDEX_MAGIC[INDEX_MAGIC_LENGTH_BYTES] = { 'F', 'A', 'T', '1', '2', 'I', 'X', 2 };
+
+// Set in the flags byte of a record for a subdirectory
+#define INDEX_ITEM_DIRECTORY 0x01
+
+#define INDEX_HASH_SEED 0x46415431324958ull
+
+struct fat12_index {
+        char* data; // The whole index file
+        size_t size;
+        uint32_t num_items;
+        const char* names; // The long file names after the records
+        size_t names_size;
+        fat12_info info;
+        fat12_geometry geometry;
+};
+
+// Records of the directory walk being collected for a new index
+typedef struct {
+        char* data;
+        size_t size;
+        size_t capacity;
+        uint32_t num_items;
+        char* names; // Long file names, appended to the records once the walk is done
+        size_t names_size;
+        size_t names_capacity;
+} fat12_index_buffer;
+
+// Function to load a little-endian 64-bit field
+static uint64_t fat12_le64 (const char* field) {
+
+        return (uint64_t)fat12_le32(field) | (uint64_t)fat12_le32(field + 4) << 32;
+
+}
+
+// Function to store a little-endian field of the given width
+static void fat12_index_put (char* field, uint64_t value, int length_bytes) {
+
+        for (int i = 0; i < length_bytes; i++) {
+                field[i] = (char)(value >> (8 * i));
+        }
+
+}
+
+// Function to append one walked item to the records of a new index, growing them as needed
+static fat12_status fat12_index_append (fat12_index_buffer* buffer, const fat12_dir_item* item) {
+
+        if (buffer->size + INDEX_ITEM_SIZE_BYTES > buffer->capacity) {
+                size_t capacity = buffer->capacity * 2;
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                char* grown = realloc(buffer->data, capacity);
+                if (grown == NULL) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                buffer->data = grown;
+                buffer->capacity = capacity;
+        }
+
+        size_t long_name_size = item->long_name != NULL ? strlen(item->long_name) + 1 : 0;
+        if (buffer->names_size + long_name_size > buffer->names_capacity) {
+                size_t capacity = buffer->names_capacity > 0 ? buffer->names_capacity * 2 : 4096;
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                char* grown = realloc(buffer->names, capacity);
+                if (grown == NULL) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                buffer->names = grown;
+                buffer->names_capacity = capacity;
+        }
+
+        char* record = buffer->data + buffer->size;
+        memcpy(record, item->entry, DIR_ENTRY_SIZE_BYTES);
+        fat12_index_put(record + INDEX_ITEM_DEPTH_BYTE, (uint64_t)item->depth, 2);
+        record[INDEX_ITEM_FLAGS_BYTE] = item->is_directory ? INDEX_ITEM_DIRECTORY : 0;
+        record[INDEX_ITEM_FLAGS_BYTE + 1] = 0;
+        fat12_index_put(record + INDEX_ITEM_LONG_NAME_BYTE, long_name_size > 0 ? buffer->names_size + 1 : 0, 4);
+        if (long_name_size > 0) {
+                memcpy(buffer->names + buffer->names_size, item->long_name, long_name_size);
+                buffer->names_size += long_name_size;
+        }
+        buffer->size += INDEX_ITEM_SIZE_BYTES;
+        buffer->num_items++;
+        return FAT12_OK;
+
+}
+
+/*
+ * Hashes the metadata of a volume, walking its directories once, and optionally records every walked item.
+ * The hash covers the boot sector, every FAT copy, the root directory and every cluster of every subdirectory,
+ * which is everything diskinfo and disklist report on; file data is never read.
+ */
+static fat12_status fat12_index_walk (fat12_volume* volume, uint64_t* hash, fat12_index_buffer* buffer) {
+
+        const fat12_geometry* geometry;
+        const fat12_fat* fat;
+        fat12_status status = fat12_volume_geometry(volume, &geometry);
+        if (status == FAT12_OK) {
+                status = fat12_volume_fat(volume, &fat);
+        }
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        // Reserved sectors, FAT copies and root directory are one contiguous region
+        const char* region = fat12_volume_bytes(volume, 0, geometry->data_start_byte);
+        if (region == NULL) {
+                return fat12_error(FAT12_ERR_RANGE, "Error reading metadata: image too small");
+        }
+        uint64_t content_hash = fat12_hash64(INDEX_HASH_SEED, region, geometry->data_start_byte);
+
+        fat12_dir_walker walker;
+        fat12_dir_item item;
+        int result = fat12_dir_walker_init(&walker, volume);
+        while (result == FAT12_OK && (result = fat12_dir_walker_next(&walker, &item)) == 1) {
+                result = buffer != NULL ? fat12_index_append(buffer, &item) : FAT12_OK;
+                if (!item.is_directory) {
+                        continue;
+                }
+
+                // A chain can have no more links than the FAT has entries, which also stops loops
+                uint16_t cluster = get_first_logical_cluster(item.entry);
+                for (uint32_t steps = 0; cluster >= 2 && cluster < FAT_ENTRY_BAD && cluster < fat->num_entries && steps < fat->num_entries; steps++) {
+                        const char* data = fat12_volume_bytes(volume, fat12_cluster_start_byte(geometry, cluster), geometry->cluster_size_bytes);
+                        if (data == NULL) {
+                                break;
+                        }
+                        content_hash = fat12_hash64(content_hash, data, geometry->cluster_size_bytes);
+                        cluster = fat12_fat_next(fat, cluster);
+                }
+        }
+        fat12_dir_walker_free(&walker);
+        if (result < 0) {
+                return (fat12_status)result;
+        }
+
+        *hash = content_hash;
+        return FAT12_OK;
+
+}
+
+/*
+ * Computes the content hash an index is keyed by: a hash of the boot sector, every FAT copy,
+ * the root directory and every subdirectory cluster of the volume.
+ *
+ * @param volume The volume.
+ * @param hash Set to the hash.
+ * @return FAT12_OK, or the reason the metadata could not be read.
+ */
+fat12_status fat12_index_content_hash (fat12_volume* volume, uint64_t* hash) {
+
+        return fat12_index_walk(volume, hash, NULL);
+
+}
+
+// Function to record the identity of the image file in an index header and recompute the index checksum
+static void fat12_index_stamp (char* data, size_t size, const struct stat* st) {
+
+        fat12_index_put(data + INDEX_IMAGE_SIZE_BYTE, (uint64_t)st->st_size, 8);
+        fat12_index_put(data + INDEX_MTIME_SEC_BYTE, (uint64_t)st->st_mtim.tv_sec, 8);
+        fat12_index_put(data + INDEX_MTIME_NSEC_BYTE, (uint64_t)st->st_mtim.tv_nsec, 8);
+        fat12_index_put(data + INDEX_DEVICE_BYTE, (uint64_t)st->st_dev, 8);
+        fat12_index_put(data + INDEX_INODE_BYTE, (uint64_t)st->st_ino, 8);
+        uint64_t checksum = fat12_hash64(INDEX_HASH_SEED, data + INDEX_IMAGE_SIZE_BYTE, size - INDEX_IMAGE_SIZE_BYTE);
+        fat12_index_put(data + INDEX_CHECKSUM_BYTE, checksum, 8);
+
+}
+
+// Function to check that an index file is complete, of this format version and undamaged
+static int fat12_index_valid (const char* data, size_t size) {
+
+        if (size < INDEX_HEADER_SIZE_BYTES || memcmp(data, INDEX_MAGIC, INDEX_MAGIC_LENGTH_BYTES) != 0) {
+                return 0;
+        }
+        uint32_t num_items = fat12_le32(data + INDEX_NUM_ITEMS_BYTE);
+        if ((size - INDEX_HEADER_SIZE_BYTES) / INDEX_ITEM_SIZE_BYTES < num_items) {
+                return 0;
+        }
+        size_t names_start = INDEX_HEADER_SIZE_BYTES + (size_t)num_items * INDEX_ITEM_SIZE_BYTES;
+        if (size > names_start && data[size - 1] != '\0') {
+                return 0; // Every long name must be terminated within the file
+        }
+        uint64_t checksum = fat12_hash64(INDEX_HASH_SEED, data + INDEX_IMAGE_SIZE_BYTE, size - INDEX_IMAGE_SIZE_BYTE);
+        return checksum == fat12_le64(data + INDEX_CHECKSUM_BYTE);
+
+}
+
+// Function to check whether an index was stamped from this very image file, unchanged since: same size, modification time, device and inode
+static int fat12_index_current (const char* data, const struct stat* st) {
+
+        return fat12_le64(data + INDEX_IMAGE_SIZE_BYTE) == (uint64_t)st->st_size
+                && fat12_le64(data + INDEX_MTIME_SEC_BYTE) == (uint64_t)st->st_mtim.tv_sec
+                && fat12_le64(data + INDEX_MTIME_NSEC_BYTE) == (uint64_t)st->st_mtim.tv_nsec
+                && fat12_le64(data + INDEX_DEVICE_BYTE) == (uint64_t)st->st_dev
+                && fat12_le64(data + INDEX_INODE_BYTE) == (uint64_t)st->st_ino;
+
+}
+
+/*
+ * Builds the index of a volume: its summary, the start of its boot sector and every item of the directory walk.
+ * The caller stamps it with fat12_index_stamp and is responsible for freeing it.
+ */
+static fat12_status fat12_index_build (fat12_volume* volume, char** data, size_t* size) {
+
+        fat12_info info;
+        fat12_status status = fat12_get_info(volume, &info);
+        if (status != FAT12_OK) {
+                return status;
+        }
+        const char* boot_sector = fat12_volume_bytes(volume, 0, INDEX_BOOT_SECTOR_LENGTH_BYTES);
+        if (boot_sector == NULL) {
+                return fat12_error(FAT12_ERR_RANGE, "Error reading boot sector: image too small");
+        }
+
+        fat12_index_buffer buffer = { NULL, INDEX_HEADER_SIZE_BYTES, INDEX_HEADER_SIZE_BYTES + 64 * INDEX_ITEM_SIZE_BYTES, 0, NULL, 0, 0 };
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        buffer.data = calloc(1, buffer.capacity);
+        if (buffer.data == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        uint64_t content_hash;
+        status = fat12_index_walk(volume, &content_hash, &buffer);
+        if (status == FAT12_OK && buffer.size + buffer.names_size > buffer.capacity) {
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                char* grown = realloc(buffer.data, buffer.size + buffer.names_size);
+                if (grown != NULL) {
+                        buffer.data = grown;
+                } else {
+                        status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+        }
+        if (status != FAT12_OK) {
+                free(buffer.names);
+                free(buffer.data);
+                return status;
+        }
+        if (buffer.names_size > 0) {
+                memcpy(buffer.data + buffer.size, buffer.names, buffer.names_size);
+                buffer.size += buffer.names_size;
+        }
+        free(buffer.names);
+
+        char* header = buffer.data;
+        memcpy(header, INDEX_MAGIC, INDEX_MAGIC_LENGTH_BYTES);
+        fat12_index_put(header + INDEX_NUM_ITEMS_BYTE, buffer.num_items, 4);
+        fat12_index_put(header + INDEX_CONTENT_HASH_BYTE, content_hash, 8);
+        memcpy(header + INDEX_BOOT_SECTOR_BYTE, boot_sector, INDEX_BOOT_SECTOR_LENGTH_BYTES);
+        memcpy(header + INDEX_LABEL_BYTE, info.label, sizeof(info.label));
+        fat12_index_put(header + INDEX_TOTAL_SIZE_BYTE, info.total_size, 4);
+        fat12_index_put(header + INDEX_FREE_SIZE_BYTE, info.free_size, 4);
+        fat12_index_put(header + INDEX_NUM_FILES_BYTE, (uint32_t)info.num_files, 4);
+
+        *data = buffer.data;
+        *size = buffer.size;
+        return FAT12_OK;
+
+}
+
+// Function to read a whole index file with a single read in the common case
+static fat12_status fat12_index_read (const char* index_path, char** data, size_t* size) {
+
+        int fd = open(index_path, O_RDONLY);
+        if (fd < 0) {
+                return fat12_error(FAT12_ERR_IO, "Error opening index: %s", strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < INDEX_HEADER_SIZE_BYTES) {
+                close(fd);
+                return fat12_error(FAT12_ERR_INVALID, "Index too small");
+        }
+
+        size_t length = (size_t)st.st_size;
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        char* buffer = malloc(length);
+        if (buffer == NULL) {
+                close(fd);
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        size_t total = 0;
+        while (total < length) {
+                ssize_t bytes_read = read(fd, buffer + total, length - total);
+                fat12_stats_add(FAT12_STAT_READ_CALLS, 1);
+                if (bytes_read < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (bytes_read <= 0) {
+                        break;
+                }
+                total += (size_t)bytes_read;
+        }
+        fat12_stats_add(FAT12_STAT_BYTES_READ, total);
+        close(fd);
+        if (total < length) {
+                free(buffer);
+                return fat12_error(FAT12_ERR_IO, "Error reading index: short read");
+        }
+
+        *data = buffer;
+        *size = length;
+        return FAT12_OK;
+
+}
+
+// Function to replace an index file atomically, so that concurrent readers see either the old or the new index
+static fat12_status fat12_index_store (const char* index_dir, const char* index_path, const char* data, size_t size) {
+
+        if (mkdir(index_dir, 0755) != 0 && errno != EEXIST) {
+                return fat12_error(FAT12_ERR_IO, "Error creating directory %s: %s", index_dir, strerror(errno));
+        }
+        char temp_path[4096];
+        if (snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", index_path) >= (int)sizeof(temp_path)) {
+                return fat12_error(FAT12_ERR_INVALID, "Index path too long");
+        }
+        int fd = mkstemp(temp_path);
+        if (fd < 0) {
+                return fat12_error(FAT12_ERR_IO, "Error creating index: %s", strerror(errno));
+        }
+        fchmod(fd, 0644); // mkstemp creates the file private, but an index holds nothing the image does not
+
+        size_t total = 0;
+        while (total < size) {
+                ssize_t written = write(fd, data + total, size - total);
+                if (written < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (written <= 0) {
+                        break;
+                }
+                total += (size_t)written;
+        }
+        int failed = total < size;
+        if (close(fd) != 0) {
+                failed = 1;
+        }
+        if (failed || rename(temp_path, index_path) != 0) {
+                fat12_status status = fat12_error(FAT12_ERR_IO, "Error writing index %s: %s", index_path, strerror(errno));
+                unlink(temp_path);
+                return status;
+        }
+        return FAT12_OK;
+
+}
+
+// Function to bring a missing, damaged or stale index up to date from the image, storing it when the image is a regular file
+static fat12_status fat12_index_refresh (const char* index_dir, const char* index_path, const char* image_path, const struct stat* st, char** data, size_t* size) {
+
+        fat12_volume* volume;
+        fat12_status status = fat12_volume_open(image_path, &volume);
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        // Touched or copied but unchanged where it matters, so only the identity in the header needs updating
+        uint64_t content_hash;
+        if (*data != NULL && st != NULL && fat12_index_content_hash(volume, &content_hash) == FAT12_OK
+                && content_hash == fat12_le64(*data + INDEX_CONTENT_HASH_BYTE)) {
+                fat12_volume_close(volume);
+                fat12_index_stamp(*data, *size, st);
+                return fat12_index_store(index_dir, index_path, *data, *size);
+        }
+
+        free(*data);
+        *data = NULL;
+        status = fat12_index_build(volume, data, size);
+        fat12_volume_close(volume);
+        if (status != FAT12_OK || st == NULL) {
+                return status;
+        }
+        fat12_index_stamp(*data, *size, st);
+        return fat12_index_store(index_dir, index_path, *data, *size);
+
+}
+
+/*
+ * Loads the index of an image from index_dir. An index that is missing, damaged or stale is rebuilt from the image
+ * and stored; one whose image was only touched or copied is matched by content hash and just re-stamped.
+ * When the image has the same size, modification time, device and inode as when it was indexed,
+ * the image itself is not opened at all and loading costs a single read of the index file.
+ * The caller is responsible for freeing the index.
+ *
+ * @param index_dir The directory holding index files, created if needed.
+ * @param image_path The disk image.
+ * @param index Set to the loaded index.
+ * @return FAT12_OK, or the reason the index could neither be loaded nor rebuilt.
+ */
+fat12_status fat12_index_load (const char* index_dir, const char* image_path, fat12_index** index) {
+
+        uint64_t phase_start = fat12_stats_phase_begin();
+        char* data = NULL;
+        size_t size = 0;
+        char index_path[4096];
+        struct stat st;
+        int indexable = stat(image_path, &st) == 0 && S_ISREG(st.st_mode);
+        if (indexable) {
+                if (snprintf(index_path, sizeof(index_path), "%s/%llx-%llx.idx", index_dir, (unsigned long long)st.st_dev, (unsigned long long)st.st_ino) >= (int)sizeof(index_path)) {
+                        return fat12_error(FAT12_ERR_INVALID, "Index path too long");
+                }
+                if (fat12_index_read(index_path, &data, &size) == FAT12_OK && !fat12_index_valid(data, size)) {
+                        free(data);
+                        data = NULL;
+                }
+        }
+        fat12_stats_phase_end(FAT12_PHASE_OPEN, phase_start);
+
+        // Anything but a regular file has no identity to key an index by, so it is indexed in memory only
+        if (data == NULL || !fat12_index_current(data, &st)) {
+                fat12_status status = fat12_index_refresh(index_dir, index_path, image_path, indexable ? &st : NULL, &data, &size);
+                if (status != FAT12_OK) {
+                        free(data);
+                        return status;
+                }
+        }
+
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        fat12_index* loaded = calloc(1, sizeof(fat12_index));
+        if (loaded == NULL) {
+                free(data);
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        loaded->data = data;
+        loaded->size = size;
+        loaded->num_items = fat12_le32(data + INDEX_NUM_ITEMS_BYTE);
+        size_t names_start = INDEX_HEADER_SIZE_BYTES + (size_t)loaded->num_items * INDEX_ITEM_SIZE_BYTES;
+        loaded->names = data + names_start;
+        loaded->names_size = size - names_start;
+
+        const char* boot_sector = data + INDEX_BOOT_SECTOR_BYTE;
+        fat12_status status = fat12_parse_geometry(boot_sector, &loaded->geometry);
+        if (status != FAT12_OK) {
+                fat12_index_free(loaded);
+                return status;
+        }
+        fat12_info* info = &loaded->info;
+        read_directory_entry_data(boot_sector, OS_NAME_START_BYTE, OS_NAME_LENGTH_BYTES, info->os_name);
+        memcpy(info->label, data + INDEX_LABEL_BYTE, sizeof(info->label));
+        info->label[sizeof(info->label) - 1] = '\0';
+        info->total_size = fat12_le32(data + INDEX_TOTAL_SIZE_BYTE);
+        info->free_size = fat12_le32(data + INDEX_FREE_SIZE_BYTE);
+        info->num_files = (int)fat12_le32(data + INDEX_NUM_FILES_BYTE);
+        info->sectors_per_fat = loaded->geometry.sectors_per_fat;
+        info->num_fat_copies = loaded->geometry.num_fats;
+
+        *index = loaded;
+        return FAT12_OK;
+
+}
+
+// Function to get the summary of the indexed image, as fat12_get_info reports it
+const fat12_info* fat12_index_info (const fat12_index* index) {
+
+        return &index->info;
+
+}
+
+// Function to get the layout of the indexed image
+const fat12_geometry* fat12_index_geometry (const fat12_index* index) {
+
+        return &index->geometry;
+
+}
+
+// Function to get the number of items the directory walk of the indexed image produced
+size_t fat12_index_num_items (const fat12_index* index) {
+
+        return index->num_items;
+
+}
+
+// Function to get an item of the directory walk, in walk order, with its entry and long name pointing into the index
+void fat12_index_item (const fat12_index* index, size_t i, fat12_dir_item* item) {
+
+        const char* record = index->data + INDEX_HEADER_SIZE_BYTES + i * INDEX_ITEM_SIZE_BYTES;
+        uint32_t long_name = fat12_le32(record + INDEX_ITEM_LONG_NAME_BYTE);
+        item->entry = record;
+        item->depth = fat12_le16(record + INDEX_ITEM_DEPTH_BYTE);
+        item->is_directory = (record[INDEX_ITEM_FLAGS_BYTE] & INDEX_ITEM_DIRECTORY) != 0;
+        item->long_name = long_name > 0 && long_name <= index->names_size ? index->names + long_name - 1 : NULL;
+        item->is_deleted = 0;
+
+}
+
+// Function to release an index loaded with fat12_index_load
+void fat12_index_free (fat12_index* index) {
+
+        if (index != NULL) {
+                free(index->data);
+                free(index);
+        }
+
+}
+
+// Function to check whether a command-line argument is --index=<dir>, returning 1 if so (with index_dir pointing into arg), -1 if it is --index without a directory, or 0 otherwise
+int fat12_index_parse_option (const char* arg, const char** index_dir) {
+
+        if (strncmp(arg, "--index=", 8) == 0 && arg[8] != '\0') {
+                *index_dir = arg + 8;
+                return 1;
+        }
+        if (strcmp(arg, "--index") == 0 || strcmp(arg, "--index=") == 0) {
+                return -1;
+        }
+        return 0;
+
+}
@@ -0,0 +1,20 @@
+#ifndef FAT12_INDEX_H
+#define FAT12_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fat12_utils.h"
+
+// Everything diskinfo and disklist report about one image, loaded from its index file in a single read
+typedef struct fat12_index fat12_index;
+
+fat12_status fat12_index_load (const char* index_dir, const char* image_path, fat12_index** index);
+const fat12_info* fat12_index_info (const fat12_index* index);
+const fat12_geometry* fat12_index_geometry (const fat12_index* index);
+size_t fat12_index_num_items (const fat12_index* index);
+void fat12_index_item (const fat12_index* index, size_t i, fat12_dir_item* item);
+void fat12_index_free (fat12_index* index);
+fat12_status fat12_index_content_hash (fat12_volume* volume, uint64_t* hash);
+int fat12_index_parse_option (const char* arg, const char** index_dir);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef FAT12_INTERNAL_H
+#define FAT12_INTERNAL_H
+
+#include "fat12_utils.h"
+
+// Definitions shared by the library sources but hidden from callers of fat12_utils.h
+
+struct fat12_volume {
+        const char* data;
+        size_t size;
+        int mapped;
+        int writable; // Mapped shared and writable, by fat12_volume_open_writable
+        int fd; // The image file behind a mapped volume, kept open for copy_file_range; -1 otherwise
+        struct fat12_fat* fat; // Decoded first FAT, filled in on first use by fat12_volume_fat
+        fat12_geometry geometry; // Parsed on first use by fat12_volume_geometry
+        int has_geometry;
+        struct fat12_path_index* path_index; // Built on first use by fat12_volume_path_index, dropped when the volume is written to
+        size_t last_end_byte; // End of the previous range requested, for counting seeks in statistics
+};
+
+fat12_status fat12_error (fat12_status status, const char* format, ...);
+uint64_t fat12_hash64 (uint64_t hash, const char* data, size_t length);
+
+#endif
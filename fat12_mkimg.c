@@ -0,0 +1,542 @@
+#include "fat12_mkimg.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+
+// Standard floppy formats, selected by total sector count
+typedef struct {
+        uint16_t total_sectors;
+        uint8_t sectors_per_cluster;
+        uint16_t root_entries;
+        uint16_t sectors_per_fat;
+        uint8_t media;
+        uint16_t sectors_per_track;
+} fat12_mkimg_format;
+
+static const fat12_mkimg_format FAT12_MKIMG_FORMATS[] = {
+        { 720, 2, 112, 2, 0xFD, 9 }, // 360 KB
+        { 1440, 2, 112, 3, 0xF9, 9 }, // 720 KB
+        { 2400, 1, 224, 7, 0xF9, 15 }, // 1.2 MB
+        { 2880, 1, 224, 9, 0xF0, 18 }, // 1.44 MB
+        { 5760, 2, 240, 9, 0xF0, 36 } // 2.88 MB
+};
+
+// Extensions given to generated files, each with the signature its content starts with (NULL for text)
+static const char* const FAT12_MKIMG_EXTENSIONS[][2] = {
+        { "TXT", NULL },
+        { "BIN", "\x7F" "ELF" },
+        { "ZIP", "PK\x03\x04" },
+        { "GIF", "GIF89a" },
+        { "EXE", "MZ" },
+        { "BMP", "BM" },
+        { "DAT", "" }
+};
+#define FAT12_MKIMG_NUM_EXTENSIONS (sizeof(FAT12_MKIMG_EXTENSIONS) / sizeof(FAT12_MKIMG_EXTENSIONS[0]))
+
+typedef struct {
+        int parent; // Index of the parent directory, or -1 for the root
+        char name[FILENAME_LENGTH_BYTES + 1];
+        uint32_t num_slots;
+        uint32_t next_slot;
+        uint16_t first_cluster;
+        uint32_t num_clusters;
+} fat12_mkimg_dir;
+
+typedef struct {
+        uint32_t dir;
+        uint32_t size;
+        uint32_t extension;
+        int deleted;
+        int fragmented;
+        uint16_t first_cluster;
+        uint16_t date;
+        uint16_t time;
+} fat12_mkimg_file;
+
+typedef struct {
+        const fat12_mkimg_spec* spec;
+        const fat12_mkimg_format* format;
+        unsigned char* image;
+        size_t image_size;
+        uint16_t* fat;
+        uint32_t num_clusters; // Data clusters, numbered from 2
+        uint32_t cluster_size_bytes;
+        uint32_t data_start_sector;
+        uint32_t root_start_sector;
+        uint32_t state; // Generator state, so the same seed always gives the same image
+        fat12_mkimg_dir* dirs;
+        uint32_t num_dirs;
+        fat12_mkimg_file* files;
+} fat12_mkimg_context;
+
+// Function to get the next pseudo-random number of the generator (xorshift32)
+static uint32_t fat12_mkimg_random (fat12_mkimg_context* context) {
+
+        uint32_t x = context->state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        context->state = x;
+        return x;
+
+}
+
+// Function to get a pointer to the first byte of a data cluster
+static unsigned char* fat12_mkimg_cluster (fat12_mkimg_context* context, uint16_t cluster) {
+
+        return context->image + ((size_t)context->data_start_sector + (size_t)(cluster - 2) * context->format->sectors_per_cluster) * SECTOR_SIZE_BYTES;
+
+}
+
+// Function to allocate a chain of count clusters, contiguous if possible or scattered if asked, returning its first cluster or 0 if the image is full
+static uint16_t fat12_mkimg_allocate (fat12_mkimg_context* context, uint32_t count, int scattered) {
+
+        uint32_t last = context->num_clusters + 2;
+        uint16_t first = 0;
+        uint16_t previous = 0;
+        uint32_t taken = 0;
+
+        // Contiguous files take the first run that fits; scattered ones start anywhere and leave gaps behind them
+        uint32_t cluster = 2;
+        if (!scattered) {
+                uint32_t run = 0;
+                for (uint32_t c = 2; c < last && run < count; c++) {
+                        run = context->fat[c] == 0 ? run + 1 : 0;
+                        if (run == count) {
+                                cluster = c - count + 1;
+                        }
+                }
+        } else {
+                cluster = 2 + fat12_mkimg_random(context) % context->num_clusters;
+        }
+
+        for (uint32_t visited = 0; taken < count && visited < context->num_clusters * 4; visited++) {
+                if (cluster >= last) {
+                        cluster = 2;
+                }
+                if (context->fat[cluster] == 0) {
+                        if (previous != 0) {
+                                context->fat[previous] = (uint16_t)cluster;
+                        } else {
+                                first = (uint16_t)cluster;
+                        }
+                        context->fat[cluster] = 0xFFF;
+                        previous = (uint16_t)cluster;
+                        taken++;
+                        cluster += scattered ? 2 + fat12_mkimg_random(context) % 3 : 1;
+                } else {
+                        cluster++;
+                }
+        }
+
+        // Fewer clusters than asked for means the image is full
+        if (taken < count) {
+                for (uint16_t c = first; c != 0 && c != 0xFFF; ) {
+                        uint16_t next = context->fat[c];
+                        context->fat[c] = 0;
+                        c = next;
+                }
+                return 0;
+        }
+        return first;
+
+}
+
+// Function to get the next free 32-byte slot of a directory
+static unsigned char* fat12_mkimg_slot (fat12_mkimg_context* context, uint32_t dir_index) {
+
+        fat12_mkimg_dir* dir = &context->dirs[dir_index];
+        uint32_t slot = dir->next_slot++;
+        if (dir_index == 0) {
+                return context->image + (size_t)context->root_start_sector * SECTOR_SIZE_BYTES + (size_t)slot * DIR_ENTRY_SIZE_BYTES;
+        }
+
+        // Follow the directory's chain to the cluster holding the slot
+        uint32_t slots_per_cluster = context->cluster_size_bytes / DIR_ENTRY_SIZE_BYTES;
+        uint16_t cluster = dir->first_cluster;
+        for (uint32_t i = 0; i < slot / slots_per_cluster; i++) {
+                cluster = context->fat[cluster];
+        }
+        return fat12_mkimg_cluster(context, cluster) + (size_t)(slot % slots_per_cluster) * DIR_ENTRY_SIZE_BYTES;
+
+}
+
+// Function to fill in a short directory entry
+static void fat12_mkimg_entry (unsigned char* entry, const char* short_name, uint8_t attributes, uint16_t cluster, uint32_t size, uint16_t date, uint16_t time) {
+
+        memcpy(entry, short_name, FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES);
+        entry[DIR_ENTRY_ATTRIBUTE_BYTE] = attributes;
+        entry[FILE_CREATE_TIME_START_BYTE] = time & 0xFF;
+        entry[FILE_CREATE_TIME_START_BYTE + 1] = time >> 8;
+        entry[FILE_CREATE_DATE_START_BYTE] = date & 0xFF;
+        entry[FILE_CREATE_DATE_START_BYTE + 1] = date >> 8;
+        entry[FILE_ACCESS_DATE_START_BYTE] = date & 0xFF;
+        entry[FILE_ACCESS_DATE_START_BYTE + 1] = date >> 8;
+        entry[FILE_WRITE_TIME_START_BYTE] = time & 0xFF;
+        entry[FILE_WRITE_TIME_START_BYTE + 1] = time >> 8;
+        entry[FILE_WRITE_DATE_START_BYTE] = date & 0xFF;
+        entry[FILE_WRITE_DATE_START_BYTE + 1] = date >> 8;
+        entry[FIRST_LOGICAL_CLUSTER_BYTE1] = cluster & 0xFF;
+        entry[FIRST_LOGICAL_CLUSTER_BYTE2] = cluster >> 8;
+        for (int i = 0; i < FILE_SIZE_LENGTH_BYTES; i++) {
+                entry[FILE_SIZE_START_BYTE + i] = (size >> (8 * i)) & 0xFF;
+        }
+
+}
+
+// Function to get the checksum of an 11-byte short name that its long file name entries carry
+static uint8_t fat12_mkimg_short_name_checksum (const char* short_name) {
+
+        uint8_t checksum = 0;
+        for (int i = 0; i < FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES; i++) {
+                checksum = (uint8_t)(((checksum & 1) << 7) + (checksum >> 1) + (unsigned char)short_name[i]);
+        }
+        return checksum;
+
+}
+
+// Number of UCS-2 characters held by one long file name entry
+#define FAT12_MKIMG_LFN_CHARS 13
+
+// Function to get the number of long file name entries needed for a name
+static uint32_t fat12_mkimg_lfn_slots (const char* long_name) {
+
+        return (uint32_t)(strlen(long_name) + FAT12_MKIMG_LFN_CHARS) / FAT12_MKIMG_LFN_CHARS; // Room for the null terminator too
+
+}
+
+// Function to derive the 11-byte short name Windows gives a long name: the name without spaces and dots, upper-cased and
+// cut short for a "~<tail>" suffix, then the first three characters of the last extension
+static void fat12_mkimg_short_name (const char* long_name, uint32_t tail, char* short_name) {
+
+        char suffix[12];
+        int suffix_length = snprintf(suffix, sizeof(suffix), "~%u", tail);
+        const char* dot = strrchr(long_name, '.');
+        const char* end = dot != NULL ? dot : long_name + strlen(long_name);
+        memset(short_name, ' ', FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES);
+        short_name[FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES] = '\0';
+
+        int length = 0;
+        for (const char* c = long_name; c < end && length < FILENAME_LENGTH_BYTES - suffix_length; c++) {
+                if (*c != ' ' && *c != '.') {
+                        short_name[length++] = isalnum((unsigned char)*c) ? (char)toupper((unsigned char)*c) : '_';
+                }
+        }
+        memcpy(short_name + length, suffix, (size_t)suffix_length);
+        for (int i = 0; dot != NULL && dot[1 + i] != '\0' && i < EXTENSION_LENGTH_BYTES; i++) {
+                short_name[FILENAME_LENGTH_BYTES + i] = (char)toupper((unsigned char)dot[1 + i]);
+        }
+
+}
+
+// Function to write the long file name entries of a file, last part first, into consecutive slots of a directory
+// (marked 0xE5 like its short entry if the file is deleted)
+static void fat12_mkimg_lfn (fat12_mkimg_context* context, uint32_t dir_index, const char* long_name, const char* short_name, int deleted) {
+
+        static const int offsets[FAT12_MKIMG_LFN_CHARS] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+        uint32_t num_slots = fat12_mkimg_lfn_slots(long_name);
+        size_t length = strlen(long_name);
+        uint8_t checksum = fat12_mkimg_short_name_checksum(short_name);
+
+        for (uint32_t part = num_slots; part > 0; part--) {
+                unsigned char* entry = fat12_mkimg_slot(context, dir_index);
+                entry[0] = (uint8_t)(part | (part == num_slots ? 0x40 : 0));
+                entry[DIR_ENTRY_ATTRIBUTE_BYTE] = ATTRIBUTE_LONG_FILE_NAME;
+                entry[13] = checksum;
+                for (int i = 0; i < FAT12_MKIMG_LFN_CHARS; i++) {
+                        size_t position = (part - 1) * FAT12_MKIMG_LFN_CHARS + i;
+                        uint16_t c = position < length ? (unsigned char)long_name[position] : position == length ? 0x0000 : 0xFFFF;
+                        entry[offsets[i]] = c & 0xFF;
+                        entry[offsets[i] + 1] = c >> 8;
+                }
+                if (deleted) {
+                        entry[0] = 0xE5;
+                }
+        }
+
+}
+
+// Function to write the content of a file, starting with the signature of its extension, along its cluster chain
+static void fat12_mkimg_content (fat12_mkimg_context* context, const fat12_mkimg_file* file, uint32_t index) {
+
+        const char* signature = FAT12_MKIMG_EXTENSIONS[file->extension][1];
+        uint32_t written = 0;
+        uint16_t cluster = file->first_cluster;
+        uint32_t text_state = index * 2654435761u + 1;
+
+        while (written < file->size && cluster >= 2 && cluster < 0xFF8) {
+                unsigned char* data = fat12_mkimg_cluster(context, cluster);
+                for (uint32_t i = 0; i < context->cluster_size_bytes && written < file->size; i++, written++) {
+                        text_state = text_state * 1103515245u + 12345u;
+                        if (signature != NULL && written < strlen(signature)) {
+                                data[i] = (unsigned char)signature[written];
+                        } else if (signature == NULL) {
+                                data[i] = (unsigned char)(written % 64 == 63 ? '\n' : 'a' + (text_state >> 16) % 26);
+                        } else {
+                                data[i] = (unsigned char)(text_state >> 16);
+                        }
+                }
+                cluster = context->fat[cluster];
+        }
+
+}
+
+// Function to build the directory tree: the root, then depth levels of dirs_per_level subdirectories each
+static fat12_status fat12_mkimg_plan_dirs (fat12_mkimg_context* context) {
+
+        const fat12_mkimg_spec* spec = context->spec;
+        uint32_t fanout = spec->dirs_per_level > 0 ? spec->dirs_per_level : 1;
+        uint32_t num_dirs = 1;
+        uint32_t level_size = 1;
+        for (uint32_t level = 0; level < spec->depth; level++) {
+                level_size *= fanout;
+                num_dirs += level_size;
+                if (num_dirs > context->num_clusters) {
+                        return fat12_error(FAT12_ERR_INVALID, "Too many directories for the image");
+                }
+        }
+
+        context->dirs = calloc(num_dirs, sizeof(fat12_mkimg_dir));
+        if (context->dirs == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        context->dirs[0].parent = -1;
+        context->num_dirs = 1;
+
+        // Add each level breadth-first below the directories of the level above
+        uint32_t level_start = 0;
+        uint32_t level_end = 1;
+        for (uint32_t level = 0; level < spec->depth; level++) {
+                for (uint32_t parent = level_start; parent < level_end; parent++) {
+                        for (uint32_t i = 0; i < fanout; i++) {
+                                fat12_mkimg_dir* dir = &context->dirs[context->num_dirs];
+                                dir->parent = (int)parent;
+                                snprintf(dir->name, sizeof(dir->name), "DIR%05u", context->num_dirs);
+                                context->num_dirs++;
+                        }
+                }
+                level_start = level_end;
+                level_end = context->num_dirs;
+        }
+
+        return FAT12_OK;
+
+}
+
+/*
+ * Generates a valid FAT12 image in memory according to spec.
+ * The same spec, seed included, always produces the same bytes.
+ * The caller is responsible for freeing the returned image.
+ *
+ * @param spec The description of the image.
+ * @param image Set to the generated image.
+ * @param image_size Set to the size of the generated image in bytes.
+ * @return FAT12_OK, or the reason the image could not be generated.
+ */
+fat12_status fat12_mkimg (const fat12_mkimg_spec* spec, char** image, size_t* image_size) {
+
+        fat12_mkimg_context context;
+        memset(&context, 0, sizeof(context));
+        context.spec = spec;
+        context.state = spec->seed != 0 ? spec->seed : 0x9E3779B9;
+
+        uint16_t total_sectors = spec->total_sectors != 0 ? spec->total_sectors : 2880;
+        for (size_t i = 0; i < sizeof(FAT12_MKIMG_FORMATS) / sizeof(FAT12_MKIMG_FORMATS[0]); i++) {
+                if (FAT12_MKIMG_FORMATS[i].total_sectors == total_sectors) {
+                        context.format = &FAT12_MKIMG_FORMATS[i];
+                }
+        }
+        if (context.format == NULL) {
+                return fat12_error(FAT12_ERR_INVALID, "Unsupported image size: %u sectors", total_sectors);
+        }
+
+        const fat12_mkimg_format* format = context.format;
+        uint32_t root_sectors = format->root_entries * DIR_ENTRY_SIZE_BYTES / SECTOR_SIZE_BYTES;
+        context.root_start_sector = 1 + 2 * format->sectors_per_fat;
+        context.data_start_sector = context.root_start_sector + root_sectors;
+        context.num_clusters = (total_sectors - context.data_start_sector) / format->sectors_per_cluster;
+        context.cluster_size_bytes = format->sectors_per_cluster * SECTOR_SIZE_BYTES;
+        context.image_size = (size_t)total_sectors * SECTOR_SIZE_BYTES;
+        context.image = calloc(context.image_size, 1);
+        context.fat = calloc(context.num_clusters + 2, sizeof(uint16_t));
+        context.files = calloc(spec->num_files > 0 ? spec->num_files : 1, sizeof(fat12_mkimg_file));
+        fat12_status status = FAT12_OK;
+        if (context.image == NULL || context.fat == NULL || context.files == NULL) {
+                status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        if (status == FAT12_OK) {
+                status = fat12_mkimg_plan_dirs(&context);
+        }
+        if (status != FAT12_OK) {
+                free(context.files);
+                free(context.dirs);
+                free(context.fat);
+                free(context.image);
+                return status;
+        }
+        context.fat[0] = 0xF00 | format->media;
+        context.fat[1] = 0xFFF;
+
+        // Plan the files, spread round-robin over every directory, and count the slots each directory needs
+        int label_in_root = spec->label != NULL && (spec->label_placement & FAT12_LABEL_ROOT);
+        context.dirs[0].num_slots = label_in_root ? 1 : 0;
+        for (uint32_t d = 1; d < context.num_dirs; d++) {
+                context.dirs[d].num_slots += 2; // "." and ".."
+                context.dirs[context.dirs[d].parent].num_slots++;
+        }
+        uint32_t num_deleted = spec->num_deleted < spec->num_files ? spec->num_deleted : spec->num_files;
+        for (uint32_t i = 0; i < spec->num_files; i++) {
+                fat12_mkimg_file* file = &context.files[i];
+                file->dir = i % context.num_dirs;
+                file->size = 1 + (spec->max_file_size > 1 ? fat12_mkimg_random(&context) % spec->max_file_size : 0);
+                file->extension = fat12_mkimg_random(&context) % FAT12_MKIMG_NUM_EXTENSIONS;
+                file->fragmented = fat12_mkimg_random(&context) % 100 < spec->fragmentation;
+                file->deleted = i >= spec->num_files - num_deleted; // The last files are the deleted ones, so their data is written last
+                file->date = (uint16_t)(((10 + fat12_mkimg_random(&context) % 30) << 9) | ((1 + fat12_mkimg_random(&context) % 12) << 5) | (1 + fat12_mkimg_random(&context) % 28));
+                file->time = (uint16_t)((fat12_mkimg_random(&context) % 24) << 11 | (fat12_mkimg_random(&context) % 60) << 5 | (fat12_mkimg_random(&context) % 30));
+                char long_name[64];
+                snprintf(long_name, sizeof(long_name), "Generated file %u.%s", i, FAT12_MKIMG_EXTENSIONS[file->extension][0]);
+                context.dirs[file->dir].num_slots += 1 + (spec->long_names ? fat12_mkimg_lfn_slots(long_name) : 0);
+        }
+        if (context.dirs[0].num_slots > format->root_entries) {
+                status = fat12_error(FAT12_ERR_INVALID, "Too many entries for the root directory (%u of %u)", context.dirs[0].num_slots, format->root_entries);
+        }
+
+        // Allocate each subdirectory as one contiguous run, then the files in order
+        uint32_t slots_per_cluster = context.cluster_size_bytes / DIR_ENTRY_SIZE_BYTES;
+        for (uint32_t d = 1; d < context.num_dirs && status == FAT12_OK; d++) {
+                fat12_mkimg_dir* dir = &context.dirs[d];
+                dir->num_clusters = (dir->num_slots + 1 + slots_per_cluster - 1) / slots_per_cluster; // +1 leaves room for the end marker
+                dir->first_cluster = fat12_mkimg_allocate(&context, dir->num_clusters, 0);
+                if (dir->first_cluster == 0) {
+                        status = fat12_error(FAT12_ERR_INVALID, "Image full while allocating directories");
+                }
+        }
+        for (uint32_t i = 0; i < spec->num_files && status == FAT12_OK; i++) {
+                fat12_mkimg_file* file = &context.files[i];
+                uint32_t num_clusters = (file->size + context.cluster_size_bytes - 1) / context.cluster_size_bytes;
+                file->first_cluster = fat12_mkimg_allocate(&context, num_clusters, file->fragmented);
+                if (file->first_cluster == 0) {
+                        status = fat12_error(FAT12_ERR_INVALID, "Image full after %u files", i);
+                        break;
+                }
+                fat12_mkimg_content(&context, file, i);
+        }
+
+        // Write the directory entries: the label, "." and "..", subdirectories, then files
+        uint32_t* tails = NULL;
+        if (status == FAT12_OK) {
+                tails = calloc((size_t)context.num_dirs * FAT12_MKIMG_NUM_EXTENSIONS, sizeof(uint32_t));
+                if (tails == NULL) {
+                        status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+        }
+        if (status == FAT12_OK) {
+                if (label_in_root) {
+                        char label[FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES + 1];
+                        snprintf(label, sizeof(label), "%-11.11s", spec->label);
+                        fat12_mkimg_entry(fat12_mkimg_slot(&context, 0), label, ATTRIBUTE_VOLUME_LABEL_BIT_MASK, 0, 0, 0, 0);
+                }
+                for (uint32_t d = 1; d < context.num_dirs; d++) {
+                        fat12_mkimg_dir* dir = &context.dirs[d];
+                        uint16_t parent_cluster = dir->parent > 0 ? context.dirs[dir->parent].first_cluster : 0;
+                        char short_name[FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES + 1];
+                        fat12_mkimg_entry(fat12_mkimg_slot(&context, d), ".          ", ATTRIBUTE_SUBDIRECTORY_BIT_MASK, dir->first_cluster, 0, 0x5021, 0);
+                        fat12_mkimg_entry(fat12_mkimg_slot(&context, d), "..         ", ATTRIBUTE_SUBDIRECTORY_BIT_MASK, parent_cluster, 0, 0x5021, 0);
+                        snprintf(short_name, sizeof(short_name), "%-8s   ", dir->name);
+                        fat12_mkimg_entry(fat12_mkimg_slot(&context, (uint32_t)dir->parent), short_name, ATTRIBUTE_SUBDIRECTORY_BIT_MASK, dir->first_cluster, 0, 0x5021, 0);
+                }
+                for (uint32_t i = 0; i < spec->num_files; i++) {
+                        fat12_mkimg_file* file = &context.files[i];
+                        char short_name[FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES + 1];
+                        if (spec->long_names) {
+                                // Every long name of a directory has the same basis, so each extension counts its own tails, as Windows does
+                                char long_name[64];
+                                snprintf(long_name, sizeof(long_name), "Generated file %u.%s", i, FAT12_MKIMG_EXTENSIONS[file->extension][0]);
+                                fat12_mkimg_short_name(long_name, ++tails[file->dir * FAT12_MKIMG_NUM_EXTENSIONS + file->extension], short_name);
+                                fat12_mkimg_lfn(&context, file->dir, long_name, short_name, file->deleted);
+                        } else {
+                                snprintf(short_name, sizeof(short_name), "F%07u%s", i, FAT12_MKIMG_EXTENSIONS[file->extension][0]);
+                        }
+                        unsigned char* entry = fat12_mkimg_slot(&context, file->dir);
+                        fat12_mkimg_entry(entry, short_name, 0x20, file->first_cluster, file->size, file->date, file->time);
+                        if (file->deleted) {
+                                entry[0] = 0xE5;
+                        }
+                }
+
+                // Deleting a file frees its chain but leaves its data and first cluster behind
+                for (uint32_t i = 0; i < spec->num_files; i++) {
+                        if (context.files[i].deleted) {
+                                for (uint16_t c = context.files[i].first_cluster; c >= 2 && c < 0xFF8; ) {
+                                        uint16_t next = context.fat[c];
+                                        context.fat[c] = 0;
+                                        c = next;
+                                }
+                        }
+                }
+        }
+        free(tails);
+
+        if (status == FAT12_OK) {
+
+                // Boot sector and BIOS parameter block
+                unsigned char* boot = context.image;
+                memcpy(boot, "\xEB\x3C\x90" "MSDOS5.0", 11);
+                boot[11] = SECTOR_SIZE_BYTES & 0xFF;
+                boot[12] = SECTOR_SIZE_BYTES >> 8;
+                boot[13] = format->sectors_per_cluster;
+                boot[14] = 1; // Reserved sectors
+                boot[NUM_FAT_COPIES_START_BYTE] = 2;
+                boot[17] = format->root_entries & 0xFF;
+                boot[18] = format->root_entries >> 8;
+                boot[TOTAL_SECTOR_COUNT_START_BYTE] = total_sectors & 0xFF;
+                boot[TOTAL_SECTOR_COUNT_START_BYTE + 1] = total_sectors >> 8;
+                boot[21] = format->media;
+                boot[SECTORS_PER_FAT_START_BYTE] = format->sectors_per_fat & 0xFF;
+                boot[SECTORS_PER_FAT_START_BYTE + 1] = format->sectors_per_fat >> 8;
+                boot[24] = format->sectors_per_track;
+                boot[26] = 2; // Heads
+                boot[38] = 0x29; // Extended boot signature
+                boot[39] = context.state & 0xFF; // Volume serial number
+                boot[40] = (context.state >> 8) & 0xFF;
+                boot[41] = (context.state >> 16) & 0xFF;
+                boot[42] = (context.state >> 24) & 0xFF;
+                char label[LABEL_LENGTH_BYTES + 1];
+                snprintf(label, sizeof(label), "%-11.11s", spec->label != NULL && (spec->label_placement & FAT12_LABEL_BOOT) ? spec->label : "");
+                memcpy(boot + LABEL_START_BYTE, label, LABEL_LENGTH_BYTES);
+                memcpy(boot + 54, "FAT12   ", 8);
+                boot[510] = 0x55;
+                boot[511] = 0xAA;
+
+                // Pack the FAT and write it to both copies
+                unsigned char* fat = context.image + SECTOR_SIZE_BYTES;
+                for (uint32_t n = 0; n < context.num_clusters + 2; n += 2) {
+                        uint16_t even = context.fat[n];
+                        uint16_t odd = n + 1 < context.num_clusters + 2 ? context.fat[n + 1] : 0;
+                        unsigned char* pair = fat + n / 2 * 3;
+                        pair[0] = even & 0xFF;
+                        pair[1] = (uint8_t)(((even >> 8) & 0x0F) | ((odd & 0x0F) << 4));
+                        pair[2] = (uint8_t)(odd >> 4);
+                }
+                memcpy(fat + (size_t)format->sectors_per_fat * SECTOR_SIZE_BYTES, fat, (size_t)format->sectors_per_fat * SECTOR_SIZE_BYTES);
+
+        }
+
+        free(context.files);
+        free(context.dirs);
+        free(context.fat);
+        if (status != FAT12_OK) {
+                free(context.image);
+                return status;
+        }
+        *image = (char*)context.image;
+        *image_size = context.image_size;
+        return FAT12_OK;
+
+}
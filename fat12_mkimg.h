@@ -0,0 +1,33 @@
+#ifndef FAT12_MKIMG_H
+#define FAT12_MKIMG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fat12_utils.h"
+
+// Where the generator puts the volume label
+typedef enum {
+        FAT12_LABEL_NONE = 0,
+        FAT12_LABEL_BOOT = 1, // In the boot sector only
+        FAT12_LABEL_ROOT = 2, // In a root directory entry only, with a blank boot sector label
+        FAT12_LABEL_BOTH = 3
+} fat12_label_placement;
+
+// Description of a synthetic image; zero-initialize and set the fields of interest
+typedef struct {
+        uint16_t total_sectors; // 720, 1440, 2400, 2880 or 5760 (0 means 2880, a 1.44 MB floppy)
+        uint32_t num_files;
+        uint32_t depth; // Levels of subdirectories below the root
+        uint32_t dirs_per_level; // Subdirectories in each directory above the deepest level (0 means 1)
+        uint32_t max_file_size; // Files are 1 to max_file_size bytes long, so each owns at least one cluster
+        uint32_t fragmentation; // Percentage of files whose clusters are scattered instead of contiguous
+        int long_names; // Give every file a VFAT long file name
+        uint32_t num_deleted; // Files written and then deleted, leaving 0xE5 entries and their data behind
+        const char* label;
+        fat12_label_placement label_placement;
+        uint32_t seed;
+} fat12_mkimg_spec;
+
+fat12_status fat12_mkimg (const fat12_mkimg_spec* spec, char** image, size_t* image_size);
+
+#endif
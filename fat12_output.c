@@ -0,0 +1,674 @@
+#include "fat12_output.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_path.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Buffered output is written out once it passes this size, so a report costs one write per this many bytes
+#define OUTPUT_FLUSH_BYTES (64 * 1024)
+
+// Size a thread's buffer starts at: room for a full flush plus the largest record
+#define OUTPUT_INITIAL_CAPACITY (128 * 1024)
+
+// Room reserved for everything in a record but its strings, which may grow sixfold when escaped
+#define OUTPUT_RECORD_FIXED_BYTES 512
+
+// Separator under "Root" and every directory name in the human listing
+static const char OUTPUT_RULE[] = "--------------------------------------------------\n";
+
+// Buffer each thread reuses from one report to the next, freed when the thread exits
+typedef struct {
+        char* buffer;
+        size_t capacity;
+} fat12_output_cache;
+
+static pthread_key_t fat12_output_cache_key;
+static pthread_once_t fat12_output_cache_once = PTHREAD_ONCE_INIT;
+
+// Function to free a thread's cached buffer when the thread exits
+static void fat12_output_cache_free (void* cache) {
+
+        free(((fat12_output_cache*)cache)->buffer);
+        free(cache);
+
+}
+
+// Function to create the key of the per-thread buffers, once per process
+static void fat12_output_cache_init (void) {
+
+        pthread_key_create(&fat12_output_cache_key, fat12_output_cache_free);
+
+}
+
+// Function to start a report written to out, taking over the calling thread's buffer
+void fat12_output_open (fat12_output* output, FILE* out, fat12_output_format format, const char* image) {
+
+        output->out = out;
+        output->format = format;
+        output->image = image != NULL ? image : "";
+        output->image_length = strlen(output->image);
+        output->buffer = NULL;
+        output->size = 0;
+        output->capacity = 0;
+        output->status = FAT12_OK;
+        output->path[0] = '\0';
+        output->dir_lengths = NULL;
+        output->dir_lengths_capacity = 0;
+
+        pthread_once(&fat12_output_cache_once, fat12_output_cache_init);
+        fat12_output_cache* cache = pthread_getspecific(fat12_output_cache_key);
+        if (cache != NULL && cache->buffer != NULL) {
+                output->buffer = cache->buffer;
+                output->capacity = cache->capacity;
+                cache->buffer = NULL;
+        }
+
+}
+
+/*
+ * Writes out everything buffered so far. Anything out already holds goes first; then, if out is backed by a file
+ * descriptor, the buffer goes to it in as few write calls as the kernel accepts, bypassing the stdio buffer.
+ * Memory streams, which have no descriptor, get it through fwrite.
+ */
+static void fat12_output_flush (fat12_output* output) {
+
+        if (output->size == 0 || output->status != FAT12_OK) {
+                output->size = 0;
+                return;
+        }
+        int fd = fileno(output->out);
+        if (fd < 0) {
+                if (fwrite(output->buffer, 1, output->size, output->out) != output->size) {
+                        output->status = fat12_error(FAT12_ERR_IO, "Error writing output: %s", strerror(errno));
+                }
+                output->size = 0;
+                return;
+        }
+
+        fflush(output->out);
+        for (size_t written = 0; written < output->size;) {
+                ssize_t result = write(fd, output->buffer + written, output->size - written);
+                if (result < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (result <= 0) {
+                        output->status = fat12_error(FAT12_ERR_IO, "Error writing output: %s", strerror(errno));
+                        break;
+                }
+                written += (size_t)result;
+        }
+        output->size = 0;
+
+}
+
+// Function to finish a report, writing out what is left and handing the buffer back to the thread; returns the first failure, if any
+fat12_status fat12_output_close (fat12_output* output) {
+
+        fat12_output_flush(output);
+        free(output->dir_lengths);
+        output->dir_lengths = NULL;
+
+        // Keep the buffer for the thread's next report
+        fat12_output_cache* cache = pthread_getspecific(fat12_output_cache_key);
+        if (cache == NULL && output->buffer != NULL) {
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                cache = calloc(1, sizeof(fat12_output_cache));
+                if (cache != NULL && pthread_setspecific(fat12_output_cache_key, cache) != 0) {
+                        free(cache);
+                        cache = NULL;
+                }
+        }
+        if (cache != NULL && cache->buffer == NULL) {
+                cache->buffer = output->buffer;
+                cache->capacity = output->capacity;
+        } else {
+                free(output->buffer);
+        }
+        output->buffer = NULL;
+        return output->status;
+
+}
+
+// Function to make room for a record of up to length bytes after writing out a full buffer, returning where it goes or NULL on failure
+static char* fat12_output_reserve (fat12_output* output, size_t length) {
+
+        if (output->size >= OUTPUT_FLUSH_BYTES) {
+                fat12_output_flush(output);
+        }
+        if (output->status != FAT12_OK) {
+                return NULL;
+        }
+        if (output->size + length > output->capacity) {
+                size_t capacity = output->capacity > 0 ? output->capacity : OUTPUT_INITIAL_CAPACITY;
+                while (output->size + length > capacity) {
+                        capacity *= 2;
+                }
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                char* grown = realloc(output->buffer, capacity);
+                if (grown == NULL) {
+                        output->status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                        return NULL;
+                }
+                output->buffer = grown;
+                output->capacity = capacity;
+        }
+        return output->buffer + output->size;
+
+}
+
+// Function to copy bytes into a record
+static inline char* fat12_output_bytes (char* p, const char* data, size_t length) {
+
+        memcpy(p, data, length);
+        return p + length;
+
+}
+
+// Function to write an unsigned number in decimal
+static char* fat12_output_uint (char* p, uint64_t value) {
+
+        char digits[20];
+        int n = 0;
+        do {
+                digits[n++] = (char)('0' + value % 10);
+                value /= 10;
+        } while (value > 0);
+        while (n > 0) {
+                *p++ = digits[--n];
+        }
+        return p;
+
+}
+
+// Function to write an unsigned number in decimal, left-justified in a field of width characters, as printf's %-*u does
+static char* fat12_output_uint_padded (char* p, uint64_t value, int width) {
+
+        char* start = p;
+        p = fat12_output_uint(p, value);
+        while (p - start < width) {
+                *p++ = ' ';
+        }
+        return p;
+
+}
+
+// Function to write a string left-justified in a field of width characters, as printf's %-*s does
+static char* fat12_output_padded (char* p, const char* string, int width) {
+
+        size_t length = strlen(string);
+        p = fat12_output_bytes(p, string, length);
+        for (; (int)length < width; length++) {
+                *p++ = ' ';
+        }
+        return p;
+
+}
+
+// Function to write a packed date and time as "YYYY-MM-DD HH:MM", exactly as fat12_format_datetime does, without going through snprintf
+static char* fat12_output_datetime (char* p, uint16_t date, uint16_t time) {
+
+        unsigned year = ((date & 0xFE00) >> 9) + 1980;
+        unsigned fields[4] = { (date & 0x1E0) >> 5, date & 0x1F, (time & 0xF800) >> 11, (time & 0x7E0) >> 5 };
+        static const char separators[4] = { '-', '-', ' ', ':' };
+        *p++ = (char)('0' + year / 1000);
+        *p++ = (char)('0' + year / 100 % 10);
+        *p++ = (char)('0' + year / 10 % 10);
+        *p++ = (char)('0' + year % 10);
+        for (int i = 0; i < 4; i++) {
+                *p++ = separators[i];
+                *p++ = (char)('0' + fields[i] / 10);
+                *p++ = (char)('0' + fields[i] % 10);
+        }
+        return p;
+
+}
+
+// Function to get the length of the well-formed UTF-8 sequence at the start of bytes, such as a long file name holds, or 0 if there is none
+static size_t fat12_output_utf8_length (const unsigned char* bytes, size_t length) {
+
+        size_t sequence_length = bytes[0] >= 0xC2 && bytes[0] <= 0xDF ? 2 : bytes[0] >= 0xE0 && bytes[0] <= 0xEF ? 3 : bytes[0] >= 0xF0 && bytes[0] <= 0xF4 ? 4 : 0;
+        if (sequence_length == 0 || sequence_length > length) {
+                return 0;
+        }
+
+        // The second byte also rules out overlong forms, surrogates and code points past U+10FFFF
+        unsigned char low = bytes[0] == 0xE0 ? 0xA0 : bytes[0] == 0xF0 ? 0x90 : 0x80;
+        unsigned char high = bytes[0] == 0xED ? 0x9F : bytes[0] == 0xF4 ? 0x8F : 0xBF;
+        if (bytes[1] < low || bytes[1] > high) {
+                return 0;
+        }
+        for (size_t i = 2; i < sequence_length; i++) {
+                if (bytes[i] < 0x80 || bytes[i] > 0xBF) {
+                        return 0;
+                }
+        }
+        return sequence_length;
+
+}
+
+/*
+ * Writes a JSON string, quoted and escaped in place. Well-formed UTF-8, such as long file names, is kept as it is;
+ * other bytes outside printable ASCII become \u00XX escapes, reading short names as Latin-1 so that any byte they hold still yields valid UTF-8 JSON.
+ * At most six bytes are written per input byte, plus the quotes.
+ */
+static char* fat12_output_json_string (char* p, const char* string, size_t length) {
+
+        static const char hex[] = "0123456789abcdef";
+        *p++ = '"';
+        for (size_t i = 0; i < length; i++) {
+                unsigned char c = (unsigned char)string[i];
+                size_t sequence_length = c >= 0x80 ? fat12_output_utf8_length((const unsigned char*)string + i, length - i) : 0;
+                if (c == '"' || c == '\\') {
+                        *p++ = '\\';
+                        *p++ = (char)c;
+                } else if (c >= 0x20 && c < 0x7F) {
+                        *p++ = (char)c;
+                } else if (sequence_length > 0) {
+                        p = fat12_output_bytes(p, string + i, sequence_length);
+                        i += sequence_length - 1;
+                } else {
+                        p = fat12_output_bytes(p, "\\u00", 4);
+                        *p++ = hex[c >> 4];
+                        *p++ = hex[c & 0xF];
+                }
+        }
+        *p++ = '"';
+        return p;
+
+}
+
+// Function to write a JSON object key with its colon
+static inline char* fat12_output_json_key (char* p, const char* key) {
+
+        *p++ = ',';
+        *p++ = '"';
+        p = fat12_output_bytes(p, key, strlen(key));
+        *p++ = '"';
+        *p++ = ':';
+        return p;
+
+}
+
+// Function to write a CSV field, quoted only when it holds a comma, quote, line break or surrounding space, with quotes doubled
+static char* fat12_output_csv_field (char* p, const char* string, size_t length) {
+
+        int quoted = length > 0 && (string[0] == ' ' || string[length - 1] == ' ');
+        for (size_t i = 0; i < length && !quoted; i++) {
+                quoted = string[i] == ',' || string[i] == '"' || string[i] == '\n' || string[i] == '\r';
+        }
+        if (!quoted) {
+                return fat12_output_bytes(p, string, length);
+        }
+        *p++ = '"';
+        for (size_t i = 0; i < length; i++) {
+                if (string[i] == '"') {
+                        *p++ = '"';
+                }
+                *p++ = string[i];
+        }
+        *p++ = '"';
+        return p;
+
+}
+
+// Function to write a little-endian integer of the given size
+static inline char* fat12_output_le (char* p, uint32_t value, int size) {
+
+        for (int i = 0; i < size; i++) {
+                *p++ = (char)(value >> (i * 8));
+        }
+        return p;
+
+}
+
+// Function to write a binary string: a 16-bit length, then the bytes
+static char* fat12_output_binary_string (char* p, const char* string, size_t length) {
+
+        if (length > UINT16_MAX) {
+                length = UINT16_MAX;
+        }
+        p = fat12_output_le(p, (uint32_t)length, 2);
+        return fat12_output_bytes(p, string, length);
+
+}
+
+// Function to start a binary record, returning where its payload starts so the length can be filled in by fat12_output_binary_end
+static inline char* fat12_output_binary_begin (char* p, fat12_output_record record) {
+
+        p += 4;
+        *p++ = (char)record;
+        return p;
+
+}
+
+// Function to fill in the length of a binary record whose payload runs from payload - 1 (the record kind) to end
+static inline void fat12_output_binary_end (char* payload, char* end) {
+
+        char* start = payload - 1;
+        fat12_output_le(start - 4, (uint32_t)(end - start), 4);
+
+}
+
+// Function to write the header row of a CSV report to out; other formats have none
+void fat12_output_begin (FILE* out, fat12_output_format format, fat12_output_record record) {
+
+        if (format != FAT12_OUTPUT_CSV) {
+                return;
+        }
+        if (record == FAT12_RECORD_INFO) {
+                fputs("image,os,label,total_size,free_size,file_count,sectors_per_fat,fat_copies\n", out);
+        } else {
+                fputs("image,type,path,short_name,size,cluster,attributes,created,modified,checksum\n", out);
+        }
+
+}
+
+/*
+ * Writes a volume summary: the labelled lines diskinfo prints, or one record with the same fields.
+ *
+ * @param output The report.
+ * @param info The summary.
+ */
+void fat12_output_info (fat12_output* output, const fat12_info* info) {
+
+        size_t os_length = strlen(info->os_name);
+        size_t label_length = strlen(info->label);
+        char* p = fat12_output_reserve(output, OUTPUT_RECORD_FIXED_BYTES + 6 * (output->image_length + os_length + label_length));
+        if (p == NULL) {
+                return;
+        }
+
+        switch (output->format) {
+                case FAT12_OUTPUT_HUMAN:
+                        p = fat12_output_padded(p, "OS:", 12);
+                        *p++ = ' ';
+                        p = fat12_output_bytes(p, info->os_name, os_length);
+                        p = fat12_output_padded(p, "\nLabel:", 13);
+                        *p++ = ' ';
+                        p = fat12_output_bytes(p, info->label, label_length);
+                        p = fat12_output_padded(p, "\nTotal Size:", 13);
+                        *p++ = ' ';
+                        p = fat12_output_uint(p, info->total_size);
+                        p = fat12_output_padded(p, "\nFree Size:", 13);
+                        *p++ = ' ';
+                        p = fat12_output_uint(p, info->free_size);
+                        p = fat12_output_padded(p, "\nFile Count:", 13);
+                        *p++ = ' ';
+                        p = fat12_output_uint(p, (uint64_t)(info->num_files < 0 ? 0 : info->num_files));
+                        p = fat12_output_padded(p, "\nSectors/FAT:", 13);
+                        *p++ = ' ';
+                        p = fat12_output_uint(p, info->sectors_per_fat);
+                        p = fat12_output_padded(p, "\nFAT Copies:", 13);
+                        *p++ = ' ';
+                        p = fat12_output_uint(p, info->num_fat_copies);
+                        *p++ = '\n';
+                        break;
+                case FAT12_OUTPUT_JSONL:
+                        p = fat12_output_bytes(p, "{\"image\":", 9);
+                        p = fat12_output_json_string(p, output->image, output->image_length);
+                        p = fat12_output_bytes(p, ",\"type\":\"info\"", 14);
+                        p = fat12_output_json_key(p, "os");
+                        p = fat12_output_json_string(p, info->os_name, os_length);
+                        p = fat12_output_json_key(p, "label");
+                        p = fat12_output_json_string(p, info->label, label_length);
+                        p = fat12_output_json_key(p, "total_size");
+                        p = fat12_output_uint(p, info->total_size);
+                        p = fat12_output_json_key(p, "free_size");
+                        p = fat12_output_uint(p, info->free_size);
+                        p = fat12_output_json_key(p, "file_count");
+                        p = fat12_output_uint(p, (uint64_t)(info->num_files < 0 ? 0 : info->num_files));
+                        p = fat12_output_json_key(p, "sectors_per_fat");
+                        p = fat12_output_uint(p, info->sectors_per_fat);
+                        p = fat12_output_json_key(p, "fat_copies");
+                        p = fat12_output_uint(p, info->num_fat_copies);
+                        p = fat12_output_bytes(p, "}\n", 2);
+                        break;
+                case FAT12_OUTPUT_CSV:
+                        p = fat12_output_csv_field(p, output->image, output->image_length);
+                        *p++ = ',';
+                        p = fat12_output_csv_field(p, info->os_name, os_length);
+                        *p++ = ',';
+                        p = fat12_output_csv_field(p, info->label, label_length);
+                        *p++ = ',';
+                        p = fat12_output_uint(p, info->total_size);
+                        *p++ = ',';
+                        p = fat12_output_uint(p, info->free_size);
+                        *p++ = ',';
+                        p = fat12_output_uint(p, (uint64_t)(info->num_files < 0 ? 0 : info->num_files));
+                        *p++ = ',';
+                        p = fat12_output_uint(p, info->sectors_per_fat);
+                        *p++ = ',';
+                        p = fat12_output_uint(p, info->num_fat_copies);
+                        *p++ = '\n';
+                        break;
+                case FAT12_OUTPUT_BINARY: {
+                        char* payload = fat12_output_binary_begin(p, FAT12_RECORD_INFO);
+                        p = fat12_output_binary_string(payload, output->image, output->image_length);
+                        p = fat12_output_binary_string(p, info->os_name, os_length);
+                        p = fat12_output_binary_string(p, info->label, label_length);
+                        p = fat12_output_le(p, info->total_size, 4);
+                        p = fat12_output_le(p, info->free_size, 4);
+                        p = fat12_output_le(p, (uint32_t)info->num_files, 4);
+                        p = fat12_output_le(p, info->sectors_per_fat, 2);
+                        p = fat12_output_le(p, info->num_fat_copies, 1);
+                        fat12_output_binary_end(payload, p);
+                        break;
+                }
+        }
+        output->size = (size_t)(p - output->buffer);
+
+}
+
+// Function to start a file listing: the "Root" heading of the human format, nothing in the others
+void fat12_output_listing (fat12_output* output) {
+
+        if (output->format != FAT12_OUTPUT_HUMAN) {
+                return;
+        }
+        char* p = fat12_output_reserve(output, OUTPUT_RECORD_FIXED_BYTES);
+        if (p == NULL) {
+                return;
+        }
+        p = fat12_output_bytes(p, "Root\n", 5);
+        p = fat12_output_bytes(p, OUTPUT_RULE, sizeof(OUTPUT_RULE) - 1);
+        output->size = (size_t)(p - output->buffer);
+
+}
+
+// Function to rebuild the full path of an item from its name and depth, as the path walker does, returning its length or -1 on failure
+static long fat12_output_item_path (fat12_output* output, const fat12_dir_item* item) {
+
+        size_t length = item->depth > 0 && item->depth <= output->dir_lengths_capacity ? output->dir_lengths[item->depth - 1] : 0;
+        char short_name[FAT12_NAME_BUFFER_SIZE];
+        const char* name = fat12_item_path_name(item, short_name);
+        size_t name_length = strlen(name);
+        if (length + name_length + 2 > FAT12_PATH_MAX) {
+                output->status = fat12_error(FAT12_ERR_RANGE, "Path too long below %.*s", (int)length, output->path);
+                return -1;
+        }
+        if (length > 0) {
+                output->path[length - 1] = '/';
+        }
+        memcpy(output->path + length, name, name_length + 1);
+
+        if (item->is_directory) {
+                if (item->depth >= output->dir_lengths_capacity) {
+                        int capacity = output->dir_lengths_capacity > 0 ? output->dir_lengths_capacity * 2 : 16;
+                        while (item->depth >= capacity) {
+                                capacity *= 2;
+                        }
+                        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                        size_t* dir_lengths = realloc(output->dir_lengths, capacity * sizeof(size_t));
+                        if (dir_lengths == NULL) {
+                                output->status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                                return -1;
+                        }
+                        output->dir_lengths = dir_lengths;
+                        output->dir_lengths_capacity = capacity;
+                }
+                output->dir_lengths[item->depth] = length + name_length + 1;
+        }
+        return (long)(length + name_length);
+
+}
+
+/*
+ * Writes one item of a directory walk: the line disklist prints for it, or one record with its full path,
+ * which is rebuilt from the names and depths of the items, so the items must come in walk order.
+ *
+ * @param output The report.
+ * @param item The item.
+ * @param checksum The file's checksum, or NULL for none.
+ */
+void fat12_output_item (fat12_output* output, const fat12_dir_item* item, const char* checksum) {
+
+        const char* entry = item->entry;
+        fat12_dirent dirent;
+        fat12_dirent_decode(entry, &dirent);
+        size_t checksum_length = checksum != NULL ? strlen(checksum) : 0;
+        size_t long_name_length = item->long_name != NULL ? strlen(item->long_name) : 0;
+
+        if (output->format == FAT12_OUTPUT_HUMAN) {
+                char* p = fat12_output_reserve(output, OUTPUT_RECORD_FIXED_BYTES + checksum_length + long_name_length);
+                if (p == NULL) {
+                        return;
+                }
+                if (item->is_directory && item->long_name != NULL) {
+                        p = fat12_output_bytes(p, item->long_name, long_name_length);
+                        *p++ = '\n';
+                        p = fat12_output_bytes(p, OUTPUT_RULE, sizeof(OUTPUT_RULE) - 1);
+                } else if (item->is_directory) {
+                        const char* end = memchr(entry + FILENAME_START_BYTE, '\0', FILENAME_LENGTH_BYTES);
+                        p = fat12_output_bytes(p, entry + FILENAME_START_BYTE, end != NULL ? (size_t)(end - entry - FILENAME_START_BYTE) : FILENAME_LENGTH_BYTES);
+                        *p++ = '\n';
+                        p = fat12_output_bytes(p, OUTPUT_RULE, sizeof(OUTPUT_RULE) - 1);
+                } else {
+                        char filename_extension[FAT12_NAME_BUFFER_SIZE];
+                        fat12_dirent_format_name(&dirent, filename_extension);
+                        p = fat12_output_bytes(p, "F ", 2);
+                        p = fat12_output_uint_padded(p, dirent.file_size, 10);
+                        *p++ = ' ';
+                        p = fat12_output_padded(p, filename_extension, FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES + 1); // +1 for the dot
+                        *p++ = ' ';
+                        p = fat12_output_datetime(p, dirent.creation_date, dirent.creation_time);
+                        if (checksum != NULL) {
+                                *p++ = ' ';
+                                p = fat12_output_bytes(p, checksum, checksum_length);
+                        }
+                        if (item->long_name != NULL) {
+                                *p++ = ' ';
+                                p = fat12_output_bytes(p, item->long_name, long_name_length);
+                        }
+                        *p++ = '\n';
+                }
+                output->size = (size_t)(p - output->buffer);
+                return;
+        }
+
+        long path_length = fat12_output_item_path(output, item);
+        if (path_length < 0) {
+                return;
+        }
+        char short_name[FAT12_NAME_BUFFER_SIZE];
+        fat12_entry_path_name(entry, short_name);
+        size_t short_name_length = strlen(short_name);
+        char* p = fat12_output_reserve(output, OUTPUT_RECORD_FIXED_BYTES + 6 * (output->image_length + (size_t)path_length + short_name_length + checksum_length));
+        if (p == NULL) {
+                return;
+        }
+        switch (output->format) {
+                case FAT12_OUTPUT_JSONL:
+                        p = fat12_output_bytes(p, "{\"image\":", 9);
+                        p = fat12_output_json_string(p, output->image, output->image_length);
+                        p = fat12_output_json_key(p, "type");
+                        p = item->is_directory ? fat12_output_bytes(p, "\"directory\"", 11) : fat12_output_bytes(p, "\"file\"", 6);
+                        p = fat12_output_json_key(p, "path");
+                        p = fat12_output_json_string(p, output->path, (size_t)path_length);
+                        p = fat12_output_json_key(p, "short_name");
+                        p = fat12_output_json_string(p, short_name, short_name_length);
+                        p = fat12_output_json_key(p, "size");
+                        p = fat12_output_uint(p, dirent.file_size);
+                        p = fat12_output_json_key(p, "cluster");
+                        p = fat12_output_uint(p, dirent.first_logical_cluster);
+                        p = fat12_output_json_key(p, "attributes");
+                        p = fat12_output_uint(p, dirent.attributes);
+                        p = fat12_output_json_key(p, "created");
+                        *p++ = '"';
+                        p = fat12_output_datetime(p, dirent.creation_date, dirent.creation_time);
+                        *p++ = '"';
+                        p = fat12_output_json_key(p, "modified");
+                        *p++ = '"';
+                        p = fat12_output_datetime(p, dirent.write_date, dirent.write_time);
+                        *p++ = '"';
+                        if (checksum != NULL) {
+                                p = fat12_output_json_key(p, "checksum");
+                                p = fat12_output_json_string(p, checksum, checksum_length);
+                        }
+                        p = fat12_output_bytes(p, "}\n", 2);
+                        break;
+                case FAT12_OUTPUT_CSV:
+                        p = fat12_output_csv_field(p, output->image, output->image_length);
+                        p = item->is_directory ? fat12_output_bytes(p, ",directory,", 11) : fat12_output_bytes(p, ",file,", 6);
+                        p = fat12_output_csv_field(p, output->path, (size_t)path_length);
+                        *p++ = ',';
+                        p = fat12_output_csv_field(p, short_name, short_name_length);
+                        *p++ = ',';
+                        p = fat12_output_uint(p, dirent.file_size);
+                        *p++ = ',';
+                        p = fat12_output_uint(p, dirent.first_logical_cluster);
+                        *p++ = ',';
+                        p = fat12_output_uint(p, dirent.attributes);
+                        *p++ = ',';
+                        p = fat12_output_datetime(p, dirent.creation_date, dirent.creation_time);
+                        *p++ = ',';
+                        p = fat12_output_datetime(p, dirent.write_date, dirent.write_time);
+                        *p++ = ',';
+                        p = fat12_output_bytes(p, checksum != NULL ? checksum : "", checksum_length);
+                        *p++ = '\n';
+                        break;
+                case FAT12_OUTPUT_BINARY: {
+                        char* payload = fat12_output_binary_begin(p, item->is_directory ? FAT12_RECORD_DIRECTORY : FAT12_RECORD_FILE);
+                        p = fat12_output_binary_string(payload, output->image, output->image_length);
+                        p = fat12_output_binary_string(p, output->path, (size_t)path_length);
+                        p = fat12_output_binary_string(p, short_name, short_name_length);
+                        p = fat12_output_le(p, dirent.file_size, 4);
+                        p = fat12_output_le(p, dirent.first_logical_cluster, 2);
+                        p = fat12_output_le(p, dirent.attributes, 1);
+                        p = fat12_output_le(p, dirent.creation_date, 2);
+                        p = fat12_output_le(p, dirent.creation_time, 2);
+                        p = fat12_output_le(p, dirent.write_date, 2);
+                        p = fat12_output_le(p, dirent.write_time, 2);
+                        p = fat12_output_binary_string(p, checksum != NULL ? checksum : "", checksum_length);
+                        fat12_output_binary_end(payload, p);
+                        break;
+                }
+                case FAT12_OUTPUT_HUMAN:
+                        break;
+        }
+        output->size = (size_t)(p - output->buffer);
+
+}
+
+// Function to check whether a command-line argument is --format=human|jsonl|csv|binary, returning 1 if so, -1 if it names an unknown format, or 0 otherwise
+int fat12_output_parse_option (const char* arg, fat12_output_format* format) {
+
+        static const char* const names[] = { "human", "jsonl", "csv", "binary" };
+        if (strncmp(arg, "--format=", 9) != 0) {
+                return strcmp(arg, "--format") == 0 ? -1 : 0;
+        }
+        for (int i = 0; i < 4; i++) {
+                if (strcmp(arg + 9, names[i]) == 0) {
+                        *format = (fat12_output_format)i;
+                        return 1;
+                }
+        }
+        return -1;
+
+}
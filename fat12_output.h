@@ -0,0 +1,47 @@
+#ifndef FAT12_OUTPUT_H
+#define FAT12_OUTPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "fat12_utils.h"
+#include "fat12_path.h"
+
+// Formats diskinfo and disklist can write their reports in
+typedef enum {
+        FAT12_OUTPUT_HUMAN = 0, // The aligned text the tools have always printed
+        FAT12_OUTPUT_JSONL, // One JSON object per line
+        FAT12_OUTPUT_CSV, // One row per record, after a header row
+        FAT12_OUTPUT_BINARY // Length-prefixed little-endian records
+} fat12_output_format;
+
+// Kinds of record, also the first payload byte of a binary record
+typedef enum {
+        FAT12_RECORD_INFO = 'I',
+        FAT12_RECORD_DIRECTORY = 'D',
+        FAT12_RECORD_FILE = 'F'
+} fat12_output_record;
+
+// Report being formatted into a reusable per-thread buffer, written out in large chunks
+typedef struct {
+        FILE* out;
+        fat12_output_format format;
+        const char* image; // Path of the image, part of every machine-readable record
+        size_t image_length;
+        char* buffer;
+        size_t size;
+        size_t capacity;
+        fat12_status status; // The first failure to grow the buffer or write it out
+        char path[FAT12_PATH_MAX]; // Full path of the last item, rebuilt from the names and depths of the items
+        size_t* dir_lengths; // Length of path up to and including the directory at each depth
+        int dir_lengths_capacity;
+} fat12_output;
+
+void fat12_output_open (fat12_output* output, FILE* out, fat12_output_format format, const char* image);
+fat12_status fat12_output_close (fat12_output* output);
+void fat12_output_begin (FILE* out, fat12_output_format format, fat12_output_record record);
+void fat12_output_info (fat12_output* output, const fat12_info* info);
+void fat12_output_listing (fat12_output* output);
+void fat12_output_item (fat12_output* output, const fat12_dir_item* item, const char* checksum);
+int fat12_output_parse_option (const char* arg, fat12_output_format* format);
+
+#endif
@@ -0,0 +1,435 @@
+#include "fat12_path.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+// Function to format the name of a raw entry as a path component: "NAME.EXT", or "NAME" when there is no extension
+void fat12_entry_path_name (const char* entry, char* name) {
+
+        fat12_dirent dirent;
+        fat12_dirent_decode(entry, &dirent);
+        fat12_dirent_format_name(&dirent, name);
+        if (dirent.extension[0] == '\0') {
+                name[strlen(dirent.name)] = '\0'; // Drop the dot
+        }
+        if ((unsigned char)name[0] == 0xE5) {
+                name[0] = '_'; // A deleted entry lost its first character to the 0xE5 marker
+        }
+
+}
+
+// Function to get the name of an item as a path component: its long file name if it has one, otherwise its short name formatted into name
+const char* fat12_item_path_name (const fat12_dir_item* item, char* name) {
+
+        if (item->long_name != NULL) {
+                return item->long_name;
+        }
+        fat12_entry_path_name(item->entry, name);
+        return name;
+
+}
+
+// Function to check that no component of a path built from image names is "..", so it cannot leave the directory it is joined to
+int fat12_path_is_safe (const char* path) {
+
+        for (const char* component = path; *component != '\0'; ) {
+                size_t length = strcspn(component, "/");
+                if (length == 2 && component[0] == '.' && component[1] == '.') {
+                        return 0;
+                }
+                component += length;
+                component += *component == '/';
+        }
+        return 1;
+
+}
+
+// Function to skip the leading slashes of a path
+static const char* fat12_path_skip_root (const char* path) {
+
+        while (*path == '/') {
+                path++;
+        }
+        return path;
+
+}
+
+// Function to get the length of a path without its trailing slashes
+static size_t fat12_path_length (const char* path) {
+
+        size_t length = strlen(path);
+        while (length > 0 && path[length - 1] == '/') {
+                length--;
+        }
+        return length;
+
+}
+
+// Function to check whether two paths name the same entry, ignoring case (FAT short names are upper case) and leading or trailing slashes
+int fat12_path_equal (const char* a, const char* b) {
+
+        a = fat12_path_skip_root(a);
+        b = fat12_path_skip_root(b);
+        size_t length = fat12_path_length(a);
+        if (length != fat12_path_length(b)) {
+                return 0;
+        }
+        for (size_t i = 0; i < length; i++) {
+                if (toupper((unsigned char)a[i]) != toupper((unsigned char)b[i])) {
+                        return 0;
+                }
+        }
+        return 1;
+
+}
+
+// Function to check whether path lies below the directory dir_path, where an empty dir_path or "/" is the root
+int fat12_path_within (const char* path, const char* dir_path) {
+
+        path = fat12_path_skip_root(path);
+        dir_path = fat12_path_skip_root(dir_path);
+        size_t length = fat12_path_length(dir_path);
+        if (length == 0) {
+                return 1;
+        }
+        for (size_t i = 0; i < length; i++) {
+                if (toupper((unsigned char)path[i]) != toupper((unsigned char)dir_path[i])) {
+                        return 0;
+                }
+        }
+        return path[length] == '/';
+
+}
+
+// Function to initialize a path walker over every entry of the volume, as fat12_dir_walker_init does
+fat12_status fat12_path_walker_init (fat12_path_walker* walker, fat12_volume* volume) {
+
+        walker->path[0] = '\0';
+        walker->short_path[0] = '\0';
+        walker->dir_lengths = NULL;
+        walker->short_dir_lengths = NULL;
+        walker->dir_lengths_capacity = 0;
+        return fat12_dir_walker_init(&walker->walker, volume);
+
+}
+
+// Function to set path to the path of the item's parent, as recorded in dir_lengths, followed by name, recording where it ends if the item is a directory
+static fat12_status fat12_path_walker_set (char* path, size_t* dir_lengths, const fat12_dir_item* item, const char* name) {
+
+        // The parent directories of the entry are the ones recorded at the depths above it
+        size_t length = item->depth > 0 ? dir_lengths[item->depth - 1] : 0;
+        size_t name_length = strlen(name);
+        if (length + name_length + 2 > FAT12_PATH_MAX) {
+                return fat12_error(FAT12_ERR_RANGE, "Path too long below %.*s", (int)length, path);
+        }
+        if (length > 0) {
+                path[length - 1] = '/'; // Reported paths end at the name, so restore the separator after the parent
+        }
+        memcpy(path + length, name, name_length + 1);
+
+        // Remember where a directory's own path ends so its children can be appended after it
+        if (item->is_directory) {
+                dir_lengths[item->depth] = length + name_length + 1;
+        }
+        return FAT12_OK;
+
+}
+
+/*
+ * Advances the path walker to the next entry, as fat12_dir_walker_next does,
+ * and sets walker->path and walker->short_path to the full path of that entry.
+ *
+ * @param walker The path walker.
+ * @param item Filled in with the visited entry.
+ * @return 1 if an entry was visited, 0 once every directory has been walked, or a negative fat12_status on failure.
+ */
+int fat12_path_walker_next (fat12_path_walker* walker, fat12_dir_item* item) {
+
+        int result = fat12_dir_walker_next(&walker->walker, item);
+        if (result != 1) {
+                return result;
+        }
+
+        if (item->is_directory && item->depth >= walker->dir_lengths_capacity) {
+                int capacity = walker->dir_lengths_capacity > 0 ? walker->dir_lengths_capacity * 2 : 16;
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 2);
+                size_t* dir_lengths = realloc(walker->dir_lengths, capacity * sizeof(size_t));
+                if (dir_lengths != NULL) {
+                        walker->dir_lengths = dir_lengths;
+                }
+                size_t* short_dir_lengths = realloc(walker->short_dir_lengths, capacity * sizeof(size_t));
+                if (short_dir_lengths != NULL) {
+                        walker->short_dir_lengths = short_dir_lengths;
+                }
+                if (dir_lengths == NULL || short_dir_lengths == NULL) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                walker->dir_lengths_capacity = capacity;
+        }
+
+        char name[FAT12_NAME_BUFFER_SIZE];
+        fat12_entry_path_name(item->entry, name);
+        if (item->is_deleted && (unsigned char)item->entry[0] == 0xE5 && item->long_name != NULL) {
+                name[0] = (char)toupper((unsigned char)item->long_name[0]); // Recovered along with the long name
+        }
+        fat12_status status = fat12_path_walker_set(walker->short_path, walker->short_dir_lengths, item, name);
+        if (status == FAT12_OK) {
+                status = fat12_path_walker_set(walker->path, walker->dir_lengths, item, item->long_name != NULL ? item->long_name : name);
+        }
+        return status == FAT12_OK ? 1 : status;
+
+}
+
+// Function to release the memory held by a path walker
+void fat12_path_walker_free (fat12_path_walker* walker) {
+
+        fat12_dir_walker_free(&walker->walker);
+        free(walker->dir_lengths);
+        free(walker->short_dir_lengths);
+        walker->dir_lengths = NULL;
+        walker->short_dir_lengths = NULL;
+        walker->dir_lengths_capacity = 0;
+
+}
+
+// One path in a path index; the key is upper-cased, without leading or trailing slashes
+typedef struct {
+        uint64_t hash; // 0 marks an empty slot
+        uint32_t key_offset; // Offset of the key in the key arena, followed by the path as walked and a null terminator
+        uint32_t key_length;
+        const char* entry; // The raw entry, pointing into the volume
+} fat12_path_slot;
+
+// Open-addressing hash table from every path of a volume to its entry, kept at most half full
+struct fat12_path_index {
+        fat12_path_slot* slots;
+        size_t num_slots; // A power of two
+        size_t num_paths;
+        char* keys;
+        size_t keys_size;
+        size_t keys_capacity;
+};
+
+// Function to copy a path into key the way the path index stores it, returning its length, or FAT12_PATH_MAX if it cannot be a stored path
+static size_t fat12_path_key (const char* path, char* key) {
+
+        path = fat12_path_skip_root(path);
+        size_t length = fat12_path_length(path);
+        if (length >= FAT12_PATH_MAX) {
+                return FAT12_PATH_MAX;
+        }
+        for (size_t i = 0; i < length; i++) {
+                key[i] = (char)toupper((unsigned char)path[i]);
+        }
+        return length;
+
+}
+
+// Function to hash a key with 64-bit FNV-1a, never returning the empty-slot marker 0
+static uint64_t fat12_path_hash (const char* key, size_t length) {
+
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < length; i++) {
+                hash = (hash ^ (unsigned char)key[i]) * 0x100000001b3ull;
+        }
+        return hash != 0 ? hash : 1;
+
+}
+
+// Function to find the slot holding key, or the empty slot where it would go
+static fat12_path_slot* fat12_path_index_probe (const fat12_path_index* index, const char* key, size_t length, uint64_t hash) {
+
+        size_t mask = index->num_slots - 1;
+        for (size_t i = (size_t)hash & mask; ; i = (i + 1) & mask) {
+                fat12_path_slot* slot = &index->slots[i];
+                if (slot->hash == 0 || (slot->hash == hash && slot->key_length == length && memcmp(index->keys + slot->key_offset, key, length) == 0)) {
+                        return slot;
+                }
+        }
+
+}
+
+// Function to double the number of slots of a path index, reinserting every path
+static fat12_status fat12_path_index_grow (fat12_path_index* index) {
+
+        size_t num_slots = index->num_slots > 0 ? index->num_slots * 2 : 256;
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        fat12_path_slot* slots = calloc(num_slots, sizeof(fat12_path_slot));
+        if (slots == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        fat12_path_slot* old_slots = index->slots;
+        size_t old_num_slots = index->num_slots;
+        index->slots = slots;
+        index->num_slots = num_slots;
+        for (size_t i = 0; i < old_num_slots; i++) {
+                if (old_slots[i].hash != 0) {
+                        *fat12_path_index_probe(index, index->keys + old_slots[i].key_offset, old_slots[i].key_length, old_slots[i].hash) = old_slots[i];
+                }
+        }
+        free(old_slots);
+        return FAT12_OK;
+
+}
+
+// Function to add a path to the index, keeping the first entry when an image lists the same path twice
+static fat12_status fat12_path_index_insert (fat12_path_index* index, const char* path, const char* entry) {
+
+        if ((index->num_paths + 1) * 2 > index->num_slots) {
+                fat12_status status = fat12_path_index_grow(index);
+                if (status != FAT12_OK) {
+                        return status;
+                }
+        }
+        if (index->keys_size + 2 * FAT12_PATH_MAX > index->keys_capacity) {
+                size_t capacity = index->keys_capacity > 0 ? index->keys_capacity * 2 : 8 * FAT12_PATH_MAX;
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                char* keys = realloc(index->keys, capacity);
+                if (keys == NULL) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                index->keys = keys;
+                index->keys_capacity = capacity;
+        }
+
+        // Build the key straight into the arena; it is only kept if the path is new
+        char* key = index->keys + index->keys_size;
+        size_t length = fat12_path_key(path, key);
+        uint64_t hash = fat12_path_hash(key, length);
+        fat12_path_slot* slot = fat12_path_index_probe(index, key, length, hash);
+        if (slot->hash == 0) {
+                slot->hash = hash;
+                slot->key_offset = (uint32_t)index->keys_size;
+                slot->key_length = (uint32_t)length;
+                slot->entry = entry;
+                memcpy(key + length, path, length);
+                key[2 * length] = '\0';
+                index->keys_size += 2 * length + 1;
+                index->num_paths++;
+        }
+        return FAT12_OK;
+
+}
+
+/*
+ * Builds a path index of the volume in one walk over its directory tree, so that any number of lookups
+ * afterwards cost constant time each. Paths are keyed upper-cased, as fat12_path_equal compares them.
+ * An entry below long file names is keyed by both its long path and its short path, but not by a mix of the two.
+ * The caller is responsible for freeing the index with fat12_path_index_free.
+ *
+ * @param volume The volume.
+ * @param index Set to the new index.
+ * @return FAT12_OK, or the reason the tree could not be walked.
+ */
+fat12_status fat12_path_index_build (fat12_volume* volume, fat12_path_index** index) {
+
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        fat12_path_index* built = calloc(1, sizeof(fat12_path_index));
+        if (built == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+
+        fat12_path_walker walker;
+        fat12_dir_item item;
+        int status = fat12_path_walker_init(&walker, volume);
+        while (status == FAT12_OK && (status = fat12_path_walker_next(&walker, &item)) == 1) {
+                status = fat12_path_index_insert(built, walker.path, item.entry);
+                if (status == FAT12_OK && strcmp(walker.short_path, walker.path) != 0) {
+                        status = fat12_path_index_insert(built, walker.short_path, item.entry);
+                }
+        }
+        fat12_path_walker_free(&walker);
+        if (status < 0) {
+                fat12_path_index_free(built);
+                return (fat12_status)status;
+        }
+
+        *index = built;
+        return FAT12_OK;
+
+}
+
+// Function to get the number of paths in a path index
+size_t fat12_path_index_size (const fat12_path_index* index) {
+
+        return index->num_paths;
+
+}
+
+/*
+ * Looks up the entry of the file or directory at the given path, such as "SUBDIR/FILE.TXT",
+ * without regard to the case of ASCII letters or to leading and trailing slashes.
+ *
+ * @param index The path index.
+ * @param path The path of the entry, relative to the root directory.
+ * @param entry Set to the raw entry on success.
+ * @param found_path Set to the path as the walk spelled it, in the same form (long or short) as path (may be NULL).
+ * @return FAT12_OK, or FAT12_ERR_NOT_FOUND if there is no such entry.
+ */
+fat12_status fat12_path_index_lookup (const fat12_path_index* index, const char* path, const char** entry, const char** found_path) {
+
+        char key[FAT12_PATH_MAX];
+        size_t length = fat12_path_key(path, key);
+        if (length > 0 && length < FAT12_PATH_MAX && index->num_slots > 0) {
+                const fat12_path_slot* slot = fat12_path_index_probe(index, key, length, fat12_path_hash(key, length));
+                if (slot->hash != 0) {
+                        *entry = slot->entry;
+                        if (found_path != NULL) {
+                                *found_path = index->keys + slot->key_offset + slot->key_length;
+                        }
+                        return FAT12_OK;
+                }
+        }
+        return fat12_error(FAT12_ERR_NOT_FOUND, "File not found: %s", path);
+
+}
+
+// Function to release a path index
+void fat12_path_index_free (fat12_path_index* index) {
+
+        if (index != NULL) {
+                free(index->slots);
+                free(index->keys);
+                free(index);
+        }
+
+}
+
+// Function to get the path index of the volume, built on first use and kept until the volume is closed or written to
+fat12_status fat12_volume_path_index (fat12_volume* volume, const fat12_path_index** index) {
+
+        if (volume->path_index == NULL) {
+                fat12_status status = fat12_path_index_build(volume, &volume->path_index);
+                if (status != FAT12_OK) {
+                        return status;
+                }
+        }
+        *index = volume->path_index;
+        return FAT12_OK;
+
+}
+
+/*
+ * Finds the entry of the file or directory at the given path, such as "SUBDIR/FILE.TXT" or "Long Directory/Long Name.txt".
+ * Names are matched without regard to case. The entry points into the volume.
+ * The first lookup on a volume builds its path index; every later one costs constant time.
+ *
+ * @param volume The volume.
+ * @param path The path of the entry, relative to the root directory.
+ * @param entry Set to the raw entry on success.
+ * @return FAT12_OK, FAT12_ERR_NOT_FOUND if there is no such entry, or the reason the lookup failed.
+ */
+fat12_status fat12_find_entry (fat12_volume* volume, const char* path, const char** entry) {
+
+        const fat12_path_index* index;
+        fat12_status status = fat12_volume_path_index(volume, &index);
+        if (status != FAT12_OK) {
+                return status;
+        }
+        return fat12_path_index_lookup(index, path, entry, NULL);
+
+}
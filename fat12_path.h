@@ -0,0 +1,40 @@
+#ifndef FAT12_PATH_H
+#define FAT12_PATH_H
+
+#include <stddef.h>
+#include "fat12_utils.h"
+
+// Longest "DIR/SUBDIR/NAME.EXT" path the path walker builds, including the null terminator
+#define FAT12_PATH_MAX 4096
+
+// Directory walker that also keeps the full path of the current entry, relative to the root and without a leading '/'
+typedef struct {
+        fat12_dir_walker walker;
+        char path[FAT12_PATH_MAX]; // Made of long file names, where entries have them
+        char short_path[FAT12_PATH_MAX]; // Made of short names only
+        size_t* dir_lengths; // Length of path up to and including the directory at each depth
+        size_t* short_dir_lengths; // The same for short_path
+        int dir_lengths_capacity;
+} fat12_path_walker;
+
+void fat12_entry_path_name (const char* entry, char* name);
+const char* fat12_item_path_name (const fat12_dir_item* item, char* name);
+int fat12_path_equal (const char* a, const char* b);
+int fat12_path_within (const char* path, const char* dir_path);
+int fat12_path_is_safe (const char* path);
+
+fat12_status fat12_path_walker_init (fat12_path_walker* walker, fat12_volume* volume);
+int fat12_path_walker_next (fat12_path_walker* walker, fat12_dir_item* item);
+void fat12_path_walker_free (fat12_path_walker* walker);
+
+// Hash table from every path of a volume to its entry, for constant-time lookups
+typedef struct fat12_path_index fat12_path_index;
+
+fat12_status fat12_path_index_build (fat12_volume* volume, fat12_path_index** index);
+size_t fat12_path_index_size (const fat12_path_index* index);
+fat12_status fat12_path_index_lookup (const fat12_path_index* index, const char* path, const char** entry, const char** found_path);
+void fat12_path_index_free (fat12_path_index* index);
+fat12_status fat12_volume_path_index (fat12_volume* volume, const fat12_path_index** index);
+fat12_status fat12_find_entry (fat12_volume* volume, const char* path, const char** entry);
+
+#endif
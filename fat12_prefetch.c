@@ -0,0 +1,780 @@
+#include "fat12_prefetch.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_fat.h"
+#include "fat12_batch.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#endif
+
+// Images the io_uring backend keeps in flight at once
+#define PREFETCH_URING_IMAGES 64
+// Submission queue entries asked of the kernel
+#define PREFETCH_URING_ENTRIES 256
+// Threads of the pread backend, each with one read outstanding
+#define PREFETCH_PREAD_THREADS 16
+
+// What a read brings in, which decides what is done with it once it completes
+typedef enum {
+        PREFETCH_BOOT,
+        PREFETCH_FAT,
+        PREFETCH_ROOT,
+        PREFETCH_CLUSTER // One cluster of a subdirectory
+} fat12_prefetch_kind;
+
+// Stages an image goes through; reads of one stage all complete before the next begins
+typedef enum {
+        PREFETCH_HEADER, // Boot sector, FAT and root directory where a 1.44 MB layout would put them
+        PREFETCH_METADATA, // The FAT and root directory again, where the boot sector says they really are
+        PREFETCH_DIRECTORIES // Subdirectory clusters, queued as their parents are decoded
+} fat12_prefetch_stage;
+
+struct fat12_prefetch_image;
+
+// One read of an image, with its buffer
+typedef struct fat12_prefetch_request {
+        struct fat12_prefetch_request* prev; // Neighbours among the reads of the engine not yet completed
+        struct fat12_prefetch_request* next;
+        struct fat12_prefetch_image* image;
+        fat12_prefetch_kind kind;
+        int linked; // The next request of the image only starts once this one has read all it asked for
+        int chain_length; // Requests linked together from this one on, so they are submitted together
+        int in_flight; // Handed to the kernel, which may still write into the buffer
+        uint16_t cluster;
+        off_t offset;
+        struct iovec iov;
+} fat12_prefetch_request;
+
+// Read-ahead state of one image
+typedef struct fat12_prefetch_image {
+        struct fat12_prefetch_image* prev; // Neighbours among the images of the engine in flight
+        struct fat12_prefetch_image* next;
+        size_t index; // Position of the image in the batch
+        int fd;
+        size_t size;
+        int pending; // Reads queued or in flight
+        fat12_prefetch_stage stage;
+        fat12_prefetch_request* header[3]; // Completed boot sector, FAT and root directory reads, by kind
+        fat12_geometry geometry;
+        uint16_t* entries; // Decoded FAT
+        uint32_t end_cluster; // One past the last cluster both the data region and the FAT cover
+        unsigned char* visited; // One bit per directory cluster already queued
+} fat12_prefetch_image;
+
+struct fat12_prefetch {
+        char** paths;
+        size_t* order; // Images in the order the batch workers will take them
+        size_t count;
+        fat12_prefetch_mode mode;
+        size_t next; // Position in order of the next image to start, shared by the pread threads
+        unsigned char* done; // One per image, set once its reads are over, successful or not
+        int finished; // Set once nothing more will be read
+        pthread_mutex_t lock;
+        pthread_cond_t ready;
+        pthread_t thread;
+        int threaded;
+};
+
+// Requests waiting to be submitted, in order, and everything one thread has in flight
+typedef struct {
+        fat12_prefetch* prefetch;
+        fat12_prefetch_request** queue;
+        size_t queue_head;
+        size_t queue_size;
+        size_t queue_capacity;
+        fat12_prefetch_request* requests; // Not yet completed
+        fat12_prefetch_image* images; // Started and not yet finished
+        size_t num_images;
+} fat12_prefetch_engine;
+
+// Function to record that an image needs nothing more, waking the worker waiting for it
+static void fat12_prefetch_mark_done (fat12_prefetch* prefetch, size_t index) {
+
+        pthread_mutex_lock(&prefetch->lock);
+        prefetch->done[index] = 1;
+        pthread_cond_broadcast(&prefetch->ready);
+        pthread_mutex_unlock(&prefetch->lock);
+
+}
+
+// Function to release a request that has completed or will never be submitted
+static void fat12_prefetch_release (fat12_prefetch_engine* engine, fat12_prefetch_request* request) {
+
+        if (request->prev != NULL) {
+                request->prev->next = request->next;
+        } else {
+                engine->requests = request->next;
+        }
+        if (request->next != NULL) {
+                request->next->prev = request->prev;
+        }
+        free(request);
+
+}
+
+// Function to close an image whose reads are over, marking it done
+static void fat12_prefetch_finish (fat12_prefetch_engine* engine, fat12_prefetch_image* image) {
+
+        for (int i = 0; i < 3; i++) {
+                if (image->header[i] != NULL) {
+                        fat12_prefetch_release(engine, image->header[i]);
+                }
+        }
+        if (image->prev != NULL) {
+                image->prev->next = image->next;
+        } else {
+                engine->images = image->next;
+        }
+        if (image->next != NULL) {
+                image->next->prev = image->prev;
+        }
+        engine->num_images--;
+        close(image->fd);
+        free(image->entries);
+        free(image->visited);
+        fat12_prefetch_mark_done(engine->prefetch, image->index);
+        free(image);
+
+}
+
+/*
+ * Queues a read of part of an image, trimmed to the end of the file. The buffer follows the request in the same allocation.
+ *
+ * @return The request, or NULL if nothing of the range lies in the file or memory ran out.
+ */
+static fat12_prefetch_request* fat12_prefetch_read (fat12_prefetch_engine* engine, fat12_prefetch_image* image, fat12_prefetch_kind kind, size_t offset, size_t length) {
+
+        if (offset >= image->size || length == 0) {
+                return NULL;
+        }
+        if (length > image->size - offset) {
+                length = image->size - offset;
+        }
+        if (engine->queue_head + engine->queue_size == engine->queue_capacity) {
+                if (engine->queue_head > 0) {
+                        memmove(engine->queue, engine->queue + engine->queue_head, engine->queue_size * sizeof(fat12_prefetch_request*));
+                        engine->queue_head = 0;
+                } else {
+                        size_t capacity = engine->queue_capacity > 0 ? engine->queue_capacity * 2 : 256;
+                        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                        fat12_prefetch_request** queue = realloc(engine->queue, capacity * sizeof(fat12_prefetch_request*));
+                        if (queue == NULL) {
+                                return NULL;
+                        }
+                        engine->queue = queue;
+                        engine->queue_capacity = capacity;
+                }
+        }
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        fat12_prefetch_request* request = malloc(sizeof(fat12_prefetch_request) + length);
+        if (request == NULL) {
+                return NULL;
+        }
+
+        request->prev = NULL;
+        request->next = engine->requests;
+        if (engine->requests != NULL) {
+                engine->requests->prev = request;
+        }
+        engine->requests = request;
+        request->image = image;
+        request->kind = kind;
+        request->linked = 0;
+        request->chain_length = 1;
+        request->in_flight = 0;
+        request->cluster = 0;
+        request->offset = (off_t)offset;
+        request->iov.iov_base = request + 1;
+        request->iov.iov_len = length;
+        engine->queue[engine->queue_head + engine->queue_size++] = request;
+        image->pending++;
+        return request;
+
+}
+
+// Function to queue reads of the FAT and root directory of an image as one linked chain, behind whatever request comes first
+static void fat12_prefetch_read_header (fat12_prefetch_engine* engine, fat12_prefetch_image* image, fat12_prefetch_request* first, const fat12_geometry* geometry) {
+
+        fat12_prefetch_request* chain[3] = { first, NULL, NULL };
+        int length = first != NULL;
+        if (image->header[PREFETCH_FAT] == NULL) {
+                chain[length] = fat12_prefetch_read(engine, image, PREFETCH_FAT, geometry->fat_start_byte, (size_t)geometry->sectors_per_fat * geometry->bytes_per_sector);
+                length += chain[length] != NULL;
+        }
+        if (image->header[PREFETCH_ROOT] == NULL) {
+                chain[length] = fat12_prefetch_read(engine, image, PREFETCH_ROOT, geometry->root_start_byte, (size_t)geometry->root_entries * DIR_ENTRY_SIZE_BYTES);
+                length += chain[length] != NULL;
+        }
+        for (int i = 0; i + 1 < length; i++) {
+                chain[i]->linked = 1;
+        }
+        if (length > 0) {
+                chain[0]->chain_length = length;
+        }
+
+}
+
+// Function to mark a cluster in an image's visited bitmap, returning 1 if it was already marked
+static int fat12_prefetch_visit (fat12_prefetch_image* image, uint32_t cluster) {
+
+        unsigned char bit = (unsigned char)(1 << (cluster & 7));
+        if (image->visited[cluster >> 3] & bit) {
+                return 1;
+        }
+        image->visited[cluster >> 3] |= bit;
+        return 0;
+
+}
+
+// Function to queue the read of one directory cluster, unless it is out of range or already queued
+static void fat12_prefetch_read_cluster (fat12_prefetch_engine* engine, fat12_prefetch_image* image, uint32_t cluster) {
+
+        if (cluster < 2 || cluster >= FAT_ENTRY_BAD || cluster >= image->end_cluster || fat12_prefetch_visit(image, cluster)) {
+                return;
+        }
+        fat12_prefetch_request* request = fat12_prefetch_read(engine, image, PREFETCH_CLUSTER, fat12_cluster_start_byte(&image->geometry, cluster), image->geometry.cluster_size_bytes);
+        if (request != NULL) {
+                request->cluster = (uint16_t)cluster;
+        }
+
+}
+
+// Function to queue the clusters of every subdirectory named in a stretch of directory, then the next cluster of the directory itself unless its end marker was reached
+static void fat12_prefetch_directory (fat12_prefetch_engine* engine, fat12_prefetch_image* image, const char* entries, size_t length_bytes, uint16_t cluster) {
+
+        for (size_t offset = 0; offset + DIR_ENTRY_SIZE_BYTES <= length_bytes; offset += DIR_ENTRY_SIZE_BYTES) {
+                const char* entry = entries + offset;
+                if (entry[0] == 0x00) {
+                        return;
+                }
+                if ((unsigned char)entry[0] == 0xE5 || entry[0] == '.' || entry[DIR_ENTRY_ATTRIBUTE_BYTE] == ATTRIBUTE_LONG_FILE_NAME
+                        || (entry[DIR_ENTRY_ATTRIBUTE_BYTE] & ATTRIBUTE_VOLUME_LABEL_BIT_MASK)) {
+                        continue;
+                }
+                if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] & ATTRIBUTE_SUBDIRECTORY_BIT_MASK) {
+                        fat12_prefetch_read_cluster(engine, image, get_first_logical_cluster(entry));
+                }
+        }
+        if (cluster != 0) {
+                fat12_prefetch_read_cluster(engine, image, image->entries[cluster]);
+        }
+
+}
+
+// Function to take an image to its next stage once every read of the current one has completed
+static void fat12_prefetch_advance (fat12_prefetch_engine* engine, fat12_prefetch_image* image) {
+
+        if (image->stage == PREFETCH_HEADER) {
+
+                // Keep the guessed reads that match the real layout, and read the rest again
+                fat12_prefetch_request* boot = image->header[PREFETCH_BOOT];
+                if (boot == NULL || fat12_parse_geometry(boot->iov.iov_base, &image->geometry) != FAT12_OK) {
+                        fat12_prefetch_finish(engine, image);
+                        return;
+                }
+                const fat12_geometry* geometry = &image->geometry;
+                fat12_prefetch_request* fat = image->header[PREFETCH_FAT];
+                if (fat != NULL && (fat->offset != (off_t)geometry->fat_start_byte || fat->iov.iov_len != (size_t)geometry->sectors_per_fat * geometry->bytes_per_sector)) {
+                        fat12_prefetch_release(engine, fat);
+                        image->header[PREFETCH_FAT] = NULL;
+                }
+                fat12_prefetch_request* root = image->header[PREFETCH_ROOT];
+                if (root != NULL && (root->offset != (off_t)geometry->root_start_byte || root->iov.iov_len != (size_t)geometry->root_entries * DIR_ENTRY_SIZE_BYTES)) {
+                        fat12_prefetch_release(engine, root);
+                        image->header[PREFETCH_ROOT] = NULL;
+                }
+                image->stage = PREFETCH_METADATA;
+                fat12_prefetch_read_header(engine, image, NULL, geometry);
+                if (image->pending > 0) {
+                        return;
+                }
+
+        }
+
+        if (image->stage == PREFETCH_METADATA) {
+
+                fat12_prefetch_request* fat = image->header[PREFETCH_FAT];
+                fat12_prefetch_request* root = image->header[PREFETCH_ROOT];
+                if (fat == NULL || root == NULL) {
+                        fat12_prefetch_finish(engine, image);
+                        return;
+                }
+                uint32_t num_entries = (uint32_t)(fat->iov.iov_len * 2 / 3);
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 2);
+                image->entries = malloc((num_entries + 1) * sizeof(uint16_t));
+                image->visited = calloc(num_entries / 8 + 1, sizeof(unsigned char));
+                if (image->entries == NULL || image->visited == NULL) {
+                        fat12_prefetch_finish(engine, image);
+                        return;
+                }
+                fat12_fat_unpack(fat->iov.iov_base, image->entries, num_entries);
+                image->end_cluster = image->geometry.end_cluster < num_entries ? image->geometry.end_cluster : num_entries;
+                image->stage = PREFETCH_DIRECTORIES;
+                fat12_prefetch_directory(engine, image, root->iov.iov_base, root->iov.iov_len, 0);
+                if (image->pending > 0) {
+                        return;
+                }
+
+        }
+
+        fat12_prefetch_finish(engine, image);
+
+}
+
+// Function to handle a completed read: result is the number of bytes read, or a negative errno
+static void fat12_prefetch_complete (fat12_prefetch_engine* engine, fat12_prefetch_request* request, long result) {
+
+        fat12_prefetch_image* image = request->image;
+        request->in_flight = 0;
+        image->pending--;
+        if (result == (long)request->iov.iov_len && request->kind != PREFETCH_CLUSTER) {
+                image->header[request->kind] = request; // Kept until the stage is over
+        } else {
+                if (result == (long)request->iov.iov_len) {
+                        fat12_prefetch_directory(engine, image, request->iov.iov_base, request->iov.iov_len, request->cluster);
+                }
+                fat12_prefetch_release(engine, request);
+        }
+        if (image->pending == 0) {
+                fat12_prefetch_advance(engine, image);
+        }
+
+}
+
+/*
+ * Opens the next image and queues its first reads: the boot sector, then the FAT and root directory where a
+ * 1.44 MB layout puts them, linked so they run one after the other as soon as the boot sector is in. Anything
+ * but a non-empty regular file is left alone, to be read by its worker.
+ */
+static void fat12_prefetch_begin (fat12_prefetch_engine* engine, size_t index) {
+
+        int fd = open(engine->prefetch->paths[index], O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < SECTOR_SIZE_BYTES) {
+                if (fd >= 0) {
+                        close(fd);
+                }
+                fat12_prefetch_mark_done(engine->prefetch, index);
+                return;
+        }
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        fat12_prefetch_image* image = calloc(1, sizeof(fat12_prefetch_image));
+        if (image == NULL) {
+                close(fd);
+                fat12_prefetch_mark_done(engine->prefetch, index);
+                return;
+        }
+        image->index = index;
+        image->fd = fd;
+        image->size = (size_t)st.st_size;
+        image->stage = PREFETCH_HEADER;
+        image->next = engine->images;
+        if (engine->images != NULL) {
+                engine->images->prev = image;
+        }
+        engine->images = image;
+        engine->num_images++;
+
+        fat12_prefetch_request* boot = fat12_prefetch_read(engine, image, PREFETCH_BOOT, 0, SECTOR_SIZE_BYTES);
+        if (boot == NULL) {
+                fat12_prefetch_finish(engine, image);
+                return;
+        }
+        fat12_prefetch_read_header(engine, image, boot, &FAT12_GEOMETRY_1440K);
+
+}
+
+// Function to drop everything an engine still holds, once its reads can no longer complete
+static void fat12_prefetch_abandon (fat12_prefetch_engine* engine) {
+
+        engine->queue_size = 0;
+        while (engine->images != NULL) {
+                fat12_prefetch_finish(engine, engine->images);
+        }
+
+        // Buffers the kernel may still be writing into are left to it; this only happens when io_uring fails mid-batch
+        fat12_prefetch_request* request = engine->requests;
+        while (request != NULL) {
+                fat12_prefetch_request* next = request->next;
+                if (!request->in_flight) {
+                        fat12_prefetch_release(engine, request);
+                }
+                request = next;
+        }
+        free(engine->queue);
+
+}
+
+#if defined(__NR_io_uring_setup) && defined(IORING_OFF_SQ_RING)
+
+// Submission and completion rings shared with the kernel, set up with raw system calls
+typedef struct {
+        int fd;
+        unsigned* sq_head;
+        unsigned* sq_tail;
+        unsigned sq_mask;
+        unsigned sq_entries;
+        unsigned* sq_array;
+        struct io_uring_sqe* sqes;
+        unsigned* cq_head;
+        unsigned* cq_tail;
+        unsigned cq_mask;
+        struct io_uring_cqe* cqes;
+        void* sq_ring;
+        size_t sq_ring_size;
+        void* cq_ring;
+        size_t cq_ring_size;
+        size_t sqes_size;
+        unsigned to_submit; // Queued in the ring but not yet handed to the kernel
+        unsigned in_flight; // Handed to the kernel and not yet completed
+} fat12_uring;
+
+// Function to release a ring, which cancels whatever it still has in flight
+static void fat12_uring_close (fat12_uring* ring) {
+
+        if (ring->sqes != NULL) {
+                munmap(ring->sqes, ring->sqes_size);
+        }
+        if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+                munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        if (ring->sq_ring != NULL) {
+                munmap(ring->sq_ring, ring->sq_ring_size);
+        }
+        close(ring->fd);
+
+}
+
+// Function to set up a ring, returning -1 if the kernel has no io_uring or will not let this process use it
+static int fat12_uring_setup (fat12_uring* ring, unsigned entries) {
+
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        memset(ring, 0, sizeof(*ring));
+        ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (ring->fd < 0) {
+                return -1;
+        }
+
+        ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                if (ring->cq_ring_size > ring->sq_ring_size) {
+                        ring->sq_ring_size = ring->cq_ring_size;
+                }
+                ring->cq_ring_size = ring->sq_ring_size;
+        }
+        ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+        if (ring->sq_ring == MAP_FAILED) {
+                ring->sq_ring = NULL;
+                fat12_uring_close(ring);
+                return -1;
+        }
+        ring->cq_ring = ring->sq_ring;
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+                ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+                if (ring->cq_ring == MAP_FAILED) {
+                        ring->cq_ring = NULL;
+                        fat12_uring_close(ring);
+                        return -1;
+                }
+        }
+        ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+        if (ring->sqes == MAP_FAILED) {
+                ring->sqes = NULL;
+                fat12_uring_close(ring);
+                return -1;
+        }
+
+        char* sq = ring->sq_ring;
+        char* cq = ring->cq_ring;
+        ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+        ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+        ring->sq_entries = *(unsigned*)(sq + params.sq_off.ring_entries);
+        ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+        ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+        ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+        ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+        return 0;
+
+}
+
+// Function to move queued requests into the submission ring, whole link chains at a time, while there is room
+static void fat12_uring_fill (fat12_uring* ring, fat12_prefetch_engine* engine) {
+
+        unsigned tail = *ring->sq_tail;
+        unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        while (engine->queue_size > 0) {
+                fat12_prefetch_request* first = engine->queue[engine->queue_head];
+                unsigned room = ring->sq_entries - (tail - head);
+                if ((unsigned)first->chain_length > room) {
+                        break;
+                }
+                for (int i = 0; i < first->chain_length; i++) {
+                        fat12_prefetch_request* request = engine->queue[engine->queue_head++];
+                        engine->queue_size--;
+                        unsigned slot = tail & ring->sq_mask;
+                        struct io_uring_sqe* sqe = &ring->sqes[slot];
+                        memset(sqe, 0, sizeof(*sqe));
+                        sqe->opcode = IORING_OP_READV;
+                        sqe->fd = request->image->fd;
+                        sqe->off = (uint64_t)request->offset;
+                        sqe->addr = (uint64_t)(uintptr_t)&request->iov;
+                        sqe->len = 1;
+                        sqe->flags = request->linked ? IOSQE_IO_LINK : 0;
+                        sqe->user_data = (uint64_t)(uintptr_t)request;
+                        request->in_flight = 1;
+                        ring->sq_array[slot] = slot;
+                        tail++;
+                        ring->to_submit++;
+                }
+        }
+        if (engine->queue_size == 0) {
+                engine->queue_head = 0;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+}
+
+/*
+ * Reads the metadata of the batch through io_uring: up to PREFETCH_URING_IMAGES images at a time, each
+ * one's boot sector, FAT and root directory submitted as one linked chain, and each subdirectory cluster
+ * submitted as soon as the cluster naming it has been decoded. One thread keeps the device queue full.
+ *
+ * @return 0 once every image has been read, or -1 if io_uring is unavailable or failed; the pread threads then take the remaining images.
+ */
+static int fat12_prefetch_uring (fat12_prefetch* prefetch) {
+
+        fat12_uring ring;
+        if (fat12_uring_setup(&ring, PREFETCH_URING_ENTRIES) != 0) {
+                return -1;
+        }
+        fat12_prefetch_engine engine;
+        memset(&engine, 0, sizeof(engine));
+        engine.prefetch = prefetch;
+
+        int result = 0;
+        while (prefetch->next < prefetch->count || engine.num_images > 0) {
+                while (engine.num_images < PREFETCH_URING_IMAGES && prefetch->next < prefetch->count) {
+                        fat12_prefetch_begin(&engine, prefetch->order[prefetch->next++]);
+                }
+                fat12_uring_fill(&ring, &engine);
+                if (ring.to_submit == 0 && ring.in_flight == 0) {
+                        continue; // Every image started so far finished without a read
+                }
+
+                long submitted = syscall(__NR_io_uring_enter, ring.fd, ring.to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+                if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                        result = -1;
+                        break;
+                }
+                if (submitted > 0) {
+                        ring.to_submit -= (unsigned)submitted;
+                        ring.in_flight += (unsigned)submitted;
+                }
+
+                // Handle every completion; each may queue more reads for the next round
+                unsigned head = *ring.cq_head;
+                unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+                for (; head != tail; head++) {
+                        struct io_uring_cqe* cqe = &ring.cqes[head & ring.cq_mask];
+                        fat12_prefetch_request* request = (fat12_prefetch_request*)(uintptr_t)cqe->user_data;
+                        ring.in_flight--;
+                        fat12_prefetch_complete(&engine, request, cqe->res);
+                }
+                __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+        }
+
+        // After a failure, images still in flight are marked done so their workers read them themselves
+        fat12_uring_close(&ring);
+        fat12_prefetch_abandon(&engine);
+        return result;
+
+}
+
+#else
+
+// Function standing in for the io_uring backend where the system headers lack it
+static int fat12_prefetch_uring (fat12_prefetch* prefetch) {
+
+        (void)prefetch;
+        return -1;
+
+}
+
+#endif
+
+// Function to read a request with blocking pread calls, returning the bytes read or a negative errno
+static long fat12_prefetch_pread (const fat12_prefetch_request* request) {
+
+        size_t done = 0;
+        while (done < request->iov.iov_len) {
+                ssize_t n = pread(request->image->fd, (char*)request->iov.iov_base + done, request->iov.iov_len - done, request->offset + (off_t)done);
+                if (n < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (n < 0) {
+                        return -errno;
+                }
+                if (n == 0) {
+                        break;
+                }
+                done += (size_t)n;
+        }
+        return (long)done;
+
+}
+
+// Function run by each pread thread: take the next image, read its metadata one request at a time, and repeat
+static void fat12_prefetch_pread_task (size_t index, int worker, void* context) {
+
+        (void)index;
+        (void)worker;
+        fat12_prefetch* prefetch = context;
+        fat12_prefetch_engine engine;
+        memset(&engine, 0, sizeof(engine));
+        engine.prefetch = prefetch;
+
+        size_t position;
+        while ((position = __atomic_fetch_add(&prefetch->next, 1, __ATOMIC_RELAXED)) < prefetch->count) {
+                fat12_prefetch_begin(&engine, prefetch->order[position]);
+
+                // A short read cancels the rest of its chain, as it would in the ring
+                int cancel = 0;
+                while (engine.queue_size > 0) {
+                        fat12_prefetch_request* request = engine.queue[engine.queue_head++];
+                        engine.queue_size--;
+                        long result = cancel ? -ECANCELED : fat12_prefetch_pread(request);
+                        cancel = request->linked && result != (long)request->iov.iov_len;
+                        fat12_prefetch_complete(&engine, request, result);
+                }
+                engine.queue_head = 0;
+        }
+        fat12_prefetch_abandon(&engine);
+
+}
+
+// Function run on the prefetch thread: io_uring if the kernel allows it, the pread threads otherwise
+static void* fat12_prefetch_thread (void* argument) {
+
+        fat12_prefetch* prefetch = argument;
+        if (prefetch->mode == FAT12_PREFETCH_PREAD || fat12_prefetch_uring(prefetch) != 0) {
+                size_t remaining = prefetch->count - prefetch->next;
+                int num_threads = remaining < PREFETCH_PREAD_THREADS ? (int)remaining : PREFETCH_PREAD_THREADS;
+                fat12_pool_run((size_t)num_threads, num_threads, fat12_prefetch_pread_task, prefetch);
+        }
+
+        pthread_mutex_lock(&prefetch->lock);
+        prefetch->finished = 1;
+        pthread_cond_broadcast(&prefetch->ready);
+        pthread_mutex_unlock(&prefetch->lock);
+        return NULL;
+
+}
+
+/*
+ * Starts reading the boot sector, FAT and directory clusters of a batch of images on a background thread,
+ * so that the page cache already holds them when the workers map the images. Nothing is kept once read:
+ * the workers still open and map each image themselves, and any page the read-ahead did not reach is simply
+ * faulted in as before. The caller must release it with fat12_prefetch_free.
+ *
+ * @param paths The image paths.
+ * @param order The indices of paths in the order they will be needed.
+ * @param count The number of images.
+ * @param mode FAT12_PREFETCH_AUTO or FAT12_PREFETCH_PREAD.
+ * @param started Set to the running read-ahead on success.
+ * @return FAT12_OK, or the reason it could not be started.
+ */
+fat12_status fat12_prefetch_start (char** paths, const size_t* order, size_t count, fat12_prefetch_mode mode, fat12_prefetch** started) {
+
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 3);
+        fat12_prefetch* prefetch = calloc(1, sizeof(fat12_prefetch));
+        if (prefetch != NULL) {
+                prefetch->order = malloc((count > 0 ? count : 1) * sizeof(size_t));
+                prefetch->done = calloc(count > 0 ? count : 1, sizeof(unsigned char));
+        }
+        if (prefetch == NULL || prefetch->order == NULL || prefetch->done == NULL) {
+                fat12_status status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                if (prefetch != NULL) {
+                        free(prefetch->order);
+                        free(prefetch->done);
+                        free(prefetch);
+                }
+                return status;
+        }
+        memcpy(prefetch->order, order, count * sizeof(size_t));
+        prefetch->paths = paths;
+        prefetch->count = count;
+        prefetch->mode = mode;
+        pthread_mutex_init(&prefetch->lock, NULL);
+        pthread_cond_init(&prefetch->ready, NULL);
+
+        prefetch->threaded = pthread_create(&prefetch->thread, NULL, fat12_prefetch_thread, prefetch) == 0;
+        if (!prefetch->threaded) {
+                prefetch->finished = 1; // Nothing will be read ahead; the workers read everything themselves
+        }
+        *started = prefetch;
+        return FAT12_OK;
+
+}
+
+// Function to wait until the read-ahead of the image at index in paths is over, successful or not
+void fat12_prefetch_wait (fat12_prefetch* prefetch, size_t index) {
+
+        pthread_mutex_lock(&prefetch->lock);
+        while (!prefetch->done[index] && !prefetch->finished) {
+                pthread_cond_wait(&prefetch->ready, &prefetch->lock);
+        }
+        pthread_mutex_unlock(&prefetch->lock);
+
+}
+
+// Function to wait for the read-ahead to end and release it
+void fat12_prefetch_free (fat12_prefetch* prefetch) {
+
+        if (prefetch == NULL) {
+                return;
+        }
+        if (prefetch->threaded) {
+                pthread_join(prefetch->thread, NULL);
+        }
+        pthread_cond_destroy(&prefetch->ready);
+        pthread_mutex_destroy(&prefetch->lock);
+        free(prefetch->order);
+        free(prefetch->done);
+        free(prefetch);
+
+}
+
+// Function to check whether a command-line argument is --prefetch[=pread], returning 1 if so, -1 if it names an unknown backend, or 0 otherwise
+int fat12_prefetch_parse_option (const char* arg, fat12_prefetch_mode* mode) {
+
+        if (strcmp(arg, "--prefetch") == 0) {
+                *mode = FAT12_PREFETCH_AUTO;
+                return 1;
+        }
+        if (strcmp(arg, "--prefetch=pread") == 0) {
+                *mode = FAT12_PREFETCH_PREAD;
+                return 1;
+        }
+        if (strncmp(arg, "--prefetch=", 11) == 0) {
+                return -1;
+        }
+        return 0;
+
+}
@@ -0,0 +1,22 @@
+#ifndef FAT12_PREFETCH_H
+#define FAT12_PREFETCH_H
+
+#include <stddef.h>
+#include "fat12_utils.h"
+
+// How the metadata of a batch is read ahead of the workers
+typedef enum {
+        FAT12_PREFETCH_OFF = 0, // Each worker faults the pages of its image in as it walks it
+        FAT12_PREFETCH_AUTO, // io_uring, or the pread threads where the kernel refuses it
+        FAT12_PREFETCH_PREAD // Blocking pread calls on a pool of threads
+} fat12_prefetch_mode;
+
+// Read-ahead of the boot sector, FAT and directories of many images at once, into the page cache their mappings use
+typedef struct fat12_prefetch fat12_prefetch;
+
+fat12_status fat12_prefetch_start (char** paths, const size_t* order, size_t count, fat12_prefetch_mode mode, fat12_prefetch** prefetch);
+void fat12_prefetch_wait (fat12_prefetch* prefetch, size_t index);
+void fat12_prefetch_free (fat12_prefetch* prefetch);
+int fat12_prefetch_parse_option (const char* arg, fat12_prefetch_mode* mode);
+
+#endif
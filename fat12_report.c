@@ -0,0 +1,285 @@
+#include "fat12_report.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_stats.h"
+#include "fat12_index.h"
+#include "fat12_daemon.h"
+#include "fat12_checksum.h"
+#include "fat12_output.h"
+#include "fat12_stream.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+// Directory of the index files the reports are answered from, or NULL to read every image directly
+static const char* fat12_report_index_dir = NULL;
+
+// Function to answer fat12_report_info and fat12_report_files from index files kept in index_dir (NULL to stop)
+void fat12_report_use_index (const char* index_dir) {
+
+	fat12_report_index_dir = index_dir;
+
+}
+
+// Socket of the fat12d the reports are fetched from, or NULL to produce them in this process
+static const char* fat12_report_daemon_socket = NULL;
+
+// Function to fetch fat12_report_info and fat12_report_files from the fat12d listening on socket_path (NULL to stop)
+void fat12_report_use_daemon (const char* socket_path) {
+
+	fat12_report_daemon_socket = socket_path;
+
+}
+
+// Checksum fat12_report_files adds to every file, or FAT12_CHECKSUM_NONE for the plain listing
+static fat12_checksum_kind fat12_report_checksum = FAT12_CHECKSUM_NONE;
+
+// Function to make fat12_report_files add a checksum column to every file (FAT12_CHECKSUM_NONE to stop)
+void fat12_report_use_checksum (fat12_checksum_kind kind) {
+
+	fat12_report_checksum = kind;
+
+}
+
+// Format the reports are written in
+static fat12_output_format fat12_report_format = FAT12_OUTPUT_HUMAN;
+
+// Function to make fat12_report_info and fat12_report_files write their reports in the given format
+void fat12_report_use_format (fat12_output_format format) {
+
+	fat12_report_format = format;
+
+}
+
+// Whether images are read once front to back, as they arrive through a pipe, instead of being mapped
+static int fat12_report_stream = 0;
+
+// Function to make fat12_report_info and fat12_report_files open their images with fat12_volume_open_stream
+void fat12_report_use_stream (int stream) {
+
+	fat12_report_stream = stream;
+
+}
+
+// Function to fetch a report on the image at path from fat12d, over a connection of its own
+static fat12_status fat12_report_via_daemon (fat12_daemon_request request, const char* path, FILE* out) {
+
+	int fd;
+	fat12_status status = fat12_daemon_connect(fat12_report_daemon_socket, &fd);
+	if (status != FAT12_OK) {
+		return status;
+	}
+	status = fat12_daemon_query(fd, request, path, out);
+	close(fd);
+	return status;
+
+}
+
+// Function to write a volume summary as diskinfo reports it
+static void fat12_write_info (fat12_output* output, const fat12_info* info) {
+
+	uint64_t phase_start = fat12_stats_phase_begin();
+	fat12_output_info(output, info);
+	fat12_stats_phase_end(FAT12_PHASE_OUTPUT, phase_start);
+
+}
+
+// Function to write the summary of a volume
+static fat12_status fat12_write_volume_info (fat12_volume* volume, fat12_output* output) {
+
+	fat12_info info;
+	fat12_status status = fat12_get_info(volume, &info);
+	if (status != FAT12_OK) {
+		return status;
+	}
+	fat12_write_info(output, &info);
+	return FAT12_OK;
+
+}
+
+// Function to print the information of the provided disk image, as diskinfo reports it
+fat12_status fat12_print_info (fat12_volume* volume, FILE* out) {
+
+	fat12_output output;
+	fat12_output_open(&output, out, FAT12_OUTPUT_HUMAN, NULL);
+	fat12_status status = fat12_write_volume_info(volume, &output);
+	fat12_status close_status = fat12_output_close(&output);
+	return status != FAT12_OK ? status : close_status;
+
+}
+
+// Function to write one item of the directory walk as disklist reports it, with the file's checksum unless checksum is NULL
+static void fat12_write_item (fat12_output* output, const fat12_dir_item* item, const char* checksum) {
+
+	uint64_t phase_start = fat12_stats_phase_begin();
+	fat12_output_item(output, item, checksum);
+	fat12_stats_phase_end(FAT12_PHASE_OUTPUT, phase_start);
+
+}
+
+// Function to write all files of a volume, organized by directory
+static fat12_status fat12_write_files (fat12_volume* volume, fat12_output* output) {
+
+	fat12_output_listing(output);
+
+	// Walk all directories; each subdirectory's entries follow right after it
+	fat12_dir_walker walker;
+	fat12_dir_item item;
+	int status = fat12_dir_walker_init(&walker, volume);
+	while (status == FAT12_OK && (status = fat12_dir_walker_next(&walker, &item)) == 1) {
+		fat12_write_item(output, &item, NULL);
+		status = FAT12_OK;
+	}
+	fat12_dir_walker_free(&walker);
+
+	return status < 0 ? (fat12_status)status : FAT12_OK;
+
+}
+
+// Function to print all files, organized by directory, in the provided disk image, as disklist reports them
+fat12_status fat12_print_files (fat12_volume* volume, FILE* out) {
+
+	fat12_output output;
+	fat12_output_open(&output, out, FAT12_OUTPUT_HUMAN, NULL);
+	fat12_status status = fat12_write_files(volume, &output);
+	fat12_status close_status = fat12_output_close(&output);
+	return status != FAT12_OK ? status : close_status;
+
+}
+
+/*
+ * Writes all files of a volume with a checksum of every file.
+ * The walk is done first, then the files are checksummed together, so large images can spread the hashing over several cores.
+ *
+ * @param volume The volume.
+ * @param kind The checksum to add.
+ * @param output Where the listing is written.
+ * @return FAT12_OK, or the reason the walk or a file's chain failed; nothing is written then.
+ */
+static fat12_status fat12_write_files_checksummed (fat12_volume* volume, fat12_checksum_kind kind, fat12_output* output) {
+
+	fat12_dir_item* items = NULL;
+	const char** entries = NULL;
+	size_t num_items = 0;
+	size_t num_files = 0;
+	size_t capacity = 0;
+	fat12_dir_walker walker;
+	fat12_dir_item item;
+	int status = fat12_dir_walker_init(&walker, volume);
+	while (status == FAT12_OK && (status = fat12_dir_walker_next(&walker, &item)) == 1) {
+		status = FAT12_OK;
+		if (num_items == capacity) {
+			capacity = capacity > 0 ? capacity * 2 : 256;
+			fat12_stats_add(FAT12_STAT_ALLOCATIONS, 2);
+			fat12_dir_item* grown_items = realloc(items, capacity * sizeof(fat12_dir_item));
+			if (grown_items != NULL) {
+				items = grown_items;
+			}
+			const char** grown_entries = realloc(entries, capacity * sizeof(const char*));
+			if (grown_entries != NULL) {
+				entries = grown_entries;
+			}
+			if (grown_items == NULL || grown_entries == NULL) {
+				status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+				break;
+			}
+		}
+		items[num_items++] = item;
+		if (!item.is_directory) {
+			entries[num_files++] = item.entry;
+		}
+	}
+
+	char (*checksums)[FAT12_CHECKSUM_BUFFER_SIZE] = NULL;
+	if (status == FAT12_OK && num_files > 0) {
+		fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+		checksums = malloc(num_files * FAT12_CHECKSUM_BUFFER_SIZE);
+		status = checksums != NULL ? fat12_checksum_files(volume, entries, num_files, kind, checksums) : fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+	}
+	if (status == FAT12_OK) {
+		fat12_output_listing(output);
+		for (size_t i = 0, file = 0; i < num_items; i++) {
+			fat12_write_item(output, &items[i], items[i].is_directory ? NULL : checksums[file++]);
+		}
+	}
+
+	// The long names of the items belong to the walker, so it goes last
+	fat12_dir_walker_free(&walker);
+	free(checksums);
+	free(entries);
+	free(items);
+	return status < 0 ? (fat12_status)status : FAT12_OK;
+
+}
+
+// Function to print the information of the disk image at the provided path
+fat12_status fat12_report_info (const char* path, FILE* out) {
+
+	if (fat12_report_daemon_socket != NULL) {
+		return fat12_report_via_daemon(FAT12_DAEMON_INFO, path, out);
+	}
+
+	fat12_output output;
+	fat12_output_open(&output, out, fat12_report_format, path);
+	fat12_status status;
+	if (fat12_report_index_dir != NULL) {
+		fat12_index* index;
+		status = fat12_index_load(fat12_report_index_dir, path, &index);
+		if (status == FAT12_OK) {
+			fat12_write_info(&output, fat12_index_info(index));
+			fat12_index_free(index);
+		}
+	} else {
+		fat12_volume* volume;
+		status = fat12_report_stream ? fat12_volume_open_stream(path, &volume) : fat12_volume_open(path, &volume);
+		if (status == FAT12_OK) {
+			status = fat12_write_volume_info(volume, &output);
+			fat12_volume_close(volume);
+		}
+	}
+	fat12_status close_status = fat12_output_close(&output);
+	return status != FAT12_OK ? status : close_status;
+
+}
+
+// Function to print all files of the disk image at the provided path
+fat12_status fat12_report_files (const char* path, FILE* out) {
+
+	if (fat12_report_daemon_socket != NULL) {
+		return fat12_report_via_daemon(FAT12_DAEMON_LIST, path, out);
+	}
+
+	fat12_output output;
+	fat12_output_open(&output, out, fat12_report_format, path);
+	fat12_status status;
+	if (fat12_report_index_dir != NULL) {
+		fat12_index* index;
+		status = fat12_index_load(fat12_report_index_dir, path, &index);
+		if (status == FAT12_OK) {
+			fat12_output_listing(&output);
+			fat12_dir_item item;
+			for (size_t i = 0; i < fat12_index_num_items(index); i++) {
+				fat12_index_item(index, i, &item);
+				fat12_write_item(&output, &item, NULL);
+			}
+			fat12_index_free(index);
+		}
+	} else {
+		fat12_volume* volume;
+		status = fat12_report_stream ? fat12_volume_open_stream(path, &volume) : fat12_volume_open(path, &volume);
+		if (status == FAT12_OK) {
+			if (fat12_report_checksum != FAT12_CHECKSUM_NONE) {
+				status = fat12_write_files_checksummed(volume, fat12_report_checksum, &output);
+			} else {
+				status = fat12_write_files(volume, &output);
+			}
+			fat12_volume_close(volume);
+		}
+	}
+	fat12_status close_status = fat12_output_close(&output);
+	return status != FAT12_OK ? status : close_status;
+
+}
@@ -0,0 +1,19 @@
+#ifndef FAT12_REPORT_H
+#define FAT12_REPORT_H
+
+#include <stdio.h>
+#include "fat12_utils.h"
+#include "fat12_checksum.h"
+#include "fat12_output.h"
+
+fat12_status fat12_print_info (fat12_volume* volume, FILE* out);
+fat12_status fat12_print_files (fat12_volume* volume, FILE* out);
+void fat12_report_use_index (const char* index_dir);
+void fat12_report_use_daemon (const char* socket_path);
+void fat12_report_use_checksum (fat12_checksum_kind kind);
+void fat12_report_use_format (fat12_output_format format);
+void fat12_report_use_stream (int stream);
+fat12_status fat12_report_info (const char* path, FILE* out);
+fat12_status fat12_report_files (const char* path, FILE* out);
+
+#endif
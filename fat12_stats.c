@@ -0,0 +1,134 @@
+#include "fat12_stats.h"
+#include "fat12_internal.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+// Names of the counters and phases, in enum order, as printed by fat12_stats_print
+static const char* const FAT12_STAT_COUNTER_NAMES[FAT12_STAT_NUM_COUNTERS] = {
+        "bytes_read", "read_calls", "seeks", "allocations", "entries_visited"
+};
+static const char* const FAT12_STAT_PHASE_NAMES[FAT12_NUM_PHASES] = {
+        "open", "boot_sector", "fat", "directories", "output"
+};
+
+#ifndef FAT12_NO_STATS
+
+// Process-wide state, updated with relaxed atomics so batch workers can share it
+int fat12_stats_enabled = 0;
+uint64_t fat12_stats_counters[FAT12_STAT_NUM_COUNTERS];
+uint64_t fat12_stats_phase_ns[FAT12_NUM_PHASES];
+
+// Function to turn statistics collection on or off for the whole process
+fat12_status fat12_stats_enable (int enabled) {
+
+        __atomic_store_n(&fat12_stats_enabled, enabled != 0, __ATOMIC_RELAXED);
+        return FAT12_OK;
+
+}
+
+// Function to zero every counter and phase time
+void fat12_stats_reset (void) {
+
+        for (int i = 0; i < FAT12_STAT_NUM_COUNTERS; i++) {
+                __atomic_store_n(&fat12_stats_counters[i], 0, __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < FAT12_NUM_PHASES; i++) {
+                __atomic_store_n(&fat12_stats_phase_ns[i], 0, __ATOMIC_RELAXED);
+        }
+
+}
+
+// Function to get the current value of a counter
+uint64_t fat12_stats_counter (fat12_stat_counter counter) {
+
+        return __atomic_load_n(&fat12_stats_counters[counter], __ATOMIC_RELAXED);
+
+}
+
+// Function to get the time accumulated in a phase, in nanoseconds
+uint64_t fat12_stats_phase_time (fat12_stat_phase phase) {
+
+        return __atomic_load_n(&fat12_stats_phase_ns[phase], __ATOMIC_RELAXED);
+
+}
+
+#else
+
+fat12_status fat12_stats_enable (int enabled) {
+
+        return enabled ? fat12_error(FAT12_ERR_INVALID, "Statistics were compiled out (FAT12_NO_STATS)") : FAT12_OK;
+
+}
+
+void fat12_stats_reset (void) {
+}
+
+uint64_t fat12_stats_counter (fat12_stat_counter counter) {
+
+        (void)counter;
+        return 0;
+
+}
+
+uint64_t fat12_stats_phase_time (fat12_stat_phase phase) {
+
+        (void)phase;
+        return 0;
+
+}
+
+#endif
+
+/*
+ * Prints every counter and phase time, either as aligned "name value" lines
+ * or as a single JSON object on one line.
+ *
+ * @param out The stream to print to.
+ * @param json Nonzero for JSON.
+ */
+void fat12_stats_print (FILE* out, int json) {
+
+        if (json) {
+                fprintf(out, "{\"counters\":{");
+                for (int i = 0; i < FAT12_STAT_NUM_COUNTERS; i++) {
+                        fprintf(out, "%s\"%s\":%" PRIu64, i > 0 ? "," : "", FAT12_STAT_COUNTER_NAMES[i], fat12_stats_counter((fat12_stat_counter)i));
+                }
+                fprintf(out, "},\"phases_ns\":{");
+                for (int i = 0; i < FAT12_NUM_PHASES; i++) {
+                        fprintf(out, "%s\"%s\":%" PRIu64, i > 0 ? "," : "", FAT12_STAT_PHASE_NAMES[i], fat12_stats_phase_time((fat12_stat_phase)i));
+                }
+                fprintf(out, "}}\n");
+                return;
+        }
+
+        for (int i = 0; i < FAT12_STAT_NUM_COUNTERS; i++) {
+                fprintf(out, "%-18s %" PRIu64 "\n", FAT12_STAT_COUNTER_NAMES[i], fat12_stats_counter((fat12_stat_counter)i));
+        }
+        for (int i = 0; i < FAT12_NUM_PHASES; i++) {
+                fprintf(out, "%-18s %.3f ms\n", FAT12_STAT_PHASE_NAMES[i], fat12_stats_phase_time((fat12_stat_phase)i) / 1e6);
+        }
+
+}
+
+// Function to check whether a command-line argument is --stats or --stats=json, returning 1 if so, -1 if it is --stats with an unknown format, or 0 otherwise
+int fat12_stats_parse_option (const char* arg, int* json) {
+
+        if (strcmp(arg, "--stats") == 0) {
+                *json = 0;
+                return 1;
+        }
+        if (strncmp(arg, "--stats=", 8) == 0) {
+                if (strcmp(arg + 8, "json") == 0) {
+                        *json = 1;
+                        return 1;
+                }
+                if (strcmp(arg + 8, "text") == 0) {
+                        *json = 0;
+                        return 1;
+                }
+                return -1;
+        }
+        return 0;
+
+}
@@ -0,0 +1,84 @@
+#ifndef FAT12_STATS_H
+#define FAT12_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "fat12_utils.h"
+
+// Counters kept by the library while statistics are enabled
+typedef enum {
+        FAT12_STAT_BYTES_READ, // Bytes of the image requested through fat12_volume_bytes, or read() from a stream
+        FAT12_STAT_READ_CALLS, // Requests for a range of the image, plus read() calls on streams
+        FAT12_STAT_SEEKS, // Requests that did not start where the previous one on the same volume ended
+        FAT12_STAT_ALLOCATIONS, // Heap allocations and reallocations made by the library
+        FAT12_STAT_ENTRIES_VISITED, // Raw directory entries examined by the directory walker
+        FAT12_STAT_NUM_COUNTERS
+} fat12_stat_counter;
+
+// Phases whose monotonic-clock time is accumulated while statistics are enabled
+typedef enum {
+        FAT12_PHASE_OPEN, // Opening, mapping or reading in the image
+        FAT12_PHASE_BOOT_SECTOR, // Boot sector fields and the label
+        FAT12_PHASE_FAT, // Decoding the FAT and counting free clusters
+        FAT12_PHASE_DIRECTORIES, // Walking the directory tree
+        FAT12_PHASE_OUTPUT, // Formatting and writing the report
+        FAT12_NUM_PHASES
+} fat12_stat_phase;
+
+// Building with -DFAT12_NO_STATS compiles every hook below down to nothing
+#ifndef FAT12_NO_STATS
+
+extern int fat12_stats_enabled;
+extern uint64_t fat12_stats_counters[FAT12_STAT_NUM_COUNTERS];
+extern uint64_t fat12_stats_phase_ns[FAT12_NUM_PHASES];
+
+// Function to add to a counter; a single predictable branch when statistics are disabled
+static inline void fat12_stats_add (fat12_stat_counter counter, uint64_t amount) {
+
+        if (__builtin_expect(fat12_stats_enabled, 0)) {
+                __atomic_fetch_add(&fat12_stats_counters[counter], amount, __ATOMIC_RELAXED);
+        }
+
+}
+
+// Function to start timing a phase, returning the start timestamp (0 when statistics are disabled)
+static inline uint64_t fat12_stats_phase_begin (void) {
+
+        if (__builtin_expect(fat12_stats_enabled, 0)) {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+        }
+        return 0;
+
+}
+
+// Function to add the time elapsed since a fat12_stats_phase_begin timestamp to a phase
+static inline void fat12_stats_phase_end (fat12_stat_phase phase, uint64_t start) {
+
+        if (__builtin_expect(fat12_stats_enabled, 0) && start != 0) {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                uint64_t now = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+                __atomic_fetch_add(&fat12_stats_phase_ns[phase], now - start, __ATOMIC_RELAXED);
+        }
+
+}
+
+#else
+
+static inline void fat12_stats_add (fat12_stat_counter counter, uint64_t amount) { (void)counter; (void)amount; }
+static inline uint64_t fat12_stats_phase_begin (void) { return 0; }
+static inline void fat12_stats_phase_end (fat12_stat_phase phase, uint64_t start) { (void)phase; (void)start; }
+
+#endif
+
+fat12_status fat12_stats_enable (int enabled);
+void fat12_stats_reset (void);
+uint64_t fat12_stats_counter (fat12_stat_counter counter);
+uint64_t fat12_stats_phase_time (fat12_stat_phase phase);
+void fat12_stats_print (FILE* out, int json);
+int fat12_stats_parse_option (const char* arg, int* json);
+
+#endif
@@ -0,0 +1,405 @@
+#define _GNU_SOURCE // mremap
+#include "fat12_stream.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_fat.h"
+#include "fat12_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Bytes asked of the stream per read call; the window grows to hold a whole cluster when clusters are larger
+#define STREAM_WINDOW_BYTES (256 * 1024)
+// Clusters a directory entry can name, as its first-cluster field is 16 bits
+#define STREAM_MAX_CLUSTERS 65536
+
+// What the scheduler knows about each data cluster
+enum {
+        STREAM_CLUSTER_WANTED = 1, // Part of a directory the walk reads; decoded once its bytes are in
+        STREAM_CLUSTER_KEPT = 2, // Copied into the volume as the stream went past it
+        STREAM_CLUSTER_LIKELY = 4 // Follows a kept cluster in its chain, so it is kept too in case a parent turns up later
+};
+
+// An image being read front to back, and what is still needed from it
+typedef struct {
+        int fd;
+        char* window; // The last bytes read from the stream, not all of them taken yet
+        size_t window_size;
+        size_t start; // Offset in window of the next byte to take
+        size_t end; // Offset in window past the last byte read
+        size_t position; // Offset in the image of the next byte to take
+        int eof;
+        char* image; // Sparse anonymous mapping the metadata is copied into, each byte at its offset in the image
+        size_t image_size;
+        fat12_volume* volume;
+        const fat12_geometry* geometry;
+        const fat12_fat* fat;
+        unsigned char* clusters; // STREAM_CLUSTER_* flags of each cluster
+        uint32_t num_clusters;
+        uint32_t num_pending; // Wanted clusters the stream has not reached yet
+        uint16_t* ready; // Wanted clusters already kept, waiting to be decoded
+        uint32_t num_ready;
+        uint16_t missed; // First wanted cluster the stream went past without keeping, or 0
+        uint64_t phase_start;
+} fat12_stream;
+
+// Function to take up to length bytes (at most the window size) from the stream, reading more as needed; fewer are taken only at the end of the stream
+static fat12_status fat12_stream_take (fat12_stream* stream, size_t length, const char** bytes, size_t* taken) {
+
+        if (stream->end - stream->start < length && !stream->eof) {
+
+                // Slide what is left to the front of the window, then fill the rest of it
+                memmove(stream->window, stream->window + stream->start, stream->end - stream->start);
+                stream->end -= stream->start;
+                stream->start = 0;
+                while (stream->end < length && !stream->eof) {
+                        ssize_t n = read(stream->fd, stream->window + stream->end, stream->window_size - stream->end);
+                        fat12_stats_add(FAT12_STAT_READ_CALLS, 1);
+                        if (n < 0) {
+                                if (errno == EINTR) {
+                                        continue;
+                                }
+                                return fat12_error(FAT12_ERR_IO, "Error reading file: %s", strerror(errno));
+                        }
+                        if (n == 0) {
+                                stream->eof = 1;
+                        }
+                        fat12_stats_add(FAT12_STAT_BYTES_READ, (uint64_t)n);
+                        stream->end += (size_t)n;
+                }
+
+        }
+
+        size_t available = stream->end - stream->start;
+        *taken = available < length ? available : length;
+        *bytes = stream->window + stream->start;
+        stream->start += *taken;
+        stream->position += *taken;
+        return FAT12_OK;
+
+}
+
+// Function to grow the mapping the metadata is copied into to at least size bytes; pages never written to cost no memory
+static fat12_status fat12_stream_reserve (fat12_stream* stream, size_t size) {
+
+        if (size <= stream->image_size) {
+                return FAT12_OK;
+        }
+        size_t grown_size = stream->image_size * 2 > size ? stream->image_size * 2 : size;
+        void* grown;
+        if (stream->image == NULL) {
+                grown = mmap(NULL, grown_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        } else {
+                grown = mremap(stream->image, stream->image_size, grown_size, MREMAP_MAYMOVE);
+        }
+        if (grown == MAP_FAILED) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        stream->image = grown;
+        stream->image_size = grown_size;
+        stream->volume->data = stream->image;
+        stream->volume->size = stream->image_size;
+        return FAT12_OK;
+
+}
+
+// Function to copy the stream into the volume up to the given offset, or to its end if it stops short
+static fat12_status fat12_stream_copy (fat12_stream* stream, size_t end_byte) {
+
+        fat12_status status = fat12_stream_reserve(stream, end_byte);
+        while (status == FAT12_OK && stream->position < end_byte) {
+                size_t length = end_byte - stream->position < stream->window_size ? end_byte - stream->position : stream->window_size;
+                size_t offset = stream->position;
+                const char* bytes;
+                size_t taken;
+                status = fat12_stream_take(stream, length, &bytes, &taken);
+                if (status != FAT12_OK || taken == 0) {
+                        break;
+                }
+                memcpy(stream->image + offset, bytes, taken);
+        }
+        return status;
+
+}
+
+// Function to mark a cluster as part of a directory the walk reads: queued if the stream has yet to reach it, decoded soon if it was kept
+static void fat12_stream_want (fat12_stream* stream, uint32_t cluster) {
+
+        if (cluster < 2 || cluster >= stream->num_clusters || (stream->clusters[cluster] & STREAM_CLUSTER_WANTED)) {
+                return;
+        }
+        stream->clusters[cluster] |= STREAM_CLUSTER_WANTED;
+        if (fat12_cluster_start_byte(stream->geometry, cluster) >= stream->position) {
+                stream->num_pending++;
+        } else if (stream->clusters[cluster] & STREAM_CLUSTER_KEPT) {
+                stream->ready[stream->num_ready++] = (uint16_t)cluster;
+        } else if (stream->missed == 0) {
+                stream->missed = (uint16_t)cluster;
+        }
+
+}
+
+// Function to want the subdirectories named by a run of directory entries, returning 1 if the run holds the end-of-directory marker
+static int fat12_stream_scan (fat12_stream* stream, const char* entries, size_t num_entries) {
+
+        for (size_t i = 0; i < num_entries; i++) {
+                const char* entry = entries + i * DIR_ENTRY_SIZE_BYTES;
+                if (entry[0] == 0x00) {
+                        return 1;
+                }
+
+                // The same subdirectories the walker enters: not free, not a label or long name slot (which has the label bit), not "." or ".."
+                char attribute = entry[DIR_ENTRY_ATTRIBUTE_BYTE];
+                if ((unsigned char)entry[0] == 0xE5 || (attribute & ATTRIBUTE_VOLUME_LABEL_BIT_MASK) || entry[0] == '.'
+                        || !(attribute & ATTRIBUTE_SUBDIRECTORY_BIT_MASK)) {
+                        continue;
+                }
+                fat12_stream_want(stream, get_first_logical_cluster(entry));
+        }
+        return 0;
+
+}
+
+// Function to decode the wanted clusters that are already kept, which may want more of them
+static void fat12_stream_decode_ready (fat12_stream* stream) {
+
+        while (stream->num_ready > 0) {
+                uint16_t cluster = stream->ready[--stream->num_ready];
+                const char* entries = stream->image + fat12_cluster_start_byte(stream->geometry, cluster);
+                if (fat12_stream_scan(stream, entries, stream->geometry->cluster_size_bytes / DIR_ENTRY_SIZE_BYTES)) {
+                        continue;
+                }
+
+                // The directory goes on in the next cluster of its chain, as long as the walker would follow it there
+                uint16_t next_cluster = fat12_fat_next(stream->fat, cluster);
+                if (next_cluster >= 2 && next_cluster < FAT_ENTRY_BAD && next_cluster < stream->fat->num_entries) {
+                        fat12_stream_want(stream, next_cluster);
+                }
+        }
+
+}
+
+// Function to check whether a cluster starts with the "." and ".." entries of a subdirectory
+static int fat12_stream_is_directory_start (const char* bytes, size_t length) {
+
+        return length >= 2 * DIR_ENTRY_SIZE_BYTES && memcmp(bytes, ".          ", FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES) == 0
+                && memcmp(bytes + DIR_ENTRY_SIZE_BYTES, "..         ", FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES) == 0;
+
+}
+
+/*
+ * Streams the data region cluster by cluster, in on-disk order, until no wanted cluster is left ahead.
+ * Wanted clusters are kept and decoded as they go past. A subdirectory may sit before the directory that names it,
+ * so clusters that start like a subdirectory, and the clusters after them in their chains, are kept as well.
+ * Every other cluster is passed over without being copied.
+ *
+ * @param stream The stream, positioned at the start of the data region.
+ * @return FAT12_OK, or the reason the stream could not be read.
+ */
+static fat12_status fat12_stream_directories (fat12_stream* stream) {
+
+        const fat12_geometry* geometry = stream->geometry;
+        for (uint32_t cluster = 2; stream->num_pending > 0 && cluster < stream->num_clusters; cluster++) {
+
+                size_t start_byte = fat12_cluster_start_byte(geometry, cluster);
+                const char* bytes;
+                size_t taken;
+                fat12_status status = fat12_stream_take(stream, geometry->cluster_size_bytes, &bytes, &taken);
+                if (status != FAT12_OK) {
+                        return status;
+                }
+                if (taken == 0) {
+                        break;
+                }
+
+                unsigned char flags = stream->clusters[cluster];
+                if (!(flags & (STREAM_CLUSTER_WANTED | STREAM_CLUSTER_LIKELY)) && !fat12_stream_is_directory_start(bytes, taken)) {
+                        continue;
+                }
+                status = fat12_stream_reserve(stream, start_byte + geometry->cluster_size_bytes);
+                if (status != FAT12_OK) {
+                        return status;
+                }
+                memcpy(stream->image + start_byte, bytes, taken);
+                stream->clusters[cluster] |= STREAM_CLUSTER_KEPT;
+
+                if (flags & STREAM_CLUSTER_WANTED) {
+                        stream->num_pending--;
+                        stream->ready[stream->num_ready++] = (uint16_t)cluster;
+                        fat12_stream_decode_ready(stream);
+                } else {
+                        uint16_t next_cluster = fat12_fat_next(stream->fat, (uint16_t)cluster);
+                        if (next_cluster > cluster && next_cluster < FAT_ENTRY_BAD && next_cluster < stream->num_clusters) {
+                                stream->clusters[next_cluster] |= STREAM_CLUSTER_LIKELY;
+                        }
+                }
+
+        }
+        return FAT12_OK;
+
+}
+
+/*
+ * Reads the metadata of the image as it streams past: the boot sector, the FATs and root directory,
+ * then the subdirectory clusters. Stops as soon as a part is missing, leaving it to the reports to fail on it.
+ *
+ * @param stream The stream, at its start.
+ * @return FAT12_OK, or the reason the stream could not be read.
+ */
+static fat12_status fat12_stream_metadata (fat12_stream* stream) {
+
+        fat12_status status = fat12_stream_copy(stream, SECTOR_SIZE_BYTES);
+        if (status != FAT12_OK || stream->position < SECTOR_SIZE_BYTES) {
+                return status;
+        }
+        if (fat12_volume_geometry(stream->volume, &stream->geometry) != FAT12_OK) {
+                return FAT12_OK; // The reports fail on the boot sector the same way
+        }
+        const fat12_geometry* geometry = stream->geometry;
+        if (geometry->cluster_size_bytes > stream->window_size) {
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                char* window = realloc(stream->window, geometry->cluster_size_bytes);
+                if (window == NULL) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                stream->window = window;
+                stream->window_size = geometry->cluster_size_bytes;
+        }
+
+        // The first FAT is decoded as soon as it is in, so its own phase is timed apart from the reading
+        size_t fat_end_byte = geometry->fat_start_byte + (size_t)geometry->sectors_per_fat * geometry->bytes_per_sector;
+        status = fat12_stream_copy(stream, fat_end_byte);
+        if (status != FAT12_OK || stream->position < fat_end_byte) {
+                return status;
+        }
+        fat12_stats_phase_end(FAT12_PHASE_OPEN, stream->phase_start);
+        status = fat12_volume_fat(stream->volume, &stream->fat);
+        stream->phase_start = fat12_stats_phase_begin();
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        // The other FAT copies and the root directory come next
+        status = fat12_stream_copy(stream, geometry->data_start_byte);
+        if (status != FAT12_OK || stream->position < geometry->data_start_byte) {
+                return status;
+        }
+        stream->num_clusters = stream->fat->num_entries < STREAM_MAX_CLUSTERS ? stream->fat->num_entries : STREAM_MAX_CLUSTERS;
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 2);
+        stream->clusters = calloc(stream->num_clusters, sizeof(unsigned char));
+        stream->ready = malloc(stream->num_clusters * sizeof(uint16_t));
+        if (stream->clusters == NULL || stream->ready == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        fat12_stream_scan(stream, stream->image + geometry->root_start_byte, geometry->root_entries);
+        return fat12_stream_directories(stream);
+
+}
+
+// Function to open the image at path as fat12_volume_open_stream describes, without timing the opening itself
+static fat12_status fat12_stream_load (fat12_stream* stream, const char* path) {
+
+        stream->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+        if (stream->fd < 0) {
+                return fat12_error(FAT12_ERR_IO, "Error opening file: %s", strerror(errno));
+        }
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 2);
+        stream->volume = calloc(1, sizeof(fat12_volume));
+        stream->window = malloc(STREAM_WINDOW_BYTES);
+        if (stream->volume == NULL || stream->window == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        stream->window_size = STREAM_WINDOW_BYTES;
+
+        fat12_status status = fat12_stream_metadata(stream);
+
+        // Read the rest through, so the volume has the size of the whole image and whatever writes the stream is not cut off
+        while (status == FAT12_OK && !stream->eof) {
+                const char* bytes;
+                size_t taken;
+                status = fat12_stream_take(stream, stream->window_size, &bytes, &taken);
+        }
+        if (status == FAT12_OK && stream->missed != 0) {
+                status = fat12_error(FAT12_ERR_INVALID, "Directory cluster %u lies before the entry that leads to it; open the image as a file instead", stream->missed);
+        }
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        // Trim the mapping to the image, or release it if the stream was empty
+        fat12_volume* volume = stream->volume;
+        if (stream->position == 0) {
+                if (stream->image != NULL) {
+                        munmap(stream->image, stream->image_size);
+                }
+                volume->data = NULL;
+                volume->size = 0;
+                volume->mapped = 0;
+        } else {
+                void* image = mremap(stream->image, stream->image_size, stream->position, MREMAP_MAYMOVE);
+                if (image == MAP_FAILED) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                volume->data = image;
+                volume->size = stream->position;
+                volume->mapped = 1;
+        }
+        stream->image = NULL;
+        volume->fd = -1;
+        return FAT12_OK;
+
+}
+
+/*
+ * Opens a disk image that can only be read once, front to back, such as a pipe from a decompressor.
+ * Only the metadata is kept: the boot sector, the FATs and root directory, and the clusters of every subdirectory,
+ * which are queued as their parents are decoded and picked up in on-disk order as the stream reaches them.
+ * File contents are read past but not kept, so the volume serves fat12_get_info and the directory walk,
+ * but reading a file's data through it gives zeros. The caller must release it with fat12_volume_close.
+ *
+ * @param path The path of the image, or "-" for standard input.
+ * @param opened Set to the opened volume on success.
+ * @return FAT12_OK, or the reason the image could not be read; FAT12_ERR_INVALID if a subdirectory lies before
+ *         the directory that names it and was not recognizable as one when the stream went past it.
+ */
+fat12_status fat12_volume_open_stream (const char* path, fat12_volume** opened) {
+
+        fat12_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        stream.phase_start = fat12_stats_phase_begin();
+        fat12_status status = fat12_stream_load(&stream, path);
+        fat12_stats_phase_end(FAT12_PHASE_OPEN, stream.phase_start);
+
+        if (stream.fd > STDIN_FILENO) {
+                close(stream.fd);
+        }
+        if (stream.image != NULL) {
+                munmap(stream.image, stream.image_size);
+        }
+        if (status == FAT12_OK) {
+                *opened = stream.volume;
+        } else if (stream.volume != NULL) {
+                stream.volume->data = NULL;
+                stream.volume->mapped = 0;
+                fat12_volume_close(stream.volume);
+        }
+        free(stream.window);
+        free(stream.clusters);
+        free(stream.ready);
+        return status;
+
+}
+
+// Function to check whether a command-line argument is --stream, returning 1 if so, or 0 otherwise
+int fat12_stream_parse_option (const char* arg, int* stream) {
+
+        if (strcmp(arg, "--stream") == 0) {
+                *stream = 1;
+                return 1;
+        }
+        return 0;
+
+}
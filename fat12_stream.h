@@ -0,0 +1,9 @@
+#ifndef FAT12_STREAM_H
+#define FAT12_STREAM_H
+
+#include "fat12_utils.h"
+
+fat12_status fat12_volume_open_stream (const char* path, fat12_volume** opened);
+int fat12_stream_parse_option (const char* arg, int* stream);
+
+#endif
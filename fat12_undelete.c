@@ -0,0 +1,596 @@
+#include "fat12_undelete.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_fat.h"
+#include "fat12_path.h"
+#include "fat12_batch.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Deleted files are scored on parallel workers once their samples add up to this many bytes
+#define UNDELETE_PARALLEL_MIN_BYTES (1024 * 1024)
+// Bytes from the start of each deleted file that the content heuristics look at
+#define UNDELETE_SAMPLE_BYTES 65536
+// Share of text bytes from which a sample counts as text
+#define UNDELETE_TEXT_RATIO 0.95
+// Most "~N" suffixes tried when a recovered file's name is taken
+#define UNDELETE_MAX_SUFFIX 99
+
+// Where the clusters of a deleted file were guessed to be
+typedef enum {
+        FAT12_UNDELETE_CONTIGUOUS = 0, // Free clusters follow the start cluster for the whole size
+        FAT12_UNDELETE_GAPPED, // Enough free clusters follow the start cluster, past allocated ones
+        FAT12_UNDELETE_OVERWRITTEN, // The start cluster belongs to a live chain again
+        FAT12_UNDELETE_LOST // The start cluster is invalid, or too few free clusters follow it
+} fat12_undelete_state;
+
+static const char* const UNDELETE_STATE_NAMES[] = { "contiguous", "gapped", "overwritten", "lost" };
+
+// Magic bytes a kind of file starts with, and the extensions that promise it
+typedef struct {
+        const char* kind;
+        const char* extensions; // Space-separated
+        const char* magic;
+        size_t magic_length;
+} fat12_undelete_signature;
+
+static const fat12_undelete_signature UNDELETE_SIGNATURES[] = {
+        { "PNG", "PNG", "\x89PNG\r\n\x1A\n", 8 },
+        { "OLE", "DOC XLS PPT MSI", "\xD0\xCF\x11\xE0\xA1\xB1\x1A\xE1", 8 },
+        { "7Z", "7Z", "7z\xBC\xAF\x27\x1C", 6 },
+        { "GIF", "GIF", "GIF8", 4 },
+        { "PDF", "PDF", "%PDF", 4 },
+        { "ZIP", "ZIP JAR", "PK\x03\x04", 4 },
+        { "RAR", "RAR", "Rar!", 4 },
+        { "RIFF", "WAV AVI", "RIFF", 4 },
+        { "TIFF", "TIF", "II*\x00", 4 },
+        { "JPEG", "JPG JPE", "\xFF\xD8\xFF", 3 },
+        { "MP3", "MP3", "ID3", 3 },
+        { "GZIP", "GZ TGZ", "\x1F\x8B", 2 },
+        { "BMP", "BMP", "BM", 2 },
+        { "EXE", "EXE DLL", "MZ", 2 }
+};
+
+// Extensions that promise plain text
+static const char* const UNDELETE_TEXT_EXTENSIONS = "TXT ASC ME 1ST LOG BAT CMD INI CFG CSV HTM XML C H CPP ASM BAS PAS LST";
+
+// One deleted file or directory, where its clusters were guessed to be, and how much that guess is worth
+typedef struct {
+        const char* entry; // The raw entry, pointing into the volume
+        size_t path_offset; // Offset of its path in the path arena
+        int is_directory;
+        fat12_undelete_state state;
+        uint32_t num_clusters;
+        int shared; // Some of its clusters are guessed to belong to another deleted file too
+        int score; // 0 to 100
+        const char* kind; // What its content looks like, or NULL if nothing was recognized
+} fat12_undelete_candidate;
+
+// Deleted entries of one volume, and the free space their clusters are looked for in
+typedef struct {
+        fat12_volume* volume;
+        const fat12_geometry* geometry;
+        const fat12_fat* fat;
+        uint32_t end_cluster; // One past the last cluster both the data region and the FAT cover
+        uint64_t* free; // One bit per free cluster
+        fat12_undelete_candidate* candidates; // In walk order
+        size_t num_candidates;
+        size_t candidates_capacity;
+        char* paths;
+        size_t paths_size;
+        size_t paths_capacity;
+} fat12_undelete;
+
+// Function to get the first free cluster after the given one, or end_cluster if there is none
+static uint32_t fat12_undelete_next_free (const fat12_undelete* undelete, uint32_t cluster) {
+
+        for (cluster++; cluster < undelete->end_cluster; cluster = (cluster / 64 + 1) * 64) {
+                uint64_t word = undelete->free[cluster / 64] >> (cluster % 64);
+                if (word != 0) {
+                        return cluster + (uint32_t)__builtin_ctzll(word);
+                }
+        }
+        return undelete->end_cluster;
+
+}
+
+// Function to check whether a cluster is free
+static int fat12_undelete_is_free (const fat12_undelete* undelete, uint32_t cluster) {
+
+        return cluster < undelete->end_cluster && ((undelete->free[cluster / 64] >> (cluster % 64)) & 1);
+
+}
+
+/*
+ * Guesses where the clusters of a deleted file are. Deleting a file frees its chain but leaves the start
+ * cluster and size in the entry, and allocators hand out the lowest free clusters first, so the file most
+ * likely went on from its start cluster through the next clusters that are free now.
+ */
+static void fat12_undelete_place (const fat12_undelete* undelete, fat12_undelete_candidate* candidate) {
+
+        uint32_t cluster_size_bytes = undelete->geometry->cluster_size_bytes;
+        uint32_t size = get_file_size(candidate->entry);
+        uint32_t cluster = get_first_logical_cluster(candidate->entry);
+        candidate->num_clusters = candidate->is_directory ? 1 : (uint32_t)(((uint64_t)size + cluster_size_bytes - 1) / cluster_size_bytes);
+        candidate->state = FAT12_UNDELETE_CONTIGUOUS;
+        if (candidate->num_clusters == 0) {
+                return;
+        }
+        if (cluster < 2 || cluster >= undelete->end_cluster) {
+                candidate->state = FAT12_UNDELETE_LOST;
+                return;
+        }
+        if (!fat12_undelete_is_free(undelete, cluster)) {
+                candidate->state = FAT12_UNDELETE_OVERWRITTEN;
+                return;
+        }
+
+        for (uint32_t i = 1; i < candidate->num_clusters; i++) {
+                uint32_t next = fat12_undelete_next_free(undelete, cluster);
+                if (next == undelete->end_cluster) {
+                        candidate->state = FAT12_UNDELETE_LOST;
+                        return;
+                }
+                if (next != cluster + 1) {
+                        candidate->state = FAT12_UNDELETE_GAPPED;
+                }
+                cluster = next;
+        }
+
+}
+
+// Function to check whether a short-name extension appears in a space-separated list
+static int fat12_undelete_has_extension (const char* list, const char* extension) {
+
+        size_t length = strlen(extension);
+        while (length > 0 && *list != '\0') {
+                size_t token_length = strcspn(list, " ");
+                if (token_length == length && memcmp(list, extension, length) == 0) {
+                        return 1;
+                }
+                list += token_length;
+                list += strspn(list, " ");
+        }
+        return 0;
+
+}
+
+// Function to find the signature the start of some content matches, or NULL if none does
+static const fat12_undelete_signature* fat12_undelete_match (const unsigned char* data, size_t length) {
+
+        for (size_t i = 0; i < sizeof(UNDELETE_SIGNATURES) / sizeof(UNDELETE_SIGNATURES[0]); i++) {
+                const fat12_undelete_signature* signature = &UNDELETE_SIGNATURES[i];
+                if (length >= signature->magic_length && memcmp(data, signature->magic, signature->magic_length) == 0) {
+                        return signature;
+                }
+        }
+        return NULL;
+
+}
+
+// Function to check whether a byte is likely to appear in DOS or UTF-8 text, including the 0x1A end-of-file mark
+static inline int fat12_undelete_text_byte (unsigned char byte) {
+
+        return (byte >= 0x20 && byte != 0x7F) || byte == '\t' || byte == '\n' || byte == '\r' || byte == '\f' || byte == 0x1A;
+
+}
+
+/*
+ * Scores the guess made by fat12_undelete_place from 0 to 100, reading up to UNDELETE_SAMPLE_BYTES of the
+ * content it points at. Contiguous runs start ahead of gapped ones; the content then has to agree with the
+ * extension: magic bytes for the kinds in UNDELETE_SIGNATURES, mostly text bytes for text extensions.
+ * Content that is all zeros has been wiped. Directories score on their "." and ".." entries instead.
+ * The score may leave 0 to 100 here; it is clamped once shared clusters are known.
+ */
+static void fat12_undelete_score (const fat12_undelete* undelete, fat12_undelete_candidate* candidate) {
+
+        candidate->score = 0;
+        candidate->kind = NULL;
+        if (candidate->state == FAT12_UNDELETE_OVERWRITTEN || candidate->state == FAT12_UNDELETE_LOST) {
+                return;
+        }
+        if (candidate->num_clusters == 0) {
+                candidate->score = 100; // Nothing to get wrong
+                return;
+        }
+
+        uint32_t cluster_size_bytes = undelete->geometry->cluster_size_bytes;
+        uint32_t cluster = get_first_logical_cluster(candidate->entry);
+        if (candidate->is_directory) {
+                const char* entries = fat12_volume_bytes(undelete->volume, fat12_cluster_start_byte(undelete->geometry, cluster), 2 * DIR_ENTRY_SIZE_BYTES);
+                int dots = entries != NULL && memcmp(entries, ".          ", FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES) == 0
+                        && memcmp(entries + DIR_ENTRY_SIZE_BYTES, "..         ", FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES) == 0;
+                candidate->score = dots ? 90 : 10;
+                return;
+        }
+
+        // Look at the start of the file, cluster by cluster along the guessed run
+        uint32_t sample_bytes = get_file_size(candidate->entry);
+        if (sample_bytes > UNDELETE_SAMPLE_BYTES) {
+                sample_bytes = UNDELETE_SAMPLE_BYTES;
+        }
+        const fat12_undelete_signature* content = NULL;
+        uint32_t num_text = 0;
+        uint32_t num_zero = 0;
+        for (uint32_t seen = 0; seen < sample_bytes; cluster = fat12_undelete_next_free(undelete, cluster)) {
+                uint32_t length = sample_bytes - seen < cluster_size_bytes ? sample_bytes - seen : cluster_size_bytes;
+                const unsigned char* data = (const unsigned char*)fat12_volume_bytes(undelete->volume, fat12_cluster_start_byte(undelete->geometry, cluster), length);
+                if (data == NULL) {
+                        candidate->state = FAT12_UNDELETE_LOST; // Past the end of a truncated image
+                        return;
+                }
+                if (seen == 0) {
+                        content = fat12_undelete_match(data, length);
+                }
+                for (uint32_t i = 0; i < length; i++) {
+                        num_text += fat12_undelete_text_byte(data[i]);
+                        num_zero += data[i] == 0;
+                }
+                seen += length;
+        }
+        fat12_stats_add(FAT12_STAT_BYTES_READ, sample_bytes);
+        if (num_zero == sample_bytes) {
+                candidate->kind = "zeros";
+                candidate->score = 5;
+                return;
+        }
+
+        fat12_dirent dirent;
+        fat12_dirent_decode(candidate->entry, &dirent);
+        const fat12_undelete_signature* expected = NULL;
+        for (size_t i = 0; i < sizeof(UNDELETE_SIGNATURES) / sizeof(UNDELETE_SIGNATURES[0]) && expected == NULL; i++) {
+                if (fat12_undelete_has_extension(UNDELETE_SIGNATURES[i].extensions, dirent.extension)) {
+                        expected = &UNDELETE_SIGNATURES[i];
+                }
+        }
+        int is_text = num_text >= UNDELETE_TEXT_RATIO * sample_bytes;
+
+        int score = candidate->state == FAT12_UNDELETE_CONTIGUOUS ? 60 : 35;
+        if (expected != NULL) {
+                score += content == expected ? 40 : -40;
+        } else if (fat12_undelete_has_extension(UNDELETE_TEXT_EXTENSIONS, dirent.extension)) {
+                score += is_text ? 40 : -30;
+        } else if (content != NULL) {
+                score += 20;
+        } else if (is_text) {
+                score += 10;
+        }
+        candidate->kind = content != NULL ? content->kind : is_text ? "text" : NULL;
+        candidate->score = score;
+
+}
+
+// Function to place and score one deleted entry on a pool worker; each task only writes its own candidate
+static void fat12_undelete_task (size_t index, int worker, void* context) {
+
+        (void)worker;
+        fat12_undelete* undelete = context;
+        fat12_undelete_candidate* candidate = &undelete->candidates[index];
+        fat12_undelete_place(undelete, candidate);
+        fat12_undelete_score(undelete, candidate);
+
+}
+
+// Function to check whether a candidate's guessed clusters are worth reading
+static int fat12_undelete_recoverable (const fat12_undelete_candidate* candidate) {
+
+        return candidate->state == FAT12_UNDELETE_CONTIGUOUS || candidate->state == FAT12_UNDELETE_GAPPED;
+
+}
+
+// Function to mark the candidates whose guessed clusters overlap, lowering their scores, then clamp every score to 0 to 100
+static fat12_status fat12_undelete_overlaps (fat12_undelete* undelete) {
+
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        unsigned char* claims = calloc(undelete->end_cluster, sizeof(unsigned char));
+        if (claims == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+
+        // Count claims up to 2 per cluster, then look for the clusters claimed twice
+        for (int pass = 0; pass < 2; pass++) {
+                for (size_t i = 0; i < undelete->num_candidates; i++) {
+                        fat12_undelete_candidate* candidate = &undelete->candidates[i];
+                        if (!fat12_undelete_recoverable(candidate)) {
+                                continue;
+                        }
+                        uint32_t cluster = get_first_logical_cluster(candidate->entry);
+                        for (uint32_t j = 0; j < candidate->num_clusters && !candidate->shared; j++, cluster = fat12_undelete_next_free(undelete, cluster)) {
+                                if (pass == 0) {
+                                        claims[cluster] += claims[cluster] < 2;
+                                } else {
+                                        candidate->shared = claims[cluster] > 1;
+                                }
+                        }
+                }
+        }
+        free(claims);
+
+        for (size_t i = 0; i < undelete->num_candidates; i++) {
+                fat12_undelete_candidate* candidate = &undelete->candidates[i];
+                int score = candidate->score - (candidate->shared ? 20 : 0);
+                candidate->score = score < 0 ? 0 : score > 100 ? 100 : score;
+        }
+        return FAT12_OK;
+
+}
+
+// Function to release what a scan allocated
+static void fat12_undelete_free (fat12_undelete* undelete) {
+
+        free(undelete->free);
+        free(undelete->candidates);
+        free(undelete->paths);
+
+}
+
+// Function to remember one deleted entry found by the walk, with its path
+static fat12_status fat12_undelete_add (fat12_undelete* undelete, const fat12_dir_item* item, const char* path) {
+
+        if (undelete->num_candidates == undelete->candidates_capacity) {
+                size_t capacity = undelete->candidates_capacity > 0 ? undelete->candidates_capacity * 2 : 64;
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                fat12_undelete_candidate* candidates = realloc(undelete->candidates, capacity * sizeof(fat12_undelete_candidate));
+                if (candidates == NULL) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                undelete->candidates = candidates;
+                undelete->candidates_capacity = capacity;
+        }
+        size_t length = strlen(path) + 1;
+        if (undelete->paths_size + length > undelete->paths_capacity) {
+                size_t capacity = undelete->paths_capacity > 0 ? undelete->paths_capacity * 2 : 4096;
+                while (undelete->paths_size + length > capacity) {
+                        capacity *= 2;
+                }
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                char* paths = realloc(undelete->paths, capacity);
+                if (paths == NULL) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                undelete->paths = paths;
+                undelete->paths_capacity = capacity;
+        }
+
+        fat12_undelete_candidate* candidate = &undelete->candidates[undelete->num_candidates++];
+        memset(candidate, 0, sizeof(*candidate));
+        candidate->entry = item->entry;
+        candidate->is_directory = item->is_directory;
+        candidate->path_offset = undelete->paths_size;
+        memcpy(undelete->paths + undelete->paths_size, path, length);
+        undelete->paths_size += length;
+        return FAT12_OK;
+
+}
+
+/*
+ * Finds every deleted file and subdirectory of a volume, including those inside deleted subdirectories that
+ * can still be entered, then guesses where each one's clusters are and scores the guess. Once the samples
+ * add up to enough bytes, the guesses are spread over the work-stealing pool, one entry per task; from inside
+ * a batch worker the pool stays on the calling thread, since the batch already keeps every core busy.
+ * Deleted entries without clusters, such as empty files, are not found, as the walker skips them.
+ *
+ * @param undelete The scan, released with fat12_undelete_free whatever the result.
+ * @param volume The volume.
+ * @return FAT12_OK, or the reason the scan could not complete.
+ */
+static fat12_status fat12_undelete_scan (fat12_undelete* undelete, fat12_volume* volume) {
+
+        memset(undelete, 0, sizeof(*undelete));
+        undelete->volume = volume;
+        fat12_status status = fat12_volume_geometry(volume, &undelete->geometry);
+        if (status == FAT12_OK) {
+                status = fat12_volume_fat(volume, &undelete->fat);
+        }
+        if (status != FAT12_OK) {
+                return status;
+        }
+        undelete->end_cluster = undelete->geometry->end_cluster < undelete->fat->num_entries ? undelete->geometry->end_cluster : undelete->fat->num_entries;
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        undelete->free = calloc(undelete->end_cluster / 64 + 1, sizeof(uint64_t));
+        if (undelete->free == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+        fat12_fat_free_bitmap(undelete->fat, 2, undelete->end_cluster, undelete->free);
+
+        fat12_path_walker walker;
+        fat12_dir_item item;
+        int result = fat12_path_walker_init(&walker, volume);
+        walker.walker.include_deleted = 1;
+        while (result == FAT12_OK && (result = fat12_path_walker_next(&walker, &item)) == 1) {
+                result = item.is_deleted ? fat12_undelete_add(undelete, &item, walker.path) : FAT12_OK;
+        }
+        fat12_path_walker_free(&walker);
+        if (result < 0) {
+                return (fat12_status)result;
+        }
+
+        uint64_t total_bytes = 0;
+        for (size_t i = 0; i < undelete->num_candidates; i++) {
+                uint32_t size = get_file_size(undelete->candidates[i].entry);
+                total_bytes += size < UNDELETE_SAMPLE_BYTES ? size : UNDELETE_SAMPLE_BYTES;
+        }
+        int num_workers = total_bytes >= UNDELETE_PARALLEL_MIN_BYTES ? fat12_pool_num_workers(undelete->num_candidates) : 1;
+        status = fat12_pool_run(undelete->num_candidates, num_workers, fat12_undelete_task, undelete);
+        if (status == FAT12_OK) {
+                status = fat12_undelete_overlaps(undelete);
+        }
+        return status;
+
+}
+
+/*
+ * Lists the deleted files and subdirectories of a volume, in walk order: the score of the best guess at
+ * each one's clusters, where the guess found them, the clusters and bytes it covers, what the content looks
+ * like, and the path. The first character of a deleted short name is lost, so it shows as '_' unless a
+ * deleted long file name gives it back. A count of the likely recoverable files follows.
+ *
+ * @param volume The volume.
+ * @param out Where the list is printed.
+ * @param num_likely Set to the number of files scoring at least FAT12_UNDELETE_LIKELY_SCORE (may be NULL).
+ * @return FAT12_OK, or the reason the volume could not be scanned.
+ */
+fat12_status fat12_undelete_list (fat12_volume* volume, FILE* out, size_t* num_likely) {
+
+        fat12_undelete undelete;
+        fat12_status status = fat12_undelete_scan(&undelete, volume);
+        if (status != FAT12_OK) {
+                fat12_undelete_free(&undelete);
+                return status;
+        }
+
+        size_t likely = 0;
+        fprintf(out, "%-5s %-11s %-8s %-10s %-5s %s\n", "Score", "State", "Clusters", "Size", "Type", "Path");
+        for (size_t i = 0; i < undelete.num_candidates; i++) {
+                const fat12_undelete_candidate* candidate = &undelete.candidates[i];
+                likely += !candidate->is_directory && fat12_undelete_recoverable(candidate) && candidate->score >= FAT12_UNDELETE_LIKELY_SCORE;
+                fprintf(out, "%-5d %-11s %-8u %-10u %-5s %s%s%s\n", candidate->score, UNDELETE_STATE_NAMES[candidate->state], candidate->num_clusters,
+                        get_file_size(candidate->entry), candidate->kind != NULL ? candidate->kind : "-", undelete.paths + candidate->path_offset,
+                        candidate->is_directory ? "/" : "", candidate->shared ? " (shared)" : "");
+        }
+        fprintf(out, "\n%zu deleted, %zu likely recoverable\n", undelete.num_candidates, likely);
+
+        if (num_likely != NULL) {
+                *num_likely = likely;
+        }
+        fat12_undelete_free(&undelete);
+        return FAT12_OK;
+
+}
+
+// Function to order candidates by where their guessed clusters start on disk
+static int fat12_undelete_compare (const void* a, const void* b) {
+
+        const fat12_undelete_candidate* candidate_a = *(const fat12_undelete_candidate* const*)a;
+        const fat12_undelete_candidate* candidate_b = *(const fat12_undelete_candidate* const*)b;
+        return (int)get_first_logical_cluster(candidate_a->entry) - (int)get_first_logical_cluster(candidate_b->entry);
+
+}
+
+// Function to create a file for a recovered path, adding "~N" to its name if it is taken, as two deleted names can differ only in their lost first character
+static int fat12_undelete_create (char* dest_path, size_t capacity) {
+
+        size_t length = strlen(dest_path);
+        for (int suffix = 0; suffix <= UNDELETE_MAX_SUFFIX; suffix++) {
+                if (suffix > 0) {
+                        snprintf(dest_path + length, capacity - length, "~%d", suffix);
+                }
+                int fd = open(dest_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+                if (fd >= 0 || errno != EEXIST) {
+                        return fd;
+                }
+        }
+        return -1;
+
+}
+
+// Function to write the guessed clusters of a deleted file to fd, trimmed to its size
+static fat12_status fat12_undelete_copy (const fat12_undelete* undelete, const fat12_undelete_candidate* candidate, int fd, const char* dest_path) {
+
+        uint32_t cluster_size_bytes = undelete->geometry->cluster_size_bytes;
+        uint32_t remaining = get_file_size(candidate->entry);
+        uint32_t cluster = get_first_logical_cluster(candidate->entry);
+        for (; remaining > 0; cluster = fat12_undelete_next_free(undelete, cluster)) {
+                uint32_t length = remaining < cluster_size_bytes ? remaining : cluster_size_bytes;
+                const char* data = fat12_volume_bytes(undelete->volume, fat12_cluster_start_byte(undelete->geometry, cluster), length);
+                if (data == NULL) {
+                        return fat12_error(FAT12_ERR_RANGE, "Cluster %u lies beyond the end of the image", cluster);
+                }
+                fat12_stats_add(FAT12_STAT_BYTES_READ, length);
+                while (length > 0) {
+                        ssize_t written = write(fd, data, length);
+                        if (written < 0 && errno == EINTR) {
+                                continue;
+                        }
+                        if (written <= 0) {
+                                return fat12_error(FAT12_ERR_IO, "Error writing %s: %s", dest_path, strerror(errno));
+                        }
+                        data += written;
+                        length -= (uint32_t)written;
+                        remaining -= (uint32_t)written;
+                }
+        }
+        return FAT12_OK;
+
+}
+
+/*
+ * Extracts the deleted files of a volume whose guess scores at least min_score into dest_dir, under their
+ * paths as fat12_undelete_list shows them, creating directories as needed. A name already taken gets a
+ * "~N" suffix instead of being replaced. Files are written in the order they start on disk.
+ *
+ * @param volume The volume.
+ * @param dest_dir The directory to extract into, created if needed.
+ * @param min_score The lowest score of a file worth extracting.
+ * @param num_files Set to the number of files extracted (may be NULL).
+ * @return FAT12_OK, or the reason the files could not be extracted.
+ */
+fat12_status fat12_undelete_extract (fat12_volume* volume, const char* dest_dir, int min_score, size_t* num_files) {
+
+        if (mkdir(dest_dir, 0755) != 0 && errno != EEXIST) {
+                return fat12_error(FAT12_ERR_IO, "Error creating directory %s: %s", dest_dir, strerror(errno));
+        }
+        fat12_undelete undelete;
+        fat12_status status = fat12_undelete_scan(&undelete, volume);
+        fat12_undelete_candidate** jobs = NULL;
+        size_t num_jobs = 0;
+        if (status == FAT12_OK && undelete.num_candidates > 0) {
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                jobs = malloc(undelete.num_candidates * sizeof(fat12_undelete_candidate*));
+                if (jobs == NULL) {
+                        status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+        }
+        for (size_t i = 0; i < undelete.num_candidates && status == FAT12_OK; i++) {
+                fat12_undelete_candidate* candidate = &undelete.candidates[i];
+                if (!candidate->is_directory && fat12_undelete_recoverable(candidate) && candidate->score >= min_score
+                        && fat12_path_is_safe(undelete.paths + candidate->path_offset)) {
+                        jobs[num_jobs++] = candidate;
+                }
+        }
+        if (status == FAT12_OK) {
+                qsort(jobs, num_jobs, sizeof(fat12_undelete_candidate*), fat12_undelete_compare);
+        }
+
+        char dest_path[FAT12_PATH_MAX + 4096];
+        for (size_t i = 0; i < num_jobs && status == FAT12_OK; i++) {
+
+                // Create the directories above the file, which may have been deleted too
+                snprintf(dest_path, sizeof(dest_path), "%s/%s", dest_dir, undelete.paths + jobs[i]->path_offset);
+                size_t dest_dir_length = strlen(dest_dir);
+                for (char* slash = strchr(dest_path + dest_dir_length + 1, '/'); slash != NULL && status == FAT12_OK; slash = strchr(slash + 1, '/')) {
+                        *slash = '\0';
+                        if (mkdir(dest_path, 0755) != 0 && errno != EEXIST) {
+                                status = fat12_error(FAT12_ERR_IO, "Error creating directory %s: %s", dest_path, strerror(errno));
+                        }
+                        *slash = '/';
+                }
+                if (status != FAT12_OK) {
+                        break;
+                }
+
+                int fd = fat12_undelete_create(dest_path, sizeof(dest_path));
+                if (fd < 0) {
+                        status = fat12_error(FAT12_ERR_IO, "Error creating file %s: %s", dest_path, strerror(errno));
+                        break;
+                }
+                status = fat12_undelete_copy(&undelete, jobs[i], fd, dest_path);
+                if (close(fd) != 0 && status == FAT12_OK) {
+                        status = fat12_error(FAT12_ERR_IO, "Error writing file %s: %s", dest_path, strerror(errno));
+                }
+        }
+
+        free(jobs);
+        fat12_undelete_free(&undelete);
+        if (status == FAT12_OK && num_files != NULL) {
+                *num_files = num_jobs;
+        }
+        return status;
+
+}
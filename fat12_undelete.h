@@ -0,0 +1,14 @@
+#ifndef FAT12_UNDELETE_H
+#define FAT12_UNDELETE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "fat12_utils.h"
+
+// Score from which a deleted file counts as likely recoverable, and the default threshold for extracting it
+#define FAT12_UNDELETE_LIKELY_SCORE 50
+
+fat12_status fat12_undelete_list (fat12_volume* volume, FILE* out, size_t* num_likely);
+fat12_status fat12_undelete_extract (fat12_volume* volume, const char* dest_dir, int min_score, size_t* num_files);
+
+#endif
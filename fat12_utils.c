@@ -1,75 +1,971 @@
 #include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_fat.h"
+#include "fat12_path.h"
+#include "fat12_stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-const int OS_NAME_START_BYTE = 3;
-const int OS_NAME_LENGTH_BYTES = 8;
-const int LABEL_START_BYTE = 43;
-const int LABEL_LENGTH_BYTES = 11;
-const int ROOT_DIR_START_SECTOR = 19;
-const int ROOT_DIR_END_SECTOR = 32;
-const int SECTOR_SIZE_BYTES = 512;
-const int SECTOR_SIZE_ENTRIES = 16;
-const int DIR_ENTRY_ATTRIBUTE_BYTE = 11;
-const int TOTAL_SECTOR_COUNT_START_BYTE = 19;
-const int TOTAL_SECTOR_COUNT_LENGTH_BYTES = 2;
-const int FAT_START_SECTOR = 1;
-const int BIT_LENGTH = 12;
-const int FIRST_LOGICAL_CLUSTER_BYTE1 = 26;
-const int FIRST_LOGICAL_CLUSTER_BYTE2 = 27;
-const int ATTRIBUTE_VOLUME_LABEL_BIT_MASK = 0x08;
-const int ATTRIBUTE_SUBDIRECTORY_BIT_MASK = 0x10;
-const int FILE_SIZE_START_BYTE = 28;
-const int FILE_SIZE_LENGTH_BYTES = 4;
-const int SECTORS_PER_FAT_START_BYTE = 22;
-const int SECTORS_PER_FAT_LENGTH_BYTES = 2;
-const int NUM_FAT_COPIES_START_BYTE = 16;
-const int NUM_FAT_COPIES_LENGTH_BYTES = 1;
-const int FILENAME_START_BYTE = 0;
-const int FILENAME_LENGTH_BYTES = 8;
-const int EXTENSION_START_BYTE = 8;
-const int EXTENSION_LENGTH_BYTES = 3;
-const int FILE_CREATE_DATE_START_BYTE = 16;
-const int FILE_CREATE_DATE_LENGTH_BYTES = 2;
-const int FILE_CREATE_TIME_START_BYTE = 14;
-const int FILE_CREATE_TIME_LENGTH_BYTES = 2;
+// Description of the last error in this thread, kept per thread so batch workers do not clobber each other
+static __thread char fat12_error_message[256];
+
+// Function to record a printf-style description of a failure for the calling thread, returning the given status
+fat12_status fat12_error (fat12_status status, const char* format, ...) {
+
+        va_list args;
+        va_start(args, format);
+        vsnprintf(fat12_error_message, sizeof(fat12_error_message), format, args);
+        va_end(args);
+        return status;
+
+}
+
+// Multiplier of the 64-bit hash shared by the index files and diskdiff (the 64-bit golden ratio)
+#define FAT12_HASH_MULTIPLIER 0x9E3779B97F4A7C15ull
+
+// Function to mix a byte range into a running 64-bit hash, eight bytes at a time
+uint64_t fat12_hash64 (uint64_t hash, const char* data, size_t length) {
+
+        hash = (hash ^ length) * FAT12_HASH_MULTIPLIER;
+        for (; length >= 8; data += 8, length -= 8) {
+                uint64_t word;
+                memcpy(&word, data, sizeof(word));
+                hash = (hash ^ word) * FAT12_HASH_MULTIPLIER;
+                hash ^= hash >> 32;
+        }
+        for (; length > 0; data++, length--) {
+                hash = (hash ^ (unsigned char)*data) * FAT12_HASH_MULTIPLIER;
+                hash ^= hash >> 32;
+        }
+        return hash;
+
+}
+
+// Function to get a short description of a status code
+const char* fat12_strerror (fat12_status status) {
+
+        switch (status) {
+                case FAT12_OK: return "Success";
+                case FAT12_ERR_IO: return "I/O error";
+                case FAT12_ERR_NOMEM: return "Out of memory";
+                case FAT12_ERR_RANGE: return "Image too small";
+                case FAT12_ERR_INVALID: return "Invalid argument or image";
+                case FAT12_ERR_NOT_FOUND: return "Not found";
+                case FAT12_ERR_BUFFER: return "Buffer too small";
+                case FAT12_ERR_NO_SPACE: return "No space left in image";
+        }
+        return "Unknown error";
+
+}
+
+// Function to get the description of the last error recorded by the calling thread
+const char* fat12_last_error (void) {
+
+        return fat12_error_message;
+
+}
+
+static fat12_status fat12_volume_load (const char* path, fat12_volume** opened);
+
+/*
+ * Opens the disk image at the given path as a read-only volume.
+ * Regular files are memory-mapped; anything that cannot be mapped (pipes, character devices)
+ * is read into memory in one bulk pass instead. The caller must release it with fat12_volume_close.
+ *
+ * @param path The path of the disk image.
+ * @param opened Set to the opened volume on success.
+ * @return FAT12_OK, or the reason the image could not be opened.
+ */
+fat12_status fat12_volume_open (const char* path, fat12_volume** opened) {
+
+        uint64_t phase_start = fat12_stats_phase_begin();
+        fat12_status status = fat12_volume_load(path, opened);
+        fat12_stats_phase_end(FAT12_PHASE_OPEN, phase_start);
+        return status;
+
+}
+
+// Function to open the image at path as fat12_volume_open describes, without timing it
+static fat12_status fat12_volume_load (const char* path, fat12_volume** opened) {
+
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        fat12_volume* volume = calloc(1, sizeof(fat12_volume));
+        if (volume == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                fat12_status status = fat12_error(FAT12_ERR_IO, "Error opening file: %s", strerror(errno));
+                free(volume);
+                return status;
+        }
+
+        // Map the whole image when it is a regular file
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map != MAP_FAILED) {
+                        volume->data = map;
+                        volume->size = (size_t)st.st_size;
+                        volume->mapped = 1;
+                        volume->fd = fd;
+                        *opened = volume;
+                        return FAT12_OK;
+                }
+        }
+
+        // Otherwise read the whole stream into memory with as few read calls as possible
+        size_t capacity = 1474560; // Size of a 1.44 MB image, the common case
+        size_t size = 0;
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        char* buffer = malloc(capacity);
+        if (buffer == NULL) {
+                fat12_status status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                close(fd);
+                free(volume);
+                return status;
+        }
+        for (;;) {
+                if (size == capacity) {
+                        capacity *= 2;
+                        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                        char* grown = realloc(buffer, capacity);
+                        if (grown == NULL) {
+                                fat12_status status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                                free(buffer);
+                                close(fd);
+                                free(volume);
+                                return status;
+                        }
+                        buffer = grown;
+                }
+                ssize_t n = read(fd, buffer + size, capacity - size);
+                fat12_stats_add(FAT12_STAT_READ_CALLS, 1);
+                if (n < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        fat12_status status = fat12_error(FAT12_ERR_IO, "Error reading file: %s", strerror(errno));
+                        free(buffer);
+                        close(fd);
+                        free(volume);
+                        return status;
+                }
+                if (n == 0) {
+                        break;
+                }
+                fat12_stats_add(FAT12_STAT_BYTES_READ, (uint64_t)n);
+                size += (size_t)n;
+        }
+        close(fd);
+
+        volume->data = buffer;
+        volume->size = size;
+        volume->mapped = 0;
+        volume->fd = -1;
+        *opened = volume;
+        return FAT12_OK;
+
+}
+
+/*
+ * Opens the disk image at the given path for in-place modification. The image must be a regular file;
+ * it is mapped shared, so changes made through the library reach the file, at the latest on fat12_volume_sync.
+ * The caller must release it with fat12_volume_close.
+ *
+ * @param path The path of the disk image.
+ * @param opened Set to the opened volume on success.
+ * @return FAT12_OK, or the reason the image could not be opened for writing.
+ */
+fat12_status fat12_volume_open_writable (const char* path, fat12_volume** opened) {
+
+        uint64_t phase_start = fat12_stats_phase_begin();
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        fat12_volume* volume = calloc(1, sizeof(fat12_volume));
+        if (volume == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+
+        int fd = open(path, O_RDWR);
+        if (fd < 0) {
+                fat12_status status = fat12_error(FAT12_ERR_IO, "Error opening file: %s", strerror(errno));
+                free(volume);
+                return status;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+                fat12_status status = fat12_error(FAT12_ERR_INVALID, "Only a non-empty regular file can be opened for writing");
+                close(fd);
+                free(volume);
+                return status;
+        }
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+                fat12_status status = fat12_error(FAT12_ERR_IO, "Error mapping file: %s", strerror(errno));
+                close(fd);
+                free(volume);
+                return status;
+        }
+
+        volume->data = map;
+        volume->size = (size_t)st.st_size;
+        volume->mapped = 1;
+        volume->writable = 1;
+        volume->fd = fd;
+        *opened = volume;
+        fat12_stats_phase_end(FAT12_PHASE_OPEN, phase_start);
+        return FAT12_OK;
+
+}
+
+// Function to write the changes made to a writable volume back to its file
+fat12_status fat12_volume_sync (fat12_volume* volume) {
+
+        if (!volume->writable) {
+                return fat12_error(FAT12_ERR_INVALID, "Volume is read-only");
+        }
+        if (msync((void*)volume->data, volume->size, MS_SYNC) != 0) {
+                return fat12_error(FAT12_ERR_IO, "Error writing image: %s", strerror(errno));
+        }
+        return FAT12_OK;
+
+}
+
+// Function to release a volume opened with fat12_volume_open or fat12_volume_open_writable
+void fat12_volume_close (fat12_volume* volume) {
+
+        if (volume == NULL) {
+                return;
+        }
+        fat12_fat_free(volume->fat);
+        fat12_path_index_free(volume->path_index);
+        if (volume->mapped) {
+                munmap((void*)volume->data, volume->size);
+                close(volume->fd);
+        } else {
+                free((void*)volume->data);
+        }
+        free(volume);
+
+}
+
+// Function to get the size of the volume in bytes
+size_t fat12_volume_size (const fat12_volume* volume) {
+
+        return volume->size;
+
+}
+
+// Function to get a pointer to length_bytes bytes of the volume starting at start_byte, or NULL if the range is out of bounds
+const char* fat12_volume_bytes (fat12_volume* volume, long int start_byte, size_t length_bytes) {
+
+        if (start_byte < 0 || (size_t)start_byte > volume->size || length_bytes > volume->size - (size_t)start_byte) {
+                return NULL;
+        }
+#ifndef FAT12_NO_STATS
+        if (__builtin_expect(fat12_stats_enabled, 0)) {
+                fat12_stats_add(FAT12_STAT_READ_CALLS, 1);
+                fat12_stats_add(FAT12_STAT_BYTES_READ, length_bytes);
+                // Atomic, since the files of one volume may be read by several pool workers at once
+                size_t last_end_byte = __atomic_exchange_n(&volume->last_end_byte, (size_t)start_byte + length_bytes, __ATOMIC_RELAXED);
+                fat12_stats_add(FAT12_STAT_SEEKS, (size_t)start_byte != last_end_byte);
+        }
+#endif
+        return volume->data + start_byte;
+
+}
+
+// Function to get a pointer to the given 512-byte sector of the volume, or NULL if the sector is out of bounds (sector 0 is the boot sector whatever the geometry)
+const char* fat12_volume_sector (fat12_volume* volume, long int sector) {
+
+        return fat12_volume_bytes(volume, sector * SECTOR_SIZE_BYTES, SECTOR_SIZE_BYTES);
+
+}
+
+/*
+ * Parses the layout of a volume from the BIOS parameter block of its boot sector.
+ * The total sector count comes from the 16-bit field, or from the 32-bit one when the 16-bit field is 0.
+ *
+ * @param boot_sector The first SECTOR_SIZE_BYTES bytes of the image.
+ * @param geometry Filled in with the layout; geometry->standard is set when it is the 1.44 MB one.
+ * @return FAT12_OK, or FAT12_ERR_INVALID if a field is out of range.
+ */
+fat12_status fat12_parse_geometry (const char* boot_sector, fat12_geometry* geometry) {
+
+        geometry->bytes_per_sector = fat12_le16(boot_sector + BYTES_PER_SECTOR_START_BYTE);
+        geometry->sectors_per_cluster = (uint8_t)boot_sector[SECTORS_PER_CLUSTER_BYTE];
+        geometry->reserved_sectors = fat12_le16(boot_sector + RESERVED_SECTORS_START_BYTE);
+        geometry->num_fats = (uint8_t)boot_sector[NUM_FAT_COPIES_START_BYTE];
+        geometry->root_entries = fat12_le16(boot_sector + ROOT_ENTRIES_START_BYTE);
+        geometry->sectors_per_fat = fat12_le16(boot_sector + SECTORS_PER_FAT_START_BYTE);
+        geometry->total_sectors = fat12_le16(boot_sector + TOTAL_SECTOR_COUNT_START_BYTE);
+        if (geometry->total_sectors == 0) {
+                geometry->total_sectors = fat12_le32(boot_sector + LARGE_TOTAL_SECTOR_COUNT_START_BYTE);
+        }
+
+        uint16_t bytes_per_sector = geometry->bytes_per_sector;
+        uint8_t sectors_per_cluster = geometry->sectors_per_cluster;
+        if (bytes_per_sector < 512 || bytes_per_sector > 4096 || (bytes_per_sector & (bytes_per_sector - 1)) != 0) {
+                return fat12_error(FAT12_ERR_INVALID, "Invalid boot sector: %u bytes per sector", bytes_per_sector);
+        }
+        if (sectors_per_cluster == 0 || (sectors_per_cluster & (sectors_per_cluster - 1)) != 0) {
+                return fat12_error(FAT12_ERR_INVALID, "Invalid boot sector: %u sectors per cluster", sectors_per_cluster);
+        }
+        if (geometry->reserved_sectors == 0 || geometry->num_fats == 0 || geometry->sectors_per_fat == 0 || geometry->root_entries == 0) {
+                return fat12_error(FAT12_ERR_INVALID, "Invalid boot sector: no reserved sectors, FATs or root directory entries");
+        }
+
+        uint32_t root_sectors = ((uint32_t)geometry->root_entries * DIR_ENTRY_SIZE_BYTES + bytes_per_sector - 1) / bytes_per_sector;
+        uint32_t data_start_sector = geometry->reserved_sectors + (uint32_t)geometry->num_fats * geometry->sectors_per_fat + root_sectors;
+        if (geometry->total_sectors <= data_start_sector) {
+                return fat12_error(FAT12_ERR_INVALID, "Invalid boot sector: %u sectors leave no room for data", geometry->total_sectors);
+        }
+        geometry->fat_start_byte = (uint32_t)geometry->reserved_sectors * bytes_per_sector;
+        geometry->root_start_byte = geometry->fat_start_byte + (uint32_t)geometry->num_fats * geometry->sectors_per_fat * bytes_per_sector;
+        geometry->data_start_byte = data_start_sector * bytes_per_sector;
+        geometry->cluster_size_bytes = (uint32_t)sectors_per_cluster * bytes_per_sector;
+        geometry->end_cluster = (geometry->total_sectors - data_start_sector) / sectors_per_cluster + 2;
+
+        const fat12_geometry* standard = &FAT12_GEOMETRY_1440K;
+        geometry->standard = bytes_per_sector == standard->bytes_per_sector && sectors_per_cluster == standard->sectors_per_cluster
+                && geometry->reserved_sectors == standard->reserved_sectors && geometry->num_fats == standard->num_fats
+                && geometry->root_entries == standard->root_entries && geometry->sectors_per_fat == standard->sectors_per_fat
+                && geometry->total_sectors == standard->total_sectors;
+        return FAT12_OK;
+
+}
+
+// Function to get the layout of the volume, parsed from its boot sector on first use
+fat12_status fat12_volume_geometry (fat12_volume* volume, const fat12_geometry** geometry) {
+
+        if (!volume->has_geometry) {
+                const char* boot_sector = fat12_volume_sector(volume, 0);
+                if (boot_sector == NULL) {
+                        return fat12_error(FAT12_ERR_RANGE, "Error reading boot sector: image too small");
+                }
+                fat12_status status = fat12_parse_geometry(boot_sector, &volume->geometry);
+                if (status != FAT12_OK) {
+                        return status;
+                }
+                volume->has_geometry = 1;
+        }
+        *geometry = &volume->geometry;
+        return FAT12_OK;
+
+}
+
+// Function to check whether the label field is still all spaces, i.e. no label was set there
+static int fat12_is_label_blank (const char* label) {
+
+        for (int i = 0; i < LABEL_LENGTH_BYTES; i++) {
+                if (label[i] != ' ') {
+                        return 0;
+                }
+        }
+        return 1;
+
+}
+
+/*
+ * Gets the label of the volume: the boot sector label, or the volume label entry of the root directory
+ * when the boot sector one is blank.
+ *
+ * @param volume The volume.
+ * @param label Filled in with the null-terminated label.
+ * @param label_size The size of label, at least LABEL_LENGTH_BYTES + 1.
+ * @return FAT12_OK, or the reason the label could not be read.
+ */
+fat12_status fat12_get_label (fat12_volume* volume, char* label, size_t label_size) {
+
+        if (label_size < (size_t)LABEL_LENGTH_BYTES + 1) {
+                return fat12_error(FAT12_ERR_BUFFER, "Label buffer too small");
+        }
+        uint64_t phase_start = fat12_stats_phase_begin();
+        const char* found = fat12_volume_bytes(volume, LABEL_START_BYTE, LABEL_LENGTH_BYTES);
+        if (found == NULL) {
+                return fat12_error(FAT12_ERR_RANGE, "Error reading label from boot sector: image too small");
+        }
+
+        // If label not found, then check root directory
+        if (fat12_is_label_blank(found)) {
+
+                const fat12_geometry* geometry;
+                fat12_status status = fat12_volume_geometry(volume, &geometry);
+                if (status != FAT12_OK) {
+                        return status;
+                }
+                long int root_dir_start_byte = geometry->root_start_byte;
+                int root_dir_length_bytes = (int)(geometry->data_start_byte - geometry->root_start_byte);
+
+                // Iterate through each sector in root directory
+                for (int sector_offset = 0; sector_offset < root_dir_length_bytes; sector_offset += SECTOR_SIZE_BYTES) {
+                        const char* entry = find_directory_entry(volume, ATTRIBUTE_VOLUME_LABEL_BIT_MASK, root_dir_start_byte + sector_offset);
+                        if (entry != NULL) {
+                                found = entry; // The first 11 characters of the entry are the label
+                                break;
+                        }
+                }
+
+        }
+
+        // Copy up to the first null, as the label was printed as a string before
+        size_t length = 0;
+        while (length < (size_t)LABEL_LENGTH_BYTES && found[length] != '\0') {
+                label[length] = found[length];
+                length++;
+        }
+        label[length] = '\0';
+        fat12_stats_phase_end(FAT12_PHASE_BOOT_SECTOR, phase_start);
+        return FAT12_OK;
+
+}
+
+// Function to get the free size in bytes of the volume, counted from the free entries of the decoded FAT
+fat12_status fat12_get_free_size (fat12_volume* volume, uint32_t* free_size) {
+
+        const fat12_geometry* geometry = NULL;
+        fat12_status status = fat12_volume_geometry(volume, &geometry);
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        const fat12_fat* fat;
+        status = fat12_volume_fat(volume, &fat);
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        // Count free fat entries that map to a data cluster within the total sector count range (skipping the first two entries, since they are reserved)
+        uint64_t phase_start = fat12_stats_phase_begin();
+        *free_size = fat12_fat_count_free(fat, 2, geometry->end_cluster) * geometry->cluster_size_bytes;
+        fat12_stats_phase_end(FAT12_PHASE_FAT, phase_start);
+        return FAT12_OK;
+
+}
+
+// Function to get the number of files in the volume, across the root directory and every subdirectory
+fat12_status fat12_get_num_files (fat12_volume* volume, int* num_files) {
+
+        int count = 0;
+
+        // Walk all directories, counting every entry that is not itself a directory
+        fat12_dir_walker walker;
+        fat12_dir_item item;
+        int status = fat12_dir_walker_init(&walker, volume);
+        while (status == FAT12_OK && (status = fat12_dir_walker_next(&walker, &item)) == 1) {
+                if (!item.is_directory) {
+                        count++;
+                }
+                status = FAT12_OK;
+        }
+        fat12_dir_walker_free(&walker);
+
+        if (status < 0) {
+                return (fat12_status)status;
+        }
+        *num_files = count;
+        return FAT12_OK;
+
+}
+
+/*
+ * Gets the summary of the volume that diskinfo reports.
+ *
+ * @param volume The volume.
+ * @param info Filled in with the summary.
+ * @return FAT12_OK, or the reason the summary could not be read.
+ */
+fat12_status fat12_get_info (fat12_volume* volume, fat12_info* info) {
+
+        // Every boot sector field below lives in the first sector, so make sure it is all there first
+        const unsigned char* boot_sector = (const unsigned char*)fat12_volume_sector(volume, 0);
+        if (boot_sector == NULL) {
+                return fat12_error(FAT12_ERR_RANGE, "Error reading boot sector: image too small");
+        }
+
+        read_directory_entry_data((const char*)boot_sector, OS_NAME_START_BYTE, OS_NAME_LENGTH_BYTES, info->os_name);
+        const fat12_geometry* geometry;
+        fat12_status status = fat12_volume_geometry(volume, &geometry);
+        if (status == FAT12_OK) {
+                status = fat12_get_label(volume, info->label, sizeof(info->label));
+        }
+        if (status == FAT12_OK) {
+                status = fat12_get_free_size(volume, &info->free_size);
+        }
+        if (status == FAT12_OK) {
+                status = fat12_get_num_files(volume, &info->num_files);
+        }
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        info->total_size = geometry->total_sectors * geometry->bytes_per_sector;
+        info->sectors_per_fat = geometry->sectors_per_fat;
+        info->num_fat_copies = geometry->num_fats;
+        return FAT12_OK;
+
+}
+
+// Function to check whether the cluster is marked in the walker's visited bitmap, marking it if not
+static int fat12_dir_walker_visit (fat12_dir_walker* walker, uint16_t cluster) {
+
+        unsigned char bit = (unsigned char)(1 << (cluster & 7));
+        if (walker->visited[cluster >> 3] & bit) {
+                return 1;
+        }
+        walker->visited[cluster >> 3] |= bit;
+        return 0;
+
+}
+
+// Function to push a directory onto the walker's stack, growing the stack as needed
+static fat12_status fat12_dir_walker_push (fat12_dir_walker* walker, uint16_t cluster, int depth, int deleted) {
+
+        if (walker->stack_size == walker->stack_capacity) {
+                int capacity = walker->stack_capacity > 0 ? walker->stack_capacity * 2 : 16;
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                fat12_dir_frame* stack = realloc(walker->stack, capacity * sizeof(fat12_dir_frame));
+                if (stack == NULL) {
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                walker->stack = stack;
+                walker->stack_capacity = capacity;
+        }
+
+        fat12_dir_frame* frame = &walker->stack[walker->stack_size++];
+        frame->cluster = cluster;
+        frame->index = 0;
+        frame->depth = depth;
+        frame->deleted = deleted;
+        return FAT12_OK;
+
+}
+
+/*
+ * Gets the entry at the current position of the given frame, following the cluster chain as needed,
+ * setting it to NULL at the end of the directory. Always inlined, so each caller below gets its own copy
+ * specialized on the geometry it passes.
+ */
+static inline __attribute__((always_inline)) fat12_status fat12_dir_walker_entry_in (fat12_dir_walker* walker, fat12_dir_frame* frame, const char** entry, const fat12_geometry* geometry) {
+
+        size_t entry_size_bytes = DIR_ENTRY_SIZE_BYTES;
+        long int start_byte;
+
+        if (frame->cluster == 0) {
+
+                // The root directory is a fixed region of sectors
+                if (frame->index >= geometry->root_entries) {
+                        *entry = NULL;
+                        return FAT12_OK;
+                }
+                start_byte = geometry->root_start_byte + frame->index * entry_size_bytes;
+
+        } else {
+
+                // Subdirectories span a chain of clusters
+                if ((uint32_t)frame->index == geometry->cluster_size_bytes / DIR_ENTRY_SIZE_BYTES) {
+                        uint16_t next_cluster = fat12_fat_next(walker->fat, frame->cluster);
+                        if (next_cluster < 2 || next_cluster >= FAT_ENTRY_BAD || next_cluster >= walker->fat->num_entries) {
+                                *entry = NULL;
+                                return FAT12_OK;
+                        }
+                        if (fat12_dir_walker_visit(walker, next_cluster)) {
+                                *entry = NULL; // The chain loops back on itself
+                                return FAT12_OK;
+                        }
+                        frame->cluster = next_cluster;
+                        frame->index = 0;
+                }
+                start_byte = fat12_cluster_start_byte(geometry, frame->cluster) + frame->index * entry_size_bytes;
+
+        }
+
+        *entry = fat12_volume_bytes(walker->volume, start_byte, entry_size_bytes);
+        if (*entry == NULL) {
+                return fat12_error(FAT12_ERR_RANGE, "Error reading directory entry: out of bounds");
+        }
+        return FAT12_OK;
+
+}
+
+// Function to get the entry at the current position of the given frame, with every offset constant-folded for 1.44 MB images
+static fat12_status fat12_dir_walker_entry_1440k (fat12_dir_walker* walker, fat12_dir_frame* frame, const char** entry) {
+
+        return fat12_dir_walker_entry_in(walker, frame, entry, &FAT12_GEOMETRY_1440K);
+
+}
+
+// Function to get the entry at the current position of the given frame, for any geometry
+static fat12_status fat12_dir_walker_entry (fat12_dir_walker* walker, fat12_dir_frame* frame, const char** entry) {
+
+        if (walker->geometry->standard) {
+                return fat12_dir_walker_entry_1440k(walker, frame, entry);
+        }
+        return fat12_dir_walker_entry_in(walker, frame, entry, walker->geometry);
+
+}
+
+// Offsets of the 13 UTF-16 characters within a long file name slot
+static const unsigned char LONG_NAME_CHAR_BYTES[LONG_NAME_CHARS_PER_SLOT] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+// Long names of a walk, in blocks that never move so items can keep pointing at them
+typedef struct fat12_name_block {
+        struct fat12_name_block* next;
+        size_t size;
+        char names[8192];
+} fat12_name_block;
+
+// Function to gather one long file name slot, dropping the name being gathered if the slot does not continue it
+static void fat12_dir_walker_gather (fat12_dir_walker* walker, const char* entry) {
+
+        // Slots come last one first, numbered down to 1, and the last one starts a new name
+        int sequence = (unsigned char)entry[LONG_NAME_SEQUENCE_BYTE];
+        walker->long_name_deleted = 0;
+        if (sequence & LONG_NAME_LAST_SLOT_MASK) {
+                sequence &= ~LONG_NAME_LAST_SLOT_MASK;
+                walker->long_name_slots = sequence;
+                walker->long_name_sequence = sequence;
+                walker->long_name_checksum = (uint8_t)entry[LONG_NAME_CHECKSUM_BYTE];
+        }
+        if (sequence == 0 || sequence > LONG_NAME_MAX_SLOTS || sequence != walker->long_name_sequence
+                || (uint8_t)entry[LONG_NAME_CHECKSUM_BYTE] != walker->long_name_checksum
+                || entry[LONG_NAME_TYPE_BYTE] != 0 || fat12_le16(entry + FIRST_LOGICAL_CLUSTER_BYTE1) != 0) {
+                walker->long_name_sequence = -1;
+                return;
+        }
+
+        uint16_t* units = walker->long_name + (sequence - 1) * LONG_NAME_CHARS_PER_SLOT;
+        for (int i = 0; i < LONG_NAME_CHARS_PER_SLOT; i++) {
+                units[i] = fat12_le16(entry + LONG_NAME_CHAR_BYTES[i]);
+        }
+        walker->long_name_sequence = sequence - 1;
+
+}
+
+// Function to gather one deleted long file name slot, which lost its sequence number to the 0xE5 marker
+static void fat12_dir_walker_gather_deleted (fat12_dir_walker* walker, const char* entry) {
+
+        // Consecutive slots with the same checksum are taken to be one name, still last slot first
+        uint8_t checksum = (uint8_t)entry[LONG_NAME_CHECKSUM_BYTE];
+        if (!walker->long_name_deleted || checksum != walker->long_name_checksum || walker->long_name_slots == LONG_NAME_MAX_SLOTS) {
+                walker->long_name_deleted = 1;
+                walker->long_name_slots = 0;
+                walker->long_name_checksum = checksum;
+        }
+        walker->long_name_sequence = -1;
+        if (entry[LONG_NAME_TYPE_BYTE] != 0 || fat12_le16(entry + FIRST_LOGICAL_CLUSTER_BYTE1) != 0) {
+                walker->long_name_deleted = 0;
+                return;
+        }
+
+        uint16_t* units = walker->long_name + walker->long_name_slots * LONG_NAME_CHARS_PER_SLOT;
+        for (int i = 0; i < LONG_NAME_CHARS_PER_SLOT; i++) {
+                units[i] = fat12_le16(entry + LONG_NAME_CHAR_BYTES[i]);
+        }
+        walker->long_name_slots++;
+
+}
+
+// Function to copy a long file name as UTF-8 into the walker's name blocks, returning NULL if it could not be used as a path component
+static const char* fat12_dir_walker_keep_name (fat12_dir_walker* walker, const uint16_t* units, size_t max_units) {
+
+        // The name ends at a null character, or fills its last slot
+        size_t num_units = 0;
+        while (num_units < max_units && units[num_units] != 0) {
+                num_units++;
+        }
+        if (num_units == 0 || num_units > FAT12_LONG_NAME_MAX) {
+                return NULL;
+        }
+        char name[FAT12_LONG_NAME_BUFFER_SIZE];
+        size_t length = fat12_utf16_to_utf8(units, num_units, name);
+        name[length] = '\0';
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strpbrk(name, "/\\") != NULL) {
+                return NULL;
+        }
+
+        fat12_name_block* block = walker->names;
+        if (block == NULL || block->size + length + 1 > sizeof(block->names)) {
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                block = malloc(sizeof(fat12_name_block));
+                if (block == NULL) {
+                        return NULL; // Still listed, under its short name
+                }
+                block->next = walker->names;
+                block->size = 0;
+                walker->names = block;
+        }
+        char* kept = block->names + block->size;
+        memcpy(kept, name, length + 1);
+        block->size += length + 1;
+        return kept;
+
+}
+
+/*
+ * Finishes the long file name gathered for a short entry, copying it as UTF-8 into the walker's name blocks.
+ * The name is dropped if it is incomplete, belongs to a different short name, or could not be used as a path component.
+ *
+ * @return The name, or NULL if the entry has none.
+ */
+static const char* fat12_dir_walker_long_name (fat12_dir_walker* walker, const char* entry) {
+
+        int complete = walker->long_name_sequence == 0 && walker->long_name_checksum == fat12_short_name_checksum(entry);
+        walker->long_name_sequence = -1;
+        if (!complete) {
+                return NULL;
+        }
+        return fat12_dir_walker_keep_name(walker, walker->long_name, (size_t)walker->long_name_slots * LONG_NAME_CHARS_PER_SLOT);
+
+}
+
+/*
+ * Finishes the deleted long file name gathered for a deleted short entry. Both lost their first byte to the 0xE5
+ * marker, so the name is only kept if the short name's checksum matches once its first character is taken from
+ * the long name.
+ *
+ * @return The name, or NULL if none could be recovered.
+ */
+static const char* fat12_dir_walker_deleted_long_name (fat12_dir_walker* walker, const char* entry) {
+
+        int num_slots = walker->long_name_deleted ? walker->long_name_slots : 0;
+        walker->long_name_deleted = 0;
+        walker->long_name_slots = 0;
+        if (num_slots == 0) {
+                return NULL;
+        }
+
+        // Put the slots back in name order
+        uint16_t units[LONG_NAME_MAX_SLOTS * LONG_NAME_CHARS_PER_SLOT];
+        for (int i = 0; i < num_slots; i++) {
+                memcpy(units + i * LONG_NAME_CHARS_PER_SLOT, walker->long_name + (num_slots - 1 - i) * LONG_NAME_CHARS_PER_SLOT, LONG_NAME_CHARS_PER_SLOT * sizeof(uint16_t));
+        }
+        if (units[0] == 0 || units[0] >= 0x80) {
+                return NULL;
+        }
+        char short_name[FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES];
+        memcpy(short_name, entry, sizeof(short_name));
+        short_name[0] = (char)toupper(units[0]);
+        if (fat12_short_name_checksum(short_name) != walker->long_name_checksum) {
+                return NULL;
+        }
+        return fat12_dir_walker_keep_name(walker, units, (size_t)num_slots * LONG_NAME_CHARS_PER_SLOT);
+
+}
+
+// Function to check whether a deleted directory's first cluster is still free and still holds its "." and ".." entries
+static int fat12_dir_walker_deleted_directory (fat12_dir_walker* walker, uint16_t cluster) {
+
+        if (cluster >= walker->fat->num_entries || fat12_fat_next(walker->fat, cluster) != FAT_ENTRY_FREE) {
+                return 0;
+        }
+        const char* entries = fat12_volume_bytes(walker->volume, fat12_cluster_start_byte(walker->geometry, cluster), 2 * DIR_ENTRY_SIZE_BYTES);
+        return entries != NULL && memcmp(entries, ".          ", FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES) == 0
+                && memcmp(entries + DIR_ENTRY_SIZE_BYTES, "..         ", FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES) == 0;
+
+}
 
 /*
- * Finds a directory entry with the specified attribute in the given sector within the file.
- * The caller is responsible for freeing the returned memory.
+ * Initializes a walker that visits every file and subdirectory of the volume, starting at the root directory.
+ * Subdirectories are entered right after they are visited, so entries come out in depth-first order.
+ * The caller is responsible for releasing the walker with fat12_dir_walker_free.
  *
- * @param file The file pointer.
+ * @param walker The walker to initialize.
+ * @param volume The volume to walk.
+ * @return FAT12_OK, or the reason the walk cannot start.
+ */
+fat12_status fat12_dir_walker_init (fat12_dir_walker* walker, fat12_volume* volume) {
+
+        walker->volume = volume;
+        walker->stack = NULL;
+        walker->stack_size = 0;
+        walker->stack_capacity = 0;
+        walker->visited = NULL;
+        walker->long_name_slots = 0;
+        walker->long_name_sequence = -1;
+        walker->long_name_deleted = 0;
+        walker->include_deleted = 0;
+        walker->names = NULL;
+        fat12_status status = fat12_volume_geometry(volume, &walker->geometry);
+        if (status == FAT12_OK) {
+                status = fat12_volume_fat(volume, &walker->fat);
+        }
+        if (status != FAT12_OK) {
+                return status;
+        }
+        uint64_t phase_start = fat12_stats_phase_begin();
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+        walker->visited = calloc(walker->fat->num_entries / 8 + 1, sizeof(unsigned char));
+        if (walker->visited == NULL) {
+                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+        }
+
+        status = fat12_dir_walker_push(walker, 0, 0, 0);
+        fat12_stats_phase_end(FAT12_PHASE_DIRECTORIES, phase_start);
+        return status;
+
+}
+
+static int fat12_dir_walker_step (fat12_dir_walker* walker, fat12_dir_item* item);
+
+/*
+ * Advances the walker to the next file or subdirectory entry.
+ * Free entries, long file name entries, volume labels, the "." and ".." entries and entries whose first
+ * logical cluster is 0 or 1 are skipped, and each directory stops at its 0x00 end-of-directory marker.
+ * Long file name slots are gathered as they are passed, so an entry comes with its long name in the same pass.
+ * With include_deleted set, deleted entries are visited as well, and a deleted subdirectory is entered if its
+ * first cluster is still free and still starts with its "." and ".." entries.
+ *
+ * @param walker The walker.
+ * @param item Filled in with the visited entry.
+ * @return 1 if an entry was visited, 0 once every directory has been walked, or a negative fat12_status on failure.
+ */
+int fat12_dir_walker_next (fat12_dir_walker* walker, fat12_dir_item* item) {
+
+        uint64_t phase_start = fat12_stats_phase_begin();
+        int result = fat12_dir_walker_step(walker, item);
+        fat12_stats_phase_end(FAT12_PHASE_DIRECTORIES, phase_start);
+        return result;
+
+}
+
+// Function to advance the walker as fat12_dir_walker_next describes, without timing it
+static int fat12_dir_walker_step (fat12_dir_walker* walker, fat12_dir_item* item) {
+
+        while (walker->stack_size > 0) {
+
+                fat12_dir_frame* frame = &walker->stack[walker->stack_size - 1];
+                const char* entry;
+                fat12_status status = fat12_dir_walker_entry(walker, frame, &entry);
+                if (status != FAT12_OK) {
+                        return status;
+                }
+
+                // Leave the directory at its end or at the end-of-directory marker
+                if (entry == NULL || entry[0] == 0x00) {
+                        walker->stack_size--;
+                        walker->long_name_sequence = -1;
+                        continue;
+                }
+                frame->index++;
+                fat12_stats_add(FAT12_STAT_ENTRIES_VISITED, 1);
+
+                // Skip the entry if first byte is 0xE5 (indicating entry is free), unless deleted entries are wanted
+                int deleted = (unsigned char)entry[0] == 0xE5;
+                if (deleted && !walker->include_deleted) {
+                        walker->long_name_sequence = -1;
+                        continue;
+                }
+
+                // Gather the entry if attribute is 0x0F (indicating entry is part of a long file name)
+                if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] == ATTRIBUTE_LONG_FILE_NAME) {
+                        if (deleted) {
+                                fat12_dir_walker_gather_deleted(walker, entry);
+                        } else {
+                                fat12_dir_walker_gather(walker, entry);
+                        }
+                        continue;
+                }
+
+                // Every other entry ends the long file name before it, whether or not it is the one it names
+                const char* long_name = deleted ? fat12_dir_walker_deleted_long_name(walker, entry) : fat12_dir_walker_long_name(walker, entry);
+                walker->long_name_deleted = 0;
+
+                // Skip the entry if volume label bit of attribute is set
+                if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] & ATTRIBUTE_VOLUME_LABEL_BIT_MASK) {
+                        continue;
+                }
+
+                // Skip the "." and ".." entries of subdirectories
+                if (entry[0] == '.') {
+                        continue;
+                }
+
+                // Skip the entry if first logical cluster is 0 or 1
+                uint16_t first_logical_cluster = get_first_logical_cluster(entry);
+                if (first_logical_cluster == 0 || first_logical_cluster == 1) {
+                        continue;
+                }
+
+                item->entry = entry;
+                item->long_name = long_name;
+                item->depth = frame->depth;
+                item->is_directory = (entry[DIR_ENTRY_ATTRIBUTE_BYTE] & ATTRIBUTE_SUBDIRECTORY_BIT_MASK) != 0;
+                item->is_deleted = deleted || frame->deleted;
+
+                // Enter the subdirectory next, unless it is out of range, was already entered, or was deleted and reused
+                if (item->is_directory && first_logical_cluster < walker->fat->num_entries
+                        && (!item->is_deleted || fat12_dir_walker_deleted_directory(walker, first_logical_cluster))
+                        && !fat12_dir_walker_visit(walker, first_logical_cluster)) {
+                        fat12_status status = fat12_dir_walker_push(walker, first_logical_cluster, item->depth + 1, item->is_deleted);
+                        if (status != FAT12_OK) {
+                                return status;
+                        }
+                }
+
+                return 1;
+
+        }
+
+        return 0;
+
+}
+
+// Function to release the memory held by a walker, including the long names of the items it visited
+void fat12_dir_walker_free (fat12_dir_walker* walker) {
+
+        free(walker->stack);
+        free(walker->visited);
+        while (walker->names != NULL) {
+                fat12_name_block* next = walker->names->next;
+                free(walker->names);
+                walker->names = next;
+        }
+        walker->stack = NULL;
+        walker->visited = NULL;
+        walker->stack_size = 0;
+        walker->stack_capacity = 0;
+
+}
+
+/*
+ * Finds a directory entry with the specified attribute in the given sector within the volume.
+ * The returned entry points into the volume and stays valid until the volume is closed.
+ *
+ * @param volume The volume.
  * @param attribute The attribute to match.
  * @param sector_start_byte The starting byte of the sector.
- * @return A pointer to the matched entry or NULL if no entry is found.
+ * @return A pointer to the matched entry or NULL if no entry is found or the sector is out of bounds.
  */
-char* find_directory_entry (FILE* file, char attribute, long int sector_start_byte) {
+const char* find_directory_entry (fat12_volume* volume, char attribute, long int sector_start_byte) {
 
-        size_t entry_size_bytes = SECTOR_SIZE_BYTES / SECTOR_SIZE_ENTRIES;
-        char* entry = calloc(entry_size_bytes + 1, sizeof(char));
-        if (entry == NULL) {
-                perror("Memory allocation failed");
-                fclose(file);
-                exit(EXIT_FAILURE);
-        }
+        size_t entry_size_bytes = DIR_ENTRY_SIZE_BYTES;
 
-        // Seek to position of given sector
-        if (fseek(file, sector_start_byte, SEEK_SET) != 0) { // Move file pointer sector_start_byte number of bytes relative to start of file
-                perror("Error seeking to sector");
-                fclose(file);
-                exit(EXIT_FAILURE);
+        // Get the sector in place
+        const char* sector = fat12_volume_bytes(volume, sector_start_byte, SECTOR_SIZE_BYTES);
+        if (sector == NULL) {
+                fat12_error(FAT12_ERR_RANGE, "Error reading sector: out of bounds");
+                return NULL;
         }
 
         // Traverse entries in the sector
         for (int i = 0; i < SECTOR_SIZE_ENTRIES; i++) {
 
-                // Read the next entry
-                if (fread(entry, 1, entry_size_bytes, file) != entry_size_bytes) {
-                        perror("Error reading entry");
-                        fclose(file);
-                        exit(EXIT_FAILURE);
-                }
+                const char* entry = sector + i * entry_size_bytes;
 
                 // Check attribute byte and return entry upon match
                 if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] == attribute) {
@@ -78,46 +974,189 @@ char* find_directory_entry (FILE* file, char attribute, long int sector_start_by
 
         }
 
-        free(entry);
         return NULL;
 
 }
 
 // Function to get the first logical cluster of the provided directory entry
-uint16_t get_first_logical_cluster (char* entry) {
+uint16_t get_first_logical_cluster (const char* entry) {
 
-        return (uint16_t)((unsigned char)entry[FIRST_LOGICAL_CLUSTER_BYTE1] | ((unsigned char)entry[FIRST_LOGICAL_CLUSTER_BYTE2] << 8));
+        return fat12_le16(entry + FIRST_LOGICAL_CLUSTER_BYTE1);
 
 }
 
 // Function to get the file size of the provided directory entry
-uint32_t get_file_size (char* entry) {
+uint32_t get_file_size (const char* entry) {
+
+        return fat12_le32(entry + FILE_SIZE_START_BYTE);
+
+}
 
-        uint32_t file_size = 0;
-        for (int i = 0; i < FILE_SIZE_LENGTH_BYTES; i++) {
-                file_size |= (uint32_t)((unsigned char)entry[FILE_SIZE_START_BYTE + i]) << (8 * i);
+// Function to copy a space-padded name field of an entry into name, dropping the trailing spaces
+static inline void fat12_dirent_copy_name (const char* field, int length_bytes, char* name) {
+
+        int length = length_bytes;
+        while (length > 0 && (field[length - 1] == ' ' || field[length - 1] == '\0')) {
+                length--;
+        }
+        for (int i = 0; i < length; i++) {
+                name[i] = field[i];
         }
+        name[length] = '\0';
+
+}
+
+/*
+ * Decodes the fields of a raw 32-byte directory entry into a fixed-layout view.
+ * Multi-byte fields are read as little-endian regardless of the host, and nothing is allocated.
+ *
+ * @param entry The raw entry.
+ * @param dirent Filled in with the decoded fields.
+ */
+void fat12_dirent_decode (const char* entry, fat12_dirent* dirent) {
+
+        fat12_dirent_copy_name(entry + FILENAME_START_BYTE, FILENAME_LENGTH_BYTES, dirent->name);
+        fat12_dirent_copy_name(entry + EXTENSION_START_BYTE, EXTENSION_LENGTH_BYTES, dirent->extension);
+        dirent->attributes = (uint8_t)entry[DIR_ENTRY_ATTRIBUTE_BYTE];
+        dirent->first_logical_cluster = fat12_le16(entry + FIRST_LOGICAL_CLUSTER_BYTE1);
+        dirent->file_size = fat12_le32(entry + FILE_SIZE_START_BYTE);
+        dirent->creation_date = fat12_le16(entry + FILE_CREATE_DATE_START_BYTE);
+        dirent->creation_time = fat12_le16(entry + FILE_CREATE_TIME_START_BYTE);
+        dirent->write_date = fat12_le16(entry + FILE_WRITE_DATE_START_BYTE);
+        dirent->write_time = fat12_le16(entry + FILE_WRITE_TIME_START_BYTE);
+
+}
 
-        return file_size;
+// Function to format the name of a decoded entry as "NAME.EXT" into name, which must hold FAT12_NAME_BUFFER_SIZE bytes
+void fat12_dirent_format_name (const fat12_dirent* dirent, char* name) {
+
+        size_t length = strlen(dirent->name);
+        memcpy(name, dirent->name, length);
+        name[length++] = '.';
+        strcpy(name + length, dirent->extension);
+
+}
+
+// Function to format a packed date and time into formatted_datetime, which must hold FAT12_DATETIME_BUFFER_SIZE bytes
+void fat12_format_datetime (uint16_t date, uint16_t time, char* formatted_datetime) {
+
+        // Extract the date and time from raw data
+        int year, month, day, hour, minute;
+        year = ((date & 0xFE00) >> 9) + 1980; // Year is stored in the high seven bits as a value since 1980
+        month = (date & 0x1E0) >> 5; // Month is stored in the middle four bits
+        day = (date & 0x1F); // Day is stored in the low five bits
+        hour = (time & 0xF800) >> 11; // Hour is stored in the high five bits
+        minute = (time & 0x7E0) >> 5; // Minute is stored in the middle six bits
+
+        // Format the date and time into human-readable string
+        snprintf(formatted_datetime, FAT12_DATETIME_BUFFER_SIZE, "%04d-%02d-%02d %02d:%02d", year, month, day, hour, minute);
 
 }
 
-// Function to read a field of data from the provided directory entry in the provided disk image
-char* read_directory_entry_data (FILE* file, char* entry, int start_byte, int length_bytes) {
+// Function to pack a local time into the FAT date and time fields, the inverse of fat12_format_datetime (seconds are kept at two-second resolution)
+void fat12_encode_datetime (time_t timestamp, uint16_t* date, uint16_t* time) {
 
-        // Allocate memory for string
-        char* data = (char*)calloc(length_bytes + 1, sizeof(char));
-        if (data == NULL) {
-                perror("Memory allocation failed");
-                fclose(file);
-                exit(EXIT_FAILURE);
+        struct tm local;
+        if (localtime_r(&timestamp, &local) == NULL) {
+                // Only years far outside what FAT can hold fail to convert
+                memset(&local, 0, sizeof(local));
+                local.tm_year = timestamp < 0 ? 0 : 10000;
         }
+        int year = local.tm_year + 1900;
+        if (year < 1980) {
+                // The earliest date a FAT entry can hold, 1980-01-01 00:00:00
+                *date = (uint16_t)((1 << 5) | 1);
+                *time = 0;
+                return;
+        }
+        if (year > 2107) {
+                // The latest date a FAT entry can hold, 2107-12-31 23:59:58
+                *date = (uint16_t)((127 << 9) | (12 << 5) | 31);
+                *time = (uint16_t)((23 << 11) | (59 << 5) | 29);
+                return;
+        }
+        int second = local.tm_sec > 59 ? 59 : local.tm_sec; // A leap second would be stored as 30, one past the last valid value
+        *date = (uint16_t)(((year - 1980) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday);
+        *time = (uint16_t)((local.tm_hour << 11) | (local.tm_min << 5) | (second / 2));
+
+}
+
+// Function to compute the checksum of the 11-byte short name of an entry, which each of its long file name slots repeats
+uint8_t fat12_short_name_checksum (const char* entry) {
+
+        uint8_t checksum = 0;
+        for (int i = 0; i < FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES; i++) {
+                checksum = (uint8_t)(((checksum & 1) << 7) + (checksum >> 1) + (uint8_t)entry[FILENAME_START_BYTE + i]);
+        }
+        return checksum;
+
+}
+
+/*
+ * Converts UTF-16 to UTF-8, as long file names are stored. Runs of eight ASCII characters, by far the most
+ * common case, are narrowed eight at a time; unpaired surrogates become U+FFFD.
+ *
+ * @param units The UTF-16 code units.
+ * @param num_units The number of code units.
+ * @param utf8 Filled in with the UTF-8, not null-terminated; must hold 3 bytes per code unit.
+ * @return The number of bytes written.
+ */
+size_t fat12_utf16_to_utf8 (const uint16_t* units, size_t num_units, char* utf8) {
+
+        unsigned char* out = (unsigned char*)utf8;
+        size_t i = 0;
+        while (i < num_units) {
+
+#if defined(__SSE2__)
+                // A block with no bit above the low seven set in any unit packs straight down to bytes
+                if (i + 8 <= num_units) {
+                        __m128i block = _mm_loadu_si128((const __m128i*)(units + i));
+                        __m128i high = _mm_and_si128(block, _mm_set1_epi16((short)0xFF80));
+                        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF) {
+                                _mm_storel_epi64((__m128i*)out, _mm_packus_epi16(block, block));
+                                out += 8;
+                                i += 8;
+                                continue;
+                        }
+                }
+#endif
+
+                uint32_t code_point = units[i++];
+                if (code_point < 0x80) {
+                        *out++ = (unsigned char)code_point;
+                        continue;
+                }
+                if (code_point >= 0xD800 && code_point <= 0xDFFF) {
+                        if (code_point <= 0xDBFF && i < num_units && units[i] >= 0xDC00 && units[i] <= 0xDFFF) {
+                                code_point = 0x10000 + ((code_point - 0xD800) << 10) + (units[i++] - 0xDC00);
+                        } else {
+                                code_point = 0xFFFD;
+                        }
+                }
+                if (code_point < 0x800) {
+                        *out++ = (unsigned char)(0xC0 | code_point >> 6);
+                } else if (code_point < 0x10000) {
+                        *out++ = (unsigned char)(0xE0 | code_point >> 12);
+                        *out++ = (unsigned char)(0x80 | (code_point >> 6 & 0x3F));
+                } else {
+                        *out++ = (unsigned char)(0xF0 | code_point >> 18);
+                        *out++ = (unsigned char)(0x80 | (code_point >> 12 & 0x3F));
+                        *out++ = (unsigned char)(0x80 | (code_point >> 6 & 0x3F));
+                }
+                *out++ = (unsigned char)(0x80 | (code_point & 0x3F));
+
+        }
+        return (size_t)(out - (unsigned char*)utf8);
+
+}
+
+// Function to copy a field of data from the provided directory entry into data, which must hold length_bytes + 1 bytes (the copy is null-terminated)
+void read_directory_entry_data (const char* entry, int start_byte, int length_bytes, char* data) {
 
 	// Copy the relevant bytes from the entry into data
         for (int i = 0; i < length_bytes; i++) {
                 data[i] = entry[start_byte + i];
         }
-
-	return data;
+        data[length_bytes] = '\0';
 
 }
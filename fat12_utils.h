@@ -4,42 +4,223 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <time.h>
 
-extern const int OS_NAME_START_BYTE;
-extern const int OS_NAME_LENGTH_BYTES;
-extern const int LABEL_START_BYTE;
-extern const int LABEL_LENGTH_BYTES;
-extern const int ROOT_DIR_START_SECTOR;
-extern const int ROOT_DIR_END_SECTOR;
-extern const int SECTOR_SIZE_BYTES;
-extern const int SECTOR_SIZE_ENTRIES;
-extern const int DIR_ENTRY_ATTRIBUTE_BYTE;
-extern const int TOTAL_SECTOR_COUNT_START_BYTE;
-extern const int TOTAL_SECTOR_COUNT_LENGTH_BYTES;
-extern const int FAT_START_SECTOR;
-extern const int BIT_LENGTH;
-extern const int FIRST_LOGICAL_CLUSTER_BYTE1;
-extern const int FIRST_LOGICAL_CLUSTER_BYTE2;
-extern const int ATTRIBUTE_VOLUME_LABEL_BIT_MASK;
-extern const int ATTRIBUTE_SUBDIRECTORY_BIT_MASK;
-extern const int FILE_SIZE_START_BYTE;
-extern const int FILE_SIZE_LENGTH_BYTES;
-extern const int SECTORS_PER_FAT_START_BYTE;
-extern const int SECTORS_PER_FAT_LENGTH_BYTES;
-extern const int NUM_FAT_COPIES_START_BYTE;
-extern const int NUM_FAT_COPIES_LENGTH_BYTES;
-extern const int FILENAME_START_BYTE;
-extern const int FILENAME_LENGTH_BYTES;
-extern const int EXTENSION_START_BYTE;
-extern const int EXTENSION_LENGTH_BYTES;
-extern const int FILE_CREATE_DATE_START_BYTE;
-extern const int FILE_CREATE_DATE_LENGTH_BYTES;
-extern const int FILE_CREATE_TIME_START_BYTE;
-extern const int FILE_CREATE_TIME_LENGTH_BYTES;
-
-char* find_directory_entry (FILE* file, char attribute, long int sector_start_byte);
-uint16_t get_first_logical_cluster (char* entry);
-uint32_t get_file_size (char* entry);
-char* read_directory_entry_data (FILE* file, char* entry, int start_byte, int length_bytes);
+// On-disk layout, as compile-time constants so that every field read folds to a load at a fixed offset
+enum {
+        OS_NAME_START_BYTE = 3,
+        OS_NAME_LENGTH_BYTES = 8,
+        LABEL_START_BYTE = 43,
+        LABEL_LENGTH_BYTES = 11,
+        ROOT_DIR_START_SECTOR = 19,
+        ROOT_DIR_END_SECTOR = 32,
+        SECTOR_SIZE_BYTES = 512,
+        SECTOR_SIZE_ENTRIES = 16,
+        DIR_ENTRY_ATTRIBUTE_BYTE = 11,
+        TOTAL_SECTOR_COUNT_START_BYTE = 19,
+        TOTAL_SECTOR_COUNT_LENGTH_BYTES = 2,
+        FAT_START_SECTOR = 1,
+        BIT_LENGTH = 12,
+        FIRST_LOGICAL_CLUSTER_BYTE1 = 26,
+        FIRST_LOGICAL_CLUSTER_BYTE2 = 27,
+        ATTRIBUTE_VOLUME_LABEL_BIT_MASK = 0x08,
+        ATTRIBUTE_SUBDIRECTORY_BIT_MASK = 0x10,
+        FILE_SIZE_START_BYTE = 28,
+        FILE_SIZE_LENGTH_BYTES = 4,
+        SECTORS_PER_FAT_START_BYTE = 22,
+        SECTORS_PER_FAT_LENGTH_BYTES = 2,
+        NUM_FAT_COPIES_START_BYTE = 16,
+        NUM_FAT_COPIES_LENGTH_BYTES = 1,
+        FILENAME_START_BYTE = 0,
+        FILENAME_LENGTH_BYTES = 8,
+        EXTENSION_START_BYTE = 8,
+        EXTENSION_LENGTH_BYTES = 3,
+        FILE_CREATE_DATE_START_BYTE = 16,
+        FILE_CREATE_DATE_LENGTH_BYTES = 2,
+        FILE_CREATE_TIME_START_BYTE = 14,
+        FILE_CREATE_TIME_LENGTH_BYTES = 2,
+        DIR_ENTRY_SIZE_BYTES = 32,
+        FILE_CREATE_TIME_TENTHS_BYTE = 13,
+        FILE_ACCESS_DATE_START_BYTE = 18,
+        FILE_WRITE_TIME_START_BYTE = 22,
+        FILE_WRITE_DATE_START_BYTE = 24,
+        ATTRIBUTE_LONG_FILE_NAME = 0x0F,
+        LONG_NAME_SEQUENCE_BYTE = 0,
+        LONG_NAME_LAST_SLOT_MASK = 0x40,
+        LONG_NAME_TYPE_BYTE = 12,
+        LONG_NAME_CHECKSUM_BYTE = 13,
+        LONG_NAME_CHARS_PER_SLOT = 13,
+        LONG_NAME_MAX_SLOTS = 20,
+        BYTES_PER_SECTOR_START_BYTE = 11,
+        SECTORS_PER_CLUSTER_BYTE = 13,
+        RESERVED_SECTORS_START_BYTE = 14,
+        ROOT_ENTRIES_START_BYTE = 17,
+        LARGE_TOTAL_SECTOR_COUNT_START_BYTE = 32
+};
+
+// Result of a library call; every failure also leaves a description in fat12_last_error
+typedef enum {
+        FAT12_OK = 0,
+        FAT12_ERR_IO = -1, // The image could not be opened or read
+        FAT12_ERR_NOMEM = -2, // Memory allocation failed
+        FAT12_ERR_RANGE = -3, // The image is too small for a structure it describes
+        FAT12_ERR_INVALID = -4, // An argument or on-disk value is invalid
+        FAT12_ERR_NOT_FOUND = -5, // The requested entry does not exist
+        FAT12_ERR_BUFFER = -6, // A caller-supplied buffer is too small
+        FAT12_ERR_NO_SPACE = -7 // The image has no room left for the data or entry being added
+} fat12_status;
+
+// Layout of a volume, parsed from the BIOS parameter block of its boot sector
+typedef struct {
+        uint16_t bytes_per_sector;
+        uint8_t sectors_per_cluster;
+        uint16_t reserved_sectors;
+        uint8_t num_fats;
+        uint16_t root_entries;
+        uint16_t sectors_per_fat;
+        uint32_t total_sectors;
+        uint32_t fat_start_byte;
+        uint32_t root_start_byte;
+        uint32_t data_start_byte; // Where cluster 2 starts
+        uint32_t cluster_size_bytes;
+        uint32_t end_cluster; // One past the last cluster backed by a data sector
+        int standard; // Nonzero when the layout is exactly FAT12_GEOMETRY_1440K
+} fat12_geometry;
+
+// The 1.44 MB floppy layout the constants above describe, as a constant table so code specialized on it folds every offset
+static const fat12_geometry FAT12_GEOMETRY_1440K = {
+        SECTOR_SIZE_BYTES, 1, FAT_START_SECTOR, 2, (ROOT_DIR_END_SECTOR - ROOT_DIR_START_SECTOR + 1) * SECTOR_SIZE_ENTRIES, 9, 2880,
+        FAT_START_SECTOR * SECTOR_SIZE_BYTES, ROOT_DIR_START_SECTOR * SECTOR_SIZE_BYTES, (ROOT_DIR_END_SECTOR + 1) * SECTOR_SIZE_BYTES,
+        SECTOR_SIZE_BYTES, 2880 - (ROOT_DIR_END_SECTOR + 1) + 2, 1
+};
+
+// Function to get the byte offset of a data cluster
+static inline uint32_t fat12_cluster_start_byte (const fat12_geometry* geometry, uint32_t cluster) {
+
+        return geometry->data_start_byte + (cluster - 2) * geometry->cluster_size_bytes;
+
+}
+
+// Read-only view of a whole disk image, mapped (or read in bulk) once when opened
+typedef struct fat12_volume fat12_volume;
+
+// Summary of a volume, as reported by diskinfo
+typedef struct {
+        char os_name[9]; // OS_NAME_LENGTH_BYTES plus a null terminator
+        char label[12]; // LABEL_LENGTH_BYTES plus a null terminator
+        uint32_t total_size;
+        uint32_t free_size;
+        int num_files;
+        uint16_t sectors_per_fat;
+        uint8_t num_fat_copies;
+} fat12_info;
+
+const char* fat12_strerror (fat12_status status);
+const char* fat12_last_error (void);
+
+fat12_status fat12_volume_open (const char* path, fat12_volume** volume);
+fat12_status fat12_volume_open_writable (const char* path, fat12_volume** volume);
+fat12_status fat12_volume_sync (fat12_volume* volume);
+fat12_status fat12_parse_geometry (const char* boot_sector, fat12_geometry* geometry);
+fat12_status fat12_volume_geometry (fat12_volume* volume, const fat12_geometry** geometry);
+void fat12_volume_close (fat12_volume* volume);
+size_t fat12_volume_size (const fat12_volume* volume);
+const char* fat12_volume_bytes (fat12_volume* volume, long int start_byte, size_t length_bytes);
+const char* fat12_volume_sector (fat12_volume* volume, long int sector);
+
+fat12_status fat12_get_label (fat12_volume* volume, char* label, size_t label_size);
+fat12_status fat12_get_free_size (fat12_volume* volume, uint32_t* free_size);
+fat12_status fat12_get_num_files (fat12_volume* volume, int* num_files);
+fat12_status fat12_get_info (fat12_volume* volume, fat12_info* info);
+
+// Function to load a little-endian 16-bit field, independent of host byte order
+static inline uint16_t fat12_le16 (const char* field) {
+
+        const unsigned char* bytes = (const unsigned char*)field;
+        return (uint16_t)(bytes[0] | bytes[1] << 8);
+
+}
+
+// Function to load a little-endian 32-bit field, independent of host byte order
+static inline uint32_t fat12_le32 (const char* field) {
+
+        const unsigned char* bytes = (const unsigned char*)field;
+        return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+
+}
+
+// Fixed-layout view of one 32-byte directory entry, decoded in place without allocating
+typedef struct {
+        char name[FILENAME_LENGTH_BYTES + 1]; // Trailing spaces trimmed
+        char extension[EXTENSION_LENGTH_BYTES + 1]; // Trailing spaces trimmed
+        uint8_t attributes;
+        uint16_t first_logical_cluster;
+        uint32_t file_size;
+        uint16_t creation_date;
+        uint16_t creation_time;
+        uint16_t write_date;
+        uint16_t write_time;
+} fat12_dirent;
+
+// Length of "NAME.EXT" plus a null terminator, the buffer size for fat12_dirent_format_name
+#define FAT12_NAME_BUFFER_SIZE (FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES + 2)
+// Length of "YYYY-MM-DD HH:MM" plus a null terminator, the buffer size for fat12_format_datetime
+#define FAT12_DATETIME_BUFFER_SIZE 17
+
+// Longest VFAT long file name in UTF-16 code units, and the size of a buffer holding any of them as UTF-8 with a null terminator
+#define FAT12_LONG_NAME_MAX 255
+#define FAT12_LONG_NAME_BUFFER_SIZE (FAT12_LONG_NAME_MAX * 3 + 1)
+
+void fat12_dirent_decode (const char* entry, fat12_dirent* dirent);
+void fat12_dirent_format_name (const fat12_dirent* dirent, char* name);
+void fat12_format_datetime (uint16_t date, uint16_t time, char* formatted_datetime);
+void fat12_encode_datetime (time_t timestamp, uint16_t* date, uint16_t* time);
+uint8_t fat12_short_name_checksum (const char* entry);
+size_t fat12_utf16_to_utf8 (const uint16_t* units, size_t num_units, char* utf8);
+
+// One directory entry visited by the directory walker
+typedef struct {
+        const char* entry; // The raw entry, pointing into the volume
+        int depth; // 0 for entries of the root directory, 1 for their children, and so on
+        int is_directory;
+        const char* long_name; // The entry's VFAT long file name in UTF-8, or NULL if it has none; kept until the walker is freed
+        int is_deleted; // The entry, or a directory above it, was deleted; only visited when the walker includes deleted entries
+} fat12_dir_item;
+
+// Position of the walker within one directory (cluster 0 stands for the fixed root directory region)
+typedef struct {
+        uint16_t cluster;
+        int index;
+        int depth;
+        int deleted; // The directory itself was deleted, so every entry in it is too
+} fat12_dir_frame;
+
+// Depth-first walker over every directory of a volume, using an explicit stack instead of recursion
+typedef struct {
+        fat12_volume* volume;
+        const fat12_geometry* geometry;
+        const struct fat12_fat* fat;
+        fat12_dir_frame* stack;
+        int stack_size;
+        int stack_capacity;
+        unsigned char* visited; // One bit per cluster, so each directory is entered at most once
+        uint16_t long_name[LONG_NAME_MAX_SLOTS * LONG_NAME_CHARS_PER_SLOT]; // UTF-16 of the long file name being gathered
+        int long_name_slots; // Number of slots of that name
+        int long_name_sequence; // Sequence number of the slot expected next, 0 once the name is complete, or -1 when none is being gathered
+        uint8_t long_name_checksum; // Checksum of the short name the slots belong to
+        int long_name_deleted; // The slots being gathered are deleted ones, held in on-disk order
+        int include_deleted; // Set after fat12_dir_walker_init to also visit deleted entries
+        struct fat12_name_block* names; // Long names handed out in items so far
+} fat12_dir_walker;
+
+fat12_status fat12_dir_walker_init (fat12_dir_walker* walker, fat12_volume* volume);
+int fat12_dir_walker_next (fat12_dir_walker* walker, fat12_dir_item* item);
+void fat12_dir_walker_free (fat12_dir_walker* walker);
+
+const char* find_directory_entry (fat12_volume* volume, char attribute, long int sector_start_byte);
+uint16_t get_first_logical_cluster (const char* entry);
+uint32_t get_file_size (const char* entry);
+void read_directory_entry_data (const char* entry, int start_byte, int length_bytes, char* data);
 
 #endif
@@ -0,0 +1,585 @@
+#include "fat12_write.h"
+#include "fat12_utils.h"
+#include "fat12_internal.h"
+#include "fat12_fat.h"
+#include "fat12_path.h"
+#include "fat12_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+// Directory entry of a file whose data is in, kept back until its clusters are in every FAT copy
+typedef struct {
+        size_t offset; // Byte offset of the entry's slot in the image
+        uint16_t dir_cluster; // Directory the slot belongs to, 0 for the root
+        char entry[DIR_ENTRY_SIZE_BYTES];
+} fat12_pending_entry;
+
+struct fat12_writer {
+        fat12_volume* volume;
+        const fat12_geometry* geometry;
+        fat12_fat* fat; // The volume's decoded FAT, updated in place so lookups see new chains right away
+        uint64_t* free_bitmap; // One bit per cluster, set while the cluster is free
+        uint32_t end_cluster; // One past the last cluster that maps to a sector of the image
+        uint32_t num_free;
+        uint32_t dirty_first; // Range of FAT entries changed since the last commit, empty when first >= end
+        uint32_t dirty_end;
+        uint64_t* reserved_slots; // One bit per 32-byte slot of the image, set while a pending entry holds it
+        fat12_pending_entry* pending;
+        size_t num_pending;
+        size_t pending_capacity;
+};
+
+// Run of free clusters considered by the allocator
+typedef struct {
+        uint32_t first;
+        uint32_t length;
+} fat12_free_run;
+
+// Function to get a pointer to the first byte of a data cluster of a writable volume
+static char* fat12_writer_cluster (fat12_writer* writer, uint16_t cluster) {
+
+        return (char*)writer->volume->data + fat12_cluster_start_byte(writer->geometry, cluster);
+
+}
+
+// Function to change one FAT entry, keeping the free bitmap and the dirty range in step
+static void fat12_writer_set (fat12_writer* writer, uint32_t cluster, uint16_t value) {
+
+        uint64_t bit = (uint64_t)1 << (cluster % 64);
+        int was_free = (writer->free_bitmap[cluster / 64] & bit) != 0;
+        if (value == FAT_ENTRY_FREE) {
+                writer->free_bitmap[cluster / 64] |= bit;
+        } else {
+                writer->free_bitmap[cluster / 64] &= ~bit;
+        }
+        writer->num_free += (value == FAT_ENTRY_FREE) - was_free;
+        writer->fat->entries[cluster] = value;
+
+        if (writer->dirty_first >= writer->dirty_end) {
+                writer->dirty_first = cluster;
+                writer->dirty_end = cluster + 1;
+        } else if (cluster < writer->dirty_first) {
+                writer->dirty_first = cluster;
+        } else if (cluster >= writer->dirty_end) {
+                writer->dirty_end = cluster + 1;
+        }
+
+}
+
+// Function to find the first cluster at or after from whose free bit equals want_free, or end_cluster if there is none
+static uint32_t fat12_writer_scan (const fat12_writer* writer, uint32_t from, int want_free) {
+
+        while (from < writer->end_cluster) {
+                uint64_t word = writer->free_bitmap[from / 64];
+                if (!want_free) {
+                        word = ~word;
+                }
+                word >>= from % 64;
+                if (word != 0) {
+                        uint32_t found = from + (uint32_t)__builtin_ctzll(word);
+                        return found < writer->end_cluster ? found : writer->end_cluster;
+                }
+                from = (from / 64 + 1) * 64; // Skip the rest of the word, all of it the wrong kind
+        }
+        return writer->end_cluster;
+
+}
+
+/*
+ * Starts modifying a writable volume. Free clusters are found from a bitmap built by one scan of the FAT,
+ * over the same cluster range fat12_get_free_size counts.
+ *
+ * @param volume A volume opened with fat12_volume_open_writable.
+ * @param started Set to the new writer, to be released with fat12_writer_free.
+ * @return FAT12_OK, or the reason the volume cannot be modified.
+ */
+fat12_status fat12_writer_begin (fat12_volume* volume, fat12_writer** started) {
+
+        if (!volume->writable) {
+                return fat12_error(FAT12_ERR_INVALID, "Volume was not opened for writing");
+        }
+        const fat12_geometry* geometry;
+        const fat12_fat* fat;
+        fat12_status status = fat12_volume_geometry(volume, &geometry);
+        if (status == FAT12_OK) {
+                status = fat12_volume_fat(volume, &fat);
+        }
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        uint32_t end_cluster = geometry->end_cluster;
+        if (end_cluster > fat->num_entries) {
+                end_cluster = fat->num_entries;
+        }
+        if (fat12_cluster_start_byte(geometry, end_cluster) > fat12_volume_size(volume)) {
+                return fat12_error(FAT12_ERR_RANGE, "Image is smaller than its boot sector says");
+        }
+
+        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 3);
+        fat12_writer* writer = calloc(1, sizeof(fat12_writer));
+        uint64_t* free_bitmap = calloc(end_cluster / 64 + 1, sizeof(uint64_t));
+        uint64_t* reserved_slots = calloc(fat12_volume_size(volume) / DIR_ENTRY_SIZE_BYTES / 64 + 1, sizeof(uint64_t));
+        if (writer == NULL || free_bitmap == NULL || reserved_slots == NULL) {
+                status = fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                free(reserved_slots);
+                free(free_bitmap);
+                free(writer);
+                return status;
+        }
+        writer->volume = volume;
+        writer->geometry = geometry;
+        writer->fat = (fat12_fat*)fat;
+        writer->free_bitmap = free_bitmap;
+        writer->reserved_slots = reserved_slots;
+        writer->end_cluster = end_cluster;
+        writer->num_free = fat12_fat_count_free(fat, 2, end_cluster);
+        fat12_fat_free_bitmap(fat, 2, end_cluster, free_bitmap);
+
+        *started = writer;
+        return FAT12_OK;
+
+}
+
+// Function to get the number of clusters still free, counting the allocations not yet committed
+uint32_t fat12_writer_free_clusters (const fat12_writer* writer) {
+
+        return writer->num_free;
+
+}
+
+// Function to order free runs longest first
+static int fat12_free_run_compare_length (const void* a, const void* b) {
+
+        const fat12_free_run* run_a = a;
+        const fat12_free_run* run_b = b;
+        return run_a->length != run_b->length ? (run_a->length < run_b->length ? 1 : -1) : (run_a->first < run_b->first ? -1 : 1);
+
+}
+
+// Function to order free runs by position on disk
+static int fat12_free_run_compare_first (const void* a, const void* b) {
+
+        const fat12_free_run* run_a = a;
+        const fat12_free_run* run_b = b;
+        return run_a->first < run_b->first ? -1 : run_a->first > run_b->first;
+
+}
+
+/*
+ * Allocates a chain of count clusters. The smallest free run that holds the whole chain is used, so the file
+ * stays contiguous without breaking up larger runs; only when no run is long enough is the chain spread over
+ * the longest runs, which keeps the number of fragments as low as possible.
+ *
+ * @param writer The writer.
+ * @param count The number of clusters, at least 1.
+ * @param first Set to the first cluster of the chain.
+ * @return FAT12_OK, or FAT12_ERR_NO_SPACE if there are fewer than count free clusters.
+ */
+static fat12_status fat12_writer_allocate (fat12_writer* writer, uint32_t count, uint16_t* first) {
+
+        if (count > writer->num_free) {
+                return fat12_error(FAT12_ERR_NO_SPACE, "Not enough free space in the disk image (%u clusters needed, %u free)", count, writer->num_free);
+        }
+
+        // Collect the free runs, remembering the best fit along the way
+        fat12_free_run* runs = NULL;
+        size_t num_runs = 0;
+        size_t runs_capacity = 0;
+        fat12_free_run best = { 0, 0 };
+        for (uint32_t start = fat12_writer_scan(writer, 2, 1); start < writer->end_cluster; ) {
+                uint32_t end = fat12_writer_scan(writer, start, 0);
+                fat12_free_run run = { start, end - start };
+                if (run.length >= count && (best.length == 0 || run.length < best.length)) {
+                        best = run;
+                }
+                if (num_runs == runs_capacity) {
+                        runs_capacity = runs_capacity > 0 ? runs_capacity * 2 : 64;
+                        fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                        fat12_free_run* grown = realloc(runs, runs_capacity * sizeof(fat12_free_run));
+                        if (grown == NULL) {
+                                free(runs);
+                                return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                        }
+                        runs = grown;
+                }
+                runs[num_runs++] = run;
+                start = fat12_writer_scan(writer, end, 1);
+        }
+
+        // Fall back to the fewest, longest runs, chained in disk order so the file still reads forward
+        size_t num_used = 1;
+        if (best.length > 0) {
+                runs[0] = best;
+                runs[0].length = count;
+        } else {
+                qsort(runs, num_runs, sizeof(fat12_free_run), fat12_free_run_compare_length);
+                uint32_t taken = 0;
+                for (num_used = 0; taken < count; num_used++) {
+                        if (runs[num_used].length > count - taken) {
+                                runs[num_used].length = count - taken;
+                        }
+                        taken += runs[num_used].length;
+                }
+                qsort(runs, num_used, sizeof(fat12_free_run), fat12_free_run_compare_first);
+        }
+
+        uint32_t previous = 0;
+        for (size_t r = 0; r < num_used; r++) {
+                for (uint32_t cluster = runs[r].first; cluster < runs[r].first + runs[r].length; cluster++) {
+                        if (previous != 0) {
+                                fat12_writer_set(writer, previous, (uint16_t)cluster);
+                        } else {
+                                *first = (uint16_t)cluster;
+                        }
+                        previous = cluster;
+                }
+        }
+        fat12_writer_set(writer, previous, 0xFFF);
+
+        free(runs);
+        return FAT12_OK;
+
+}
+
+// Function to copy length characters of a name part into a short name field in upper case, failing on characters a short name cannot hold
+static fat12_status fat12_short_name_part (const char* name, const char* part, size_t length, char* field) {
+
+        for (size_t i = 0; i < length; i++) {
+                unsigned char c = (unsigned char)toupper((unsigned char)part[i]);
+                if (c <= ' ' || c >= 0x7F || strchr("\"*+,./:;<=>?[\\]|", c) != NULL) {
+                        return fat12_error(FAT12_ERR_INVALID, "%s is not a valid 8.3 file name", name);
+                }
+                field[i] = (char)c;
+        }
+        return FAT12_OK;
+
+}
+
+// Function to convert a host file name such as "notes.txt" into a space-padded 11-byte short name, or fail if it does not fit the 8.3 form
+static fat12_status fat12_short_name (const char* name, char* short_name) {
+
+        const char* dot = strrchr(name, '.');
+        size_t base_length = dot != NULL ? (size_t)(dot - name) : strlen(name);
+        size_t extension_length = dot != NULL ? strlen(dot + 1) : 0;
+        if (base_length == 0 || base_length > FILENAME_LENGTH_BYTES || extension_length > EXTENSION_LENGTH_BYTES) {
+                return fat12_error(FAT12_ERR_INVALID, "%s is not a valid 8.3 file name", name);
+        }
+
+        memset(short_name, ' ', FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES);
+        fat12_status status = fat12_short_name_part(name, name, base_length, short_name + FILENAME_START_BYTE);
+        if (status == FAT12_OK && dot != NULL) {
+                status = fat12_short_name_part(name, dot + 1, extension_length, short_name + EXTENSION_START_BYTE);
+        }
+        return status;
+
+}
+
+// Function to check whether a slot of the image is held by a pending entry
+static int fat12_writer_reserved (const fat12_writer* writer, const char* slot) {
+
+        size_t index = (size_t)(slot - (const char*)writer->volume->data) / DIR_ENTRY_SIZE_BYTES;
+        return (writer->reserved_slots[index / 64] >> (index % 64)) & 1;
+
+}
+
+// Function to find a free slot for a new entry in a directory (cluster 0 for the root), failing if the name is taken; for a full subdirectory, slot is set to NULL and last_cluster to the end of its chain
+static fat12_status fat12_writer_slot (fat12_writer* writer, uint16_t dir_cluster, const char* short_name, char** slot, uint16_t* last_cluster_out) {
+
+        // Pending entries are not in the image yet, so their names are checked here and their slots skipped below
+        for (size_t i = 0; i < writer->num_pending; i++) {
+                if (writer->pending[i].dir_cluster == dir_cluster && memcmp(writer->pending[i].entry, short_name, FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES) == 0) {
+                        fat12_dirent dirent;
+                        char existing[FAT12_NAME_BUFFER_SIZE];
+                        fat12_dirent_decode(writer->pending[i].entry, &dirent);
+                        fat12_dirent_format_name(&dirent, existing);
+                        return fat12_error(FAT12_ERR_INVALID, "%s already exists", existing);
+                }
+        }
+
+        char* free_slot = NULL;
+        uint16_t cluster = dir_cluster;
+        uint16_t last_cluster = dir_cluster;
+        int at_end = 0;
+
+        for (uint32_t steps = 0; !at_end; steps++) {
+
+                // The root directory is one fixed region; subdirectories are chains of clusters
+                char* entries;
+                int num_entries;
+                if (dir_cluster == 0) {
+                        entries = (char*)writer->volume->data + writer->geometry->root_start_byte;
+                        num_entries = writer->geometry->root_entries;
+                } else {
+                        if (cluster < 2 || cluster >= writer->end_cluster || steps >= writer->end_cluster) {
+                                return fat12_error(FAT12_ERR_INVALID, "Broken directory cluster chain at cluster %u", cluster);
+                        }
+                        entries = fat12_writer_cluster(writer, cluster);
+                        num_entries = (int)(writer->geometry->cluster_size_bytes / DIR_ENTRY_SIZE_BYTES);
+                }
+
+                for (int i = 0; i < num_entries; i++) {
+                        char* entry = entries + i * DIR_ENTRY_SIZE_BYTES;
+                        if (fat12_writer_reserved(writer, entry)) {
+                                continue;
+                        }
+                        if (entry[0] == 0x00) {
+                                if (free_slot == NULL) {
+                                        free_slot = entry;
+                                }
+                                at_end = 1; // Nothing follows the end-of-directory marker
+                                break;
+                        }
+                        if ((unsigned char)entry[0] == 0xE5) {
+                                if (free_slot == NULL) {
+                                        free_slot = entry;
+                                }
+                                continue;
+                        }
+                        if (entry[DIR_ENTRY_ATTRIBUTE_BYTE] != ATTRIBUTE_LONG_FILE_NAME && memcmp(entry, short_name, FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES) == 0) {
+                                fat12_dirent dirent;
+                                char existing[FAT12_NAME_BUFFER_SIZE];
+                                fat12_dirent_decode(entry, &dirent);
+                                fat12_dirent_format_name(&dirent, existing);
+                                return fat12_error(FAT12_ERR_INVALID, "%s already exists", existing);
+                        }
+                }
+
+                if (dir_cluster == 0) {
+                        break;
+                }
+                last_cluster = cluster;
+                cluster = writer->fat->entries[cluster];
+                if (cluster >= FAT_ENTRY_BAD) {
+                        break;
+                }
+        }
+
+        if (free_slot == NULL && dir_cluster == 0) {
+                return fat12_error(FAT12_ERR_NO_SPACE, "Root directory is full");
+        }
+
+        *slot = free_slot;
+        *last_cluster_out = last_cluster;
+        return FAT12_OK;
+
+}
+
+// Function to extend a full subdirectory, whose chain ends at last_cluster, with an empty cluster, setting slot to its first entry
+static fat12_status fat12_writer_grow (fat12_writer* writer, uint16_t last_cluster, char** slot) {
+
+        uint16_t added;
+        fat12_status status = fat12_writer_allocate(writer, 1, &added);
+        if (status != FAT12_OK) {
+                return status;
+        }
+        fat12_writer_set(writer, last_cluster, added);
+        *slot = fat12_writer_cluster(writer, added);
+        memset(*slot, 0, writer->geometry->cluster_size_bytes);
+        return FAT12_OK;
+
+}
+
+// Function to give back the clusters of a chain, so a failed file leaves no trace in the FAT
+static void fat12_writer_release (fat12_writer* writer, uint16_t first_cluster) {
+
+        for (uint16_t cluster = first_cluster; cluster >= 2 && cluster < FAT_ENTRY_BAD; ) {
+                uint16_t next = writer->fat->entries[cluster];
+                fat12_writer_set(writer, cluster, FAT_ENTRY_FREE);
+                cluster = next;
+        }
+
+}
+
+// Function to store a 16-bit little-endian field of a directory entry
+static void fat12_store_le16 (char* field, uint16_t value) {
+
+        field[0] = (char)(value & 0xFF);
+        field[1] = (char)(value >> 8);
+
+}
+
+/*
+ * Adds a file to a directory of the volume, reading its content from fd. The data is copied into freshly
+ * allocated clusters right away; the FAT changes and the directory entry are only collected, for
+ * fat12_writer_commit to write. Until then the file cannot be found in the image.
+ *
+ * @param writer The writer.
+ * @param dir_path The directory to add the file to, such as "SUBDIR"; "" or "/" for the root directory.
+ * @param name The 8.3 name of the new file, in any case.
+ * @param fd The content, read from its current position.
+ * @param size The number of bytes to read from fd; empty files are refused.
+ * @param modified The creation and modification time to record.
+ * @return FAT12_OK, or the reason the file could not be added.
+ */
+fat12_status fat12_put_file (fat12_writer* writer, const char* dir_path, const char* name, int fd, uint32_t size, time_t modified) {
+
+        char short_name[FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES];
+        fat12_status status = fat12_short_name(name, short_name);
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        // An empty file would get first cluster 0, and the directory walk skips such entries, so it could never be listed or read back
+        if (size == 0) {
+                return fat12_error(FAT12_ERR_INVALID, "%s is empty; empty files cannot be added", name);
+        }
+
+        // Find the target directory
+        uint16_t dir_cluster = 0;
+        while (*dir_path == '/') {
+                dir_path++;
+        }
+        if (*dir_path != '\0') {
+                const char* dir_entry;
+                status = fat12_find_entry(writer->volume, dir_path, &dir_entry);
+                if (status != FAT12_OK) {
+                        return status;
+                }
+                if (!(dir_entry[DIR_ENTRY_ATTRIBUTE_BYTE] & ATTRIBUTE_SUBDIRECTORY_BIT_MASK)) {
+                        return fat12_error(FAT12_ERR_INVALID, "%s is not a directory", dir_path);
+                }
+                dir_cluster = get_first_logical_cluster(dir_entry);
+        }
+
+        // Only look for the slot now; a full subdirectory grows once the data is in, so a failure before leaves it as it was
+        char* slot = NULL;
+        uint16_t last_cluster = 0;
+        status = fat12_writer_slot(writer, dir_cluster, short_name, &slot, &last_cluster);
+        if (status != FAT12_OK) {
+                return status;
+        }
+
+        // Copy the content into the chain, one cluster at a time, zero-filling the tail of the last one
+        uint16_t first_cluster = 0;
+        uint32_t cluster_size_bytes = writer->geometry->cluster_size_bytes;
+        uint32_t num_clusters = (uint32_t)(((uint64_t)size + cluster_size_bytes - 1) / cluster_size_bytes);
+        if (num_clusters > 0) {
+                status = fat12_writer_allocate(writer, num_clusters, &first_cluster);
+                if (status != FAT12_OK) {
+                        return status;
+                }
+        }
+        uint32_t remaining = size;
+        for (uint16_t cluster = first_cluster; remaining > 0; cluster = writer->fat->entries[cluster]) {
+                char* data = fat12_writer_cluster(writer, cluster);
+                uint32_t length = remaining < cluster_size_bytes ? remaining : cluster_size_bytes;
+                for (uint32_t done = 0; done < length; ) {
+                        ssize_t n = read(fd, data + done, length - done);
+                        if (n < 0 && errno == EINTR) {
+                                continue;
+                        }
+                        if (n <= 0) {
+                                fat12_writer_release(writer, first_cluster);
+                                return fat12_error(FAT12_ERR_IO, "Error reading %s: %s", name, n < 0 ? strerror(errno) : "file is shorter than its size");
+                        }
+                        done += (uint32_t)n;
+                }
+                memset(data + length, 0, cluster_size_bytes - length);
+                remaining -= length;
+        }
+
+        // Make room for the pending entry before growing the directory, so neither can fail after the other
+        if (writer->num_pending == writer->pending_capacity) {
+                size_t capacity = writer->pending_capacity > 0 ? writer->pending_capacity * 2 : 16;
+                fat12_stats_add(FAT12_STAT_ALLOCATIONS, 1);
+                fat12_pending_entry* grown = realloc(writer->pending, capacity * sizeof(fat12_pending_entry));
+                if (grown == NULL) {
+                        fat12_writer_release(writer, first_cluster);
+                        return fat12_error(FAT12_ERR_NOMEM, "Memory allocation failed: %s", strerror(errno));
+                }
+                writer->pending = grown;
+                writer->pending_capacity = capacity;
+        }
+        if (slot == NULL) {
+                status = fat12_writer_grow(writer, last_cluster, &slot);
+                if (status != FAT12_OK) {
+                        fat12_writer_release(writer, first_cluster);
+                        return status;
+                }
+        }
+
+        // The entry is only prepared here; fat12_writer_commit writes it once its chain is in every FAT copy
+        fat12_pending_entry* pending = &writer->pending[writer->num_pending++];
+        pending->offset = (size_t)(slot - (char*)writer->volume->data);
+        pending->dir_cluster = dir_cluster;
+        char* entry = pending->entry;
+        uint16_t date, time;
+        fat12_encode_datetime(modified, &date, &time);
+        memset(entry, 0, DIR_ENTRY_SIZE_BYTES);
+        memcpy(entry, short_name, FILENAME_LENGTH_BYTES + EXTENSION_LENGTH_BYTES);
+        entry[DIR_ENTRY_ATTRIBUTE_BYTE] = 0x20; // Archive
+        fat12_store_le16(entry + FILE_CREATE_TIME_START_BYTE, time);
+        fat12_store_le16(entry + FILE_CREATE_DATE_START_BYTE, date);
+        fat12_store_le16(entry + FILE_ACCESS_DATE_START_BYTE, date);
+        fat12_store_le16(entry + FILE_WRITE_TIME_START_BYTE, time);
+        fat12_store_le16(entry + FILE_WRITE_DATE_START_BYTE, date);
+        fat12_store_le16(entry + FIRST_LOGICAL_CLUSTER_BYTE1, first_cluster);
+        fat12_store_le16(entry + FILE_SIZE_START_BYTE, (uint16_t)(size & 0xFFFF));
+        fat12_store_le16(entry + FILE_SIZE_START_BYTE + 2, (uint16_t)(size >> 16));
+        size_t index = pending->offset / DIR_ENTRY_SIZE_BYTES;
+        writer->reserved_slots[index / 64] |= (uint64_t)1 << (index % 64);
+        return FAT12_OK;
+
+}
+
+/*
+ * Writes every FAT change collected since the last commit to each FAT copy the boot sector declares,
+ * touching only the changed range, and flushes the image to its file. Only then are the pending directory
+ * entries written and flushed in turn. An interrupted commit can leave clusters marked used that no entry
+ * points to, which diskcheck reports, but never an entry whose clusters the FAT still calls free, which
+ * the next diskput would hand out again.
+ *
+ * @param writer The writer.
+ * @return FAT12_OK, or the reason the changes could not be written; if the FAT copies could not be flushed, no entry is written.
+ */
+fat12_status fat12_writer_commit (fat12_writer* writer) {
+
+        const fat12_geometry* geometry = writer->geometry;
+        size_t fat_length_bytes = (size_t)geometry->sectors_per_fat * geometry->bytes_per_sector;
+        if (geometry->fat_start_byte + geometry->num_fats * fat_length_bytes > fat12_volume_size(writer->volume)) {
+                return fat12_error(FAT12_ERR_RANGE, "Image too small for its %u FAT copies", geometry->num_fats);
+        }
+
+        for (uint8_t copy = 0; copy < geometry->num_fats; copy++) {
+                unsigned char* raw = (unsigned char*)writer->volume->data + geometry->fat_start_byte + copy * fat_length_bytes;
+                for (uint32_t cluster = writer->dirty_first; cluster < writer->dirty_end; cluster++) {
+                        fat12_fat_pack_entry(raw, cluster, writer->fat->entries[cluster]);
+                }
+        }
+        writer->dirty_first = writer->dirty_end = 0;
+        fat12_status status = fat12_volume_sync(writer->volume);
+        if (status != FAT12_OK || writer->num_pending == 0) {
+                return status;
+        }
+
+        for (size_t i = 0; i < writer->num_pending; i++) {
+                size_t index = writer->pending[i].offset / DIR_ENTRY_SIZE_BYTES;
+                memcpy((char*)writer->volume->data + writer->pending[i].offset, writer->pending[i].entry, DIR_ENTRY_SIZE_BYTES);
+                writer->reserved_slots[index / 64] &= ~((uint64_t)1 << (index % 64));
+        }
+        writer->num_pending = 0;
+
+        // The new paths are not in the volume's path index, so have the next lookup rebuild it
+        fat12_path_index_free(writer->volume->path_index);
+        writer->volume->path_index = NULL;
+        return fat12_volume_sync(writer->volume);
+
+}
+
+// Function to release a writer; changes not committed stay in the decoded FAT but never reach the FAT copies, and their entries are dropped
+void fat12_writer_free (fat12_writer* writer) {
+
+        if (writer == NULL) {
+                return;
+        }
+        free(writer->pending);
+        free(writer->reserved_slots);
+        free(writer->free_bitmap);
+        free(writer);
+
+}
@@ -0,0 +1,19 @@
+#ifndef FAT12_WRITE_H
+#define FAT12_WRITE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "fat12_utils.h"
+
+// Pending changes to a writable volume: data goes straight to the image, FAT changes and directory entries wait for
+// fat12_writer_commit, which writes the FAT copies before the entries, so always commit before closing the volume
+typedef struct fat12_writer fat12_writer;
+
+fat12_status fat12_writer_begin (fat12_volume* volume, fat12_writer** writer);
+uint32_t fat12_writer_free_clusters (const fat12_writer* writer);
+fat12_status fat12_put_file (fat12_writer* writer, const char* dir_path, const char* name, int fd, uint32_t size, time_t modified);
+fat12_status fat12_writer_commit (fat12_writer* writer);
+void fat12_writer_free (fat12_writer* writer);
+
+#endif
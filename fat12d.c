@@ -0,0 +1,66 @@
+#include "fat12_utils.h"
+#include "fat12_daemon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+// Function to print the usage message and exit
+static void usage (const char* program) {
+
+	fprintf(stderr, "Usage: %s [--socket=<path>] [--max-images=<n>] [--max-memory=<MiB>]\n", program);
+	exit(2);
+
+}
+
+// Function to parse the positive number after an option's '=', exiting with the usage message if there is none
+static size_t parse_count (const char* program, const char* value) {
+
+	char* end;
+	unsigned long long count = strtoull(value, &end, 10);
+	if (*value == '\0' || *end != '\0' || count == 0) {
+		usage(program);
+	}
+	return (size_t)count;
+
+}
+
+// Function to stop serving on SIGINT or SIGTERM, letting the daemon remove its socket
+static void handle_stop (int signal_number) {
+
+	(void)signal_number;
+	fat12_daemon_stop();
+
+}
+
+int main (int argc, char* argv[]) {
+
+	const char* socket_path = fat12_daemon_default_socket();
+	fat12_daemon_limits limits = { 256, (size_t)512 << 20 };
+	for (int arg = 1; arg < argc; arg++) {
+		if (strncmp(argv[arg], "--socket=", 9) == 0 && argv[arg][9] != '\0') {
+			socket_path = argv[arg] + 9;
+		} else if (strncmp(argv[arg], "--max-images=", 13) == 0) {
+			limits.max_images = parse_count(argv[0], argv[arg] + 13);
+		} else if (strncmp(argv[arg], "--max-memory=", 13) == 0) {
+			limits.max_bytes = parse_count(argv[0], argv[arg] + 13) << 20;
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	// Without SA_RESTART, so a signal interrupts the wait for requests
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN); // A client that hangs up early only loses its own answer
+
+	if (fat12_daemon_serve(socket_path, &limits) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+
+}
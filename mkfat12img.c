@@ -0,0 +1,120 @@
+#include "fat12_utils.h"
+#include "fat12_mkimg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Function to print the usage message and exit
+static void usage (const char* program) {
+
+	fprintf(stderr, "Usage: %s [options] <out.IMA>\n"
+		"  --sectors N      720, 1440, 2400, 2880 (default) or 5760\n"
+		"  --files N        number of files (default 16)\n"
+		"  --depth N        levels of subdirectories (default 0)\n"
+		"  --dirs N         subdirectories per directory (default 1)\n"
+		"  --max-size N     largest file size in bytes (default 4096)\n"
+		"  --fragment PCT   percentage of fragmented files (default 0)\n"
+		"  --lfn            give files long file names\n"
+		"  --deleted N      number of deleted files (default 0)\n"
+		"  --label NAME     volume label\n"
+		"  --label-in WHERE boot, root, both (default) or none\n"
+		"  --seed N         generator seed (default 1)\n", program);
+	exit(2);
+
+}
+
+// Function to parse a non-negative integer option value
+static uint32_t parse_number (const char* program, const char* option, const char* value) {
+
+	char* end;
+	unsigned long number = value != NULL ? strtoul(value, &end, 10) : 0;
+	if (value == NULL || *value == '\0' || *end != '\0' || number > UINT32_MAX) {
+		fprintf(stderr, "%s: invalid value for %s\n", program, option);
+		usage(program);
+	}
+	return (uint32_t)number;
+
+}
+
+int main (int argc, char* argv[]) {
+
+	fat12_mkimg_spec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.num_files = 16;
+	spec.max_file_size = 4096;
+	spec.label_placement = FAT12_LABEL_BOTH;
+	spec.seed = 1;
+	const char* output = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		const char* option = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (strcmp(option, "--lfn") == 0) {
+			spec.long_names = 1;
+			continue;
+		}
+		if (strncmp(option, "--", 2) != 0) {
+			if (output != NULL) {
+				usage(argv[0]);
+			}
+			output = option;
+			continue;
+		}
+		i++;
+		if (strcmp(option, "--sectors") == 0) {
+			spec.total_sectors = (uint16_t)parse_number(argv[0], option, value);
+		} else if (strcmp(option, "--files") == 0) {
+			spec.num_files = parse_number(argv[0], option, value);
+		} else if (strcmp(option, "--depth") == 0) {
+			spec.depth = parse_number(argv[0], option, value);
+		} else if (strcmp(option, "--dirs") == 0) {
+			spec.dirs_per_level = parse_number(argv[0], option, value);
+		} else if (strcmp(option, "--max-size") == 0) {
+			spec.max_file_size = parse_number(argv[0], option, value);
+		} else if (strcmp(option, "--fragment") == 0) {
+			spec.fragmentation = parse_number(argv[0], option, value);
+		} else if (strcmp(option, "--deleted") == 0) {
+			spec.num_deleted = parse_number(argv[0], option, value);
+		} else if (strcmp(option, "--seed") == 0) {
+			spec.seed = parse_number(argv[0], option, value);
+		} else if (strcmp(option, "--label") == 0 && value != NULL) {
+			spec.label = value;
+		} else if (strcmp(option, "--label-in") == 0 && value != NULL) {
+			if (strcmp(value, "boot") == 0) {
+				spec.label_placement = FAT12_LABEL_BOOT;
+			} else if (strcmp(value, "root") == 0) {
+				spec.label_placement = FAT12_LABEL_ROOT;
+			} else if (strcmp(value, "both") == 0) {
+				spec.label_placement = FAT12_LABEL_BOTH;
+			} else if (strcmp(value, "none") == 0) {
+				spec.label_placement = FAT12_LABEL_NONE;
+			} else {
+				usage(argv[0]);
+			}
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (output == NULL) {
+		usage(argv[0]);
+	}
+
+	char* image;
+	size_t image_size;
+	if (fat12_mkimg(&spec, &image, &image_size) != FAT12_OK) {
+		fprintf(stderr, "%s\n", fat12_last_error());
+		exit(EXIT_FAILURE);
+	}
+
+	// Write the image out in one go
+	FILE* file = fopen(output, "wb");
+	if (file == NULL || fwrite(image, 1, image_size, file) != image_size || fclose(file) != 0) {
+		perror(output);
+		free(image);
+		exit(EXIT_FAILURE);
+	}
+
+	free(image);
+	return 0;
+
+}
@@ -0,0 +1,136 @@
+#include "fat12_utils.h"
+#include "fat12_mkimg.h"
+#include "fat12_report.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Check that listing an image costs a fixed number of allocations, however many entries it has.
+// Linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc so every allocation the library makes is counted.
+
+void* __real_malloc (size_t size);
+void* __real_calloc (size_t count, size_t size);
+void* __real_realloc (void* pointer, size_t size);
+
+static size_t num_allocations = 0;
+
+void* __wrap_malloc (size_t size) {
+
+        num_allocations++;
+        return __real_malloc(size);
+
+}
+
+void* __wrap_calloc (size_t count, size_t size) {
+
+        num_allocations++;
+        return __real_calloc(count, size);
+
+}
+
+void* __wrap_realloc (void* pointer, size_t size) {
+
+        num_allocations++;
+        return __real_realloc(pointer, size);
+
+}
+
+// Same tree shape for every case, so only the number of entries per directory changes
+static const uint32_t NUM_FILES[] = { 16, 50, 100, 200, 400 };
+#define NUM_CASES (sizeof(NUM_FILES) / sizeof(NUM_FILES[0]))
+
+// Function to generate an image with num_files files and write it to path
+static int write_image (uint32_t num_files, const char* path) {
+
+        fat12_mkimg_spec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.num_files = num_files;
+        spec.depth = 2;
+        spec.dirs_per_level = 3;
+        spec.max_file_size = 1024;
+        spec.num_deleted = num_files / 10;
+        spec.seed = num_files;
+
+        char* image;
+        size_t image_size;
+        if (fat12_mkimg(&spec, &image, &image_size) != FAT12_OK) {
+                fprintf(stderr, "%u files: %s\n", num_files, fat12_last_error());
+                return 1;
+        }
+        FILE* file = fopen(path, "wb");
+        int failed = file == NULL || fwrite(image, 1, image_size, file) != image_size;
+        if (file != NULL && fclose(file) != 0) {
+                failed = 1;
+        }
+        if (failed) {
+                perror(path);
+        }
+        free(image);
+        return failed;
+
+}
+
+// Function to list the image at path into out, returning the allocations the listing took and setting num_files
+static size_t count_listing (const char* path, FILE* out, int* num_files) {
+
+        fat12_volume* volume;
+        if (fat12_volume_open(path, &volume) != FAT12_OK) {
+                fprintf(stderr, "%s: %s\n", path, fat12_last_error());
+                exit(EXIT_FAILURE);
+        }
+        fat12_status status = fat12_get_num_files(volume, num_files);
+        size_t before = num_allocations;
+        if (status == FAT12_OK) {
+                status = fat12_print_files(volume, out);
+        }
+        size_t allocations = num_allocations - before;
+        if (status != FAT12_OK) {
+                fprintf(stderr, "%s: %s\n", path, fat12_last_error());
+                exit(EXIT_FAILURE);
+        }
+        fat12_volume_close(volume);
+        return allocations;
+
+}
+
+int main (void) {
+
+        char path[] = "/tmp/fat12-alloc-XXXXXX";
+        int fd = mkstemp(path);
+        FILE* out = fopen("/dev/null", "w");
+        if (fd < 0 || out == NULL) {
+                perror("setup");
+                return EXIT_FAILURE;
+        }
+        close(fd);
+
+        // The first listing sets up the per-thread output buffer, which later ones reuse
+        int num_files = 0;
+        if (write_image(NUM_FILES[0], path) != 0) {
+                return EXIT_FAILURE;
+        }
+        count_listing(path, out, &num_files);
+
+        int failed = 0;
+        size_t expected = 0;
+        for (size_t i = 0; i < NUM_CASES; i++) {
+                if (write_image(NUM_FILES[i], path) != 0) {
+                        failed = 1;
+                        break;
+                }
+                size_t allocations = count_listing(path, out, &num_files);
+                printf("files-%u\tallocations\t%zu\tfor %d files listed\n", NUM_FILES[i], allocations, num_files);
+                if (i == 0) {
+                        expected = allocations;
+                } else if (allocations != expected) {
+                        failed = 1;
+                }
+        }
+
+        unlink(path);
+        fclose(out);
+        printf("%s\n", failed ? "FAIL: allocations grow with the number of entries" : "OK");
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+
+}
@@ -0,0 +1,204 @@
+#include "fat12_utils.h"
+#include "fat12_mkimg.h"
+#include "fat12_write.h"
+#include "fat12_path.h"
+#include "fat12_check.h"
+#include "fat12_extract.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Check that fat12_put_file only makes files visible once fat12_writer_commit has put their clusters in the FAT,
+// that a full subdirectory does not lose a cluster when the file cannot be added, and that empty files and
+// names already waiting in the writer are refused.
+
+static int num_failures = 0;
+
+// Function to report a failed expectation and keep going, so one run shows every failure
+static void expect (int condition, const char* what) {
+
+        if (!condition) {
+                printf("FAIL: %s\n", what);
+                num_failures++;
+        }
+
+}
+
+// Function to generate a 360 KB image, whose 1 KiB clusters hold 32 entries, with one subdirectory and files files
+static void write_image (const char* path, uint32_t files) {
+
+        fat12_mkimg_spec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.total_sectors = 720;
+        spec.num_files = files;
+        spec.depth = 1;
+        spec.dirs_per_level = 1;
+        spec.max_file_size = 2048;
+        spec.seed = 12;
+
+        char* image;
+        size_t image_size;
+        if (fat12_mkimg(&spec, &image, &image_size) != FAT12_OK) {
+                fprintf(stderr, "%s\n", fat12_last_error());
+                exit(EXIT_FAILURE);
+        }
+        FILE* file = fopen(path, "wb");
+        if (file == NULL || fwrite(image, 1, image_size, file) != image_size || fclose(file) != 0) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+        free(image);
+
+}
+
+// Function to open a writable volume with a writer on it, exiting if either fails
+static fat12_writer* begin (const char* path, fat12_volume** volume) {
+
+        fat12_writer* writer;
+        if (fat12_volume_open_writable(path, volume) != FAT12_OK || fat12_writer_begin(*volume, &writer) != FAT12_OK) {
+                fprintf(stderr, "%s: %s\n", path, fat12_last_error());
+                exit(EXIT_FAILURE);
+        }
+        return writer;
+
+}
+
+// Function to add size bytes of content derived from seed under name, returning what fat12_put_file returned
+static fat12_status put (fat12_writer* writer, const char* dir, const char* name, uint32_t size, unsigned seed) {
+
+        FILE* content = tmpfile();
+        if (content == NULL) {
+                perror("tmpfile");
+                exit(EXIT_FAILURE);
+        }
+        for (uint32_t i = 0; i < size; i++) {
+                fputc((int)((i * 31 + seed) & 0xFF), content);
+        }
+        fflush(content);
+        rewind(content);
+        fat12_status status = fat12_put_file(writer, dir, name, fileno(content), size, 1700000000);
+        fclose(content);
+        return status;
+
+}
+
+// Function to open the image as a reader would, returning its file count and setting num_problems from a full check
+static int inspect (const char* path, size_t* num_problems) {
+
+        fat12_volume* volume;
+        int num_files = -1;
+        FILE* out = fopen("/dev/null", "w");
+        if (fat12_volume_open(path, &volume) != FAT12_OK || out == NULL) {
+                fprintf(stderr, "%s: %s\n", path, fat12_last_error());
+                exit(EXIT_FAILURE);
+        }
+        if (fat12_get_num_files(volume, &num_files) != FAT12_OK || fat12_check_volume(volume, out, num_problems) != FAT12_OK) {
+                fprintf(stderr, "%s: %s\n", path, fat12_last_error());
+                exit(EXIT_FAILURE);
+        }
+        fclose(out);
+        fat12_volume_close(volume);
+        return num_files;
+
+}
+
+// Function to check that the file at file_path in the image holds the content put wrote for size and seed
+static int holds (const char* path, const char* file_path, uint32_t size, unsigned seed) {
+
+        fat12_volume* volume;
+        const char* entry;
+        FILE* copy = tmpfile();
+        int matches = copy != NULL && fat12_volume_open(path, &volume) == FAT12_OK;
+        if (!matches) {
+                return 0;
+        }
+        matches = fat12_find_entry(volume, file_path, &entry) == FAT12_OK && fat12_extract_file(volume, entry, fileno(copy)) == FAT12_OK;
+        fat12_volume_close(volume);
+        rewind(copy);
+        for (uint32_t i = 0; matches && i < size; i++) {
+                matches = fgetc(copy) == (int)((i * 31 + seed) & 0xFF);
+        }
+        matches = matches && fgetc(copy) == EOF;
+        fclose(copy);
+        return matches;
+
+}
+
+// Files put but never committed must not show up, and their clusters must stay free for the next writer
+static void test_uncommitted (const char* path) {
+
+        size_t num_problems;
+        write_image(path, 6);
+        int num_files = inspect(path, &num_problems);
+
+        fat12_volume* volume;
+        fat12_writer* writer = begin(path, &volume);
+        expect(put(writer, "", "A.TXT", 3000, 1) == FAT12_OK, "put A.TXT");
+        expect(put(writer, "DIR00001", "B.TXT", 500, 2) == FAT12_OK, "put DIR00001/B.TXT");
+        expect(inspect(path, &num_problems) == num_files && num_problems == 0, "uncommitted files are invisible and the image stays consistent");
+        fat12_writer_free(writer); // As if the run had died before its commit
+        fat12_volume_close(volume);
+        expect(inspect(path, &num_problems) == num_files && num_problems == 0, "an abandoned writer leaves the image as it was");
+
+        writer = begin(path, &volume);
+        expect(put(writer, "", "C.TXT", 4000, 3) == FAT12_OK, "put C.TXT");
+        expect(put(writer, "DIR00001", "D.TXT", 1500, 4) == FAT12_OK, "put DIR00001/D.TXT");
+        expect(fat12_writer_commit(writer) == FAT12_OK, "commit");
+        fat12_writer_free(writer);
+        fat12_volume_close(volume);
+        expect(inspect(path, &num_problems) == num_files + 2 && num_problems == 0, "committed files are listed and the image stays consistent");
+        expect(holds(path, "C.TXT", 4000, 3) && holds(path, "DIR00001/D.TXT", 1500, 4), "committed files read back as written");
+
+}
+
+// A subdirectory that is full grows only for a file that fits, and several files can wait for the same new cluster
+static void test_full_subdirectory (const char* path) {
+
+        size_t num_problems;
+        write_image(path, 0);
+
+        // "." and ".." leave 30 of the directory's 32 slots
+        fat12_volume* volume;
+        fat12_writer* writer = begin(path, &volume);
+        char name[16];
+        for (int i = 0; i < 30; i++) {
+                snprintf(name, sizeof(name), "F%02d.TXT", i);
+                expect(put(writer, "DIR00001", name, 100, (unsigned)i) == FAT12_OK, "fill DIR00001");
+        }
+        expect(put(writer, "DIR00001", "F05.TXT", 100, 0) == FAT12_ERR_INVALID, "a name waiting in the writer is refused");
+        expect(put(writer, "DIR00001", "EMPTY.TXT", 0, 0) == FAT12_ERR_INVALID, "an empty file is refused");
+
+        // The data takes every free cluster, leaving none for the directory: nothing may stay allocated
+        uint32_t num_free = fat12_writer_free_clusters(writer);
+        expect(put(writer, "DIR00001", "BIG.DAT", num_free * 1024, 7) == FAT12_ERR_NO_SPACE, "no room to grow the directory");
+        expect(fat12_writer_free_clusters(writer) == num_free, "a failed file gives back its clusters");
+
+        expect(put(writer, "DIR00001", "G00.TXT", 100, 30) == FAT12_OK && put(writer, "DIR00001", "G01.TXT", 100, 31) == FAT12_OK, "grow DIR00001");
+        expect(fat12_writer_free_clusters(writer) == num_free - 3, "the directory grows by one cluster");
+        expect(fat12_writer_commit(writer) == FAT12_OK, "commit");
+        fat12_writer_free(writer);
+        fat12_volume_close(volume);
+        expect(inspect(path, &num_problems) == 32 && num_problems == 0, "every file of the grown directory is listed");
+        expect(holds(path, "DIR00001/F29.TXT", 100, 29) && holds(path, "DIR00001/G01.TXT", 100, 31), "files on both sides of the new cluster read back");
+
+}
+
+int main (void) {
+
+        char path[] = "/tmp/fat12-put-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+                perror("mkstemp");
+                return EXIT_FAILURE;
+        }
+        close(fd);
+
+        test_uncommitted(path);
+        test_full_subdirectory(path);
+
+        unlink(path);
+        printf("%s\n", num_failures > 0 ? "FAIL" : "OK");
+        return num_failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+}